@@ -0,0 +1,103 @@
+/* =========================================================================
+Related Files: csdsa.h, every bench/ source
+Purpose:
+    A tiny timing harness shared by the benchmarks. Every benchmark is a
+    function timing its own hot loop between bench_start and bench_stop, so
+    setup stays out of the numbers. bench_run repeats it BENCH_RUNS times
+    and prints the fastest run as one CSV row:
+
+        name,ops,ns_per_op,cycles_per_op,bytes
+
+    bytes is whatever the benchmark reports as its footprint, usually the
+    memory the structure ended up holding. cycles_per_op reads the time
+    stamp counter and is 0 where there is none.
+
+    Each binary takes an optional substring to run matching names only:
+        ./bench/bin/map_bench get_miss
+========================================================================= */
+#ifndef __HEADER_BENCH_H__
+#define __HEADER_BENCH_H__
+
+#include "csdsa.h"
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_RUNS 5 /* Repetitions per benchmark, the fastest is kept */
+
+typedef struct bench bench;
+struct bench {
+  int64_t  ops;   /* Set by the benchmark, operations per run */
+  int64_t  bytes; /* Set by the benchmark, see the top comment */
+  uint64_t ns, cycles;
+  uint64_t ns_start, cycles_start;
+};
+
+typedef void (*_bench)(bench *b, void *args);
+
+/* Keeps results alive so the optimizer cannot drop the work producing them. */
+static volatile uint64_t bench_sink;
+static const char       *bench_filter;
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t bench_now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static inline void bench_start(bench *b) {
+  b->ns_start = bench_now_ns();
+  b->cycles_start = bench_now_cycles();
+}
+
+/* May be paired with bench_start more than once per run, the times add up. */
+static inline void bench_stop(bench *b) {
+  b->cycles += bench_now_cycles() - b->cycles_start;
+  b->ns += bench_now_ns() - b->ns_start;
+}
+
+static inline void bench_keep(uint64_t value) { bench_sink += value; }
+
+/* Prints the CSV header, the make target strips the repeats. */
+static inline void bench_init(int argc, char **argv) {
+  bench_filter = argc > 1 ? argv[1] : NULL;
+  printf("name,ops,ns_per_op,cycles_per_op,bytes\n");
+}
+
+static inline void bench_run(const char *name, _bench fn, void *args) {
+  if (bench_filter && !strstr(name, bench_filter)) return;
+
+  bench best = {0};
+  for (int32_t run = 0; run < BENCH_RUNS; run++) {
+    bench b = {0};
+    fn(&b, args);
+    assert(b.ops > 0 && "A benchmark must report its ops.");
+    if (run == 0 || b.ns < best.ns) best = b;
+  }
+
+  printf("%s,%ld,%.3f,%.3f,%ld\n", name, (long)best.ops,
+         (double)best.ns / best.ops, (double)best.cycles / best.ops,
+         (long)best.bytes);
+  fflush(stdout);
+}
+
+/* xorshift64, the same inputs every run so before and after compare. */
+static inline uint64_t bench_rand(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+#endif
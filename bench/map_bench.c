@@ -0,0 +1,124 @@
+#include "bench.h"
+
+#define SLOTS (1 << 16) /* Table size of the fixed load runs */
+#define GETS  (1 << 20)
+
+typedef struct shape shape;
+struct shape {
+  int64_t key_size;
+  double  load; /* Kept under MAP_LOAD_FACTOR so the table never grows */
+};
+
+stalloc *allocator = NULL;
+
+/* count keys of key_size bytes, the first 8 random and the rest zero. */
+static char *make_keys(int64_t count, int64_t key_size, uint64_t seed) {
+  char *keys = halloc(allocator, count * key_size);
+  for (int64_t i = 0; i < count; i++) {
+    uint64_t r = bench_rand(&seed);
+    memcpy(keys + i * key_size, &r, sizeof(r));
+  }
+  return keys;
+}
+
+static int64_t key_count(shape *s) { return (int64_t)(SLOTS * s->load); }
+
+static void fill(map *m, shape *s, char *keys) {
+  __map_init(m, sizeof(int64_t), s->key_size, allocator, TO_HEAP, SLOTS);
+  for (int64_t i = 0; i < key_count(s); i++)
+    map_put(m, keys + i * s->key_size, &i);
+}
+
+static void put(bench *b, void *args) {
+  shape  *s = args;
+  int64_t count = key_count(s);
+  char   *keys = make_keys(count, s->key_size, 0x51ed270b27d4e1a3ull);
+  map     m;
+  __map_init(&m, sizeof(int64_t), s->key_size, allocator, TO_HEAP, SLOTS);
+  b->ops = count;
+
+  bench_start(b);
+  for (int64_t i = 0; i < count; i++) map_put(&m, keys + i * s->key_size, &i);
+  bench_stop(b);
+
+  b->bytes = m.__size * m.elements.__el_size;
+  map_free(&m);
+  hfree(allocator, keys);
+}
+
+/* From a single slot, so every resize and rehash is in the run. */
+static void put_growing(bench *b, void *args) {
+  shape  *s = args;
+  int64_t count = key_count(s);
+  char   *keys = make_keys(count, s->key_size, 0x51ed270b27d4e1a3ull);
+  map     m;
+  __map_init(&m, sizeof(int64_t), s->key_size, allocator, TO_HEAP, 1);
+  b->ops = count;
+
+  bench_start(b);
+  for (int64_t i = 0; i < count; i++) map_put(&m, keys + i * s->key_size, &i);
+  bench_stop(b);
+
+  b->bytes = m.__size * m.elements.__el_size;
+  map_free(&m);
+  hfree(allocator, keys);
+}
+
+static void get(bench *b, void *args, bool hit) {
+  shape  *s = args;
+  int64_t count = key_count(s);
+  char   *keys = make_keys(count, s->key_size, 0x51ed270b27d4e1a3ull);
+  char   *misses = make_keys(count, s->key_size, 0x7c3a1d9e4b2f6085ull);
+  char   *probe = hit ? keys : misses;
+  map     m;
+  fill(&m, s, keys);
+  b->ops = GETS;
+  b->bytes = m.__size * m.elements.__el_size;
+
+  uint64_t found = 0;
+  bench_start(b);
+  for (int64_t i = 0; i < GETS; i++)
+    found += map_get(&m, probe + (i % count) * s->key_size).value != NULL;
+  bench_stop(b);
+
+  assert(found == (hit ? GETS : 0));
+  bench_keep(found);
+  map_free(&m);
+  hfree(allocator, misses);
+  hfree(allocator, keys);
+}
+
+static void get_hit(bench *b, void *args) { get(b, args, true); }
+static void get_miss(bench *b, void *args) { get(b, args, false); }
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv);
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  int64_t key_sizes[] = {8, 32};
+  double  loads[] = {0.25, 0.5, 0.7};
+  char    name[64];
+
+  for (int32_t k = 0; k < 2; k++) {
+    shape s = {.key_size = key_sizes[k], .load = 0.7};
+    snprintf(name, sizeof(name), "map_put_growing_k%ld", (long)s.key_size);
+    bench_run(name, put_growing, &s);
+
+    for (int32_t l = 0; l < 3; l++) {
+      s.load = loads[l];
+      int32_t pct = (int32_t)(s.load * 100);
+      snprintf(name, sizeof(name), "map_put_k%ld_load%d", (long)s.key_size,
+               pct);
+      bench_run(name, put, &s);
+      snprintf(name, sizeof(name), "map_get_hit_k%ld_load%d",
+               (long)s.key_size, pct);
+      bench_run(name, get_hit, &s);
+      snprintf(name, sizeof(name), "map_get_miss_k%ld_load%d",
+               (long)s.key_size, pct);
+      bench_run(name, get_miss, &s);
+    }
+  }
+
+  stalloc_free(allocator);
+  return 0;
+}
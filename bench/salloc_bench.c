@@ -0,0 +1,126 @@
+#include "bench.h"
+
+#define OPS    (1 << 20)
+#define LIVE   1024 /* Heap blocks kept alive at once in the mixed runs */
+#define SMALL  64
+#define LARGER 4096
+
+stalloc *allocator = NULL;
+
+static void push_pop(bench *b, void *args) {
+  int64_t bytes = *(int64_t *)args;
+  b->ops = OPS;
+  b->bytes = bytes;
+
+  start_frame(allocator);
+  bench_start(b);
+  for (int64_t i = 0; i < OPS; i++) {
+    char *p = stpusha_uninit(allocator, bytes);
+    p[0] = (char)i;
+    bench_keep((uintptr_t)p);
+    stpopa(allocator);
+  }
+  bench_stop(b);
+  end_frame(allocator);
+}
+
+/* A frame with a few pushes inside, the way a callback uses scratch. */
+static void frame(bench *b, void *args) {
+  b->ops = OPS;
+  b->bytes = 4 * SMALL;
+
+  bench_start(b);
+  for (int64_t i = 0; i < OPS; i++) {
+    start_frame(allocator);
+    for (int32_t k = 0; k < 4; k++) {
+      char *p = stpusha_uninit(allocator, SMALL);
+      p[0] = (char)k;
+    }
+    end_frame(allocator);
+  }
+  bench_stop(b);
+}
+
+static void halloc_free(bench *b, void *args) {
+  int64_t bytes = *(int64_t *)args;
+  b->ops = OPS;
+  b->bytes = bytes;
+
+  bench_start(b);
+  for (int64_t i = 0; i < OPS; i++) {
+    char *p = halloc_uninit(allocator, bytes);
+    p[0] = (char)i;
+    hfree(allocator, p);
+  }
+  bench_stop(b);
+}
+
+static void malloc_free(bench *b, void *args) {
+  int64_t bytes = *(int64_t *)args;
+  b->ops = OPS;
+  b->bytes = bytes;
+
+  bench_start(b);
+  for (int64_t i = 0; i < OPS; i++) {
+    volatile char *p = malloc(bytes);
+    p[0] = (char)i;
+    free((char *)p);
+  }
+  bench_stop(b);
+}
+
+/* Random sizes freed in random order keep LIVE blocks around, so the free
+   lists actually fill up and split. */
+static void halloc_mixed(bench *b, void *args) {
+  void    *live[LIVE] = {0};
+  uint64_t seed = 0x9e3779b97f4a7c15ull;
+  b->ops = OPS;
+  b->bytes = LIVE * (SMALL + LARGER) / 2;
+
+  bench_start(b);
+  for (int64_t i = 0; i < OPS; i++) {
+    uint64_t r = bench_rand(&seed);
+    int64_t  slot = r % LIVE;
+    if (live[slot]) hfree(allocator, live[slot]);
+    live[slot] = halloc_uninit(allocator, SMALL + (r >> 32) % LARGER);
+  }
+  for (int32_t i = 0; i < LIVE; i++)
+    if (live[i]) hfree(allocator, live[i]);
+  bench_stop(b);
+}
+
+static void malloc_mixed(bench *b, void *args) {
+  void    *live[LIVE] = {0};
+  uint64_t seed = 0x9e3779b97f4a7c15ull;
+  b->ops = OPS;
+  b->bytes = LIVE * (SMALL + LARGER) / 2;
+
+  bench_start(b);
+  for (int64_t i = 0; i < OPS; i++) {
+    uint64_t r = bench_rand(&seed);
+    int64_t  slot = r % LIVE;
+    free(live[slot]);
+    live[slot] = malloc(SMALL + (r >> 32) % LARGER);
+  }
+  for (int32_t i = 0; i < LIVE; i++) free(live[i]);
+  bench_stop(b);
+}
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv);
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  int64_t small = SMALL, larger = LARGER;
+  bench_run("stpush_stpop_64", push_pop, &small);
+  bench_run("stpush_stpop_4096", push_pop, &larger);
+  bench_run("frame_4x64", frame, NULL);
+  bench_run("halloc_hfree_64", halloc_free, &small);
+  bench_run("malloc_free_64", malloc_free, &small);
+  bench_run("halloc_hfree_4096", halloc_free, &larger);
+  bench_run("malloc_free_4096", malloc_free, &larger);
+  bench_run("halloc_mixed", halloc_mixed, NULL);
+  bench_run("malloc_mixed", malloc_mixed, NULL);
+
+  stalloc_free(allocator);
+  return 0;
+}
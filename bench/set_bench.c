@@ -0,0 +1,75 @@
+#include "bench.h"
+
+#define MEMBERS (1 << 16) /* In each input set */
+#define REPEATS 16        /* Operations timed per run */
+
+typedef struct layout layout;
+struct layout {
+  int32_t flags;
+  bool    into; /* The *_into variants, a copy of a is the target */
+  set     a, b;
+};
+
+stalloc *allocator = NULL;
+
+/* a holds the even ids and b the multiples of 3 in the same range, so a
+   third of a survives the intersection. */
+static void fill(layout *l) {
+  __set_init(&l->a, sizeof(uint32_t), allocator, TO_HEAP | l->flags, 1);
+  __set_init(&l->b, sizeof(uint32_t), allocator, TO_HEAP | l->flags, 1);
+  for (uint32_t i = 0; i < MEMBERS; i++) {
+    set_put(&l->a, &(uint32_t){i * 2});
+    set_put(&l->b, &(uint32_t){i * 3});
+  }
+}
+
+static void run(bench *b, layout *l, bool intersect) {
+  set out;
+  b->ops = REPEATS * (set_length(&l->a) + set_length(&l->b));
+
+  for (int32_t r = 0; r < REPEATS; r++) {
+    if (l->into) set_copy(&out, &l->a);
+
+    bench_start(b);
+    if (l->into)
+      intersect ? set_intersect_into(&out, &l->b) : set_union_into(&out, &l->b);
+    else
+      intersect ? set_intersect(&l->a, &l->b, &out)
+                : set_union(&l->a, &l->b, &out);
+    bench_stop(b);
+
+    b->bytes = set_length(&out) * sizeof(uint32_t);
+    bench_keep(set_length(&out));
+    set_free(&out);
+  }
+}
+
+static void intersect(bench *b, void *args) { run(b, args, true); }
+static void union_(bench *b, void *args) { run(b, args, false); }
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv);
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  const char *names[] = {"hashed", "sparse", "bitset"};
+  int32_t     flags[] = {0, SET_SPARSE, SET_BITSET};
+  char        name[64];
+
+  for (int32_t k = 0; k < 3; k++) {
+    layout l = {.flags = flags[k]};
+    fill(&l);
+    for (int32_t into = 0; into < 2; into++) {
+      const char *suffix = into ? "_into" : "";
+      l.into = into;
+      snprintf(name, sizeof(name), "set_intersect%s_%s", suffix, names[k]);
+      bench_run(name, intersect, &l);
+      snprintf(name, sizeof(name), "set_union%s_%s", suffix, names[k]);
+      bench_run(name, union_, &l);
+    }
+    set_free(&l.a);
+    set_free(&l.b);
+  }
+
+  stalloc_free(allocator);
+  return 0;
+}
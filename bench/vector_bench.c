@@ -0,0 +1,114 @@
+#include "bench.h"
+
+#define N (1 << 20)
+
+typedef struct record record;
+struct record {
+  int64_t key;
+  char    payload[24];
+};
+
+VEC_TYPE_IMPL(int_vec, int64_t);
+VEC_TYPE_IMPL(record_vec, record);
+
+stalloc *allocator = NULL;
+
+static bool int_less(void *a, void *b, void *args) {
+  return *(int64_t *)a < *(int64_t *)b;
+}
+static bool record_less(void *a, void *b, void *args) {
+  return ((record *)a)->key < ((record *)b)->key;
+}
+
+/* Starting from the smallest vec so every doubling is in the run. */
+static void push(bench *b, void *args) {
+  int_vec v;
+  int_vec_inita(&v, allocator, TO_HEAP | ALLOC_UNINIT, 1);
+  b->ops = N;
+
+  bench_start(b);
+  for (int64_t i = 0; i < N; i++) int_vec_push(&v, &i);
+  bench_stop(b);
+
+  b->bytes = v.__size * sizeof(int64_t);
+  bench_keep(*int_vec_at(&v, N - 1));
+  int_vec_free(&v);
+}
+
+static void push_reserved(bench *b, void *args) {
+  int_vec v;
+  int_vec_inita(&v, allocator, TO_HEAP | ALLOC_UNINIT, N);
+  b->ops = N;
+
+  bench_start(b);
+  for (int64_t i = 0; i < N; i++) int_vec_push(&v, &i);
+  bench_stop(b);
+
+  b->bytes = v.__size * sizeof(int64_t);
+  bench_keep(*int_vec_at(&v, N - 1));
+  int_vec_free(&v);
+}
+
+static void sort_ints(bench *b, void *args) {
+  int_vec  v;
+  uint64_t seed = 0x2545f4914f6cdd1dull;
+  int_vec_inita(&v, allocator, TO_HEAP | ALLOC_UNINIT, N);
+  for (int64_t i = 0; i < N; i++)
+    int_vec_push(&v, &(int64_t){(int64_t)(bench_rand(&seed) >> 1)});
+  b->ops = N;
+  b->bytes = N * sizeof(int64_t);
+
+  bench_start(b);
+  int_vec_sort(&v, int_less, NULL);
+  bench_stop(b);
+
+  bench_keep(*int_vec_at(&v, 0));
+  int_vec_free(&v);
+}
+
+static void sort_records(bench *b, void *args) {
+  record_vec v;
+  uint64_t   seed = 0x2545f4914f6cdd1dull;
+  record_vec_inita(&v, allocator, TO_HEAP | ALLOC_UNINIT, N);
+  for (int64_t i = 0; i < N; i++)
+    record_vec_push(&v, &(record){.key = (int64_t)bench_rand(&seed)});
+  b->ops = N;
+  b->bytes = N * sizeof(record);
+
+  bench_start(b);
+  record_vec_sort(&v, record_less, NULL);
+  bench_stop(b);
+
+  bench_keep(record_vec_at(&v, 0)->key);
+  record_vec_free(&v);
+}
+
+/* Already sorted input, the usual worst case for a naive quicksort. */
+static void sort_sorted(bench *b, void *args) {
+  int_vec v;
+  int_vec_inita(&v, allocator, TO_HEAP | ALLOC_UNINIT, N);
+  for (int64_t i = 0; i < N; i++) int_vec_push(&v, &i);
+  b->ops = N;
+  b->bytes = N * sizeof(int64_t);
+
+  bench_start(b);
+  int_vec_sort(&v, int_less, NULL);
+  bench_stop(b);
+
+  bench_keep(*int_vec_at(&v, 0));
+  int_vec_free(&v);
+}
+
+int main(int argc, char **argv) {
+  bench_init(argc, argv);
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  bench_run("vec_push", push, NULL);
+  bench_run("vec_push_reserved", push_reserved, NULL);
+  bench_run("vec_sort_int64", sort_ints, NULL);
+  bench_run("vec_sort_record32", sort_records, NULL);
+  bench_run("vec_sort_sorted", sort_sorted, NULL);
+
+  stalloc_free(allocator);
+  return 0;
+}
@@ -0,0 +1,232 @@
+/*------------------------------------------------------------------------------
+ * Concurrent map strategy.
+ *
+ *           hash(key) = [ shard bits | ........ | slot bits ]
+ *                            |                       |
+ *  shards   +----------+----------+----------+       |
+ *           | seq lock | seq lock | seq lock | ...   |
+ *           | map      | map      | map      |       v
+ *           +----------+----------+----------+   map_* probes as usual
+ *
+ * Each shard is a plain map_* behind a mutex for writers and a sequence
+ * number for readers, on its own cache line. A writer takes the mutex, makes
+ * seq odd, writes and makes it even again. A reader never locks: it copies
+ * the shard's map header, probes the table it points at and copies the value
+ * out, then checks seq did not move. If it did, or was odd to begin with, a
+ * writer got in the way and the read starts over.
+ *
+ * That only works if whatever a reader looks at stays mapped. Slots are
+ * rewritten in place, so a torn read is caught by the seq check and thrown
+ * away. Growing the table is the one write that frees memory, so writers grow
+ * it themselves through __map_grow_retired before the put and keep the old
+ * table on the shard's retired list. cmap_reclaim and cmap_free release them.
+ *
+ * Each shard has its own stalloc. The writer holding the lock adopts it first
+ * so the heap calls of the map underneath run as the owner.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+#include <sched.h>
+
+struct cmap_shard {
+  _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t seq; /* Odd while writing. */
+  pthread_mutex_t lock;                           /* Taken by writers. */
+  map             table;
+  vec             retired; /* Tables grown out of, readers may be in them. */
+  stalloc        *allocator;
+};
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void        init_asserts(cmap *m);
+static cmap_shard *shard_of(cmap *m, void *key);
+static void        write_begin(cmap_shard *s);
+static void        write_end(cmap_shard *s);
+static void        free_retired(cmap_shard *s);
+
+static void init_asserts(cmap *m) {
+  assert(m);
+  assert(m->shards);
+}
+
+static cmap_shard *shard_of(cmap *m, void *key) {
+  /* The map takes the low bits for the slot, so the shard takes the high. */
+  if (m->shard_bits == 0) return m->shards;
+  uint64_t hash = m->hasher(key, m->__key_size);
+  return &m->shards[hash >> (64 - m->shard_bits)];
+}
+
+static void write_begin(cmap_shard *s) {
+  pthread_mutex_lock(&s->lock);
+  stalloc_adopt(s->allocator);
+
+  /* Odd before any slot changes, the fence keeps the writes below it. */
+  uint64_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+  atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static void write_end(cmap_shard *s) {
+  uint64_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+  atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void free_retired(cmap_shard *s) {
+  for (int64_t i = 0; i < s->retired.length; i++)
+    vec_free(vec_at(&s->retired, i));
+  vec_clear(&s->retired);
+}
+
+/*-------------------------------------------------------
+ * Container Operations
+ *-------------------------------------------------------*/
+cmap *__cmap_init(cmap *m, int64_t el_size, int64_t key_size, int32_t shards,
+                  int64_t initial_size, _hash hasher) {
+  assert(m);
+  assert(el_size > 0);
+  assert(key_size > 0);
+  assert(shards >= 0);
+  assert(hasher);
+  if (shards == 0) shards = CMAP_DEFAULT_SHARDS;
+
+  m->__el_size = el_size;
+  m->__key_size = key_size;
+  m->hasher = hasher;
+  m->shard_bits = 0;
+  while ((1 << m->shard_bits) < shards) m->shard_bits++;
+
+  int32_t count = 1 << m->shard_bits;
+  int64_t per_shard = initial_size / count;
+  m->shards = aligned_alloc(CACHE_LINE_SIZE, count * sizeof(cmap_shard));
+  assert(m->shards);
+
+  for (int32_t i = 0; i < count; i++) {
+    cmap_shard *s = &m->shards[i];
+    atomic_init(&s->seq, 0);
+    pthread_mutex_init(&s->lock, NULL);
+    s->allocator = stalloc_create(STALLOC_DEFAULT);
+    __map_init_hashed(&s->table, el_size, key_size, s->allocator, TO_HEAP,
+                      per_shard, hasher);
+    __vec_init(&s->retired, sizeof(vec), s->allocator, TO_HEAP, 1);
+  }
+  return m;
+}
+
+void cmap_free(cmap *m) {
+  init_asserts(m);
+  for (int32_t i = 0; i < 1 << m->shard_bits; i++) {
+    cmap_shard *s = &m->shards[i];
+    stalloc_adopt(s->allocator);
+    free_retired(s);
+    vec_free(&s->retired);
+    map_free(&s->table);
+    stalloc_free(s->allocator);
+    pthread_mutex_destroy(&s->lock);
+  }
+  free(m->shards);
+  m->shards = NULL;
+}
+
+void cmap_clear(cmap *m) {
+  init_asserts(m);
+  for (int32_t i = 0; i < 1 << m->shard_bits; i++) {
+    cmap_shard *s = &m->shards[i];
+    write_begin(s);
+    map_clear(&s->table);
+    write_end(s);
+  }
+}
+
+int64_t cmap_load(cmap *m) {
+  init_asserts(m);
+  int64_t load = 0;
+  for (int32_t i = 0; i < 1 << m->shard_bits; i++) {
+    cmap_shard *s = &m->shards[i];
+    pthread_mutex_lock(&s->lock);
+    load += map_load(&s->table);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return load;
+}
+
+void cmap_reclaim(cmap *m) {
+  init_asserts(m);
+  for (int32_t i = 0; i < 1 << m->shard_bits; i++) {
+    cmap_shard *s = &m->shards[i];
+    pthread_mutex_lock(&s->lock);
+    stalloc_adopt(s->allocator);
+    free_retired(s);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+/*-------------------------------------------------------
+ * Element Operations
+ *-------------------------------------------------------*/
+bool cmap_get(cmap *m, void *key, void *out) {
+  init_asserts(m);
+  assert(key);
+  cmap_shard *s = shard_of(m, key);
+
+  for (;;) {
+    uint64_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+    if (seq & 1) {
+      sched_yield(); /* The writer may need this core to finish. */
+      continue;
+    }
+
+    /* The header must be whole before following it to a table. */
+    map view;
+    memcpy(&view, &s->table, sizeof(view));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&s->seq, memory_order_relaxed) != seq) continue;
+
+    kvpair kv = map_get(&view, key);
+    if (kv.key && out) memcpy(out, kv.value, m->__el_size);
+
+    /* Whatever was copied is only good if no write overlapped it. */
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq)
+      return kv.key != NULL;
+  }
+}
+
+bool cmap_has(cmap *m, void *key) { return cmap_get(m, key, NULL); }
+
+void cmap_put(cmap *m, void *key, void *value) {
+  init_asserts(m);
+  assert(key);
+  assert(value);
+  cmap_shard *s = shard_of(m, key);
+
+  write_begin(s);
+  vec old;
+  if (__map_grow_retired(&s->table, 1, &old)) vec_push(&s->retired, &old);
+  map_put(&s->table, key, value);
+  write_end(s);
+}
+
+void cmap_del(cmap *m, void *key) {
+  init_asserts(m);
+  assert(key);
+  cmap_shard *s = shard_of(m, key);
+
+  write_begin(s);
+  map_del(&s->table, key);
+  write_end(s);
+}
+
+/*-------------------------------------------------------
+ * Functional Operations
+ *-------------------------------------------------------*/
+void cmap_foreach(cmap *m, _each n, void *args) {
+  init_asserts(m);
+  for (int32_t i = 0; i < 1 << m->shard_bits; i++) {
+    cmap_shard *s = &m->shards[i];
+    pthread_mutex_lock(&s->lock);
+    map_foreach(&s->table, n, args);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
@@ -24,27 +24,58 @@ stack allocation for best performance.
 Only random heap allocations may use the libraries free function. Stack
 context allocations use pop() or the built in global stack pop function.
 
+stalloc_stats reports the bytes and regions an allocator holds. Building with
+STALLOC_STATS adds counters and peaks, STALLOC_TRACE a hook on every push,
+pop and new region.
+
+=== Pool ===
+pool_* is a small work stealing thread pool behind the *_par variants of the
+vec_* and map_* functional operations. Each worker runs on its own stalloc.
+
 === Data Structures ===
 vec_*   : Wrapper for a contiguous segment of memory. Can be
                   used to represent a fixed or resizable array.
 
 map_*   : Open address hashing table with resize capabilities.
 
-set_*   : Implemented as a resizeable sparse set wrapped with
-          the libraries hashing function.
+fmap_*  : Open address hashing table probing 16 control bytes at a time
+          with SIMD. Same functional API as map_*.
+
+set_*   : Implemented as an open address map without values for
+          arbitrary keys, or with SET_SPARSE as a resizeable sparse set over
+          integer ids: a packed dense array plus a sparse index. SET_BITSET
+          keeps one bit per id for small universes of integer ids.
+
+soa_*   : Structure of arrays, one contiguous column per field sharing a
+          length, capacity and allocation. Typed from a field list.
+
+heap_*  : Priority queue over vec_*, a 4-ary heap with handles for
+          decrease key.
 
 stack_* : Wrapper over vec_* and constrains the vector.
 
-queue_* : Wrapper over vec_* again and constrains the vector.
+queue_* : Power of two ring buffer over vec_* with O(1) push and pop. spsc_*
+          and mpmc_* are bounded lock free rings for passing elements
+          between threads.
+
+graph_* : Adjacency builder compiled into compressed sparse row arrays.
+          Each vertex stores a value you define.
 
-graph_* : Implemented as a map of sets. Each vertex stores a pointer to
-          some address you define.
+cmap_*  : map_* split into shards for sharing between threads. Writers lock
+          one shard, readers take no lock and retry if a writer got in.
+
+pipe_*  : Lazy filter and map stages over a vec_*, map_* or set_*, fused
+          into one traversal by a fold, count, foreach or collect.
+
+*_save  : Snapshots a vec_*, map_* or set_* to a file. *_mmap_open maps one
+          back read only and probes it in place, with no copy or rehash.
 
 buff_*  : Buffer API implementation that takes a region of memory and allows
           for various manipulations
 
 === Algorithms ===
-hash_bytes() : Modified version of djb2 to consume N bytes. Originally from:
+hash_bytes() : Word at a time hash in the style of wyhash, the map default.
+hash_djb2()  : djb2 consuming N bytes. Originally from:
                 http://www.cse.yorku.ca/~oz/hash.html
 
 bfs()        : Breadth first search over a graph
@@ -67,19 +98,49 @@ a_star()     : The classic a* graph search algorithm.
  * libcsdsa Configurations
  *-------------------------------------------------------*/
 // #define DISABLE_ALLOCATOR
+// #define STALLOC_VALIDATE_FRAMES /* Walk every block's guards in end_frame */
+// #define STALLOC_STATS /* Count pushes, pops and merges, track the peaks */
+// #define STALLOC_TRACE /* Call the stalloc_trace hook on push, pop, grow */
 
 #define TO_STACK            0
 #define TO_HEAP             1
+#define ALLOC_UNINIT        2 /* Do not zero memory, or by TO_STACK/TO_HEAP */
+#define TO_STACK_UNINIT     (TO_STACK | ALLOC_UNINIT)
+#define TO_HEAP_UNINIT      (TO_HEAP | ALLOC_UNINIT)
+#define SNAPSHOT_MAPPED     (1 << 5) /* Elements point into a mapped file */
 #define VECTOR_DEFAULT_SIZE 1
 #define STACK_DEFAULT_SIZE  1
 #define MAP_DEFAULT_SIZE    32
 #define MAP_LOAD_FACTOR     0.75
+#define MAP_MIGRATE_STEP    64 /* Old slots moved per incremental rehash step */
+#define FMAP_LOAD_FACTOR    0.875
+#define FMAP_GROUP          16 /* Control bytes compared per probe step */
 #define ARENA_DEFAULT_SIZE  128
+#define VEC_SORT_RUN        16 /* Ranges this small are insertion sorted */
+#define HEAP_ARITY          4  /* Children per heap node */
+#define CACHE_LINE_SIZE     64 /* Keeps shared atomics on separate lines */
+#define POOL_MIN_GRAIN      256 /* Fewest elements a _par chunk is cut to */
+#define VEC_BATCH           1024 /* Elements handed to a batch callback */
+#define MAP_PROBE_BUCKETS   16   /* Power of two buckets of map_stats.probes */
+#define CMAP_DEFAULT_SHARDS 16   /* Shards of a cmap initialised with 0 */
+
+/* Alignment of every stack allocation, a power of two up to 64 bytes. Define
+   it before including csdsa.h (and when building the library) to change it. */
+#ifndef STALLOC_ALIGNMENT
+#define STALLOC_ALIGNMENT 16
+#endif
+_Static_assert(STALLOC_ALIGNMENT > 0 && STALLOC_ALIGNMENT <= 64 &&
+                   (STALLOC_ALIGNMENT & (STALLOC_ALIGNMENT - 1)) == 0,
+               "STALLOC_ALIGNMENT must be a power of two up to 64");
 /*-------------------------------------------------------
  * Type Definitions
  *-------------------------------------------------------*/
 typedef struct stalloc stalloc;
 typedef struct cbuff   cbuff;
+typedef struct pool    pool;
+typedef struct snapshot snapshot;
+typedef struct vec_stats vec_stats;
+typedef struct map_stats map_stats;
 
 /* Internal typedefs for a functional programming style. */
 typedef void (*_each)(void *el, void *args);
@@ -87,6 +148,18 @@ typedef bool (*_pred)(void *el, void *args);
 typedef void (*_unary)(void *out, void *el, void *args);
 typedef void (*_binary)(void *out, void *a, void *b, void *args);
 typedef bool (*_compare)(void *a, void *b, void *args);
+typedef void (*_range)(int64_t begin, int64_t end, void *args);
+
+/* Batch callbacks get a run of count elements, stride bytes apart, starting
+   at base. _unary_batch rewrites the run in place and _pred_batch returns how
+   many elements of it match. */
+typedef void (*_each_batch)(void *base, int64_t count, int64_t stride,
+                            void *args);
+typedef void (*_unary_batch)(void *base, int64_t count, int64_t stride,
+                             void *args);
+typedef int64_t (*_pred_batch)(void *base, int64_t count, int64_t stride,
+                               void *args);
+typedef uint64_t (*_hash)(void *key, size_t size);
 
 /* Macros to create FP functions. */
 #define feach(name, ty, prop, body)                                            \
@@ -140,6 +213,39 @@ typedef bool (*_compare)(void *a, void *b, void *args);
     body;                                                                      \
   }
 
+/* Batch versions of feach, pred and unary. The body is the same as theirs,
+   it is inlined into a plain loop over a typed array the compiler can
+   vectorize. The element type must tile the run, stride == sizeof(ty). */
+#define feach_batch(name, ty, prop, body)                                      \
+  void name(void *_base, int64_t _count, int64_t _stride, void *args) {        \
+    assert(_stride == sizeof(ty));                                             \
+    ty *_els = _base;                                                          \
+    for (int64_t _i = 0; _i < _count; _i++) {                                  \
+      ty prop = _els[_i];                                                      \
+      body                                                                     \
+    }                                                                          \
+  }
+
+#define pred_batch(name, ty, prop, body)                                       \
+  static inline bool name##_pr(ty prop, void *args) { body; }                  \
+  int64_t name(void *_base, int64_t _count, int64_t _stride, void *args) {     \
+    assert(_stride == sizeof(ty));                                             \
+    ty     *_els = _base;                                                      \
+    int64_t _matches = 0;                                                      \
+    for (int64_t _i = 0; _i < _count; _i++)                                    \
+      _matches += name##_pr(_els[_i], args);                                   \
+    return _matches;                                                           \
+  }
+
+#define unary_batch(name, ty, prop, body)                                      \
+  static inline ty name##_un(ty prop, void *args) { body; }                    \
+  void name(void *_base, int64_t _count, int64_t _stride, void *args) {        \
+    assert(_stride == sizeof(ty));                                             \
+    ty *_els = _base;                                                          \
+    for (int64_t _i = 0; _i < _count; _i++)                                    \
+      _els[_i] = name##_un(_els[_i], args);                                    \
+  }
+
 /* =========================================================================
    Section: Allocator
 ========================================================================= */
@@ -158,7 +264,9 @@ typedef bool (*_compare)(void *a, void *b, void *args);
     set_frame_ctx(__##alloc##_prev);                                           \
   }
 
-/* Initiate a local frame in the allocator */
+/* Initiate a local frame in the allocator. start_frame marks the stack
+   pointer and end_frame resets to the mark, so unwinding a frame costs the
+   same no matter how many pushes it holds. */
 #define FRAME(alloc, call)                                                     \
   start_frame(alloc);                                                          \
   call;                                                                        \
@@ -167,17 +275,59 @@ typedef bool (*_compare)(void *a, void *b, void *args);
 void start_frame(stalloc *alloc);
 void end_frame(stalloc *alloc);
 
-/* Container Operations */
+/* Region retention policy, applied to the regions that empty out when a frame
+   ends. Defaults to keeping the largest region hot and caching the rest. */
+#define STALLOC_RETAIN_LARGEST (1 << 0) /* Keep the largest empty region */
+#define STALLOC_CACHE_REGIONS  (1 << 1) /* Park the others up to cache_bytes */
+#define STALLOC_MMAP           (1 << 2) /* mmap regions, MADV_DONTNEED parked */
+#define STALLOC_CACHE_DEFAULT  (1 << 20)
+
+typedef struct stalloc_policy stalloc_policy;
+struct stalloc_policy {
+  int32_t flags;       /* STALLOC_RETAIN_LARGEST | STALLOC_CACHE_REGIONS ... */
+  int64_t cache_bytes; /* High water mark of bytes kept in the region cache */
+};
+
+#define STALLOC_POLICY_DEFAULT                                                 \
+  ((stalloc_policy){.flags = STALLOC_RETAIN_LARGEST | STALLOC_CACHE_REGIONS,  \
+                    .cache_bytes = STALLOC_CACHE_DEFAULT})
+
+/* Container Operations
+   An allocator belongs to the thread that created it. stalloc_thread_local
+   returns the calling thread's own arena, creating it on first use and making
+   it the frame context if the thread had none. The arena is freed when the
+   thread exits, unless heap blocks from it are still out: then it is left
+   alive, and its memory is never returned, so their late hfree from another
+   thread stays safe. A thread producing heap memory for others (spsc, mpmc or
+   pipe payloads) should rather use stalloc_create and free it once the
+   consumers are done. stalloc_adopt hands ownership to the calling thread. */
 stalloc *stalloc_create(int64_t bytes);
+stalloc *stalloc_create_with(int64_t bytes, stalloc_policy policy);
+stalloc *stalloc_thread_local(int64_t bytes);
+void     stalloc_adopt(stalloc *alloc);
 void     stalloc_free(stalloc *alloc);
 
-/* Stack Allocation Strategy */
-#define stpusha(alloc, bytes) __stpush(alloc, bytes)
-#define stpush(bytes)         __stpushframe(bytes)
+/* Stack Allocation Strategy
+   Every push is aligned to STALLOC_ALIGNMENT, stpush_aligned takes any power
+   of two alignment for a single push (e.g. 32 for AVX loads). Pushes are
+   zeroed, stpusha_uninit skips that for memory about to be overwritten. */
+#define stpusha(alloc, bytes)        __stpush(alloc, bytes)
+#define stpush(bytes)                __stpushframe(bytes)
+#define stpusha_uninit(alloc, bytes) __stpush_uninit(alloc, bytes)
+#define stpush_aligned(alloc, bytes, align)                                    \
+  __stpush_aligned(alloc, bytes, align)
 
 void *__stpush(stalloc *alloc, int64_t bytes);
+void *__stpush_aligned(stalloc *alloc, int64_t bytes, int64_t align);
+void *__stpush_uninit(stalloc *alloc, int64_t bytes);
 void *__stpushframe(int64_t bytes);
 
+/* Resizes the block at ptr to new_bytes without moving it. Only the topmost
+   block pushed on the current frame can be resized, any other block (or too
+   little room left in the region) returns false and leaves it untouched. The
+   grown part is not zeroed. */
+bool stextend(stalloc *alloc, void *ptr, int64_t new_bytes);
+
 #define stpopa(alloc) __stpop(alloc)
 #define stpop()       __stpopframe()
 void __stpop(stalloc *alloc);
@@ -186,23 +336,97 @@ void __stpopframe(void);
 stalloc *get_frame_ctx(void);
 void     set_frame_ctx(stalloc *a);
 
-/* Heap Allocation Strategy */
-// TODO: Make into arena!
+/* Heap Allocation Strategy
+   Heap blocks are carved from the top of the allocator regions and recycled
+   through size class free lists. Requests too large for a block guard are
+   passed through to libc. Heap memory must be given back with hfree on the
+   same allocator it came from. hfree may be called from any thread, halloc
+   and hrealloc only from the owner (see stalloc_adopt). A NULL allocator (as
+   cn##_hinit passes on a thread with no frame context) means plain calloc,
+   malloc, realloc and free.
+   halloc zeroes the memory it returns, halloc_uninit does not. */
 void *halloc(stalloc *alloc, int64_t bytes);
+void *halloc_uninit(stalloc *alloc, int64_t bytes);
 void *hrealloc(stalloc *alloc, void *ptr, int64_t bytes);
 void  hfree(stalloc *alloc, void *ptr);
 
+/* Statistics
+   stalloc_stats measures what an allocator holds right now by walking its
+   regions, meant for sizing STALLOC_DEFAULT from a real workload. Counters
+   and peaks are only kept with STALLOC_STATS and read zero without it.
+   stalloc_stats_reset zeroes the counters and starts the peaks over from the
+   current values. Call both from the owning thread. */
+typedef struct stalloc_usage stalloc_usage;
+struct stalloc_usage {
+  int64_t bytes_reserved; /* Held by the live regions */
+  int64_t bytes_cached;   /* Held by regions parked in the cache */
+  int64_t bytes_used;     /* In stack and heap blocks, guards included */
+  int64_t regions;        /* Live regions */
+  int64_t frame_depth;    /* Frames open right now */
+
+  /* STALLOC_STATS only */
+  int64_t bytes_peak;
+  int64_t frame_peak;
+  int64_t regions_created; /* Fresh from the system, not out of the cache */
+  int64_t pushes, pops;
+  int64_t merges; /* Heap blocks coalesced with a free neighbour */
+};
+
+void stalloc_stats(stalloc *alloc, stalloc_usage *out);
+void stalloc_stats_reset(stalloc *alloc);
+
+#ifdef STALLOC_TRACE
+/* Called on the owning thread after every push, stpop and new region. ptr
+   and bytes are the user memory of a push, the whole block a pop took off
+   (padding and guards too) and the region for a grow. */
+#define STALLOC_EVENT_PUSH 0
+#define STALLOC_EVENT_POP  1
+#define STALLOC_EVENT_GROW 2
+
+typedef void (*_stalloc_trace)(stalloc *alloc, int32_t event, void *ptr,
+                               int64_t bytes, void *args);
+void stalloc_trace(stalloc *alloc, _stalloc_trace hook, void *args);
+#endif
+
+/* =========================================================================
+  Section: Pool
+========================================================================= */
+/* Container Operations
+   A pool of worker threads behind the _par operations. workers counts the
+   thread calling pool_run, which works every run alongside the others, so a
+   pool of 1 runs everything inline. 0 picks the number of online cores. */
+pool   *pool_create(int32_t workers);
+void    pool_free(pool *p);
+int32_t pool_workers(pool *p);
+
+/* Runs fn over [0, n) cut into chunks of grain elements, returning once every
+   chunk is done. Each worker drains its own span of chunks and then steals
+   from the others. A chunk runs inside a frame on the worker's own arena,
+   which is its frame context, so fn may stpush freely. Runs are not
+   reentrant: one thread at a time, and never from inside fn. pool_grain is
+   the chunk size the _par operations pick for n elements. */
+void    pool_run(pool *p, int64_t n, int64_t grain, _range fn, void *args);
+int64_t pool_grain(pool *p, int64_t n);
+
 /* =========================================================================
   Section: Vector
 ========================================================================= */
 typedef struct vec vec;
 struct vec {
-  int64_t  __top, __size, __el_size;
-  int64_t  length;
-  int32_t  flags;
-  int32_t  cache_counter; /* Increments each resize for invalidation checks. */
-  stalloc *allocator;
-  void    *elements;
+  int64_t    __top, __size, __el_size;
+  int64_t    length;
+  int32_t    flags;
+  int32_t    cache_counter; /* Increments each resize for invalidation checks */
+  stalloc   *allocator;
+  void      *elements;
+  vec_stats *stats; /* See vec_track, NULL while not tracked. */
+};
+
+/* Growth counters, filled in while attached with vec_track. */
+struct vec_stats {
+  int64_t resizes;      /* Times the capacity grew */
+  int64_t moves;        /* Of those, the times the elements had to move */
+  int64_t bytes_copied; /* By those moves */
 };
 
 /* Container Operations */
@@ -210,9 +434,27 @@ vec  *__vec_init(vec *v, int64_t el_size, stalloc *alloc, int32_t flags,
                  int64_t initial_size);
 void  vec_free(vec *v);
 void  vec_resize(vec *v, int64_t size);
+void  vec_reserve(vec *v, int64_t capacity);
 void *vec_copy(vec *dest, vec *src);
 void  vec_clear(vec *v);
 
+/* Starts adding v's growth to stats, NULL stops. The counters are left as
+   they are, so one vec_stats can total several containers. Copies start out
+   untracked. */
+void vec_track(vec *v, vec_stats *stats);
+
+/* Snapshots
+   vec_save writes the vec to fd as a position independent snapshot, fd
+   should be at the start of its own file. vec_mmap_open maps such a file
+   read only and points v straight at the pages, nothing is copied. Only
+   operations that leave v as it is may be used, anything that writes to it
+   faults. Filters and anything that grows v assert against a mapped
+   container, work on a *_copy instead. alloc backs what reading it
+   allocates, such as copies. vec_free unmaps it. NULL when the file is not
+   a vec snapshot. */
+bool vec_save(vec *v, int fd);
+vec *vec_mmap_open(vec *v, const char *path, stalloc *alloc);
+
 /* Element Operations */
 void   *vec_at(vec *v, int64_t pos);
 void    vec_delete_at(vec *v, int64_t pos);
@@ -220,18 +462,52 @@ void    vec_put(vec *v, int64_t pos, void *el);
 bool    vec_has(vec *v, void *el);
 int64_t vec_find(vec *v, void *el);
 void    vec_push(vec *v, void *el);
+void    vec_push_n(vec *v, void *src, int64_t n);
+void    vec_extend(vec *dest, vec *src);
+void   *vec_emplace(vec *v); /* Pushes a zeroed slot to construct in place */
 void    vec_pop(vec *v);
 void   *vec_top(vec *v);
 void    vec_swap(vec *v, int64_t idx1, int64_t idx2);
 
+/* Skips the bounds asserts of vec_at, for loops that already know pos is in
+   range. Inlines down to pointer arithmetic. */
+static inline void *vec_at_unchecked(vec *v, int64_t pos) {
+  return (char *)v->elements + pos * v->__el_size;
+}
+
 /* Functional Operations */
 void    vec_sort(vec *v, _compare cmp, void *args);
+void    vec_sort_stable(vec *v, _compare cmp, void *args);
+void    vec_sort_radix(vec *v, int64_t key_offset, int64_t key_size,
+                       bool is_signed);
 int64_t vec_count_if(vec *v, _pred p, void *args);
 vec    *vec_filter(vec *v, _pred p, void *args);
 void    vec_foreach(vec *v, _each n, void *args);
 vec    *vec_map(vec *v, _unary u, void *args);
 void   *vec_foldl(vec *v, _binary b, void *result, void *args);
 
+/* Batch Operations
+   Same as above with one callback per run of up to VEC_BATCH elements, for
+   callbacks cheap enough that the indirect call per element would dominate.
+   vec_map_batch rewrites each run in place, no temp. See feach_batch. */
+void    vec_foreach_batch(vec *v, _each_batch n, void *args);
+vec    *vec_map_batch(vec *v, _unary_batch u, void *args);
+int64_t vec_count_if_batch(vec *v, _pred_batch p, void *args);
+
+/* Parallel Operations
+   Same as above with the elements split across the workers of p, so the
+   callbacks must be safe to run concurrently. Order of calls is unspecified,
+   vec_filter_par still keeps the survivors in order. vec_foldl_par folds each
+   chunk from a copy of *result, which must hold an identity of combine (0 for
+   a sum), then combines the chunks into *result in order. combine must be
+   associative. */
+int64_t vec_count_if_par(vec *v, _pred p, void *args, pool *pl);
+vec    *vec_filter_par(vec *v, _pred p, void *args, pool *pl);
+void    vec_foreach_par(vec *v, _each n, void *args, pool *pl);
+vec    *vec_map_par(vec *v, _unary u, void *args, pool *pl);
+void   *vec_foldl_par(vec *v, _binary b, _binary combine, void *result,
+                      int64_t result_size, void *args, pool *pl);
+
 /* Vector Type Interface */
 #define VEC_TYPEDEC(cn, ty)                                                    \
   typedef vec cn;                                                              \
@@ -242,26 +518,47 @@ void   *vec_foldl(vec *v, _binary b, void *result, void *args);
                                                                                \
   void cn##_free(cn *v);                                                       \
   void cn##_resize(cn *v, int64_t size);                                       \
+  void cn##_reserve(cn *v, int64_t capacity);                                  \
   cn  *cn##_copy(cn *dest, cn *src);                                           \
                                                                                \
   void cn##_clear(cn *v);                                                      \
+  void cn##_track(cn *v, vec_stats *stats);                                    \
+  bool cn##_save(cn *v, int fd);                                               \
+  cn  *cn##_mmap_open(cn *v, const char *path, stalloc *alloc);                \
                                                                                \
   ty     *cn##_at(cn *v, int64_t pos);                                         \
+  ty     *cn##_at_unchecked(cn *v, int64_t pos);                               \
   void    cn##_put(cn *v, int64_t pos, void *el);                              \
   void    cn##_delete_at(cn *v, int64_t pos);                                  \
   bool    cn##_has(cn *v, ty *el);                                             \
   int64_t cn##_find(cn *v, ty *el);                                            \
   void    cn##_push(cn *v, ty *el);                                            \
+  void    cn##_push_n(cn *v, ty *src, int64_t n);                              \
+  void    cn##_extend(cn *dest, cn *src);                                      \
+  ty     *cn##_emplace(cn *v);                                                 \
   void    cn##_pop(cn *v);                                                     \
   ty     *cn##_top(cn *v);                                                     \
   void    cn##_swap(cn *v, int64_t idx1, int64_t idx2);                        \
                                                                                \
   void    cn##_sort(cn *v, _compare cmp, void *args);                          \
+  void    cn##_sort_stable(cn *v, _compare cmp, void *args);                   \
+  void    cn##_sort_radix(cn *v, int64_t key_offset, int64_t key_size,         \
+                          bool is_signed);                                     \
   int64_t cn##_count_if(cn *v, _pred p, void *args);                           \
   cn     *cn##_filter(cn *v, _pred p, void *args);                             \
   void    cn##_foreach(cn *v, _each n, void *args);                            \
   cn     *cn##_map(cn *v, _unary u, void *args);                               \
-  void   *cn##_foldl(cn *v, _binary b, void *result, void *args);
+  void   *cn##_foldl(cn *v, _binary b, void *result, void *args);              \
+  void    cn##_foreach_batch(cn *v, _each_batch n, void *args);                \
+  cn     *cn##_map_batch(cn *v, _unary_batch u, void *args);                   \
+  int64_t cn##_count_if_batch(cn *v, _pred_batch p, void *args);               \
+                                                                               \
+  int64_t cn##_count_if_par(cn *v, _pred p, void *args, pool *pl);             \
+  cn     *cn##_filter_par(cn *v, _pred p, void *args, pool *pl);               \
+  void    cn##_foreach_par(cn *v, _each n, void *args, pool *pl);              \
+  cn     *cn##_map_par(cn *v, _unary u, void *args, pool *pl);                 \
+  void   *cn##_foldl_par(cn *v, _binary b, _binary combine, void *result,      \
+                         int64_t result_size, void *args, pool *pl);
 
 #define VEC_TYPE_IMPL(cn, ty)                                                    \
   typedef vec cn;                                                                \
@@ -279,27 +576,69 @@ void   *vec_foldl(vec *v, _binary b, void *result, void *args);
   }                                                                              \
   void cn##_free(cn *v) { vec_free((vec *)v); }                                  \
   void cn##_resize(cn *v, int64_t size) { vec_resize((vec *)v, size); }          \
+  void cn##_reserve(cn *v, int64_t capacity) {                                   \
+    vec_reserve((vec *)v, capacity);                                             \
+  }                                                                              \
   cn  *cn##_copy(cn *dest, cn *src) {                                            \
     return vec_copy((vec *)dest, (vec *)src);                                   \
   }                                                                              \
                                                                                  \
   void cn##_clear(cn *v) { vec_clear((vec *)v); }                                \
+  void cn##_track(cn *v, vec_stats *stats) { vec_track((vec *)v, stats); }       \
+  bool cn##_save(cn *v, int fd) { return vec_save((vec *)v, fd); }               \
+  cn  *cn##_mmap_open(cn *v, const char *path, stalloc *alloc) {                 \
+    if (!vec_mmap_open((vec *)v, path, alloc)) return NULL;                      \
+    if (v->__el_size == sizeof(ty)) return v;                                    \
+    vec_free((vec *)v);                                                          \
+    return NULL;                                                                 \
+  }                                                                              \
                                                                                  \
-  ty     *cn##_at(cn *v, int64_t pos) { return vec_at((vec *)v, pos); }          \
-  void    cn##_put(cn *v, int64_t pos, void *el) { vec_put((vec *)v, pos, el); } \
+  /* sizeof(ty) is known here, so element access and copies below are plain   \
+     typed loads and stores instead of going through memmove. */               \
+  ty *cn##_at(cn *v, int64_t pos) {                                              \
+    assert(pos >= 0 && pos < v->length);                                         \
+    return (ty *)v->elements + pos;                                              \
+  }                                                                              \
+  ty *cn##_at_unchecked(cn *v, int64_t pos) { return (ty *)v->elements + pos; }  \
+  void cn##_put(cn *v, int64_t pos, void *el) {                                  \
+    assert(pos >= 0 && pos < v->length);                                         \
+    ((ty *)v->elements)[pos] = *(ty *)el;                                        \
+  }                                                                              \
   void    cn##_delete_at(cn *v, int64_t pos) { vec_delete_at((vec *)v, pos); }   \
   bool    cn##_has(cn *v, ty *el) { return vec_has((vec *)v, el); }              \
   int64_t cn##_find(cn *v, ty *el) { return vec_find((vec *)v, el); }            \
-  void    cn##_push(cn *v, ty *el) { vec_push((vec *)v, el); }                   \
+  void cn##_push(cn *v, ty *el) {                                                \
+    if (v->__top == v->length && v->length < v->__size) {                        \
+      ((ty *)v->elements)[v->length++] = *el;                                    \
+      v->__top++;                                                                \
+      return;                                                                    \
+    }                                                                            \
+    vec_push((vec *)v, el);                                                      \
+  }                                                                              \
+  void    cn##_push_n(cn *v, ty *src, int64_t n) {                               \
+    vec_push_n((vec *)v, src, n);                                                \
+  }                                                                              \
+  void cn##_extend(cn *dest, cn *src) { vec_extend((vec *)dest, (vec *)src); }   \
+  ty  *cn##_emplace(cn *v) { return vec_emplace((vec *)v); }                     \
   void    cn##_pop(cn *v) { vec_pop((vec *)v); }                                 \
   ty     *cn##_top(cn *v) { return vec_top((vec *)v); }                          \
-  void    cn##_swap(cn *v, int64_t idx1, int64_t idx2) {                         \
-    vec_swap((vec *)v, idx1, idx2);                                           \
+  void cn##_swap(cn *v, int64_t idx1, int64_t idx2) {                            \
+    ty *a = cn##_at(v, idx1), *b = cn##_at(v, idx2);                             \
+    ty  temp = *a;                                                               \
+    *a = *b;                                                                     \
+    *b = temp;                                                                   \
   }                                                                              \
                                                                                  \
   void cn##_sort(cn *v, _compare cmp, void *args) {                              \
     vec_sort((vec *)v, cmp, args);                                               \
   }                                                                              \
+  void cn##_sort_stable(cn *v, _compare cmp, void *args) {                       \
+    vec_sort_stable((vec *)v, cmp, args);                                        \
+  }                                                                              \
+  void cn##_sort_radix(cn *v, int64_t key_offset, int64_t key_size,              \
+                       bool is_signed) {                                         \
+    vec_sort_radix((vec *)v, key_offset, key_size, is_signed);                   \
+  }                                                                              \
   int64_t cn##_count_if(cn *v, _pred p, void *args) {                            \
     return vec_count_if((vec *)v, p, args);                                      \
   }                                                                              \
@@ -314,6 +653,106 @@ void   *vec_foldl(vec *v, _binary b, void *result, void *args);
   }                                                                              \
   void *cn##_foldl(cn *v, _binary b, void *result, void *args) {                 \
     return vec_foldl((vec *)v, b, result, args);                                 \
+  }                                                                              \
+  void cn##_foreach_batch(cn *v, _each_batch n, void *args) {                    \
+    vec_foreach_batch((vec *)v, n, args);                                        \
+  }                                                                              \
+  cn *cn##_map_batch(cn *v, _unary_batch u, void *args) {                        \
+    return vec_map_batch((vec *)v, u, args);                                     \
+  }                                                                              \
+  int64_t cn##_count_if_batch(cn *v, _pred_batch p, void *args) {                \
+    return vec_count_if_batch((vec *)v, p, args);                                \
+  }                                                                              \
+  int64_t cn##_count_if_par(cn *v, _pred p, void *args, pool *pl) {              \
+    return vec_count_if_par((vec *)v, p, args, pl);                              \
+  }                                                                              \
+  cn *cn##_filter_par(cn *v, _pred p, void *args, pool *pl) {                    \
+    return vec_filter_par((vec *)v, p, args, pl);                                \
+  }                                                                              \
+  void cn##_foreach_par(cn *v, _each n, void *args, pool *pl) {                  \
+    vec_foreach_par((vec *)v, n, args, pl);                                      \
+  }                                                                              \
+  cn *cn##_map_par(cn *v, _unary u, void *args, pool *pl) {                      \
+    return vec_map_par((vec *)v, u, args, pl);                                   \
+  }                                                                              \
+  void *cn##_foldl_par(cn *v, _binary b, _binary combine, void *result,          \
+                       int64_t result_size, void *args, pool *pl) {              \
+    return vec_foldl_par((vec *)v, b, combine, result, result_size, args,        \
+                         pl);                                                    \
+  }
+
+/* Generates `void cn##_sort_##cmp(cn *v, void *args)`, the same introsort as
+   vec_sort but working on `ty` directly. `cmp` is called by name, so when it
+   is defined in the same translation unit (see `compare`) the compiler can
+   inline it along with the element swaps. */
+#define VEC_SORT_IMPL(cn, ty, cmp)                                             \
+  static void cn##_##cmp##_insertion(ty *el, int64_t lo, int64_t hi,          \
+                                     void *args) {                             \
+    for (int64_t i = lo + 1; i <= hi; i++) {                                   \
+      ty      cur = el[i];                                                     \
+      int64_t j = i;                                                           \
+      for (; j > lo && cmp(&cur, &el[j - 1], args); j--) el[j] = el[j - 1];    \
+      el[j] = cur;                                                             \
+    }                                                                          \
+  }                                                                            \
+  static void cn##_##cmp##_sift(ty *el, int64_t root, int64_t end,             \
+                                void *args) {                                  \
+    for (int64_t child = 2 * root + 1; child < end; child = 2 * root + 1) {    \
+      if (child + 1 < end && cmp(&el[child], &el[child + 1], args)) child++;   \
+      if (!cmp(&el[root], &el[child], args)) return;                           \
+      ty temp = el[root];                                                      \
+      el[root] = el[child];                                                    \
+      el[child] = temp;                                                        \
+      root = child;                                                            \
+    }                                                                          \
+  }                                                                            \
+  static void cn##_##cmp##_intro(ty *el, int64_t lo, int64_t hi,               \
+                                 int32_t depth, void *args) {                  \
+    ty temp;                                                                   \
+    while (hi - lo + 1 > VEC_SORT_RUN) {                                       \
+      if (depth-- == 0) {                                                      \
+        int64_t n = hi - lo + 1;                                               \
+        for (int64_t i = n / 2 - 1; i >= 0; i--)                               \
+          cn##_##cmp##_sift(el + lo, i, n, args);                              \
+        for (int64_t end = n - 1; end > 0; end--) {                            \
+          temp = el[lo], el[lo] = el[lo + end], el[lo + end] = temp;           \
+          cn##_##cmp##_sift(el + lo, 0, end, args);                            \
+        }                                                                      \
+        return;                                                                \
+      }                                                                        \
+      int64_t mid = lo + (hi - lo) / 2;                                        \
+      if (cmp(&el[mid], &el[lo], args))                                        \
+        temp = el[mid], el[mid] = el[lo], el[lo] = temp;                       \
+      if (cmp(&el[hi], &el[mid], args)) {                                      \
+        temp = el[hi], el[hi] = el[mid], el[mid] = temp;                       \
+        if (cmp(&el[mid], &el[lo], args))                                      \
+          temp = el[mid], el[mid] = el[lo], el[lo] = temp;                     \
+      }                                                                        \
+      temp = el[mid], el[mid] = el[lo], el[lo] = temp;                         \
+      int64_t i = lo + 1, j = hi;                                              \
+      for (;;) {                                                               \
+        while (i <= j && cmp(&el[i], &el[lo], args)) i++;                      \
+        while (i <= j && cmp(&el[lo], &el[j], args)) j--;                      \
+        if (i >= j) break;                                                     \
+        temp = el[i], el[i] = el[j], el[j] = temp;                             \
+        i++, j--;                                                              \
+      }                                                                        \
+      temp = el[lo], el[lo] = el[j], el[j] = temp;                             \
+      if (j - lo < hi - j) {                                                   \
+        cn##_##cmp##_intro(el, lo, j - 1, depth, args);                        \
+        lo = j + 1;                                                            \
+      } else {                                                                 \
+        cn##_##cmp##_intro(el, j + 1, hi, depth, args);                        \
+        hi = j - 1;                                                            \
+      }                                                                        \
+    }                                                                          \
+    cn##_##cmp##_insertion(el, lo, hi, args);                                  \
+  }                                                                            \
+  void cn##_sort_##cmp(cn *v, void *args) {                                    \
+    if (((vec *)v)->length < 2) return;                                        \
+    int32_t depth = 2 * (63 - __builtin_clzll(((vec *)v)->length));            \
+    cn##_##cmp##_intro((ty *)((vec *)v)->elements, 0,                          \
+                       ((vec *)v)->length - 1, depth, args);                   \
   }
 
 /* =========================================================================
@@ -322,7 +761,7 @@ void   *vec_foldl(vec *v, _binary b, void *result, void *args);
 typedef struct kvpair kvpair;
 struct kvpair {
   void   *key, *value;
-  int32_t state; /* 0 = free, X != 0 in use */
+  int32_t state; /* in_use_id = in use, -in_use_id = deleted, else free */
 };
 
 typedef struct map map;
@@ -333,16 +772,48 @@ struct map {
   int64_t __key_size; /* The size of a key */
 
   int64_t  slots_in_use;  /* The count of elements in the map. */
+  int64_t  tombstones;    /* Deleted slots that probes still walk over. */
   int32_t  flags;         /* Contains allocation context information. */
   int32_t  in_use_id;     /* Each clear increments this. */
   int32_t  cache_counter; /* Increments each resize of invalidation checks. */
+  _hash    hasher;        /* Hashes keys, the slot is hash & (__size - 1). */
   stalloc *allocator;
   vec      elements;
+
+  /* MAP_INCREMENTAL only, the table being migrated and how far it got. */
+  vec     __old;
+  int64_t __migrated;
+
+  map_stats *stats; /* See map_track, NULL while not tracked. */
 };
 
-/* Container Operations */
+/* Probe and rehash counters, filled in while attached with map_track. Every
+   probe of the table counts, including those moving keys over while an
+   incremental map migrates. A probe's length is the slots it looked at,
+   probes[i] counts the lengths in [2^i, 2^(i+1)), the last bucket all the
+   longer ones. A healthy table has nearly everything in the first two. */
+struct map_stats {
+  int64_t hits, misses;
+  int64_t probes[MAP_PROBE_BUCKETS];
+  int64_t probe_total; /* Slots looked at over all probes */
+  int64_t probe_max;
+  int64_t rehashes;  /* Tables rebuilt or started migrating */
+  int64_t rehash_ns; /* Spent rebuilding and migrating */
+};
+
+/* Flag for __map_init. Instead of rehashing at once when growing, keep the old
+   table and migrate MAP_MIGRATE_STEP slots per insert. Every step that moves
+   entries bumps cache_counter. */
+#define MAP_INCREMENTAL (1 << 2)
+
+/* Container Operations
+   Table sizes are rounded up to a power of two. __map_init hashes keys with
+   hash_bytes, __map_init_hashed takes any _hash (see Utilities). */
 map *__map_init(map *m, int64_t el_size, int64_t key_size, stalloc *alloc,
                 int32_t flags, int64_t intial_size);
+map *__map_init_hashed(map *m, int64_t el_size, int64_t key_size,
+                       stalloc *alloc, int32_t flags, int64_t intial_size,
+                       _hash hasher);
 
 void    map_free(map *m);
 void    map_clear(map *m);
@@ -350,9 +821,40 @@ vec    *map_to_vec(map *m, vec *out);
 map    *map_copy(map *dest, map *src);
 int64_t map_load(map *m);
 
+/* Resize so `entries` fit without growing, or to the smallest table holding
+   what is in the map (dropping tombstones). Both rehash at most once. */
+void map_reserve(map *m, int64_t entries);
+void map_shrink_to_fit(map *m);
+
+/* Tracking
+   map_track starts adding m's probes and rehashes to stats, NULL stops, see
+   map_stats. Copies start out untracked. map_debug_stats prints the table to
+   stderr: its load and how far each resident key sits from its home slot,
+   where a clustering hasher shows, then the tracked counters if any. */
+void map_track(map *m, map_stats *stats);
+void map_debug_stats(map *m);
+
+/* Snapshots
+   Same as vec_save and vec_mmap_open, the whole slot array is saved and
+   mapped as is so opening never rehashes. hasher must be the one the map
+   was saved with (NULL for hash_bytes), a mismatch fails the open. */
+bool map_save(map *m, int fd);
+map *map_mmap_open(map *m, const char *path, stalloc *alloc, _hash hasher);
+
+/* Used by set snapshots, which may wrap a map. */
+void __map_snapshot(map *m, snapshot *snap);
+map *__map_from_snapshot(map *m, snapshot *snap, _hash hasher);
+
+/* Used by cmap, whose readers may still be probing the old table. Rehashes
+   now if `inserts` more puts would, so none of them does, and hands the old
+   table to retired instead of freeing it. Returns whether it rehashed. Not
+   for MAP_INCREMENTAL maps. */
+bool __map_grow_retired(map *m, int64_t inserts, vec *retired);
+
 /* Element Operations */
 kvpair map_get(map *m, void *key);
 void   map_put(map *m, void *key, void *value);
+void  *map_get_or_insert(map *m, void *key); /* Zeroed value when inserted */
 bool   map_has(map *m, void *key);
 void   map_del(map *m, void *key);
 kvpair read_kvpair(map *m, void *el);
@@ -363,6 +865,17 @@ void    map_foreach(map *m, _each n, void *args);
 map    *map_filter(map *m, _pred p, void *args);
 kvpair  map_find_one(map *m, _pred p, void *args);
 
+/* Iteration
+   Walks the live entries without a callback. Start *cursor at 0, each call
+   fills out and moves the cursor past it, false once the walk is done. The
+   map must not change during a walk. */
+bool map_next(map *m, int64_t *cursor, kvpair *out);
+
+/* Parallel Operations
+   Slots are split across the workers of p, see vec_foreach_par. */
+int64_t map_count_if_par(map *m, _pred p, void *args, pool *pl);
+void    map_foreach_par(map *m, _each n, void *args, pool *pl);
+
 /* Map Type Interface */
 #define MAP_TYPEDEC(cn, keyty, ty)                                             \
   typedef map cn;                                                              \
@@ -378,10 +891,17 @@ kvpair  map_find_one(map *m, _pred p, void *args);
   void *cn##_copy(cn *dest, cn *src);                                          \
                                                                                \
   int64_t cn##_load(cn *m);                                                    \
+  void    cn##_reserve(cn *m, int64_t entries);                                \
+  void    cn##_shrink_to_fit(cn *m);                                           \
+  void    cn##_track(cn *m, map_stats *stats);                                 \
+  void    cn##_debug_stats(cn *m);                                             \
+  bool    cn##_save(cn *m, int fd);                                            \
+  cn     *cn##_mmap_open(cn *m, const char *path, stalloc *alloc);             \
                                                                                \
   /* Element Operations */                                                     \
   kvpair cn##_get(cn *m, void *key);                                           \
   void   cn##_put(cn *m, void *key, void *value);                              \
+  ty    *cn##_get_or_insert(cn *m, void *key);                                 \
   bool   cn##_has(cn *m, void *key);                                           \
   void   cn##_del(cn *m, void *key);                                           \
                                                                                \
@@ -389,24 +909,28 @@ kvpair  map_find_one(map *m, _pred p, void *args);
   int64_t cn##_count_if(cn *m, _pred p, void *args);                           \
   void    cn##_foreach(cn *m, _each n, void *args);                            \
   cn     *cn##_filter(cn *m, _pred p, void *args);                             \
-  kvpair  cn##_find_one(cn *m, _pred p, void *args);
+  kvpair  cn##_find_one(cn *m, _pred p, void *args);                           \
+  int64_t cn##_count_if_par(cn *m, _pred p, void *args, pool *pl);             \
+  void    cn##_foreach_par(cn *m, _each n, void *args, pool *pl);
 
-#define MAP_TYPE_IMPL(cn, keyty, ty)                                           \
+/* Typed map whose keys are hashed by `hasher`, see Utilities. */
+#define MAP_TYPE_IMPL_HASH(cn, keyty, ty, hasher)                              \
   typedef map cn;                                                              \
                                                                                \
   cn *cn##_sinit(cn *m, int64_t initial_size) {                                \
-    return __map_init((map *)m, sizeof(ty), sizeof(keyty), get_frame_ctx(),    \
-                      TO_STACK, initial_size);                                 \
+    return __map_init_hashed((map *)m, sizeof(ty), sizeof(keyty),              \
+                             get_frame_ctx(), TO_STACK, initial_size, hasher); \
   }                                                                            \
                                                                                \
   cn *cn##_hinit(cn *m) {                                                      \
-    return __map_init((map *)m, sizeof(ty), sizeof(keyty), get_frame_ctx(),    \
-                      TO_HEAP, MAP_DEFAULT_SIZE);                              \
+    return __map_init_hashed((map *)m, sizeof(ty), sizeof(keyty),              \
+                             get_frame_ctx(), TO_HEAP, MAP_DEFAULT_SIZE,       \
+                             hasher);                                          \
   }                                                                            \
                                                                                \
   cn *cn##_inita(cn *m, stalloc *alloc, int8_t flags, int64_t initial_size) {  \
-    return __map_init((map *)m, sizeof(ty), sizeof(keyty), alloc, flags,       \
-                      initial_size);                                           \
+    return __map_init_hashed((map *)m, sizeof(ty), sizeof(keyty), alloc,       \
+                             flags, initial_size, hasher);                     \
   }                                                                            \
                                                                                \
   /* Container Operations */                                                   \
@@ -418,12 +942,29 @@ kvpair  map_find_one(map *m, _pred p, void *args);
   }                                                                            \
                                                                                \
   int64_t cn##_load(cn *m) { return map_load((map *)m); }                      \
+  void cn##_reserve(cn *m, int64_t entries) {                                  \
+    map_reserve((map *)m, entries);                                            \
+  }                                                                            \
+  void cn##_shrink_to_fit(cn *m) { map_shrink_to_fit((map *)m); }              \
+  void cn##_track(cn *m, map_stats *stats) { map_track((map *)m, stats); }     \
+  void cn##_debug_stats(cn *m) { map_debug_stats((map *)m); }                  \
+  bool cn##_save(cn *m, int fd) { return map_save((map *)m, fd); }             \
+  cn  *cn##_mmap_open(cn *m, const char *path, stalloc *alloc) {               \
+    if (!map_mmap_open((map *)m, path, alloc, hasher)) return NULL;            \
+    if (m->__key_size == sizeof(keyty) && m->__el_size == sizeof(ty))          \
+      return m;                                                                \
+    map_free((map *)m);                                                        \
+    return NULL;                                                               \
+  }                                                                            \
                                                                                \
   /* Element Operations */                                                     \
   kvpair cn##_get(cn *m, void *key) { return map_get((map *)m, key); }         \
   void   cn##_put(cn *m, void *key, void *value) {                             \
     map_put((map *)m, key, value);                                           \
   }                                                                            \
+  ty *cn##_get_or_insert(cn *m, void *key) {                                   \
+    return map_get_or_insert((map *)m, key);                                   \
+  }                                                                            \
   bool cn##_has(cn *m, void *key) { return map_has((map *)m, key); }           \
   void cn##_del(cn *m, void *key) { map_del((map *)m, key); }                  \
                                                                                \
@@ -439,16 +980,254 @@ kvpair  map_find_one(map *m, _pred p, void *args);
   }                                                                            \
   kvpair cn##_find_one(cn *m, _pred p, void *args) {                           \
     return map_find_one((map *)m, p, args);                                    \
+  }                                                                            \
+  int64_t cn##_count_if_par(cn *m, _pred p, void *args, pool *pl) {            \
+    return map_count_if_par((map *)m, p, args, pl);                            \
+  }                                                                            \
+  void cn##_foreach_par(cn *m, _each n, void *args, pool *pl) {                \
+    map_foreach_par((map *)m, n, args, pl);                                    \
+  }
+
+/* Same as MAP_TYPE_IMPL_HASH, keys hashed with hash_bytes. */
+#define MAP_TYPE_IMPL(cn, keyty, ty)                                           \
+  MAP_TYPE_IMPL_HASH(cn, keyty, ty, hash_bytes)
+
+/* =========================================================================
+  Section: Flat Map
+========================================================================= */
+typedef struct fmap fmap;
+
+struct fmap {
+  int64_t __size;     /* The slot count, a power of two of at least 16. */
+  int64_t __el_size;  /* The size of a element */
+  int64_t __key_size; /* The size of a key */
+
+  int64_t  slots_in_use;  /* The count of elements in the map. */
+  int64_t  tombstones;    /* Deleted slots that probes still walk over. */
+  int32_t  flags;         /* Contains allocation context information. */
+  int32_t  cache_counter; /* Increments each resize of invalidation checks. */
+  _hash    hasher;        /* Hashes keys, see Utilities. */
+  stalloc *allocator;
+  vec      ctrl;          /* One control byte per slot, see fmap.c. */
+  vec      elements;      /* [key][value] per slot, no state words. */
+};
+
+/* Container Operations
+   A drop in for map_* on hot tables. Slots hold the same [key][value] bytes
+   and callbacks receive the same kvpair, with state 1 for live entries. */
+fmap *__fmap_init(fmap *m, int64_t el_size, int64_t key_size, stalloc *alloc,
+                  int32_t flags, int64_t initial_size);
+fmap *__fmap_init_hashed(fmap *m, int64_t el_size, int64_t key_size,
+                         stalloc *alloc, int32_t flags, int64_t initial_size,
+                         _hash hasher);
+
+void    fmap_free(fmap *m);
+void    fmap_clear(fmap *m);
+fmap   *fmap_copy(fmap *dest, fmap *src);
+int64_t fmap_load(fmap *m);
+
+/* Element Operations */
+kvpair fmap_get(fmap *m, void *key);
+void   fmap_put(fmap *m, void *key, void *value);
+void  *fmap_get_or_insert(fmap *m, void *key); /* Zeroed value when inserted */
+bool   fmap_has(fmap *m, void *key);
+void   fmap_del(fmap *m, void *key);
+
+/* Functional Operations */
+int64_t fmap_count_if(fmap *m, _pred p, void *args);
+void    fmap_foreach(fmap *m, _each n, void *args);
+fmap   *fmap_filter(fmap *m, _pred p, void *args);
+kvpair  fmap_find_one(fmap *m, _pred p, void *args);
+
+/* Flat Map Type Interface */
+#define FMAP_TYPEDEC(cn, keyty, ty)                                            \
+  typedef fmap cn;                                                             \
+                                                                               \
+  cn *cn##_sinit(cn *m, int64_t initial_size);                                 \
+  cn *cn##_hinit(cn *m);                                                       \
+  cn *cn##_inita(cn *m, stalloc *alloc, int8_t flags, int64_t initial_size);   \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *m);                                                    \
+  void    cn##_clear(cn *m);                                                   \
+  cn     *cn##_copy(cn *dest, cn *src);                                        \
+  int64_t cn##_load(cn *m);                                                    \
+                                                                               \
+  /* Element Operations */                                                     \
+  kvpair cn##_get(cn *m, void *key);                                           \
+  void   cn##_put(cn *m, void *key, void *value);                              \
+  ty    *cn##_get_or_insert(cn *m, void *key);                                 \
+  bool   cn##_has(cn *m, void *key);                                           \
+  void   cn##_del(cn *m, void *key);                                           \
+                                                                               \
+  /* Functional Operations */                                                  \
+  int64_t cn##_count_if(cn *m, _pred p, void *args);                           \
+  void    cn##_foreach(cn *m, _each n, void *args);                            \
+  cn     *cn##_filter(cn *m, _pred p, void *args);                             \
+  kvpair  cn##_find_one(cn *m, _pred p, void *args);
+
+/* Typed flat map whose keys are hashed by `hasher`, see Utilities. */
+#define FMAP_TYPE_IMPL_HASH(cn, keyty, ty, hasher)                             \
+  typedef fmap cn;                                                             \
+                                                                               \
+  cn *cn##_sinit(cn *m, int64_t initial_size) {                                \
+    return __fmap_init_hashed((fmap *)m, sizeof(ty), sizeof(keyty),            \
+                              get_frame_ctx(), TO_STACK, initial_size,         \
+                              hasher);                                         \
+  }                                                                            \
+  cn *cn##_hinit(cn *m) {                                                      \
+    return __fmap_init_hashed((fmap *)m, sizeof(ty), sizeof(keyty),            \
+                              get_frame_ctx(), TO_HEAP, MAP_DEFAULT_SIZE,      \
+                              hasher);                                         \
+  }                                                                            \
+  cn *cn##_inita(cn *m, stalloc *alloc, int8_t flags, int64_t initial_size) {  \
+    return __fmap_init_hashed((fmap *)m, sizeof(ty), sizeof(keyty), alloc,     \
+                              flags, initial_size, hasher);                    \
+  }                                                                            \
+                                                                               \
+  /* Container Operations */                                                   \
+  void cn##_free(cn *m) { fmap_free((fmap *)m); }                              \
+  void cn##_clear(cn *m) { fmap_clear((fmap *)m); }                            \
+  cn  *cn##_copy(cn *dest, cn *src) {                                          \
+    return fmap_copy((fmap *)dest, (fmap *)src);                               \
+  }                                                                            \
+  int64_t cn##_load(cn *m) { return fmap_load((fmap *)m); }                    \
+                                                                               \
+  /* Element Operations */                                                     \
+  kvpair cn##_get(cn *m, void *key) { return fmap_get((fmap *)m, key); }       \
+  void   cn##_put(cn *m, void *key, void *value) {                             \
+    fmap_put((fmap *)m, key, value);                                           \
+  }                                                                            \
+  ty *cn##_get_or_insert(cn *m, void *key) {                                   \
+    return fmap_get_or_insert((fmap *)m, key);                                 \
+  }                                                                            \
+  bool cn##_has(cn *m, void *key) { return fmap_has((fmap *)m, key); }         \
+  void cn##_del(cn *m, void *key) { fmap_del((fmap *)m, key); }                \
+                                                                               \
+  /* Functional Operations */                                                  \
+  int64_t cn##_count_if(cn *m, _pred p, void *args) {                          \
+    return fmap_count_if((fmap *)m, p, args);                                  \
+  }                                                                            \
+  void cn##_foreach(cn *m, _each n, void *args) {                              \
+    fmap_foreach((fmap *)m, n, args);                                          \
+  }                                                                            \
+  cn *cn##_filter(cn *m, _pred p, void *args) {                                \
+    return fmap_filter((fmap *)m, p, args);                                    \
+  }                                                                            \
+  kvpair cn##_find_one(cn *m, _pred p, void *args) {                           \
+    return fmap_find_one((fmap *)m, p, args);                                  \
+  }
+
+/* Same as FMAP_TYPE_IMPL_HASH, keys hashed with hash_bytes. */
+#define FMAP_TYPE_IMPL(cn, keyty, ty)                                          \
+  FMAP_TYPE_IMPL_HASH(cn, keyty, ty, hash_bytes)
+
+/* =========================================================================
+  Section: Concurrent Map
+========================================================================= */
+typedef struct cmap_shard cmap_shard;
+
+/* A map_* per shard, the high bits of a key's hash pick the shard and the low
+   bits its slot within it. Every shard has its own lock and stalloc, so
+   writers to different shards never meet. */
+typedef struct cmap cmap;
+struct cmap {
+  int64_t     __el_size;  /* The size of a element */
+  int64_t     __key_size; /* The size of a key */
+  int32_t     shard_bits; /* log2 of the shard count */
+  _hash       hasher;
+  cmap_shard *shards;
+};
+
+/* Container Operations
+   shards is rounded up to a power of two, 0 means CMAP_DEFAULT_SHARDS.
+   initial_size is split between them. cmap_load is a snapshot that may be
+   stale already. cmap_reclaim frees the tables shards grew out of, which
+   readers may still be probing, so only call it while none can be. cmap_free
+   does it as well. */
+cmap   *__cmap_init(cmap *m, int64_t el_size, int64_t key_size, int32_t shards,
+                    int64_t initial_size, _hash hasher);
+void    cmap_free(cmap *m);
+void    cmap_clear(cmap *m);
+int64_t cmap_load(cmap *m);
+void    cmap_reclaim(cmap *m);
+
+/* Element Operations
+   Safe from any number of threads at once. cmap_get copies the value to out
+   (if not NULL) and returns whether the key was there. Reads never lock and
+   never block a writer, one overlapping a write to its shard retries. */
+bool cmap_get(cmap *m, void *key, void *out);
+bool cmap_has(cmap *m, void *key);
+void cmap_put(cmap *m, void *key, void *value);
+void cmap_del(cmap *m, void *key);
+
+/* Functional Operations
+   Visits each shard under its lock, n gets a kvpair as with map_foreach and
+   must not write to m. */
+void cmap_foreach(cmap *m, _each n, void *args);
+
+/* Concurrent Map Type Interface */
+#define CMAP_TYPEDEC(cn, keyty, ty)                                            \
+  typedef cmap cn;                                                             \
+                                                                               \
+  cn     *cn##_init(cn *m, int32_t shards, int64_t initial_size);              \
+  void    cn##_free(cn *m);                                                    \
+  void    cn##_clear(cn *m);                                                   \
+  int64_t cn##_load(cn *m);                                                    \
+  void    cn##_reclaim(cn *m);                                                 \
+                                                                               \
+  bool cn##_get(cn *m, keyty *key, ty *out);                                   \
+  bool cn##_has(cn *m, keyty *key);                                            \
+  void cn##_put(cn *m, keyty *key, ty *value);                                 \
+  void cn##_del(cn *m, keyty *key);                                            \
+  void cn##_foreach(cn *m, _each n, void *args);
+
+/* Typed concurrent map whose keys are hashed by `hasher`, see Utilities. */
+#define CMAP_TYPE_IMPL_HASH(cn, keyty, ty, hasher)                             \
+  typedef cmap cn;                                                             \
+                                                                               \
+  cn *cn##_init(cn *m, int32_t shards, int64_t initial_size) {                 \
+    return __cmap_init((cmap *)m, sizeof(ty), sizeof(keyty), shards,           \
+                       initial_size, hasher);                                  \
+  }                                                                            \
+  void    cn##_free(cn *m) { cmap_free((cmap *)m); }                           \
+  void    cn##_clear(cn *m) { cmap_clear((cmap *)m); }                         \
+  int64_t cn##_load(cn *m) { return cmap_load((cmap *)m); }                    \
+  void    cn##_reclaim(cn *m) { cmap_reclaim((cmap *)m); }                     \
+                                                                               \
+  bool cn##_get(cn *m, keyty *key, ty *out) {                                  \
+    return cmap_get((cmap *)m, key, out);                                      \
+  }                                                                            \
+  bool cn##_has(cn *m, keyty *key) { return cmap_has((cmap *)m, key); }        \
+  void cn##_put(cn *m, keyty *key, ty *value) {                                \
+    cmap_put((cmap *)m, key, value);                                           \
+  }                                                                            \
+  void cn##_del(cn *m, keyty *key) { cmap_del((cmap *)m, key); }               \
+  void cn##_foreach(cn *m, _each n, void *args) {                              \
+    cmap_foreach((cmap *)m, n, args);                                          \
   }
 
+/* Same as CMAP_TYPE_IMPL_HASH, keys hashed with hash_bytes. */
+#define CMAP_TYPE_IMPL(cn, keyty, ty)                                          \
+  CMAP_TYPE_IMPL_HASH(cn, keyty, ty, hash_bytes)
+
 /* =========================================================================
   Section: Set
 ========================================================================= */
 typedef struct set set;
 struct set {
   map internals; /* A set is just an open address map. */
+  vec dense;     /* SET_SPARSE only, the members packed together. */
+  vec sparse;    /* SET_SPARSE only, member id to its index in dense. */
+  vec bits;      /* SET_BITSET only, bit i is set while id i is a member. */
 };
 
+/* Sparse and bitset sets take integer keys of up to 8 bytes and cost memory
+   in proportion to the largest id stored, not the member count. Bitsets
+   intersect and union whole words at a time when both sides are bitsets. */
+#define SET_SPARSE (1 << 3)
+#define SET_BITSET (1 << 4)
+
 /* Container Operations */
 set    *__set_init(set *s, int64_t el_size, stalloc *alloc, int32_t flags,
                    int64_t initial_size);
@@ -459,6 +1238,16 @@ int64_t set_length(set *s);
 
 set *set_intersect(set *a, set *b, set *out);
 set *set_union(set *a, set *b, set *out);
+set *set_intersect_into(set *a, set *b); /* a becomes a & b */
+set *set_union_into(set *a, set *b);     /* a becomes a | b */
+void set_foreach(set *s, _each n, void *args);
+
+/* Walks the members like map_next, copying each key out. */
+bool set_next(set *s, int64_t *cursor, void *key);
+
+/* Snapshots in every layout, see vec_save. Hashed sets use hash_bytes. */
+bool set_save(set *s, int fd);
+set *set_mmap_open(set *s, const char *path, stalloc *alloc);
 
 /* Element Operations */
 void set_put(set *s, void *key);
@@ -477,29 +1266,37 @@ void set_del(set *s, void *key);
   void    cn##_clear(cn *s);                                                   \
   void    cn##_copy(cn *dest, cn *src);                                        \
   int64_t cn##_length(cn *s);                                                  \
+  bool    cn##_save(cn *s, int fd);                                            \
+  cn     *cn##_mmap_open(cn *s, const char *path, stalloc *alloc);             \
                                                                                \
-  cn *cn##_intersect(cn *a, cn *b, cn *out);                                   \
-  cn *cn##_union(cn *a, cn *b, cn *out);                                       \
+  cn  *cn##_intersect(cn *a, cn *b, cn *out);                                  \
+  cn  *cn##_union(cn *a, cn *b, cn *out);                                      \
+  cn  *cn##_intersect_into(cn *a, cn *b);                                      \
+  cn  *cn##_union_into(cn *a, cn *b);                                          \
+  void cn##_foreach(cn *s, _each n, void *args);                               \
                                                                                \
   void cn##_put(cn *s, void *key);                                             \
   bool cn##_has(cn *s, void *key);                                             \
   void cn##_del(cn *s, void *key);
 
-#define SET_TYPE_IMPL(cn, ty)                                                  \
+/* Mode is 0 for hashed sets, SET_SPARSE or SET_BITSET, and is added to every
+   init. */
+#define __SET_TYPE_IMPL(cn, ty, mode)                                          \
   typedef set cn;                                                              \
                                                                                \
   cn *cn##_sinit(cn *s, int64_t initial_size) {                                \
-    return __set_init((set *)s, sizeof(ty), get_frame_ctx(), TO_STACK,         \
+    return __set_init((set *)s, sizeof(ty), get_frame_ctx(), TO_STACK | mode,  \
                       initial_size);                                           \
   }                                                                            \
                                                                                \
   cn *cn##_hinit(cn *s) {                                                      \
-    return __set_init((set *)s, sizeof(ty), get_frame_ctx(), TO_HEAP,          \
+    return __set_init((set *)s, sizeof(ty), get_frame_ctx(), TO_HEAP | mode,   \
                       MAP_DEFAULT_SIZE);                                       \
   }                                                                            \
                                                                                \
   cn *cn##_inita(cn *s, stalloc *alloc, int8_t flags, int64_t initial_size) {  \
-    return __set_init((set *)s, sizeof(ty), alloc, flags, initial_size);       \
+    return __set_init((set *)s, sizeof(ty), alloc, flags | mode,               \
+                      initial_size);                                           \
   }                                                                            \
                                                                                \
   /* Container Operations */                                                   \
@@ -507,18 +1304,783 @@ void set_del(set *s, void *key);
   void    cn##_clear(cn *s) { set_clear((set *)s); }                           \
   void    cn##_copy(cn *dest, cn *src) { set_copy((set *)dest, (set *)src); }  \
   int64_t cn##_length(cn *s) { return set_length((set *)s); }                  \
+  bool    cn##_save(cn *s, int fd) { return set_save((set *)s, fd); }          \
+  cn *cn##_mmap_open(cn *s, const char *path, stalloc *alloc) {                \
+    if (!set_mmap_open((set *)s, path, alloc)) return NULL;                    \
+    if ((s->internals.flags & (SET_SPARSE | SET_BITSET)) == mode &&            \
+        s->internals.__key_size == sizeof(ty))                                 \
+      return s;                                                                \
+    set_free((set *)s);                                                        \
+    return NULL;                                                               \
+  }                                                                            \
                                                                                \
   cn *cn##_intersect(cn *a, cn *b, cn *out) {                                  \
     return (cn *)set_intersect((set *)a, (set *)b, (set *)out);                \
   }                                                                            \
   cn *cn##_union(cn *a, cn *b, cn *out) {                                      \
     return (cn *)set_union((set *)a, (set *)b, (set *)out);                    \
+  }                                                                            \
+  cn *cn##_intersect_into(cn *a, cn *b) {                                      \
+    return (cn *)set_intersect_into((set *)a, (set *)b);                       \
+  }                                                                            \
+  cn *cn##_union_into(cn *a, cn *b) {                                          \
+    return (cn *)set_union_into((set *)a, (set *)b);                           \
+  }                                                                            \
+  void cn##_foreach(cn *s, _each n, void *args) {                              \
+    set_foreach((set *)s, n, args);                                            \
   }                                                                            \
                                                                                \
   void cn##_put(cn *s, void *key) { set_put((set *)s, key); }                  \
   bool cn##_has(cn *s, void *key) { return set_has((set *)s, key); };          \
   void cn##_del(cn *s, void *key) { set_del((set *)s, key); }
 
+#define SET_TYPE_IMPL(cn, ty) __SET_TYPE_IMPL(cn, ty, 0)
+#define SPARSE_SET_TYPE_IMPL(cn, ty) __SET_TYPE_IMPL(cn, ty, SET_SPARSE)
+#define BITSET_SET_TYPE_IMPL(cn, ty) __SET_TYPE_IMPL(cn, ty, SET_BITSET)
+
+/* =========================================================================
+  Section: Structure of Arrays
+========================================================================= */
+#define SOA_MAX_COLUMNS 16
+
+typedef struct soa soa;
+struct soa {
+  int64_t  length, __size; /* Rows in use and rows allocated, every column. */
+  int32_t  flags;
+  int32_t  cache_counter; /* Increments each resize for invalidation checks. */
+  int32_t  columns;
+  int64_t  el_sizes[SOA_MAX_COLUMNS];
+  void    *column[SOA_MAX_COLUMNS]; /* Each starts a cache line in block */
+  void    *block;                   /* One allocation holding every column. */
+  stalloc *allocator;
+};
+
+/* Container Operations */
+soa    *__soa_init(soa *s, int32_t columns, int64_t *el_sizes, stalloc *alloc,
+                   int32_t flags, int64_t initial_size);
+void    soa_free(soa *s);
+void    soa_clear(soa *s);
+void    soa_resize(soa *s, int64_t rows);
+void    soa_reserve(soa *s, int64_t capacity);
+int64_t soa_length(soa *s);
+
+/* Element Operations
+   soa_column returns a column as a contiguous array, valid until the next
+   resize. soa_push appends a zeroed row (unless ALLOC_UNINIT) and returns
+   its index. */
+void   *soa_column(soa *s, int32_t col);
+void   *soa_at(soa *s, int32_t col, int64_t row);
+int64_t soa_push(soa *s);
+void    soa_pop(soa *s);
+void    soa_delete_at(soa *s, int64_t row);
+void    soa_swap(soa *s, int64_t row1, int64_t row2);
+
+/* Functional Operations
+   Callbacks get a row as an array of pointers, one per column. */
+int64_t soa_count_if(soa *s, _pred p, void *args);
+soa    *soa_filter(soa *s, _pred p, void *args);
+void    soa_foreach(soa *s, _each n, void *args);
+
+/* The typed wrappers take their fields as (name, type) pairs, up to
+   SOA_MAX_COLUMNS of them:
+
+     SOA_TYPE_IMPL(particles, (x, float), (y, float), (alive, bool));
+
+   which generates the columns `float *particles_x(particles *s)` and so on,
+   a `particles_el` struct holding one value per field for push/get/set, and a
+   `particles_row` struct holding one pointer per field. Functional callbacks
+   are passed a `particles_row *`, so they read as
+   `feach(name, particles_row, row, { *row.x += 1; })`.
+
+   SOA_TYPEDEC declares the types and functions, SOA_TYPE_IMPL declares and
+   defines them. A translation unit that already has the SOA_TYPEDEC uses
+   SOA_TYPE_FUNCS to only emit the definitions. */
+#define __SOA_NARGS(...)                                                       \
+  __SOA_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3,   \
+               2, 1)
+#define __SOA_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13,   \
+                     _14, _15, _16, n, ...)                                    \
+  n
+#define __SOA_CAT(a, b)        __SOA_CAT_(a, b)
+#define __SOA_CAT_(a, b)       a##b
+#define __SOA_UNPACK(...)      __VA_ARGS__
+#define __SOA_APPLY(m, cn, f)  __SOA_APPLY_(m, cn, __SOA_UNPACK f)
+#define __SOA_APPLY_(m, ...)   m(__VA_ARGS__)
+#define __SOA_EACH(m, cn, ...)                                                 \
+  __SOA_CAT(__SOA_EACH_, __SOA_NARGS(__VA_ARGS__))(m, cn, __VA_ARGS__)
+
+#define __SOA_EACH_1(m, cn, f) __SOA_APPLY(m, cn, f)
+#define __SOA_EACH_2(m, cn, f, ...)                                            \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_1(m, cn, __VA_ARGS__)
+#define __SOA_EACH_3(m, cn, f, ...)                                            \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_2(m, cn, __VA_ARGS__)
+#define __SOA_EACH_4(m, cn, f, ...)                                            \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_3(m, cn, __VA_ARGS__)
+#define __SOA_EACH_5(m, cn, f, ...)                                            \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_4(m, cn, __VA_ARGS__)
+#define __SOA_EACH_6(m, cn, f, ...)                                            \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_5(m, cn, __VA_ARGS__)
+#define __SOA_EACH_7(m, cn, f, ...)                                            \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_6(m, cn, __VA_ARGS__)
+#define __SOA_EACH_8(m, cn, f, ...)                                            \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_7(m, cn, __VA_ARGS__)
+#define __SOA_EACH_9(m, cn, f, ...)                                            \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_8(m, cn, __VA_ARGS__)
+#define __SOA_EACH_10(m, cn, f, ...)                                           \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_9(m, cn, __VA_ARGS__)
+#define __SOA_EACH_11(m, cn, f, ...)                                           \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_10(m, cn, __VA_ARGS__)
+#define __SOA_EACH_12(m, cn, f, ...)                                           \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_11(m, cn, __VA_ARGS__)
+#define __SOA_EACH_13(m, cn, f, ...)                                           \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_12(m, cn, __VA_ARGS__)
+#define __SOA_EACH_14(m, cn, f, ...)                                           \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_13(m, cn, __VA_ARGS__)
+#define __SOA_EACH_15(m, cn, f, ...)                                           \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_14(m, cn, __VA_ARGS__)
+#define __SOA_EACH_16(m, cn, f, ...)                                           \
+  __SOA_APPLY(m, cn, f) __SOA_EACH_15(m, cn, __VA_ARGS__)
+
+/* Pieces expanded once per field by __SOA_EACH. */
+#define __SOA_COLUMN_ID(cn, name, ty)   cn##_col_##name,
+#define __SOA_VALUE(cn, name, ty)       ty name;
+#define __SOA_POINTER(cn, name, ty)     ty *name;
+#define __SOA_SIZE(cn, name, ty)        sizeof(ty),
+#define __SOA_COLUMN_DEC(cn, name, ty)  ty *cn##_##name(cn *s);
+#define __SOA_COLUMN_IMPL(cn, name, ty)                                        \
+  ty *cn##_##name(cn *s) { return soa_column((soa *)s, cn##_col_##name); }
+#define __SOA_SCATTER(cn, name, ty)                                            \
+  ((ty *)s->column[cn##_col_##name])[row] = el->name;
+#define __SOA_GATHER(cn, name, ty)                                             \
+  el.name = ((ty *)s->column[cn##_col_##name])[row];
+#define __SOA_VIEW(cn, name, ty)                                               \
+  view.name = (ty *)s->column[cn##_col_##name] + row;
+
+#define SOA_TYPEDEC(cn, ...)                                                   \
+  typedef soa cn;                                                              \
+  enum { __SOA_EACH(__SOA_COLUMN_ID, cn, __VA_ARGS__) cn##_columns };          \
+  typedef struct cn##_el  cn##_el;                                             \
+  typedef struct cn##_row cn##_row;                                            \
+  struct cn##_el {                                                             \
+    __SOA_EACH(__SOA_VALUE, cn, __VA_ARGS__)                                   \
+  };                                                                           \
+  struct cn##_row {                                                            \
+    __SOA_EACH(__SOA_POINTER, cn, __VA_ARGS__)                                 \
+  };                                                                           \
+                                                                               \
+  cn *cn##_sinit(cn *s, int64_t initial_size);                                 \
+  cn *cn##_hinit(cn *s);                                                       \
+  cn *cn##_inita(cn *s, stalloc *alloc, int8_t flags, int64_t initial_size);   \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *s);                                                    \
+  void    cn##_clear(cn *s);                                                   \
+  void    cn##_resize(cn *s, int64_t rows);                                    \
+  void    cn##_reserve(cn *s, int64_t capacity);                               \
+  int64_t cn##_length(cn *s);                                                  \
+                                                                               \
+  /* Element Operations */                                                     \
+  __SOA_EACH(__SOA_COLUMN_DEC, cn, __VA_ARGS__)                                \
+  int64_t  cn##_push(cn *s, cn##_el *el);                                      \
+  cn##_el  cn##_get(cn *s, int64_t row);                                       \
+  void     cn##_set(cn *s, int64_t row, cn##_el *el);                          \
+  cn##_row cn##_at(cn *s, int64_t row);                                        \
+  void     cn##_pop(cn *s);                                                    \
+  void     cn##_delete_at(cn *s, int64_t row);                                 \
+  void     cn##_swap(cn *s, int64_t row1, int64_t row2);                       \
+                                                                               \
+  /* Functional Operations */                                                  \
+  int64_t cn##_count_if(cn *s, _pred p, void *args);                           \
+  cn     *cn##_filter(cn *s, _pred p, void *args);                             \
+  void    cn##_foreach(cn *s, _each n, void *args);
+
+#define SOA_TYPE_FUNCS(cn, ...)                                                \
+  cn *cn##_inita(cn *s, stalloc *alloc, int8_t flags, int64_t initial_size) {  \
+    _Static_assert(cn##_columns <= SOA_MAX_COLUMNS, "Too many soa fields");    \
+    /* The row view is handed to callbacks as an array of pointers. */         \
+    _Static_assert(sizeof(cn##_row) == cn##_columns * sizeof(void *),          \
+                   "Unexpected row layout");                                   \
+    int64_t sizes[] = {__SOA_EACH(__SOA_SIZE, cn, __VA_ARGS__)};               \
+    return __soa_init((soa *)s, cn##_columns, sizes, alloc, flags,             \
+                      initial_size);                                           \
+  }                                                                            \
+  cn *cn##_sinit(cn *s, int64_t initial_size) {                                \
+    return cn##_inita(s, get_frame_ctx(), TO_STACK, initial_size);             \
+  }                                                                            \
+  cn *cn##_hinit(cn *s) {                                                      \
+    return cn##_inita(s, get_frame_ctx(), TO_HEAP, VECTOR_DEFAULT_SIZE);       \
+  }                                                                            \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *s) { soa_free((soa *)s); }                             \
+  void    cn##_clear(cn *s) { soa_clear((soa *)s); }                           \
+  void    cn##_resize(cn *s, int64_t rows) { soa_resize((soa *)s, rows); }     \
+  int64_t cn##_length(cn *s) { return soa_length((soa *)s); }                  \
+  void    cn##_reserve(cn *s, int64_t capacity) {                              \
+    soa_reserve((soa *)s, capacity);                                           \
+  }                                                                            \
+                                                                               \
+  /* Element Operations */                                                     \
+  __SOA_EACH(__SOA_COLUMN_IMPL, cn, __VA_ARGS__)                               \
+  int64_t cn##_push(cn *s, cn##_el *el) {                                      \
+    soa_reserve((soa *)s, s->length + 1);                                      \
+    int64_t row = s->length++;                                                 \
+    __SOA_EACH(__SOA_SCATTER, cn, __VA_ARGS__)                                 \
+    return row;                                                                \
+  }                                                                            \
+  cn##_el cn##_get(cn *s, int64_t row) {                                       \
+    assert(row >= 0 && row < s->length);                                       \
+    cn##_el el;                                                                \
+    __SOA_EACH(__SOA_GATHER, cn, __VA_ARGS__)                                  \
+    return el;                                                                 \
+  }                                                                            \
+  void cn##_set(cn *s, int64_t row, cn##_el *el) {                             \
+    assert(row >= 0 && row < s->length);                                       \
+    __SOA_EACH(__SOA_SCATTER, cn, __VA_ARGS__)                                 \
+  }                                                                            \
+  cn##_row cn##_at(cn *s, int64_t row) {                                       \
+    assert(row >= 0 && row < s->length);                                       \
+    cn##_row view;                                                             \
+    __SOA_EACH(__SOA_VIEW, cn, __VA_ARGS__)                                    \
+    return view;                                                               \
+  }                                                                            \
+  void cn##_pop(cn *s) { soa_pop((soa *)s); }                                  \
+  void cn##_delete_at(cn *s, int64_t row) { soa_delete_at((soa *)s, row); }    \
+  void cn##_swap(cn *s, int64_t row1, int64_t row2) {                          \
+    soa_swap((soa *)s, row1, row2);                                            \
+  }                                                                            \
+                                                                               \
+  /* Functional Operations */                                                  \
+  int64_t cn##_count_if(cn *s, _pred p, void *args) {                          \
+    return soa_count_if((soa *)s, p, args);                                    \
+  }                                                                            \
+  cn *cn##_filter(cn *s, _pred p, void *args) {                                \
+    return soa_filter((soa *)s, p, args);                                      \
+  }                                                                            \
+  void cn##_foreach(cn *s, _each n, void *args) {                              \
+    soa_foreach((soa *)s, n, args);                                            \
+  }
+
+#define SOA_TYPE_IMPL(cn, ...)                                                 \
+  SOA_TYPEDEC(cn, __VA_ARGS__)                                                 \
+  SOA_TYPE_FUNCS(cn, __VA_ARGS__)
+
+/* =========================================================================
+  Section: Heap
+========================================================================= */
+typedef struct heap heap;
+struct heap {
+  vec      elements;     /* HEAP_ARITY-ary heap order, the top at 0. */
+  vec      handle_at;    /* The handle of each element, alongside elements. */
+  vec      index_of;     /* Where each handle's element is, -1 once popped. */
+  vec      free_handles; /* Popped handles waiting to be handed out again. */
+  _compare cmp;          /* True when a must be popped before b. */
+  void    *args;
+};
+
+/* Container Operations
+   heap_from_vec copies src into a new heap on src's allocator and flags,
+   ordering it in O(n). */
+heap   *__heap_init(heap *h, int64_t el_size, _compare cmp, void *args,
+                    stalloc *alloc, int32_t flags, int64_t initial_size);
+heap   *heap_from_vec(heap *h, vec *src, _compare cmp, void *args);
+void    heap_free(heap *h);
+void    heap_clear(heap *h);
+int64_t heap_length(heap *h);
+
+/* Element Operations
+   heap_push returns a handle that stays with the element until it is popped
+   and may be reused after. heap_pop copies the top into out when out is not
+   NULL. heap_decrease_key replaces the element with one that cmp does not
+   order after it. */
+int64_t heap_push(heap *h, void *el);
+void    heap_pop(heap *h, void *out);
+void   *heap_peek(heap *h);
+bool    heap_contains(heap *h, int64_t handle);
+void   *heap_get(heap *h, int64_t handle);
+void    heap_decrease_key(heap *h, int64_t handle, void *el);
+
+#define HEAP_TYPEDEC(cn, ty)                                                   \
+  typedef heap cn;                                                             \
+                                                                               \
+  cn *cn##_sinit(cn *h, int64_t initial_size);                                 \
+  cn *cn##_hinit(cn *h);                                                       \
+  cn *cn##_inita(cn *h, stalloc *alloc, int8_t flags, int64_t initial_size);   \
+  cn *cn##_from_vec(cn *h, vec *src);                                          \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *h);                                                    \
+  void    cn##_clear(cn *h);                                                   \
+  int64_t cn##_length(cn *h);                                                  \
+                                                                               \
+  /* Element Operations */                                                     \
+  int64_t cn##_push(cn *h, ty *el);                                            \
+  void    cn##_pop(cn *h, ty *out);                                            \
+  ty     *cn##_peek(cn *h);                                                    \
+  bool    cn##_contains(cn *h, int64_t handle);                                \
+  ty     *cn##_get(cn *h, int64_t handle);                                     \
+  void    cn##_decrease_key(cn *h, int64_t handle, ty *el);
+
+/* `cmp` is a `_compare` (see `compare`) called with NULL args, true when its
+   first argument must be popped first. A `<` comparison gives a min heap. */
+#define HEAP_TYPE_IMPL(cn, ty, cmp)                                            \
+  typedef heap cn;                                                             \
+                                                                               \
+  cn *cn##_sinit(cn *h, int64_t initial_size) {                                \
+    return __heap_init((heap *)h, sizeof(ty), cmp, NULL, get_frame_ctx(),      \
+                       TO_STACK, initial_size);                                \
+  }                                                                            \
+  cn *cn##_hinit(cn *h) {                                                      \
+    return __heap_init((heap *)h, sizeof(ty), cmp, NULL, get_frame_ctx(),      \
+                       TO_HEAP, VECTOR_DEFAULT_SIZE);                          \
+  }                                                                            \
+  cn *cn##_inita(cn *h, stalloc *alloc, int8_t flags, int64_t initial_size) {  \
+    return __heap_init((heap *)h, sizeof(ty), cmp, NULL, alloc, flags,         \
+                       initial_size);                                          \
+  }                                                                            \
+  cn *cn##_from_vec(cn *h, vec *src) {                                         \
+    assert(src->__el_size == sizeof(ty));                                      \
+    return heap_from_vec((heap *)h, src, cmp, NULL);                           \
+  }                                                                            \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *h) { heap_free((heap *)h); }                           \
+  void    cn##_clear(cn *h) { heap_clear((heap *)h); }                         \
+  int64_t cn##_length(cn *h) { return heap_length((heap *)h); }                \
+                                                                               \
+  /* Element Operations */                                                     \
+  int64_t cn##_push(cn *h, ty *el) { return heap_push((heap *)h, el); }        \
+  void    cn##_pop(cn *h, ty *out) { heap_pop((heap *)h, out); }               \
+  ty     *cn##_peek(cn *h) { return heap_peek((heap *)h); }                    \
+  bool    cn##_contains(cn *h, int64_t handle) {                               \
+    return heap_contains((heap *)h, handle);                                   \
+  }                                                                            \
+  ty  *cn##_get(cn *h, int64_t handle) { return heap_get((heap *)h, handle); } \
+  void cn##_decrease_key(cn *h, int64_t handle, ty *el) {                      \
+    heap_decrease_key((heap *)h, handle, el);                                  \
+  }
+
+/* =========================================================================
+  Section: Stack
+========================================================================= */
+typedef struct stack stack;
+struct stack {
+  vec elements; /* A stack is a vec that only grows and shrinks at the top. */
+};
+
+/* Container Operations */
+stack  *__stack_init(stack *s, int64_t el_size, stalloc *alloc, int32_t flags,
+                     int64_t initial_size);
+void    stack_free(stack *s);
+void    stack_clear(stack *s);
+stack  *stack_copy(stack *dest, stack *src);
+int64_t stack_length(stack *s);
+
+/* Element Operations
+   stack_pop copies the top into out when out is not NULL, stack_peek returns
+   NULL on an empty stack. */
+void  stack_push(stack *s, void *el);
+void  stack_pop(stack *s, void *out);
+void *stack_peek(stack *s);
+
+#define STACK_TYPEDEC(cn, ty)                                                  \
+  typedef stack cn;                                                            \
+                                                                               \
+  cn *cn##_sinit(cn *s, int64_t initial_size);                                 \
+  cn *cn##_hinit(cn *s);                                                       \
+  cn *cn##_inita(cn *s, stalloc *alloc, int8_t flags, int64_t initial_size);   \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *s);                                                    \
+  void    cn##_clear(cn *s);                                                   \
+  cn     *cn##_copy(cn *dest, cn *src);                                        \
+  int64_t cn##_length(cn *s);                                                  \
+                                                                               \
+  /* Element Operations */                                                     \
+  void cn##_push(cn *s, ty *el);                                               \
+  void cn##_pop(cn *s, ty *out);                                               \
+  ty  *cn##_peek(cn *s);
+
+#define STACK_TYPE_IMPL(cn, ty)                                                \
+  typedef stack cn;                                                            \
+                                                                               \
+  cn *cn##_sinit(cn *s, int64_t initial_size) {                                \
+    return __stack_init((stack *)s, sizeof(ty), get_frame_ctx(), TO_STACK,     \
+                        initial_size);                                         \
+  }                                                                            \
+  cn *cn##_hinit(cn *s) {                                                      \
+    return __stack_init((stack *)s, sizeof(ty), get_frame_ctx(), TO_HEAP,      \
+                        STACK_DEFAULT_SIZE);                                   \
+  }                                                                            \
+  cn *cn##_inita(cn *s, stalloc *alloc, int8_t flags, int64_t initial_size) {  \
+    return __stack_init((stack *)s, sizeof(ty), alloc, flags, initial_size);   \
+  }                                                                            \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *s) { stack_free((stack *)s); }                         \
+  void    cn##_clear(cn *s) { stack_clear((stack *)s); }                       \
+  cn     *cn##_copy(cn *dest, cn *src) { return stack_copy(dest, src); }       \
+  int64_t cn##_length(cn *s) { return stack_length((stack *)s); }              \
+                                                                               \
+  /* Element Operations */                                                     \
+  void cn##_push(cn *s, ty *el) { stack_push((stack *)s, el); }                \
+  void cn##_pop(cn *s, ty *out) { stack_pop((stack *)s, out); }                \
+  ty  *cn##_peek(cn *s) { return stack_peek((stack *)s); }
+
+/* =========================================================================
+  Section: Queue
+========================================================================= */
+typedef struct queue queue;
+struct queue {
+  vec     elements; /* The ring, its length is a power of two. */
+  int64_t head;     /* Slot of the front element. */
+  int64_t count;    /* Elements in the ring. */
+};
+
+/* Container Operations */
+queue  *__queue_init(queue *q, int64_t el_size, stalloc *alloc, int32_t flags,
+                     int64_t initial_size);
+void    queue_free(queue *q);
+void    queue_clear(queue *q);
+queue  *queue_copy(queue *dest, queue *src);
+int64_t queue_length(queue *q);
+
+/* Element Operations
+   Pushes go to the back and pops come from the front, both O(1). queue_pop
+   copies the front into out when out is not NULL, queue_peek returns NULL on
+   an empty queue and queue_at(q, 0) is the front. */
+void  queue_push(queue *q, void *el);
+void  queue_pop(queue *q, void *out);
+void *queue_peek(queue *q);
+void *queue_at(queue *q, int64_t i);
+
+#define QUEUE_TYPEDEC(cn, ty)                                                  \
+  typedef queue cn;                                                            \
+                                                                               \
+  cn *cn##_sinit(cn *q, int64_t initial_size);                                 \
+  cn *cn##_hinit(cn *q);                                                       \
+  cn *cn##_inita(cn *q, stalloc *alloc, int8_t flags, int64_t initial_size);   \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *q);                                                    \
+  void    cn##_clear(cn *q);                                                   \
+  cn     *cn##_copy(cn *dest, cn *src);                                        \
+  int64_t cn##_length(cn *q);                                                  \
+                                                                               \
+  /* Element Operations */                                                     \
+  void cn##_push(cn *q, ty *el);                                               \
+  void cn##_pop(cn *q, ty *out);                                               \
+  ty  *cn##_peek(cn *q);                                                       \
+  ty  *cn##_at(cn *q, int64_t i);
+
+#define QUEUE_TYPE_IMPL(cn, ty)                                                \
+  typedef queue cn;                                                            \
+                                                                               \
+  cn *cn##_sinit(cn *q, int64_t initial_size) {                                \
+    return __queue_init((queue *)q, sizeof(ty), get_frame_ctx(), TO_STACK,     \
+                        initial_size);                                         \
+  }                                                                            \
+  cn *cn##_hinit(cn *q) {                                                      \
+    return __queue_init((queue *)q, sizeof(ty), get_frame_ctx(), TO_HEAP,      \
+                        STACK_DEFAULT_SIZE);                                   \
+  }                                                                            \
+  cn *cn##_inita(cn *q, stalloc *alloc, int8_t flags, int64_t initial_size) {  \
+    return __queue_init((queue *)q, sizeof(ty), alloc, flags, initial_size);   \
+  }                                                                            \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *q) { queue_free((queue *)q); }                         \
+  void    cn##_clear(cn *q) { queue_clear((queue *)q); }                       \
+  cn     *cn##_copy(cn *dest, cn *src) { return queue_copy(dest, src); }       \
+  int64_t cn##_length(cn *q) { return queue_length((queue *)q); }              \
+                                                                               \
+  /* Element Operations */                                                     \
+  void cn##_push(cn *q, ty *el) { queue_push((queue *)q, el); }                \
+  void cn##_pop(cn *q, ty *out) { queue_pop((queue *)q, out); }                \
+  ty  *cn##_peek(cn *q) { return queue_peek((queue *)q); }                     \
+  ty  *cn##_at(cn *q, int64_t i) { return queue_at((queue *)q, i); }
+
+/* Lock free bounded queues for passing elements between threads. Their slots
+   are allocated with halloc on alloc and the capacity is rounded up to a
+   power of two. Pushing to a full queue or popping from an empty one returns
+   false and does nothing. Lengths are a snapshot that may be stale already.
+
+   spsc allows exactly one thread pushing and one thread popping, mpmc allows
+   any number of each. */
+typedef struct spsc spsc;
+struct spsc {
+  _Alignas(CACHE_LINE_SIZE) _Atomic int64_t head; /* Consumer owned. */
+  int64_t tail_cache;                             /* Consumer's view of tail */
+  _Alignas(CACHE_LINE_SIZE) _Atomic int64_t tail; /* Producer owned. */
+  int64_t head_cache;                             /* Producer's view of head */
+  _Alignas(CACHE_LINE_SIZE) int64_t mask;
+  int64_t  el_size;
+  void    *slots;
+  stalloc *allocator;
+};
+
+typedef struct mpmc mpmc;
+struct mpmc {
+  _Alignas(CACHE_LINE_SIZE) _Atomic int64_t enqueue_pos;
+  _Alignas(CACHE_LINE_SIZE) _Atomic int64_t dequeue_pos;
+  _Alignas(CACHE_LINE_SIZE) int64_t mask;
+  int64_t  el_size;
+  int64_t  stride; /* Bytes per cell, its sequence number then the element. */
+  void    *cells;
+  stalloc *allocator;
+};
+
+spsc   *__spsc_init(spsc *q, int64_t el_size, stalloc *alloc,
+                    int64_t capacity);
+void    spsc_free(spsc *q);
+bool    spsc_push(spsc *q, void *el);
+bool    spsc_pop(spsc *q, void *out);
+int64_t spsc_length(spsc *q);
+
+mpmc   *__mpmc_init(mpmc *q, int64_t el_size, stalloc *alloc,
+                    int64_t capacity);
+void    mpmc_free(mpmc *q);
+bool    mpmc_push(mpmc *q, void *el);
+bool    mpmc_pop(mpmc *q, void *out);
+int64_t mpmc_length(mpmc *q);
+
+/* kind is spsc or mpmc. */
+#define CONCURRENT_QUEUE_TYPEDEC(cn, kind, ty)                                 \
+  typedef kind cn;                                                             \
+                                                                               \
+  cn     *cn##_init(cn *q, stalloc *alloc, int64_t capacity);                  \
+  void    cn##_free(cn *q);                                                    \
+  bool    cn##_push(cn *q, ty *el);                                            \
+  bool    cn##_pop(cn *q, ty *out);                                            \
+  int64_t cn##_length(cn *q);
+
+#define CONCURRENT_QUEUE_TYPE_IMPL(cn, kind, ty)                               \
+  typedef kind cn;                                                             \
+                                                                               \
+  cn *cn##_init(cn *q, stalloc *alloc, int64_t capacity) {                     \
+    return __##kind##_init((kind *)q, sizeof(ty), alloc, capacity);            \
+  }                                                                            \
+  void    cn##_free(cn *q) { kind##_free((kind *)q); }                         \
+  bool    cn##_push(cn *q, ty *el) { return kind##_push((kind *)q, el); }      \
+  bool    cn##_pop(cn *q, ty *out) { return kind##_pop((kind *)q, out); }      \
+  int64_t cn##_length(cn *q) { return kind##_length((kind *)q); }
+
+/* =========================================================================
+  Section: Graph
+========================================================================= */
+typedef struct graph graph;
+struct graph {
+  vec vertices; /* The data stored for each vertex, indexed by vertex id. */
+  vec edges;    /* The builder, edges in the order they were added. */
+
+  /* Compressed sparse row form of edges, rebuilt by graph_compile. */
+  vec offsets; /* vertex count + 1, v's edges start at offsets[v] */
+  vec targets; /* target vertex of each edge */
+  vec weights; /* weight of each edge, alongside targets */
+
+  int32_t  flags;
+  bool     dirty; /* The builder changed since the last compile. */
+  stalloc *allocator;
+};
+
+/* Estimates the cost left from vertex to goal for a_star. Both point at
+   vertex data. Never overestimate it, or the path found may not be the
+   cheapest. */
+typedef double (*_heuristic)(void *vertex, void *goal, void *args);
+
+/* Container Operations */
+graph  *__graph_init(graph *g, int64_t vertex_size, stalloc *alloc,
+                     int32_t flags, int64_t initial_size);
+void    graph_free(graph *g);
+void    graph_clear(graph *g);
+int64_t graph_vertices(graph *g);
+int64_t graph_edges(graph *g);
+
+/* Builder Operations
+   Vertex ids are handed out in order from 0. Adding or removing an edge
+   marks the graph dirty, the next call that reads neighbors compiles it. */
+int64_t graph_add_vertex(graph *g, void *data);
+void   *graph_vertex(graph *g, int64_t v);
+void    graph_add_edge(graph *g, int64_t from, int64_t to, double weight);
+bool    graph_del_edge(graph *g, int64_t from, int64_t to);
+graph  *graph_compile(graph *g);
+
+/* Returns v's targets, count edges long, with their weights alongside. Both
+   are invalidated by the next compile. */
+int64_t *graph_neighbors(graph *g, int64_t v, int64_t *count);
+double  *graph_weights(graph *g, int64_t v);
+
+/* Searches
+   Frontiers, visited sets and open lists are pushed on alloc's current stack
+   frame and released when that frame ends, a search never touches the heap.
+   visit is passed a pointer to each vertex id as it is reached and returns
+   true to stop, bfs and dfs return whether it did.
+
+   a_star returns the cost of the cheapest path from start to goal, or -1 if
+   there is none. Weights must not be negative and a NULL heuristic makes it
+   Dijkstra. If path is not NULL it must be a vec of int64_t, which is
+   cleared and filled with the vertices from start to goal. */
+bool   bfs(graph *g, int64_t start, _pred visit, void *args, stalloc *alloc);
+bool   dfs(graph *g, int64_t start, _pred visit, void *args, stalloc *alloc);
+double a_star(graph *g, int64_t start, int64_t goal, _heuristic h, void *args,
+              vec *path, stalloc *alloc);
+
+#define GRAPH_TYPEDEC(cn, ty)                                                  \
+  typedef graph cn;                                                            \
+                                                                               \
+  cn *cn##_sinit(cn *g, int64_t initial_size);                                 \
+  cn *cn##_hinit(cn *g);                                                       \
+  cn *cn##_inita(cn *g, stalloc *alloc, int8_t flags, int64_t initial_size);   \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *g);                                                    \
+  void    cn##_clear(cn *g);                                                   \
+  int64_t cn##_vertices(cn *g);                                                \
+  int64_t cn##_edges(cn *g);                                                   \
+                                                                               \
+  /* Builder Operations */                                                     \
+  int64_t  cn##_add_vertex(cn *g, ty *data);                                   \
+  ty      *cn##_vertex(cn *g, int64_t v);                                      \
+  void     cn##_add_edge(cn *g, int64_t from, int64_t to, double weight);      \
+  bool     cn##_del_edge(cn *g, int64_t from, int64_t to);                     \
+  cn      *cn##_compile(cn *g);                                                \
+  int64_t *cn##_neighbors(cn *g, int64_t v, int64_t *count);                   \
+  double  *cn##_weights(cn *g, int64_t v);                                     \
+                                                                               \
+  /* Searches */                                                               \
+  bool   cn##_bfs(cn *g, int64_t start, _pred visit, void *args,               \
+                  stalloc *alloc);                                             \
+  bool   cn##_dfs(cn *g, int64_t start, _pred visit, void *args,               \
+                  stalloc *alloc);                                             \
+  double cn##_a_star(cn *g, int64_t start, int64_t goal, _heuristic h,         \
+                     void *args, vec *path, stalloc *alloc);
+
+#define GRAPH_TYPE_IMPL(cn, ty)                                                \
+  typedef graph cn;                                                            \
+                                                                               \
+  cn *cn##_sinit(cn *g, int64_t initial_size) {                                \
+    return __graph_init((graph *)g, sizeof(ty), get_frame_ctx(), TO_STACK,     \
+                        initial_size);                                         \
+  }                                                                            \
+  cn *cn##_hinit(cn *g) {                                                      \
+    return __graph_init((graph *)g, sizeof(ty), get_frame_ctx(), TO_HEAP,      \
+                        VECTOR_DEFAULT_SIZE);                                  \
+  }                                                                            \
+  cn *cn##_inita(cn *g, stalloc *alloc, int8_t flags, int64_t initial_size) {  \
+    return __graph_init((graph *)g, sizeof(ty), alloc, flags, initial_size);   \
+  }                                                                            \
+                                                                               \
+  /* Container Operations */                                                   \
+  void    cn##_free(cn *g) { graph_free((graph *)g); }                         \
+  void    cn##_clear(cn *g) { graph_clear((graph *)g); }                       \
+  int64_t cn##_vertices(cn *g) { return graph_vertices((graph *)g); }          \
+  int64_t cn##_edges(cn *g) { return graph_edges((graph *)g); }                \
+                                                                               \
+  /* Builder Operations */                                                     \
+  int64_t cn##_add_vertex(cn *g, ty *data) {                                   \
+    return graph_add_vertex((graph *)g, data);                                 \
+  }                                                                            \
+  ty *cn##_vertex(cn *g, int64_t v) { return graph_vertex((graph *)g, v); }    \
+  void cn##_add_edge(cn *g, int64_t from, int64_t to, double weight) {         \
+    graph_add_edge((graph *)g, from, to, weight);                              \
+  }                                                                            \
+  bool cn##_del_edge(cn *g, int64_t from, int64_t to) {                        \
+    return graph_del_edge((graph *)g, from, to);                               \
+  }                                                                            \
+  cn      *cn##_compile(cn *g) { return graph_compile((graph *)g); }           \
+  int64_t *cn##_neighbors(cn *g, int64_t v, int64_t *count) {                  \
+    return graph_neighbors((graph *)g, v, count);                              \
+  }                                                                            \
+  double *cn##_weights(cn *g, int64_t v) {                                     \
+    return graph_weights((graph *)g, v);                                       \
+  }                                                                            \
+                                                                               \
+  /* Searches */                                                               \
+  bool cn##_bfs(cn *g, int64_t start, _pred visit, void *args,                 \
+                stalloc *alloc) {                                              \
+    return bfs((graph *)g, start, visit, args, alloc);                         \
+  }                                                                            \
+  bool cn##_dfs(cn *g, int64_t start, _pred visit, void *args,                 \
+                stalloc *alloc) {                                              \
+    return dfs((graph *)g, start, visit, args, alloc);                         \
+  }                                                                            \
+  double cn##_a_star(cn *g, int64_t start, int64_t goal, _heuristic h,         \
+                     void *args, vec *path, stalloc *alloc) {                  \
+    return a_star((graph *)g, start, goal, h, args, path, alloc);              \
+  }
+
+/* =========================================================================
+  Section: Pipe
+========================================================================= */
+#define PIPE_MAX_STAGES 8
+
+/* A stage is a filter when p is set, otherwise a map through u. */
+typedef struct pipe_stage pipe_stage;
+struct pipe_stage {
+  _pred  p;
+  _unary u;
+  void  *args;
+};
+
+typedef struct pipeline pipeline;
+struct pipeline {
+  int32_t    source;   /* Which kind of container from points to. */
+  void      *from;     /* The vec, map or set being walked. */
+  int64_t    el_size;  /* Size of the elements leaving the last stage. */
+  int64_t    max_size; /* Largest scratch slot any stage needs. */
+  int32_t    stages;
+  pipe_stage stage[PIPE_MAX_STAGES];
+};
+
+/* Sources
+   A pipeline is a lazy view over a container. Stages are only recorded, the
+   terminal operation walks the source once pushing each element through every
+   stage, with no intermediate containers. Map sources yield kvpair elements
+   and set sources yield keys. The source must not change during the walk.
+   Walks only read it, so they may run on any thread, not just its owner's. */
+pipeline *pipe_from_vec(pipeline *p, vec *v);
+pipeline *pipe_from_map(pipeline *p, map *m);
+pipeline *pipe_from_set(pipeline *p, set *s);
+
+/* Stages
+   pipe_map may change the element type, out_size is the size of what u
+   writes (0 keeps the incoming size). */
+pipeline *pipe_filter(pipeline *p, _pred pr, void *args);
+pipeline *pipe_map(pipeline *p, _unary u, int64_t out_size, void *args);
+
+/* Terminals
+   Each runs the whole pipeline. pipe_collect pushes the survivors onto out,
+   which must hold the last stage's element type. */
+void   *pipe_fold(pipeline *p, _binary b, void *result, void *args);
+int64_t pipe_count(pipeline *p);
+void    pipe_foreach(pipeline *p, _each n, void *args);
+vec    *pipe_collect(pipeline *p, vec *out);
+
+/* =========================================================================
+  Section: Snapshot
+========================================================================= */
+/* The plumbing behind vec_save, map_save, set_save and their *_mmap_open
+   counterparts, which is where to look for the user facing side. */
+#define SNAPSHOT_HEADER_SIZE 128
+#define SNAPSHOT_SECTIONS    2
+#define SNAPSHOT_VEC         1
+#define SNAPSHOT_MAP         2
+#define SNAPSHOT_SET         3
+
+/* A container's bookkeeping and the vecs holding its elements. Saving reads
+   the section vecs, opening fills them in pointing into the mapped file. */
+struct snapshot {
+  int32_t  kind, flags, in_use_id, sections;
+  int64_t  el_size, key_size, count, tombstones;
+  uint64_t check; /* Fingerprint of the hasher of a hashed table. */
+  vec      section[SNAPSHOT_SECTIONS];
+};
+
+bool __snapshot_save(snapshot *snap, int fd);
+bool __snapshot_open(snapshot *snap, const char *path, int32_t kind,
+                     stalloc *alloc);
+void __snapshot_close(vec *first);
+
 /* =========================================================================
   Section: Cbuff
 ========================================================================= */
@@ -542,6 +2104,13 @@ void *buff_skip(cbuff *b, size_t to_skip);
 ========================================================================= */
 void     memswap(void *a, void *b, size_t size);
 void    *recalloc(void *a, size_t size);
+
+/* Hashers for maps. hash_bytes suits any key. For integer keys of up to 8
+   bytes, hash_identity uses the value itself (best for dense ids) and
+   hash_fibonacci spreads strided values with a single multiply. */
 uint64_t hash_bytes(void *ptr, size_t size);
+uint64_t hash_djb2(void *ptr, size_t size);
+uint64_t hash_identity(void *ptr, size_t size);
+uint64_t hash_fibonacci(void *ptr, size_t size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,385 @@
+/*------------------------------------------------------------------------------
+ * Flat map memory layout strategy.
+ *
+ *  ctrl     +----+----+----+----+     +----+----+----+     +----+
+ *           | h2 |EMPT| h2 |DELT| ... | h2 |EMPT| h2 | ... |copy| x GROUP
+ *           +----+----+----+----+     +----+----+----+     +----+
+ *  elements +---------+---------+     +---------+
+ *           |key|value|key|value| ... |key|value|
+ *           +---------+---------+     +---------+
+ *
+ * Every slot has one control byte, kept apart from the keys and values. A
+ * full slot stores the low 7 bits of its hash (h2), empty and deleted slots
+ * have the high bit set. The rest of the hash (h1) picks the group of slots a
+ * probe starts at. A probe loads FMAP_GROUP control bytes at once, compares
+ * them all against h2 with SSE2 or NEON, and only reads the keys that match.
+ * Groups are probed triangularly until one holds an empty slot.
+ *
+ * The first FMAP_GROUP control bytes are mirrored past the end of the table
+ * so a group load starting near the end never has to wrap.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define CTRL_EMPTY   ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+#define IS_FULL(c)   (((c) & 0x80) == 0)
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7F))
+
+/* Group matches are bitmasks with LANE_BITS bits per control byte, walked
+   with lane_next. NEON has no movemask, its narrowing shift leaves 4. */
+#if defined(__ARM_NEON) && !defined(__SSE2__)
+#define LANE_BITS 4
+#define LANE_MASK 0x8888888888888888ull
+#else
+#define LANE_BITS 1
+#define LANE_MASK 0xFFFFull
+#endif
+
+typedef uint64_t group_mask;
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void       init_asserts(fmap *m);
+static group_mask group_match(uint8_t *ctrl, uint8_t byte);
+static group_mask group_match_empty(uint8_t *ctrl);
+static group_mask group_match_free(uint8_t *ctrl);
+static int32_t    lane_next(group_mask *mask);
+static int32_t    lanes_trailing(group_mask mask);
+static int32_t    lanes_leading(group_mask mask);
+static uint8_t   *ctrl_at(fmap *m, int64_t idx);
+static void       set_ctrl(fmap *m, int64_t idx, uint8_t byte);
+static void      *slot_at(fmap *m, int64_t idx);
+static int64_t    find(fmap *m, void *key, uint64_t hash);
+static int64_t    find_free(fmap *m, uint64_t hash);
+static void      *insert_at(fmap *m, int64_t idx, void *key, uint64_t hash);
+static void       erase_at(fmap *m, int64_t idx);
+static void       maintain_load_factor(fmap *m);
+static kvpair     read_slot(fmap *m, int64_t idx);
+
+static void init_asserts(fmap *m) {
+  assert(m);
+  assert(m->allocator);
+  assert(m->ctrl.elements);
+  assert(m->elements.elements);
+}
+
+static group_mask group_match(uint8_t *ctrl, uint8_t byte) {
+#if defined(__SSE2__)
+  __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+  return (uint16_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#elif defined(__ARM_NEON)
+  uint8x16_t eq = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(byte));
+  uint8x8_t  narrow = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrow), 0) & LANE_MASK;
+#else
+  group_mask mask = 0;
+  for (int32_t i = 0; i < FMAP_GROUP; i++)
+    if (ctrl[i] == byte) mask |= (group_mask)1 << i;
+  return mask;
+#endif
+}
+
+static group_mask group_match_empty(uint8_t *ctrl) {
+  return group_match(ctrl, CTRL_EMPTY);
+}
+
+static group_mask group_match_free(uint8_t *ctrl) {
+  /* Empty and deleted are the only control bytes with the high bit set. */
+#if defined(__SSE2__)
+  return (uint16_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#elif defined(__ARM_NEON)
+  int8x16_t  group = vreinterpretq_s8_u8(vld1q_u8(ctrl));
+  uint8x16_t high = vcltq_s8(group, vdupq_n_s8(0));
+  uint8x8_t  narrow = vshrn_n_u16(vreinterpretq_u16_u8(high), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrow), 0) & LANE_MASK;
+#else
+  group_mask mask = 0;
+  for (int32_t i = 0; i < FMAP_GROUP; i++)
+    if (!IS_FULL(ctrl[i])) mask |= (group_mask)1 << i;
+  return mask;
+#endif
+}
+
+static int32_t lane_next(group_mask *mask) {
+  int32_t lane = __builtin_ctzll(*mask) / LANE_BITS;
+  *mask &= *mask - 1;
+  return lane;
+}
+
+static int32_t lanes_trailing(group_mask mask) {
+  return mask ? __builtin_ctzll(mask) / LANE_BITS : FMAP_GROUP;
+}
+
+static int32_t lanes_leading(group_mask mask) {
+  if (!mask) return FMAP_GROUP;
+  int32_t unused = 64 - FMAP_GROUP * LANE_BITS;
+  return (__builtin_clzll(mask) - unused) / LANE_BITS;
+}
+
+static uint8_t *ctrl_at(fmap *m, int64_t idx) {
+  return (uint8_t *)m->ctrl.elements + idx;
+}
+
+static void set_ctrl(fmap *m, int64_t idx, uint8_t byte) {
+  *ctrl_at(m, idx) = byte;
+  if (idx < FMAP_GROUP) *ctrl_at(m, m->__size + idx) = byte; /* Mirror */
+}
+
+static void *slot_at(fmap *m, int64_t idx) {
+  return (char *)m->elements.elements + idx * m->elements.__el_size;
+}
+
+static int64_t find(fmap *m, void *key, uint64_t hash) {
+  int64_t mask = m->__size - 1;
+  int64_t pos = H1(hash) & mask;
+  uint8_t h2 = H2(hash);
+
+  for (int64_t step = 0; step <= m->__size; step += FMAP_GROUP) {
+    pos = (pos + step) & mask;
+    uint8_t   *group = ctrl_at(m, pos);
+    group_mask match = group_match(group, h2);
+    while (match) {
+      int64_t idx = (pos + lane_next(&match)) & mask;
+      if (memcmp(slot_at(m, idx), key, m->__key_size) == 0) return idx;
+    }
+    if (group_match_empty(group)) return -1;
+  }
+  return -1;
+}
+
+static int64_t find_free(fmap *m, uint64_t hash) {
+  int64_t mask = m->__size - 1;
+  int64_t pos = H1(hash) & mask;
+
+  for (int64_t step = 0; step <= m->__size; step += FMAP_GROUP) {
+    pos = (pos + step) & mask;
+    group_mask free_slots = group_match_free(ctrl_at(m, pos));
+    if (free_slots) return (pos + lane_next(&free_slots)) & mask;
+  }
+
+  /* Map Full!!! */
+  assert(false && "Map is full, this should never happen.");
+  return -1;
+}
+
+static void *insert_at(fmap *m, int64_t idx, void *key, uint64_t hash) {
+  if (*ctrl_at(m, idx) == CTRL_DELETED) m->tombstones--;
+  set_ctrl(m, idx, H2(hash));
+  memmove(slot_at(m, idx), key, m->__key_size);
+  m->slots_in_use++;
+  return (char *)slot_at(m, idx) + m->__key_size;
+}
+
+static void erase_at(fmap *m, int64_t idx) {
+  /* If an empty slot lies within one group on both sides, no probe ever saw
+     a full group here and the slot can go straight back to empty. */
+  int64_t mask = m->__size - 1;
+  int32_t after = lanes_trailing(group_match_empty(ctrl_at(m, idx)));
+  int32_t before = lanes_leading(
+      group_match_empty(ctrl_at(m, (idx - FMAP_GROUP) & mask)));
+
+  if (after + before < FMAP_GROUP) {
+    set_ctrl(m, idx, CTRL_EMPTY);
+  } else {
+    set_ctrl(m, idx, CTRL_DELETED);
+    m->tombstones++;
+  }
+  m->slots_in_use--;
+}
+
+static void maintain_load_factor(fmap *m) {
+  if (m->slots_in_use + m->tombstones < m->__size * FMAP_LOAD_FACTOR) return;
+
+  /* Double the table, or rebuild it at the same size when deleted slots are
+     what filled it up. */
+  int64_t new_size = m->__size * 2;
+  if (m->slots_in_use < m->__size * FMAP_LOAD_FACTOR / 2) new_size = m->__size;
+
+  fmap new_map;
+  __fmap_init_hashed(&new_map, m->__el_size, m->__key_size, m->allocator,
+                     m->flags, new_size, m->hasher);
+
+  /* Reinsertion step, every key is known to be unique. */
+  for (int64_t i = 0; i < m->__size; i++) {
+    if (!IS_FULL(*ctrl_at(m, i))) continue;
+    void    *el = slot_at(m, i);
+    uint64_t hash = m->hasher(el, m->__key_size);
+    void    *value = insert_at(&new_map, find_free(&new_map, hash), el, hash);
+    memmove(value, (char *)el + m->__key_size, m->__el_size);
+  }
+
+  new_map.cache_counter = m->cache_counter + 1;
+  fmap_free(m);
+  memmove(m, &new_map, sizeof(fmap));
+}
+
+static kvpair read_slot(fmap *m, int64_t idx) {
+  kvpair kv = {0};
+  kv.key = slot_at(m, idx);
+  kv.value = (char *)kv.key + m->__key_size;
+  kv.state = IS_FULL(*ctrl_at(m, idx));
+  return kv;
+}
+
+/*-------------------------------------------------------
+ * Flat Map Implementation
+ *-------------------------------------------------------*/
+
+/* Container Operations */
+fmap *__fmap_init(fmap *m, int64_t el_size, int64_t key_size, stalloc *alloc,
+                  int32_t flags, int64_t initial_size) {
+  return __fmap_init_hashed(m, el_size, key_size, alloc, flags, initial_size,
+                            hash_bytes);
+}
+fmap *__fmap_init_hashed(fmap *m, int64_t el_size, int64_t key_size,
+                         stalloc *alloc, int32_t flags, int64_t initial_size,
+                         _hash hasher) {
+  assert(key_size > 0);
+  assert(el_size > 0);
+  assert(alloc);
+  assert(hasher);
+  m->slots_in_use = 0;
+  m->tombstones = 0;
+  m->flags = flags;
+  m->cache_counter = 0;
+  m->hasher = hasher;
+  m->allocator = alloc;
+
+  m->__size = FMAP_GROUP;
+  while (m->__size < initial_size) m->__size *= 2;
+  m->__el_size = el_size;
+  m->__key_size = key_size;
+
+  /* Control bytes are always written, so they can skip the zeroing. */
+  __vec_init(&m->ctrl, sizeof(uint8_t), alloc, flags | ALLOC_UNINIT,
+             m->__size + FMAP_GROUP);
+  vec_resize(&m->ctrl, m->__size + FMAP_GROUP);
+  memset(m->ctrl.elements, CTRL_EMPTY, m->__size + FMAP_GROUP);
+
+  __vec_init(&m->elements, key_size + el_size, alloc, flags, m->__size);
+  vec_resize(&m->elements, m->__size);
+
+  return m;
+}
+void fmap_free(fmap *m) {
+  init_asserts(m);
+  vec_free(&m->ctrl);
+  vec_free(&m->elements);
+}
+void fmap_clear(fmap *m) {
+  init_asserts(m);
+  memset(m->ctrl.elements, CTRL_EMPTY, m->__size + FMAP_GROUP);
+  m->slots_in_use = 0;
+  m->tombstones = 0;
+}
+fmap *fmap_copy(fmap *dest, fmap *src) {
+  init_asserts(src);
+  memmove(dest, src, sizeof(*src));
+  vec_copy(&dest->ctrl, &src->ctrl);
+  vec_copy(&dest->elements, &src->elements);
+  return dest;
+}
+int64_t fmap_load(fmap *m) {
+  init_asserts(m);
+  return m->slots_in_use;
+}
+
+/* Element Operations */
+kvpair fmap_get(fmap *m, void *key) {
+  init_asserts(m);
+  assert(key);
+  kvpair kv = {0};
+
+  int64_t idx = find(m, key, m->hasher(key, m->__key_size));
+  if (idx == -1) return kv;
+  return read_slot(m, idx);
+}
+void fmap_put(fmap *m, void *key, void *value) {
+  init_asserts(m);
+  assert(key);
+  assert(value);
+  memmove(fmap_get_or_insert(m, key), value, m->__el_size);
+}
+void *fmap_get_or_insert(fmap *m, void *key) {
+  init_asserts(m);
+  assert(key);
+
+  uint64_t hash = m->hasher(key, m->__key_size);
+  int64_t  idx = find(m, key, hash);
+  if (idx != -1) return (char *)slot_at(m, idx) + m->__key_size;
+
+  /* Only a real insert may grow the table. */
+  maintain_load_factor(m);
+  void *value = insert_at(m, find_free(m, hash), key, hash);
+  memset(value, 0, m->__el_size);
+  return value;
+}
+bool fmap_has(fmap *m, void *key) {
+  init_asserts(m);
+  assert(key);
+  return find(m, key, m->hasher(key, m->__key_size)) != -1;
+}
+void fmap_del(fmap *m, void *key) {
+  init_asserts(m);
+  assert(key);
+
+  int64_t idx = find(m, key, m->hasher(key, m->__key_size));
+  if (idx != -1) erase_at(m, idx);
+}
+
+/* Functional Operations */
+int64_t fmap_count_if(fmap *m, _pred p, void *args) {
+  init_asserts(m);
+
+  int64_t counter = 0;
+  for (int64_t i = 0; i < m->__size; i++) {
+    if (!IS_FULL(*ctrl_at(m, i))) continue;
+
+    kvpair kv = read_slot(m, i);
+    if (p(&kv, args)) counter++;
+  }
+  return counter;
+}
+void fmap_foreach(fmap *m, _each n, void *args) {
+  init_asserts(m);
+  for (int64_t i = 0; i < m->__size; i++) {
+    if (!IS_FULL(*ctrl_at(m, i))) continue;
+
+    kvpair kv = read_slot(m, i);
+    n(&kv, args);
+  }
+}
+fmap *fmap_filter(fmap *m, _pred p, void *args) {
+  init_asserts(m);
+
+  /* Filtering only removes, so it can happen in place. */
+  for (int64_t i = 0; i < m->__size; i++) {
+    if (!IS_FULL(*ctrl_at(m, i))) continue;
+
+    kvpair kv = read_slot(m, i);
+    if (!p(&kv, args)) erase_at(m, i);
+  }
+  return m;
+}
+kvpair fmap_find_one(fmap *m, _pred p, void *args) {
+  init_asserts(m);
+  kvpair kv = {0};
+  for (int64_t i = 0; i < m->__size; i++) {
+    if (!IS_FULL(*ctrl_at(m, i))) continue;
+
+    kv = read_slot(m, i);
+    if (p(&kv, args)) return kv;
+  }
+  return (kvpair){0};
+}
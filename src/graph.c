@@ -0,0 +1,333 @@
+/*------------------------------------------------------------------------------
+ * Graph memory layout strategy.
+ *
+ *  edges    +-------------+-------------+     +-------------+
+ *           |from|to|cost |from|to|cost | ... |from|to|cost |  (builder)
+ *           +-------------+-------------+     +-------------+
+ *
+ *  offsets  +---+---+---+     +---+
+ *           | 0 | 2 | 2 | ... | E |  vertex v owns targets[offsets[v] ..
+ *           +---+---+---+     +---+  offsets[v + 1]]
+ *  targets  +---+---+---+     +---+
+ *           | 1 | 3 | 0 | ... | 2 |  weights run alongside targets
+ *           +---+---+---+     +---+
+ *
+ * Edges are appended to the builder in any order. Compiling counting sorts
+ * them by source into compressed sparse row arrays, keeping each vertex's
+ * edges in insertion order, so a traversal reads one vertex's neighbors as
+ * one contiguous run. Changing the edges marks the graph dirty and the next
+ * traversal compiles it again.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+#include <math.h>
+
+typedef struct graph_edge graph_edge;
+struct graph_edge {
+  int64_t from, to;
+  double  weight;
+};
+
+typedef struct open_node open_node;
+struct open_node {
+  double  f; /* Cost so far plus the heuristic, the heap key. */
+  int64_t vertex;
+};
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void init_asserts(graph *g);
+static void vertex_asserts(graph *g, int64_t v);
+static void ensure_compiled(graph *g);
+static bool open_before(void *a, void *b, void *args);
+
+static void init_asserts(graph *g) {
+  assert(g);
+  assert(g->allocator);
+  assert(g->vertices.elements);
+  assert(g->edges.elements);
+}
+
+static void vertex_asserts(graph *g, int64_t v) {
+  assert(v >= 0 && v < g->vertices.length && "Vertex out of range.");
+}
+
+static void ensure_compiled(graph *g) {
+  if (g->dirty) graph_compile(g);
+}
+
+static bool open_before(void *a, void *b, void *args) {
+  (void)args;
+  return ((open_node *)a)->f < ((open_node *)b)->f;
+}
+
+graph *__graph_init(graph *g, int64_t vertex_size, stalloc *alloc,
+                    int32_t flags, int64_t initial_size) {
+  assert(vertex_size > 0);
+  assert(alloc);
+  if (initial_size < 1) initial_size = 1;
+
+  g->allocator = alloc;
+  g->flags = flags;
+  g->dirty = false;
+
+  __vec_init(&g->vertices, vertex_size, alloc, flags, initial_size);
+  __vec_init(&g->edges, sizeof(graph_edge), alloc, flags, initial_size);
+  __vec_init(&g->offsets, sizeof(int64_t), alloc, flags, initial_size + 1);
+  __vec_init(&g->targets, sizeof(int64_t), alloc, flags, initial_size);
+  __vec_init(&g->weights, sizeof(double), alloc, flags, initial_size);
+
+  vec_resize(&g->offsets, 1);
+  *(int64_t *)vec_at(&g->offsets, 0) = 0;
+  return g;
+}
+
+void graph_free(graph *g) {
+  vec_free(&g->vertices);
+  vec_free(&g->edges);
+  vec_free(&g->offsets);
+  vec_free(&g->targets);
+  vec_free(&g->weights);
+}
+
+void graph_clear(graph *g) {
+  init_asserts(g);
+  vec_clear(&g->vertices);
+  vec_clear(&g->edges);
+  vec_clear(&g->targets);
+  vec_clear(&g->weights);
+  vec_resize(&g->offsets, 1);
+  *(int64_t *)vec_at(&g->offsets, 0) = 0;
+  g->dirty = false;
+}
+
+int64_t graph_vertices(graph *g) { return g->vertices.length; }
+int64_t graph_edges(graph *g) { return g->edges.length; }
+
+/* Builder Operations */
+int64_t graph_add_vertex(graph *g, void *data) {
+  init_asserts(g);
+  vec_push(&g->vertices, data);
+  g->dirty = true;
+  return g->vertices.length - 1;
+}
+
+void *graph_vertex(graph *g, int64_t v) {
+  vertex_asserts(g, v);
+  return vec_at(&g->vertices, v);
+}
+
+void graph_add_edge(graph *g, int64_t from, int64_t to, double weight) {
+  init_asserts(g);
+  vertex_asserts(g, from);
+  vertex_asserts(g, to);
+
+  graph_edge edge = {.from = from, .to = to, .weight = weight};
+  vec_push(&g->edges, &edge);
+  g->dirty = true;
+}
+
+bool graph_del_edge(graph *g, int64_t from, int64_t to) {
+  init_asserts(g);
+  for (int64_t i = 0; i < g->edges.length; i++) {
+    graph_edge *edge = vec_at(&g->edges, i);
+    if (edge->from != from || edge->to != to) continue;
+
+    vec_delete_at(&g->edges, i);
+    g->dirty = true;
+    return true;
+  }
+  return false;
+}
+
+graph *graph_compile(graph *g) {
+  init_asserts(g);
+  int64_t n = g->vertices.length;
+  int64_t e = g->edges.length;
+
+  vec_resize(&g->offsets, n + 1);
+  vec_resize(&g->targets, e);
+  vec_resize(&g->weights, e);
+
+  int64_t    *offsets = g->offsets.elements;
+  int64_t    *targets = g->targets.elements;
+  double     *weights = g->weights.elements;
+  graph_edge *edges = g->edges.elements;
+
+  /* Count each source into the slot after it and prefix sum, offsets[v] is
+     then where v's run starts. */
+  memset(offsets, 0, (n + 1) * sizeof(int64_t));
+  for (int64_t i = 0; i < e; i++) offsets[edges[i].from + 1]++;
+  for (int64_t v = 0; v < n; v++) offsets[v + 1] += offsets[v];
+
+  /* Placing uses offsets[v] as the cursor of v's run, which leaves every
+     offset pointing at the start of the next run. Shifting fixes them. */
+  for (int64_t i = 0; i < e; i++) {
+    int64_t at = offsets[edges[i].from]++;
+    targets[at] = edges[i].to;
+    weights[at] = edges[i].weight;
+  }
+  memmove(offsets + 1, offsets, n * sizeof(int64_t));
+  offsets[0] = 0;
+
+  g->dirty = false;
+  return g;
+}
+
+int64_t *graph_neighbors(graph *g, int64_t v, int64_t *count) {
+  init_asserts(g);
+  vertex_asserts(g, v);
+  ensure_compiled(g);
+
+  int64_t *offsets = g->offsets.elements;
+  if (count) *count = offsets[v + 1] - offsets[v];
+  return (int64_t *)g->targets.elements + offsets[v];
+}
+
+double *graph_weights(graph *g, int64_t v) {
+  init_asserts(g);
+  vertex_asserts(g, v);
+  ensure_compiled(g);
+  return (double *)g->weights.elements + ((int64_t *)g->offsets.elements)[v];
+}
+
+/*-------------------------------------------------------
+ * Searches
+ *-------------------------------------------------------*/
+bool bfs(graph *g, int64_t start, _pred visit, void *args, stalloc *alloc) {
+  init_asserts(g);
+  vertex_asserts(g, start);
+  ensure_compiled(g);
+
+  int64_t n = g->vertices.length;
+  int64_t *offsets = g->offsets.elements;
+  int64_t *targets = g->targets.elements;
+
+  /* Every vertex is queued at most once, so the frontier never grows. */
+  vec frontier;
+  set seen;
+  __vec_init(&frontier, sizeof(int64_t), alloc, TO_STACK_UNINIT, n);
+  __set_init(&seen, sizeof(int64_t), alloc, TO_STACK | SET_BITSET, n);
+
+  vec_push(&frontier, &start);
+  set_put(&seen, &start);
+  for (int64_t head = 0; head < frontier.length; head++) {
+    int64_t v = *(int64_t *)vec_at(&frontier, head);
+    if (visit(&v, args)) return true;
+
+    for (int64_t i = offsets[v]; i < offsets[v + 1]; i++) {
+      if (set_has(&seen, &targets[i])) continue;
+      set_put(&seen, &targets[i]);
+      vec_push(&frontier, &targets[i]);
+    }
+  }
+  return false;
+}
+
+bool dfs(graph *g, int64_t start, _pred visit, void *args, stalloc *alloc) {
+  init_asserts(g);
+  vertex_asserts(g, start);
+  ensure_compiled(g);
+
+  int64_t n = g->vertices.length;
+  int64_t *offsets = g->offsets.elements;
+  int64_t *targets = g->targets.elements;
+
+  /* A vertex is marked when popped, so each edge pushes at most once. */
+  vec stack;
+  set seen;
+  __vec_init(&stack, sizeof(int64_t), alloc, TO_STACK_UNINIT,
+             g->edges.length + 1);
+  __set_init(&seen, sizeof(int64_t), alloc, TO_STACK | SET_BITSET, n);
+
+  vec_push(&stack, &start);
+  while (stack.length) {
+    int64_t v = *(int64_t *)vec_top(&stack);
+    vec_pop(&stack);
+    if (set_has(&seen, &v)) continue;
+
+    set_put(&seen, &v);
+    if (visit(&v, args)) return true;
+
+    /* Pushed in reverse so the first edge added is walked first. */
+    for (int64_t i = offsets[v + 1] - 1; i >= offsets[v]; i--)
+      if (!set_has(&seen, &targets[i])) vec_push(&stack, &targets[i]);
+  }
+  return false;
+}
+
+double a_star(graph *g, int64_t start, int64_t goal, _heuristic h, void *args,
+              vec *path, stalloc *alloc) {
+  init_asserts(g);
+  vertex_asserts(g, start);
+  vertex_asserts(g, goal);
+  ensure_compiled(g);
+  if (path) assert(path->__el_size == sizeof(int64_t));
+
+  int64_t n = g->vertices.length;
+  int64_t *offsets = g->offsets.elements;
+  int64_t *targets = g->targets.elements;
+  double  *weights = g->weights.elements;
+  void    *goal_data = graph_vertex(g, goal);
+
+  /* Each vertex is open at most once, a cheaper route decreases its key. */
+  heap open;
+  vec  cost, parent, handle;
+  __heap_init(&open, sizeof(open_node), open_before, NULL, alloc,
+              TO_STACK_UNINIT, n);
+  __vec_init(&cost, sizeof(double), alloc, TO_STACK_UNINIT, n);
+  __vec_init(&parent, sizeof(int64_t), alloc, TO_STACK_UNINIT, n);
+  __vec_init(&handle, sizeof(int64_t), alloc, TO_STACK_UNINIT, n);
+  vec_resize(&cost, n);
+  vec_resize(&parent, n);
+  vec_resize(&handle, n);
+
+  double  *g_cost = cost.elements;
+  int64_t *from = parent.elements;
+  int64_t *open_at = handle.elements;
+  for (int64_t v = 0; v < n; v++) {
+    g_cost[v] = INFINITY;
+    from[v] = -1;
+    open_at[v] = -1;
+  }
+
+  g_cost[start] = 0;
+  open_at[start] = heap_push(&open, &(open_node){.f = 0, .vertex = start});
+  while (heap_length(&open)) {
+    open_node top;
+    heap_pop(&open, &top);
+    int64_t v = top.vertex;
+    open_at[v] = -1;
+    if (v == goal) break;
+
+    for (int64_t i = offsets[v]; i < offsets[v + 1]; i++) {
+      int64_t to = targets[i];
+      double  through = g_cost[v] + weights[i];
+      if (through >= g_cost[to]) continue;
+
+      g_cost[to] = through;
+      from[to] = v;
+      open_node node = {.f = through, .vertex = to};
+      if (h) node.f += h(graph_vertex(g, to), goal_data, args);
+
+      if (open_at[to] != -1) {
+        heap_decrease_key(&open, open_at[to], &node);
+        continue;
+      }
+      /* Closed vertices need no mark, the cost check above only lets one
+         back in when a heuristic that is not consistent finds it cheaper. */
+      open_at[to] = heap_push(&open, &node);
+    }
+  }
+
+  if (g_cost[goal] == INFINITY) return -1;
+  if (!path) return g_cost[goal];
+
+  /* Walk the parents back from the goal, then flip them into order. */
+  vec_clear(path);
+  for (int64_t v = goal; v != -1; v = from[v]) vec_push(path, &v);
+  for (int64_t i = 0, j = path->length - 1; i < j; i++, j--)
+    vec_swap(path, i, j);
+  return g_cost[goal];
+}
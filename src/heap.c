@@ -0,0 +1,196 @@
+/*------------------------------------------------------------------------------
+ * Heap memory layout strategy.
+ *
+ *  elements +---+---+---+---+---+     +---+---+---+---+
+ *           | 0 | 1 | 2 | 3 | 4 | ... |4i+1..4i+4 | ...  children of i
+ *           +---+---+---+---+---+     +---+---+---+---+
+ *  handle_at  handle of the element at each index, alongside elements
+ *  index_of   index of each handle's element, -1 once it is popped
+ *
+ * The heap is HEAP_ARITY-ary, the children of i are packed next to each other
+ * at i * HEAP_ARITY + 1. Four children share a cache line for small elements,
+ * and the tree is half as deep as a binary heap, which trades a few more
+ * compares per level for fewer levels of cache misses on the way down.
+ *
+ * Every push hands out a handle that follows its element as it moves, which is
+ * what decrease key needs. Popped handles are recycled by later pushes.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void     init_asserts(heap *h);
+static void    *el_at(heap *h, int64_t idx);
+static int64_t *handle_at(heap *h, int64_t idx);
+static int64_t *index_of(heap *h, int64_t handle);
+static void     swap_at(heap *h, int64_t a, int64_t b);
+static void     sift_up(heap *h, int64_t idx);
+static void     sift_down(heap *h, int64_t idx);
+
+static void init_asserts(heap *h) {
+  assert(h);
+  assert(h->cmp);
+  assert(h->elements.elements);
+  assert(h->handle_at.elements);
+  assert(h->index_of.elements);
+}
+
+static void *el_at(heap *h, int64_t idx) { return vec_at(&h->elements, idx); }
+static int64_t *handle_at(heap *h, int64_t idx) {
+  return vec_at(&h->handle_at, idx);
+}
+static int64_t *index_of(heap *h, int64_t handle) {
+  return vec_at(&h->index_of, handle);
+}
+
+static void swap_at(heap *h, int64_t a, int64_t b) {
+  memswap(el_at(h, a), el_at(h, b), h->elements.__el_size);
+
+  int64_t handle_a = *handle_at(h, a);
+  int64_t handle_b = *handle_at(h, b);
+  *handle_at(h, a) = handle_b;
+  *handle_at(h, b) = handle_a;
+  *index_of(h, handle_a) = b;
+  *index_of(h, handle_b) = a;
+}
+
+static void sift_up(heap *h, int64_t idx) {
+  while (idx > 0) {
+    int64_t parent = (idx - 1) / HEAP_ARITY;
+    if (!h->cmp(el_at(h, idx), el_at(h, parent), h->args)) return;
+    swap_at(h, idx, parent);
+    idx = parent;
+  }
+}
+
+static void sift_down(heap *h, int64_t idx) {
+  int64_t n = h->elements.length;
+  for (;;) {
+    int64_t first = idx * HEAP_ARITY + 1;
+    if (first >= n) return;
+
+    int64_t last = first + HEAP_ARITY;
+    if (last > n) last = n;
+
+    int64_t best = first;
+    for (int64_t c = first + 1; c < last; c++)
+      if (h->cmp(el_at(h, c), el_at(h, best), h->args)) best = c;
+
+    if (!h->cmp(el_at(h, best), el_at(h, idx), h->args)) return;
+    swap_at(h, idx, best);
+    idx = best;
+  }
+}
+
+heap *__heap_init(heap *h, int64_t el_size, _compare cmp, void *args,
+                  stalloc *alloc, int32_t flags, int64_t initial_size) {
+  assert(el_size > 0);
+  assert(cmp);
+  assert(alloc);
+  if (initial_size < 1) initial_size = 1;
+
+  h->cmp = cmp;
+  h->args = args;
+  __vec_init(&h->elements, el_size, alloc, flags, initial_size);
+  __vec_init(&h->handle_at, sizeof(int64_t), alloc, flags, initial_size);
+  __vec_init(&h->index_of, sizeof(int64_t), alloc, flags, initial_size);
+  __vec_init(&h->free_handles, sizeof(int64_t), alloc, flags, 1);
+  return h;
+}
+
+heap *heap_from_vec(heap *h, vec *src, _compare cmp, void *args) {
+  int64_t n = src->length;
+  __heap_init(h, src->__el_size, cmp, args, src->allocator, src->flags, n);
+
+  vec_push_n(&h->elements, src->elements, n);
+  for (int64_t i = 0; i < n; i++) {
+    vec_push(&h->handle_at, &i);
+    vec_push(&h->index_of, &i);
+  }
+
+  /* Floyd's method, sifting down from the last parent is O(n) overall. */
+  for (int64_t i = (n - 2) / HEAP_ARITY; n > 1 && i >= 0; i--) sift_down(h, i);
+  return h;
+}
+
+void heap_free(heap *h) {
+  vec_free(&h->elements);
+  vec_free(&h->handle_at);
+  vec_free(&h->index_of);
+  vec_free(&h->free_handles);
+}
+
+void heap_clear(heap *h) {
+  init_asserts(h);
+  vec_clear(&h->elements);
+  vec_clear(&h->handle_at);
+  vec_clear(&h->index_of);
+  vec_clear(&h->free_handles);
+}
+
+int64_t heap_length(heap *h) { return h->elements.length; }
+
+/* Element Operations */
+int64_t heap_push(heap *h, void *el) {
+  init_asserts(h);
+
+  int64_t handle;
+  if (h->free_handles.length) {
+    handle = *(int64_t *)vec_top(&h->free_handles);
+    vec_pop(&h->free_handles);
+  } else {
+    handle = h->index_of.length;
+    vec_resize(&h->index_of, handle + 1);
+  }
+
+  int64_t idx = h->elements.length;
+  vec_push(&h->elements, el);
+  vec_push(&h->handle_at, &handle);
+  *index_of(h, handle) = idx;
+  sift_up(h, idx);
+  return handle;
+}
+
+void heap_pop(heap *h, void *out) {
+  init_asserts(h);
+  assert(h->elements.length > 0 && "Pop from an empty heap.");
+
+  if (out) memcpy(out, el_at(h, 0), h->elements.__el_size);
+
+  int64_t handle = *handle_at(h, 0);
+  if (h->elements.length > 1) swap_at(h, 0, h->elements.length - 1);
+  vec_pop(&h->elements);
+  vec_pop(&h->handle_at);
+  *index_of(h, handle) = -1;
+  vec_push(&h->free_handles, &handle);
+
+  if (h->elements.length) sift_down(h, 0);
+}
+
+void *heap_peek(heap *h) {
+  init_asserts(h);
+  if (!h->elements.length) return NULL;
+  return el_at(h, 0);
+}
+
+bool heap_contains(heap *h, int64_t handle) {
+  init_asserts(h);
+  if (handle < 0 || handle >= h->index_of.length) return false;
+  return *index_of(h, handle) != -1;
+}
+
+void *heap_get(heap *h, int64_t handle) {
+  assert(heap_contains(h, handle) && "Handle was popped.");
+  return el_at(h, *index_of(h, handle));
+}
+
+void heap_decrease_key(heap *h, int64_t handle, void *el) {
+  assert(heap_contains(h, handle) && "Handle was popped.");
+  int64_t idx = *index_of(h, handle);
+  assert(!h->cmp(el_at(h, idx), el, h->args) && "Key would increase.");
+
+  vec_put(&h->elements, idx, el);
+  sift_up(h, idx);
+}
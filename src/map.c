@@ -1,16 +1,45 @@
 #include "csdsa.h"
 #include <stdio.h>
+#include <time.h>
+
+/* What map_*_par hands its chunks of slots through pool_run. */
+typedef struct par_job par_job;
+struct par_job {
+  map            *m;
+  _each           n;
+  _pred           p;
+  void           *args;
+  _Atomic int64_t count;
+};
 
 /*-------------------------------------------------------
  * Static Functions
  *-------------------------------------------------------*/
 static void     init_asserts(map *m);
-static int64_t  key_pos(map *m, void *key);
-static int64_t  linear_search_open_pos(map *m, int64_t from);
+static void     track_probe(map *m, int64_t length, bool found);
+static int64_t  now_ns(void);
+static int32_t  probe_bucket(int64_t length);
+static void     print_buckets(int64_t *buckets);
+static int64_t  key_pos(map *m, vec *table, void *key);
+static int64_t  probe_slot(map *m, void *key, bool *found);
+static void    *insert_at(map *m, int64_t idx, void *key);
 static void     maintain_load_factor(map *m);
 static void    *__get_key(map *m, void *el);
 static void    *__get_value(map *m, void *el);
 static int32_t *__get_state(map *m, void *el);
+static void     reset_states(map *m);
+static int64_t  home_slot(map *m, vec *table, void *key);
+static void     migrate_slot(map *m, void *el);
+static void     migrate_step(map *m);
+static void     migrate_key(map *m, void *key);
+static void     finish_migration(map *m);
+static int64_t  grown_size(map *m);
+static void     rehash_to(map *m, int64_t new_size, vec *retired);
+static int64_t  size_for(int64_t entries);
+static void     erase_at(map *m, int64_t idx);
+static uint64_t hasher_check(_hash hasher, int64_t key_size);
+static void     count_if_range(int64_t begin, int64_t end, void *args);
+static void     foreach_range(int64_t begin, int64_t end, void *args);
 
 static void init_asserts(map *m) {
   assert(m);
@@ -18,65 +47,164 @@ static void init_asserts(map *m) {
   assert(m->elements.elements);
 }
 
-static int64_t key_pos(map *m, void *key) {
-  int64_t start_idx = hash_bytes(key, m->__key_size) % m->elements.length;
+static inline void track_probe(map *m, int64_t length, bool found) {
+  map_stats *stats = m->stats;
+  if (stats == NULL) return;
+  found ? stats->hits++ : stats->misses++;
+  stats->probes[probe_bucket(length)]++;
+  stats->probe_total += length;
+  if (length > stats->probe_max) stats->probe_max = length;
+}
 
-  /* Probe forward */
-  for (int64_t idx = start_idx; idx < m->elements.length; idx++) {
-    void *el = vec_at(&m->elements, idx);
-    if (*__get_state(m, el) != m->in_use_id) continue;
+static int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    /* Check if keys match */
-    kvpair kv = read_kvpair(m, el);
-    if (memcmp(kv.key, key, m->__key_size) == 0) return idx;
-  }
+static int32_t probe_bucket(int64_t length) {
+  int32_t bucket = 63 - __builtin_clzll(length);
+  return bucket < MAP_PROBE_BUCKETS ? bucket : MAP_PROBE_BUCKETS - 1;
+}
 
-  /* Probe failed, start from zero and go until start_idx */
-  for (int64_t idx = 0; idx < start_idx; idx++) {
-    void *el = vec_at(&m->elements, idx);
-    if (*__get_state(m, el) != m->in_use_id) continue;
+static void print_buckets(int64_t *buckets) {
+  for (int32_t b = 0; b < MAP_PROBE_BUCKETS; b++) {
+    if (buckets[b] == 0) continue;
+    if (b == MAP_PROBE_BUCKETS - 1)
+      fprintf(stderr, "    [%ld, ...): %ld\n", 1l << b, (long)buckets[b]);
+    else
+      fprintf(stderr, "    [%ld, %ld): %ld\n", 1l << b, 2l << b,
+              (long)buckets[b]);
+  }
+}
 
-    kvpair kv = read_kvpair(m, el);
-    if (memcmp(kv.key, key, m->__key_size) == 0) return idx;
+static int64_t key_pos(map *m, vec *table, void *key) {
+  int64_t mask = table->length - 1;
+  int64_t idx = home_slot(m, table, key);
+
+  /* Probe forward until the key or an empty slot. Tombstones keep the probe
+     going since the key may have been placed past them. */
+  for (int64_t probes = 0; probes < table->length; probes++) {
+    void   *el = vec_at(table, idx);
+    int32_t state = *__get_state(m, el);
+    if (state == m->in_use_id) {
+      if (memcmp(__get_key(m, el), key, m->__key_size) == 0) {
+        track_probe(m, probes + 1, true);
+        return idx;
+      }
+    } else if (state != -m->in_use_id) {
+      track_probe(m, probes + 1, false);
+      return -1;
+    }
+    idx = (idx + 1) & mask;
   }
 
   /* Search failed */
+  track_probe(m, table->length, false);
   return -1;
 }
 
-static int64_t linear_search_open_pos(map *m, int64_t from) {
-  /* Linear probe forward */
-  for (int64_t idx = from; idx < m->elements.length; idx++) {
-    void *el = vec_at(&m->elements, idx);
-    /* Check if slot free */
-    if (*__get_state(m, el) != m->in_use_id) return idx;
+static int64_t probe_slot(map *m, void *key, bool *found) {
+  int64_t mask = m->elements.length - 1;
+  int64_t idx = home_slot(m, &m->elements, key);
+  int64_t open = -1;
+
+  /* One probe serves both lookups and inserts. Remember the first tombstone
+     on the way so an insert can reuse it once the key is known absent. */
+  int64_t probes = 0;
+  for (; probes < m->elements.length; probes++) {
+    void   *el = vec_at(&m->elements, idx);
+    int32_t state = *__get_state(m, el);
+    if (state == m->in_use_id) {
+      if (memcmp(__get_key(m, el), key, m->__key_size) == 0) {
+        track_probe(m, probes + 1, true);
+        *found = true;
+        return idx;
+      }
+    } else if (state == -m->in_use_id) {
+      if (open == -1) open = idx;
+    } else {
+      probes++; /* The empty slot was looked at too. */
+      break;
+    }
+    idx = (idx + 1) & mask;
   }
 
-  /* Prove failed, start at zero and go to from */
-  for (int64_t idx = 0; idx < from; idx++) {
-    void *el = vec_at(&m->elements, idx);
-    if (*__get_state(m, el) != m->in_use_id) return idx;
-  }
+  track_probe(m, probes, false);
+  *found = false;
+  if (open != -1) return open;
+  assert(*__get_state(m, vec_at(&m->elements, idx)) != m->in_use_id &&
+         "Map is full, this should never happen.");
+  return idx;
+}
 
-  /* Map Full!!! */
-  assert(false && "Map is full, this should never happen.");
-  return -1;
+static void *insert_at(map *m, int64_t idx, void *key) {
+  void *el = vec_at(&m->elements, idx);
+  if (*__get_state(m, el) == -m->in_use_id) m->tombstones--;
+
+  cbuff buff;
+  buff_init(&buff, el);
+  buff_push(&buff, key, m->__key_size);
+  buff_skip(&buff, m->__el_size);
+  buff_push(&buff, &m->in_use_id, sizeof(m->in_use_id));
+
+  m->slots_in_use++;
+  return __get_value(m, el);
 }
 
 static void maintain_load_factor(map *m) {
-  float lf = (float)m->slots_in_use / m->__size;
+  if (m->__old.elements) migrate_step(m);
+
+  /* Tombstones lengthen probes just like live slots, so they count. */
+  float lf = (float)(m->slots_in_use + m->tombstones) / m->__size;
   if (lf < MAP_LOAD_FACTOR) return;
 
+  /* The new table filled up before the old one drained. */
+  finish_migration(m);
+
+  int64_t new_size = grown_size(m);
+  if (!(m->flags & MAP_INCREMENTAL)) {
+    rehash_to(m, new_size, NULL);
+    return;
+  }
+
+  /* Incremental maps keep the old table and move it over MAP_MIGRATE_STEP
+     slots at a time on later inserts, so no single put pays for all of it. */
+  map new_map;
+  __map_init_hashed(&new_map, m->__el_size, m->__key_size, m->allocator,
+                    m->flags, new_size, m->hasher);
+  m->__old = m->elements;
+  m->__migrated = 0;
+  m->elements = new_map.elements;
+  m->__size = new_size;
+  m->tombstones = 0;
+  m->cache_counter++;
+  if (m->stats) m->stats->rehashes++;
+  migrate_step(m);
+}
+
+static int64_t grown_size(map *m) {
+  /* If the load factor constraint is reached, create a map double the
+     current size. When mostly tombstones are to blame, rebuilding at the
+     same size is enough to clear them out. */
+  if ((float)m->slots_in_use / m->__size < MAP_LOAD_FACTOR / 2)
+    return m->__size;
+  return m->__size * 2;
+}
+
+/* The old table is freed, or handed to retired when that is set. */
+static void rehash_to(map *m, int64_t new_size, vec *retired) {
+  finish_migration(m);
+  map_stats *stats = m->stats;
+  int64_t    start = stats ? now_ns() : 0;
+
   /* The cache invalidation counter persists across resizes */
   int32_t cache_counter = m->cache_counter;
   cache_counter++;
 
-  /* If the load factor constraint is reached, create a map double the
-     current size. */
   map new_map;
-  __map_init(&new_map, m->__el_size, m->__key_size, m->allocator, m->flags,
-             m->__size * 2);
-  map_clear(&new_map); /* Reset map to be 2x bigger */
+  __map_init_hashed(&new_map, m->__el_size, m->__key_size, m->allocator,
+                    m->flags, new_size, m->hasher);
 
   /* Reinsertion step */
   for (int64_t i = 0; i < m->elements.length; i++) {
@@ -87,9 +215,51 @@ static void maintain_load_factor(map *m) {
     map_put(&new_map, kv.key, kv.value);
   }
 
-  map_free(m);
+  if (retired)
+    *retired = m->elements;
+  else
+    map_free(m);
   memmove(m, &new_map, sizeof(map));
   m->cache_counter = cache_counter;
+
+  m->stats = stats;
+  if (stats) {
+    stats->rehashes++;
+    stats->rehash_ns += now_ns() - start;
+  }
+}
+
+static void erase_at(map *m, int64_t idx) {
+  /* The slot turns into a tombstone so probes for keys placed after it keep
+     going. If the next slot is empty no probe can pass through here, so this
+     slot and the run of tombstones in front of it become empty instead. */
+  int64_t mask = m->elements.length - 1;
+  void   *next = vec_at(&m->elements, (idx + 1) & mask);
+  int32_t next_state = *__get_state(m, next);
+  bool    next_empty =
+      next_state != m->in_use_id && next_state != -m->in_use_id;
+
+  int32_t tombstone = -m->in_use_id;
+  memcpy(__get_state(m, vec_at(&m->elements, idx)), &tombstone,
+         sizeof(tombstone));
+  m->tombstones++;
+  m->slots_in_use--;
+
+  if (!next_empty) return;
+  int32_t empty = 0;
+  for (int64_t i = 0; i < m->elements.length; i++, idx = (idx - 1) & mask) {
+    int32_t *state = __get_state(m, vec_at(&m->elements, idx));
+    if (*state != tombstone) break;
+    memcpy(state, &empty, sizeof(empty));
+    m->tombstones--;
+  }
+}
+
+static int64_t size_for(int64_t entries) {
+  /* The smallest table that takes this many entries without growing. */
+  int64_t size = 1;
+  while (size * MAP_LOAD_FACTOR < entries) size *= 2;
+  return size;
 }
 
 static void *__get_key(map *m, void *el) {
@@ -101,6 +271,64 @@ static void *__get_value(map *m, void *el) {
 static int32_t *__get_state(map *m, void *el) {
   return (int32_t *)((char *)el + m->__key_size + m->__el_size);
 }
+
+static int64_t home_slot(map *m, vec *table, void *key) {
+  /* The table size is a power of two, so the mask replaces a modulo. */
+  return m->hasher(key, m->__key_size) & (table->length - 1);
+}
+
+static void migrate_slot(map *m, void *el) {
+  /* Keys in the old table are never in the new one, see migrate_key. */
+  bool    found;
+  int64_t idx = probe_slot(m, __get_key(m, el), &found);
+  assert(!found);
+  memmove(insert_at(m, idx, __get_key(m, el)), __get_value(m, el),
+          m->__el_size);
+  m->slots_in_use--; /* Already counted while in the old table. */
+
+  /* A tombstone keeps probes in the old table going past this slot. */
+  int32_t tombstone = -m->in_use_id;
+  memcpy(__get_state(m, el), &tombstone, sizeof(tombstone));
+}
+
+static void migrate_step(map *m) {
+  int64_t start = m->stats ? now_ns() : 0;
+  bool    moved = false;
+  for (int64_t n = 0; n < MAP_MIGRATE_STEP && m->__migrated < m->__old.length;
+       n++) {
+    void *el = vec_at(&m->__old, m->__migrated++);
+    if (*__get_state(m, el) != m->in_use_id) continue;
+    migrate_slot(m, el);
+    moved = true;
+  }
+  if (moved) m->cache_counter++;
+  if (m->stats) m->stats->rehash_ns += now_ns() - start;
+
+  if (m->__migrated < m->__old.length) return;
+  vec_free(&m->__old);
+  m->__old.elements = NULL;
+}
+
+static void migrate_key(map *m, void *key) {
+  /* Inserts move their key over first so it only ever lives in one table. */
+  int64_t idx = key_pos(m, &m->__old, key);
+  if (idx == -1) return;
+  migrate_slot(m, vec_at(&m->__old, idx));
+  m->cache_counter++;
+}
+
+static void finish_migration(map *m) {
+  while (m->__old.elements) migrate_step(m);
+}
+
+static void reset_states(map *m) {
+  /* Only the state words decide if a slot is live, keys and values can
+     stay as they are. */
+  int32_t free_state = 0;
+  for (int64_t i = 0; i < m->elements.length; i++)
+    memcpy(__get_state(m, vec_at(&m->elements, i)), &free_state,
+           sizeof(free_state));
+}
 /*-------------------------------------------------------
  * Map Implementation
  *-------------------------------------------------------*/
@@ -108,37 +336,64 @@ static int32_t *__get_state(map *m, void *el) {
 /* Container Operations */
 map *__map_init(map *m, int64_t el_size, int64_t key_size, stalloc *alloc,
                 int32_t flags, int64_t initial_size) {
+  return __map_init_hashed(m, el_size, key_size, alloc, flags, initial_size,
+                           hash_bytes);
+}
+map *__map_init_hashed(map *m, int64_t el_size, int64_t key_size,
+                       stalloc *alloc, int32_t flags, int64_t initial_size,
+                       _hash hasher) {
   assert(key_size > 0);
   assert(el_size > 0);
   assert(alloc);
+  assert(hasher);
+  m->hasher = hasher;
   m->slots_in_use = 0;
+  m->tombstones = 0;
   m->flags = flags;
   m->allocator = alloc;
   m->in_use_id = 1;
   m->cache_counter = 0;
+  m->__old.elements = NULL;
+  m->__migrated = 0;
+  m->stats = NULL;
 
-  m->__size = initial_size;
+  m->__size = 1;
+  while (m->__size < initial_size) m->__size *= 2;
   m->__el_size = el_size;
   m->__key_size = key_size;
 
   /* We lay out the KV pair in memory as such. The kvpair struct is just
      smoke and mirrors. */
-  assert(__vec_init(&m->elements, key_size + el_size + sizeof(m->in_use_id),
-                    alloc, flags, initial_size) != NULL);
+  __vec_init(&m->elements, key_size + el_size + sizeof(m->in_use_id), alloc,
+             flags, m->__size);
   vec_resize(&m->elements, m->__size);
 
+  /* Uninitialised tables may hold anything, make sure no slot looks live. */
+  if (flags & ALLOC_UNINIT) reset_states(m);
+
   return m;
 }
 void map_free(map *m) {
   init_asserts(m);
   vec_free(&m->elements);
+  if (m->__old.elements) vec_free(&m->__old);
 }
 void map_clear(map *m) {
   init_asserts(m);
+  if (m->__old.elements) {
+    vec_free(&m->__old);
+    m->__old.elements = NULL;
+  }
+
+  /* Bumping in_use_id invalidates every slot at once. Only when the id runs
+     out do the states have to be rewritten. */
+  if (m->in_use_id == INT32_MAX) {
+    reset_states(m);
+    m->in_use_id = 0;
+  }
   m->in_use_id++;
   m->slots_in_use = 0;
-  vec_clear(&m->elements);
-  vec_resize(&m->elements, m->__size);
+  m->tombstones = 0;
 }
 
 pred(select_in_use, int *, el, {
@@ -149,6 +404,7 @@ pred(select_in_use, int *, el, {
 });
 vec *map_to_vec(map *m, vec *out) {
   init_asserts(m);
+  finish_migration(m);
 
   __vec_init(out, m->__el_size + m->__key_size + sizeof(m->in_use_id),
              m->allocator, m->flags, m->slots_in_use);
@@ -165,11 +421,157 @@ vec *map_to_vec(map *m, vec *out) {
 
 map *map_copy(map *dest, map *src) {
   init_asserts(src);
+  finish_migration(src);
   memmove(dest, src, sizeof(*src));
   vec_copy(&dest->elements, &src->elements);
+  dest->stats = NULL;
   return dest;
 }
 
+void map_reserve(map *m, int64_t entries) {
+  init_asserts(m);
+  int64_t size = size_for(entries);
+  if (size > m->__size) rehash_to(m, size, NULL);
+}
+
+void map_shrink_to_fit(map *m) {
+  init_asserts(m);
+  int64_t size = size_for(m->slots_in_use);
+  if (size < m->__size || m->tombstones > 0) rehash_to(m, size, NULL);
+}
+
+bool __map_grow_retired(map *m, int64_t inserts, vec *retired) {
+  init_asserts(m);
+  assert(inserts >= 0);
+  assert(retired);
+  assert(!(m->flags & MAP_INCREMENTAL));
+
+  /* The same test maintain_load_factor makes, `inserts` puts ahead. */
+  float lf = (float)(m->slots_in_use + m->tombstones + inserts) / m->__size;
+  if (lf < MAP_LOAD_FACTOR) return false;
+
+  int64_t new_size = grown_size(m);
+  while ((float)(m->slots_in_use + inserts) / new_size >= MAP_LOAD_FACTOR)
+    new_size *= 2;
+  rehash_to(m, new_size, retired);
+  return true;
+}
+
+void map_track(map *m, map_stats *stats) {
+  init_asserts(m);
+  m->stats = stats;
+}
+
+void map_debug_stats(map *m) {
+  init_asserts(m);
+  finish_migration(m);
+
+  /* A resident key's probe length is how far it sits past its home slot,
+     plus one. That is what a hit on it costs. */
+  int64_t lengths[MAP_PROBE_BUCKETS] = {0};
+  int64_t total = 0, longest = 0, mask = m->elements.length - 1;
+  for (int64_t i = 0; i < m->elements.length; i++) {
+    void *el = vec_at(&m->elements, i);
+    if (*__get_state(m, el) != m->in_use_id) continue;
+
+    int64_t home = home_slot(m, &m->elements, __get_key(m, el));
+    int64_t length = ((i - home) & mask) + 1;
+    lengths[probe_bucket(length)]++;
+    total += length;
+    if (length > longest) longest = length;
+  }
+
+  fprintf(stderr, "map %p: %ld of %ld slots, %ld tombstones, load %.3f\n",
+          (void *)m, (long)m->slots_in_use, (long)m->__size,
+          (long)m->tombstones,
+          (double)(m->slots_in_use + m->tombstones) / m->__size);
+  fprintf(stderr, "  resident probe length: mean %.2f, max %ld\n",
+          m->slots_in_use ? (double)total / m->slots_in_use : 0.0,
+          (long)longest);
+  print_buckets(lengths);
+
+  map_stats *stats = m->stats;
+  if (stats == NULL) return;
+  int64_t probes = stats->hits + stats->misses;
+  fprintf(stderr, "  tracked: %ld hits, %ld misses, mean probe %.2f, max %ld\n",
+          (long)stats->hits, (long)stats->misses,
+          probes ? (double)stats->probe_total / probes : 0.0,
+          (long)stats->probe_max);
+  print_buckets(stats->probes);
+  fprintf(stderr, "  tracked: %ld rehashes, %.3f ms\n", (long)stats->rehashes,
+          stats->rehash_ns / 1e6);
+}
+
+/* Hashes a fixed pattern, so opening a snapshot can tell whether it was
+   given the hasher the table was laid out with. */
+static uint64_t hasher_check(_hash hasher, int64_t key_size) {
+  uint8_t pattern[8] = {'c', 's', 'd', 's', 'a', 1, 2, 3};
+  return hasher(pattern, key_size < 8 ? key_size : 8);
+}
+
+void __map_snapshot(map *m, snapshot *snap) {
+  init_asserts(m);
+  finish_migration(m);
+  snap->flags = m->flags;
+  snap->in_use_id = m->in_use_id;
+  snap->el_size = m->__el_size;
+  snap->key_size = m->__key_size;
+  snap->count = m->slots_in_use;
+  snap->tombstones = m->tombstones;
+  snap->check = hasher_check(m->hasher, m->__key_size);
+  snap->sections = 1;
+  snap->section[0] = m->elements;
+}
+
+map *__map_from_snapshot(map *m, snapshot *snap, _hash hasher) {
+  if (hasher == NULL) hasher = hash_bytes;
+  int64_t slots = snap->section[0].length;
+  int64_t slot_size = snap->key_size + snap->el_size + sizeof(m->in_use_id);
+
+  /* Anything but the table map_save wrote would send probes astray. The
+     sizes go first, hasher_check reads key_size bytes. in_use_id 0 would
+     make every zeroed slot look live. */
+  bool sized = snap->key_size >= 1 && snap->el_size >= 1 &&
+               snap->in_use_id >= 1 && snap->count >= 0 &&
+               snap->tombstones >= 0 &&
+               snap->count + snap->tombstones <= slots;
+  if (!sized || snap->sections != 1 ||
+      hasher_check(hasher, snap->key_size) != snap->check ||
+      snap->section[0].__el_size != slot_size || slots < 1 ||
+      (slots & (slots - 1)) != 0) {
+    vec_free(&snap->section[0]);
+    return NULL;
+  }
+
+  m->__size = slots;
+  m->__el_size = snap->el_size;
+  m->__key_size = snap->key_size;
+  m->slots_in_use = snap->count;
+  m->tombstones = snap->tombstones;
+  m->flags = snap->flags & ~(TO_HEAP | MAP_INCREMENTAL);
+  m->in_use_id = snap->in_use_id;
+  m->cache_counter = 0;
+  m->hasher = hasher;
+  m->allocator = snap->section[0].allocator;
+  m->elements = snap->section[0];
+  m->__old.elements = NULL;
+  m->__migrated = 0;
+  m->stats = NULL;
+  return m;
+}
+
+bool map_save(map *m, int fd) {
+  snapshot snap = {.kind = SNAPSHOT_MAP};
+  __map_snapshot(m, &snap);
+  return __snapshot_save(&snap, fd);
+}
+
+map *map_mmap_open(map *m, const char *path, stalloc *alloc, _hash hasher) {
+  snapshot snap;
+  if (!__snapshot_open(&snap, path, SNAPSHOT_MAP, alloc)) return NULL;
+  return __map_from_snapshot(m, &snap, hasher);
+}
+
 int64_t map_load(map *m) {
   init_asserts(m);
   return m->slots_in_use;
@@ -181,11 +583,17 @@ kvpair map_get(map *m, void *key) {
   assert(key);
   kvpair kv = {0};
 
-  int64_t idx = key_pos(m, key);
+  /* While migrating a key may still be in the old table. */
+  vec    *table = &m->elements;
+  int64_t idx = key_pos(m, table, key);
+  if (idx == -1 && m->__old.elements) {
+    table = &m->__old;
+    idx = key_pos(m, table, key);
+  }
   if (idx == -1) return kv;
 
   /* Load element and check element validity */
-  void *el = vec_at(&m->elements, idx);
+  void *el = vec_at(table, idx);
 
   if (*__get_state(m, el) != m->in_use_id) return kv;
 
@@ -197,21 +605,28 @@ void map_put(map *m, void *key, void *value) {
   assert(key);
   assert(value);
   maintain_load_factor(m);
+  if (m->__old.elements) migrate_key(m, key);
 
-  if (map_has(m, key)) map_del(m, key);
-
-  int64_t idx = hash_bytes(key, m->__key_size) % m->elements.length;
-  idx = linear_search_open_pos(m, idx);
+  bool    found;
+  int64_t idx = probe_slot(m, key, &found);
 
-  void *el = vec_at(&m->elements, idx);
+  void *slot = found ? __get_value(m, vec_at(&m->elements, idx))
+                     : insert_at(m, idx, key);
+  memmove(slot, value, m->__el_size);
+}
+void *map_get_or_insert(map *m, void *key) {
+  init_asserts(m);
+  assert(key);
+  maintain_load_factor(m);
+  if (m->__old.elements) migrate_key(m, key);
 
-  cbuff buff;
-  buff_init(&buff, el);
-  buff_push(&buff, key, m->__key_size);
-  buff_push(&buff, value, m->__el_size);
-  buff_push(&buff, &m->in_use_id, sizeof(m->in_use_id));
+  bool    found;
+  int64_t idx = probe_slot(m, key, &found);
+  if (found) return __get_value(m, vec_at(&m->elements, idx));
 
-  m->slots_in_use++;
+  void *slot = insert_at(m, idx, key);
+  memset(slot, 0, m->__el_size);
+  return slot;
 }
 bool map_has(map *m, void *key) {
   init_asserts(m);
@@ -224,22 +639,20 @@ void map_del(map *m, void *key) {
   init_asserts(m);
   assert(key);
 
-  kvpair kv = map_get(m, key);
-  if (!kv.key) return;
-
-  /* Hack! Since map_get's kvpair return contains the state as a copied value
-     and we know that right after the value is the REAL state, so we edit
-     the 8 bytes after value. */
-  cbuff buff;
-  buff_init(&buff, kv.value);
-  buff_skip(&buff, m->__el_size);
-
-  /* setting to 0 is explicit delete. setting to any value other than
-     in_use_id is an implicit delete. */
-  int32_t new_state = 0;
-  buff_push(&buff, &new_state, sizeof(new_state));
+  int64_t idx = key_pos(m, &m->elements, key);
+  if (idx == -1 && m->__old.elements) {
+    /* Not migrated yet, a tombstone in the old table is all it takes. */
+    idx = key_pos(m, &m->__old, key);
+    if (idx == -1) return;
+    int32_t tombstone = -m->in_use_id;
+    memcpy(__get_state(m, vec_at(&m->__old, idx)), &tombstone,
+           sizeof(tombstone));
+    m->slots_in_use--;
+    return;
+  }
+  if (idx == -1) return;
 
-  m->slots_in_use--;
+  erase_at(m, idx);
 }
 
 kvpair read_kvpair(map *m, void *el) {
@@ -253,6 +666,7 @@ kvpair read_kvpair(map *m, void *el) {
 /* Functional Operations */
 int64_t map_count_if(map *m, _pred p, void *args) {
   init_asserts(m);
+  finish_migration(m);
 
   int64_t counter = 0;
   for (int64_t i = 0; i < m->elements.length; i++) {
@@ -267,6 +681,7 @@ int64_t map_count_if(map *m, _pred p, void *args) {
 
 void map_foreach(map *m, _each n, void *args) {
   init_asserts(m);
+  finish_migration(m);
   for (int64_t i = 0; i < m->elements.length; i++) {
     void *el = vec_at(&m->elements, i);
     if (*__get_state(m, el) != m->in_use_id) continue;
@@ -277,24 +692,24 @@ void map_foreach(map *m, _each n, void *args) {
 }
 map *map_filter(map *m, _pred p, void *args) {
   init_asserts(m);
-  map filter;
-  __map_init(&filter, m->__el_size, m->__key_size, m->allocator, TO_STACK,
-             m->__size);
+  assert(!(m->elements.flags & SNAPSHOT_MAPPED) &&
+         "Mapped maps are read only, map_copy first.");
+  finish_migration(m);
 
+  /* Deleting in place needs no second table. Erasing only ever rewrites the
+     slot itself and tombstones in front of it, so the scan can go on. */
   for (int64_t i = 0; i < m->elements.length; i++) {
     void *el = vec_at(&m->elements, i);
-    if (*__get_state(m, el) == m->in_use_id) {
+    if (*__get_state(m, el) != m->in_use_id) continue;
 
-      kvpair kv = read_kvpair(m, el);
-      if (p(&kv, args)) map_put(&filter, kv.key, kv.value);
-    }
+    kvpair kv = read_kvpair(m, el);
+    if (!p(&kv, args)) erase_at(m, i);
   }
-
-  memmove(m, &filter, sizeof(map));
   return m;
 }
 kvpair map_find_one(map *m, _pred p, void *args) {
   init_asserts(m);
+  finish_migration(m);
   kvpair kv = {0};
   for (int64_t i = 0; i < m->elements.length; i++) {
     void *el = vec_at(&m->elements, i);
@@ -306,3 +721,66 @@ kvpair map_find_one(map *m, _pred p, void *args) {
   }
   return kv;
 }
+
+bool map_next(map *m, int64_t *cursor, kvpair *out) {
+  init_asserts(m);
+  if (*cursor == 0) finish_migration(m);
+
+  for (int64_t i = *cursor; i < m->elements.length; i++) {
+    void *el = vec_at(&m->elements, i);
+    if (*__get_state(m, el) != m->in_use_id) continue;
+
+    *out = read_kvpair(m, el);
+    *cursor = i + 1;
+    return true;
+  }
+  *cursor = m->elements.length;
+  return false;
+}
+
+static void count_if_range(int64_t begin, int64_t end, void *args) {
+  par_job *job = args;
+  map     *m = job->m;
+  int64_t  count = 0;
+  for (int64_t i = begin; i < end; i++) {
+    void *el = vec_at(&m->elements, i);
+    if (*__get_state(m, el) != m->in_use_id) continue;
+
+    kvpair kv = read_kvpair(m, el);
+    if (job->p(&kv, job->args)) count++;
+  }
+  atomic_fetch_add_explicit(&job->count, count, memory_order_relaxed);
+}
+
+static void foreach_range(int64_t begin, int64_t end, void *args) {
+  par_job *job = args;
+  map     *m = job->m;
+  for (int64_t i = begin; i < end; i++) {
+    void *el = vec_at(&m->elements, i);
+    if (*__get_state(m, el) != m->in_use_id) continue;
+
+    kvpair kv = read_kvpair(m, el);
+    job->n(&kv, job->args);
+  }
+}
+
+/* Any migration is finished up front, the workers then only read slots. */
+int64_t map_count_if_par(map *m, _pred p, void *args, pool *pl) {
+  init_asserts(m);
+  finish_migration(m);
+
+  int64_t slots = m->elements.length;
+  par_job job = {.m = m, .p = p, .args = args};
+  atomic_init(&job.count, 0);
+  pool_run(pl, slots, pool_grain(pl, slots), count_if_range, &job);
+  return atomic_load(&job.count);
+}
+
+void map_foreach_par(map *m, _each n, void *args, pool *pl) {
+  init_asserts(m);
+  finish_migration(m);
+
+  int64_t slots = m->elements.length;
+  par_job job = {.m = m, .n = n, .args = args};
+  pool_run(pl, slots, pool_grain(pl, slots), foreach_range, &job);
+}
@@ -0,0 +1,177 @@
+/*------------------------------------------------------------------------------
+ * Pipeline traversal strategy.
+ *
+ *  source el --> filter --> map --> filter --> map --> sink (fold, count...)
+ *                  |         |                  |
+ *                 drop    scratch a          scratch b    a, b alternate
+ *
+ * Building a pipeline only records the stages. The terminal operation walks
+ * the source once and pushes every element through all the stages before
+ * touching the next, so nothing in between is stored. A map stage writes into
+ * one of two scratch slots, the one its input is not in, so each stage reads
+ * the previous one's output in place. The scratch comes from libc and is
+ * freed when the walk ends. The source's allocator belongs to one thread,
+ * while a pipeline only reads and may run on any.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+
+#define FROM_VEC 0
+#define FROM_MAP 1
+#define FROM_SET 2
+
+typedef struct fold_sink fold_sink;
+struct fold_sink {
+  _binary b;
+  void   *result, *args;
+};
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void      init_asserts(pipeline *p);
+static pipeline *pipe_source(pipeline *p, int32_t source, void *from,
+                             int64_t el_size);
+static pipeline *add_stage(pipeline *p, pipe_stage stage);
+static int64_t   slot_size(int64_t el_size);
+static void      drain(pipeline *p, void *el, char *scratch, _each sink,
+                       void *args);
+static void      run(pipeline *p, _each sink, void *args);
+static void      fold_el(void *el, void *args);
+static void      count_el(void *el, void *args);
+static void      collect_el(void *el, void *args);
+
+static void init_asserts(pipeline *p) {
+  assert(p);
+  assert(p->from);
+  assert(p->stages >= 0 && p->stages <= PIPE_MAX_STAGES);
+}
+
+static pipeline *pipe_source(pipeline *p, int32_t source, void *from,
+                             int64_t el_size) {
+  assert(from);
+  p->source = source;
+  p->from = from;
+  p->el_size = el_size;
+  p->max_size = slot_size(el_size);
+  p->stages = 0;
+  return p;
+}
+
+static pipeline *add_stage(pipeline *p, pipe_stage stage) {
+  init_asserts(p);
+  assert(p->stages < PIPE_MAX_STAGES && "See PIPE_MAX_STAGES.");
+  p->stage[p->stages++] = stage;
+  return p;
+}
+
+/* Scratch slots are rounded up so the second one stays as aligned as the
+   block they share. */
+static int64_t slot_size(int64_t el_size) { return (el_size + 15) & ~15; }
+
+static void drain(pipeline *p, void *el, char *scratch, _each sink,
+                  void *args) {
+  for (int32_t i = 0; i < p->stages; i++) {
+    pipe_stage *stage = &p->stage[i];
+    if (stage->p) {
+      if (!stage->p(el, stage->args)) return;
+      continue;
+    }
+
+    void *out = el == scratch ? scratch + p->max_size : scratch;
+    stage->u(out, el, stage->args);
+    el = out;
+  }
+  sink(el, args);
+}
+
+static void run(pipeline *p, _each sink, void *args) {
+  init_asserts(p);
+
+  /* Two scratch slots for map stages, then room for a set key. Taken from
+     the heap so a sink may push to the stack (collect growing a vec). */
+  char *scratch = halloc_uninit(NULL, p->max_size * 3);
+
+  if (p->source == FROM_VEC) {
+    vec *v = p->from;
+    for (int64_t i = 0; i < v->length; i++)
+      drain(p, vec_at_unchecked(v, i), scratch, sink, args);
+  } else if (p->source == FROM_MAP) {
+    kvpair  kv;
+    int64_t cursor = 0;
+    while (map_next(p->from, &cursor, &kv))
+      drain(p, &kv, scratch, sink, args);
+  } else {
+    void   *key = scratch + p->max_size * 2;
+    int64_t cursor = 0;
+    while (set_next(p->from, &cursor, key))
+      drain(p, key, scratch, sink, args);
+  }
+
+  hfree(NULL, scratch);
+}
+
+static void fold_el(void *el, void *args) {
+  fold_sink *fold = args;
+  fold->b(fold->result, fold->result, el, fold->args);
+}
+
+static void count_el(void *el, void *args) { (*(int64_t *)args)++; }
+
+static void collect_el(void *el, void *args) { vec_push(args, el); }
+
+/* Sources */
+pipeline *pipe_from_vec(pipeline *p, vec *v) {
+  return pipe_source(p, FROM_VEC, v, v->__el_size);
+}
+
+pipeline *pipe_from_map(pipeline *p, map *m) {
+  return pipe_source(p, FROM_MAP, m, sizeof(kvpair));
+}
+
+pipeline *pipe_from_set(pipeline *p, set *s) {
+  return pipe_source(p, FROM_SET, s, s->internals.__key_size);
+}
+
+/* Stages */
+pipeline *pipe_filter(pipeline *p, _pred pr, void *args) {
+  assert(pr);
+  return add_stage(p, (pipe_stage){.p = pr, .args = args});
+}
+
+pipeline *pipe_map(pipeline *p, _unary u, int64_t out_size, void *args) {
+  assert(u);
+  if (out_size <= 0) out_size = p->el_size;
+  add_stage(p, (pipe_stage){.u = u, .args = args});
+
+  p->el_size = out_size;
+  if (slot_size(out_size) > p->max_size) p->max_size = slot_size(out_size);
+  return p;
+}
+
+/* Terminals */
+void *pipe_fold(pipeline *p, _binary b, void *result, void *args) {
+  assert(b);
+  assert(result);
+  fold_sink fold = {.b = b, .result = result, .args = args};
+  run(p, fold_el, &fold);
+  return result;
+}
+
+int64_t pipe_count(pipeline *p) {
+  int64_t count = 0;
+  run(p, count_el, &count);
+  return count;
+}
+
+void pipe_foreach(pipeline *p, _each n, void *args) {
+  assert(n);
+  run(p, n, args);
+}
+
+vec *pipe_collect(pipeline *p, vec *out) {
+  assert(out);
+  assert(out->__el_size == p->el_size && "out must hold the last stage type");
+  run(p, collect_el, out);
+  return out;
+}
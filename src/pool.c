@@ -0,0 +1,194 @@
+/*------------------------------------------------------------------------------
+ * Pool work splitting strategy.
+ *
+ *  chunks  +----+----+----+----+----+----+----+----+----+----+----+----+
+ *          | 0  | 1  | 2  | 3  | 4  | 5  | 6  | 7  | 8  | 9  | 10 | 11 |
+ *          +----+----+----+----+----+----+----+----+----+----+----+----+
+ *  spans     worker 0 next..end | worker 1          | worker 2          |
+ *
+ * A run cuts [0, n) into chunks of grain elements and hands every worker an
+ * equal span of them. A span is just an atomic next chunk and an end, so
+ * taking a chunk is one fetch add. A worker drains its own span first and then
+ * steals from the spans after it with the same fetch add, so uneven chunks
+ * balance out without any locking on the hot path.
+ *
+ * The calling thread is worker 0 and works the run alongside the pool
+ * threads, which sleep on a condition variable between runs. Every chunk runs
+ * inside a frame on the worker's own arena, which is also its frame context.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+#include <unistd.h>
+
+#define CHUNKS_PER_WORKER 8 /* Slack pool_grain leaves for stealing */
+
+typedef struct pool_span pool_span;
+struct pool_span {
+  _Alignas(CACHE_LINE_SIZE) _Atomic int64_t next; /* Next chunk to take */
+  int64_t end;
+};
+
+typedef struct pool_thread pool_thread;
+struct pool_thread {
+  pthread_t thread;
+  pool     *pool;
+  int32_t   id;
+};
+
+struct pool {
+  int32_t      workers; /* Counting the thread calling pool_run. */
+  pool_thread *threads; /* workers - 1 of them, ids 1 and up. */
+  pool_span   *spans;   /* One per worker. */
+
+  pthread_mutex_t lock;
+  pthread_cond_t  wake, done;
+  int64_t         generation; /* Bumped every run, threads wait for a new one */
+  int32_t         running;    /* Threads still working the current run */
+  bool            stop;
+
+  /* The current run. */
+  int64_t n, grain;
+  _range  fn;
+  void   *args;
+};
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void  work(pool *p, int32_t self);
+static void *thread_main(void *arg);
+
+static void work(pool *p, int32_t self) {
+  stalloc *alloc = get_frame_ctx();
+  if (alloc == NULL) alloc = stalloc_thread_local(STALLOC_DEFAULT);
+
+  for (int32_t k = 0; k < p->workers; k++) {
+    pool_span *span = &p->spans[(self + k) % p->workers];
+    for (;;) {
+      int64_t chunk =
+          atomic_fetch_add_explicit(&span->next, 1, memory_order_relaxed);
+      if (chunk >= span->end) break;
+
+      int64_t begin = chunk * p->grain;
+      int64_t end = begin + p->grain < p->n ? begin + p->grain : p->n;
+      FRAME(alloc, p->fn(begin, end, p->args));
+    }
+  }
+}
+
+static void *thread_main(void *arg) {
+  pool_thread *t = arg;
+  pool        *p = t->pool;
+  int64_t      seen = 0;
+
+  /* Done first so the arena is this thread's frame context for every run. */
+  stalloc_thread_local(STALLOC_DEFAULT);
+
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->generation == seen && !p->stop)
+      pthread_cond_wait(&p->wake, &p->lock);
+    if (p->stop) break;
+    seen = p->generation;
+    pthread_mutex_unlock(&p->lock);
+
+    work(p, t->id);
+
+    pthread_mutex_lock(&p->lock);
+    if (--p->running == 0) pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+pool *pool_create(int32_t workers) {
+  if (workers <= 0) workers = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers <= 0) workers = 1;
+
+  pool *p = calloc(1, sizeof(*p));
+  assert(p);
+  p->workers = workers;
+  p->spans = aligned_alloc(CACHE_LINE_SIZE, workers * sizeof(pool_span));
+  p->threads = calloc(workers, sizeof(pool_thread));
+  assert(p->spans && p->threads);
+
+  for (int32_t w = 0; w < workers; w++) {
+    atomic_init(&p->spans[w].next, 0);
+    p->spans[w].end = 0;
+  }
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->wake, NULL);
+  pthread_cond_init(&p->done, NULL);
+
+  for (int32_t w = 1; w < workers; w++) {
+    pool_thread *t = &p->threads[w - 1];
+    t->pool = p;
+    t->id = w;
+    int err = pthread_create(&t->thread, NULL, thread_main, t);
+    assert(err == 0 && "Failed to start a pool thread.");
+    (void)err;
+  }
+  return p;
+}
+
+void pool_free(pool *p) {
+  pthread_mutex_lock(&p->lock);
+  p->stop = true;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+
+  for (int32_t w = 1; w < p->workers; w++)
+    pthread_join(p->threads[w - 1].thread, NULL);
+
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->wake);
+  pthread_cond_destroy(&p->done);
+  free(p->spans);
+  free(p->threads);
+  free(p);
+}
+
+int32_t pool_workers(pool *p) { return p->workers; }
+
+int64_t pool_grain(pool *p, int64_t n) {
+  int64_t grain = n / ((int64_t)p->workers * CHUNKS_PER_WORKER);
+  return grain < POOL_MIN_GRAIN ? POOL_MIN_GRAIN : grain;
+}
+
+void pool_run(pool *p, int64_t n, int64_t grain, _range fn, void *args) {
+  assert(p);
+  assert(fn);
+  assert(grain > 0);
+  if (n <= 0) return;
+
+  int64_t chunks = (n + grain - 1) / grain;
+  p->n = n;
+  p->grain = grain;
+  p->fn = fn;
+  p->args = args;
+  for (int32_t w = 0; w < p->workers; w++) {
+    atomic_store_explicit(&p->spans[w].next, chunks * w / p->workers,
+                          memory_order_relaxed);
+    p->spans[w].end = chunks * (w + 1) / p->workers;
+  }
+
+  /* Not worth waking anyone for a single chunk. */
+  if (p->workers == 1 || chunks == 1) {
+    work(p, 0);
+    return;
+  }
+
+  /* The lock publishes the run to the threads as they wake. */
+  pthread_mutex_lock(&p->lock);
+  p->running = p->workers - 1;
+  p->generation++;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+
+  work(p, 0);
+
+  pthread_mutex_lock(&p->lock);
+  while (p->running) pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,270 @@
+/*------------------------------------------------------------------------------
+ * Queue memory layout strategy.
+ *
+ *  queue    +---+---+---+---+---+---+---+---+
+ *           | e | f |   |   |   | b | c | d |   capacity is a power of two
+ *           +---+---+---+---+---+---+---+---+
+ *                 ^ tail          ^ head        slot i is (head + i) & mask
+ *
+ * The plain queue is a ring over a vec that doubles when full. Growing moves
+ * the wrapped part (e, f) past the old end so the ring is contiguous again.
+ *
+ * spsc and mpmc are bounded rings for passing elements between threads, their
+ * memory comes from halloc since a stack frame belongs to one thread. Both
+ * count positions up forever and mask them down to a slot.
+ *
+ * spsc: The producer owns tail and the consumer owns head, each on its own
+ *       cache line. Each side keeps a private copy of the other's index and
+ *       only reloads it when the ring looks full or empty.
+ *
+ * mpmc: Dmitry Vyukov's bounded queue. Every slot carries a sequence number
+ *       saying whose turn it is. A producer claims position p when its slot
+ *       reads p and publishes p + 1, a consumer then takes it and publishes
+ *       p + capacity for the producer one lap later.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+
+typedef struct mpmc_cell mpmc_cell;
+struct mpmc_cell {
+  _Atomic int64_t sequence;
+  /* el_size bytes of element follow, see cell_data. */
+};
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void       init_asserts(queue *q);
+static int64_t    ring_size(int64_t capacity);
+static void      *slot_at(queue *q, int64_t i);
+static void       grow(queue *q);
+static mpmc_cell *cell_at(mpmc *q, int64_t pos);
+static void      *cell_data(mpmc_cell *cell);
+
+static void init_asserts(queue *q) {
+  assert(q);
+  assert(q->elements.elements);
+  assert((q->elements.length & (q->elements.length - 1)) == 0);
+}
+
+static int64_t ring_size(int64_t capacity) {
+  int64_t size = 1;
+  while (size < capacity) size <<= 1;
+  return size;
+}
+
+static void *slot_at(queue *q, int64_t i) {
+  return vec_at(&q->elements, (q->head + i) & (q->elements.length - 1));
+}
+
+static void grow(queue *q) {
+  int64_t old = q->elements.length;
+  vec_resize(&q->elements, old * 2);
+
+  /* Slots [0, wrapped) hold the back of the ring, they now go after old. */
+  int64_t wrapped = q->head + q->count - old;
+  if (wrapped > 0)
+    memcpy(vec_at(&q->elements, old), vec_at(&q->elements, 0),
+           wrapped * q->elements.__el_size);
+}
+
+static mpmc_cell *cell_at(mpmc *q, int64_t pos) {
+  return (mpmc_cell *)((char *)q->cells + (pos & q->mask) * q->stride);
+}
+
+static void *cell_data(mpmc_cell *cell) { return cell + 1; }
+
+queue *__queue_init(queue *q, int64_t el_size, stalloc *alloc, int32_t flags,
+                    int64_t initial_size) {
+  assert(el_size > 0);
+  assert(alloc);
+  int64_t size = ring_size(initial_size < 1 ? 1 : initial_size);
+
+  __vec_init(&q->elements, el_size, alloc, flags, size);
+  vec_resize(&q->elements, size);
+  q->head = 0;
+  q->count = 0;
+  return q;
+}
+
+void queue_free(queue *q) { vec_free(&q->elements); }
+void queue_clear(queue *q) {
+  init_asserts(q);
+  q->head = 0;
+  q->count = 0;
+}
+queue *queue_copy(queue *dest, queue *src) {
+  init_asserts(src);
+  memmove(dest, src, sizeof(*src));
+  vec_copy(&dest->elements, &src->elements);
+  return dest;
+}
+int64_t queue_length(queue *q) { return q->count; }
+
+/* Element Operations */
+void queue_push(queue *q, void *el) {
+  init_asserts(q);
+  assert(el);
+  if (q->count == q->elements.length) grow(q);
+  memcpy(slot_at(q, q->count), el, q->elements.__el_size);
+  q->count++;
+}
+
+void queue_pop(queue *q, void *out) {
+  init_asserts(q);
+  assert(q->count > 0 && "Pop from an empty queue.");
+  if (out) memcpy(out, slot_at(q, 0), q->elements.__el_size);
+  q->head = (q->head + 1) & (q->elements.length - 1);
+  q->count--;
+}
+
+void *queue_peek(queue *q) {
+  init_asserts(q);
+  if (!q->count) return NULL;
+  return slot_at(q, 0);
+}
+
+void *queue_at(queue *q, int64_t i) {
+  init_asserts(q);
+  assert(i >= 0 && i < q->count);
+  return slot_at(q, i);
+}
+
+/*-------------------------------------------------------
+ * Single Producer Single Consumer
+ *-------------------------------------------------------*/
+spsc *__spsc_init(spsc *q, int64_t el_size, stalloc *alloc,
+                  int64_t capacity) {
+  assert(el_size > 0);
+  assert(alloc);
+  int64_t size = ring_size(capacity < 1 ? 1 : capacity);
+
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  q->tail_cache = 0;
+  q->head_cache = 0;
+  q->mask = size - 1;
+  q->el_size = el_size;
+  q->allocator = alloc;
+  q->slots = halloc_uninit(alloc, size * el_size);
+  return q;
+}
+
+void spsc_free(spsc *q) { hfree(q->allocator, q->slots); }
+
+bool spsc_push(spsc *q, void *el) {
+  int64_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  if (tail - q->head_cache > q->mask) {
+    q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - q->head_cache > q->mask) return false;
+  }
+
+  memcpy((char *)q->slots + (tail & q->mask) * q->el_size, el, q->el_size);
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+bool spsc_pop(spsc *q, void *out) {
+  int64_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  if (head == q->tail_cache) {
+    q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == q->tail_cache) return false;
+  }
+
+  if (out)
+    memcpy(out, (char *)q->slots + (head & q->mask) * q->el_size, q->el_size);
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return true;
+}
+
+int64_t spsc_length(spsc *q) {
+  int64_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+  int64_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  return tail - head;
+}
+
+/*-------------------------------------------------------
+ * Multi Producer Multi Consumer
+ *-------------------------------------------------------*/
+mpmc *__mpmc_init(mpmc *q, int64_t el_size, stalloc *alloc,
+                  int64_t capacity) {
+  assert(el_size > 0);
+  assert(alloc);
+
+  /* Vyukov's sequence scheme needs at least two slots to tell a full ring
+     from an empty one. */
+  int64_t size = ring_size(capacity < 2 ? 2 : capacity);
+  int64_t align = sizeof(mpmc_cell);
+
+  atomic_init(&q->enqueue_pos, 0);
+  atomic_init(&q->dequeue_pos, 0);
+  q->mask = size - 1;
+  q->el_size = el_size;
+  q->stride = (sizeof(mpmc_cell) + el_size + align - 1) / align * align;
+  q->allocator = alloc;
+  q->cells = halloc_uninit(alloc, size * q->stride);
+
+  for (int64_t i = 0; i < size; i++)
+    atomic_init(&cell_at(q, i)->sequence, i);
+  return q;
+}
+
+void mpmc_free(mpmc *q) { hfree(q->allocator, q->cells); }
+
+bool mpmc_push(mpmc *q, void *el) {
+  int64_t    pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  mpmc_cell *cell;
+  for (;;) {
+    cell = cell_at(q, pos);
+    int64_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    int64_t dif = seq - pos;
+
+    if (dif == 0) {
+      /* The slot is free this lap, claim it. A failed exchange reloads pos. */
+      if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      return false; /* The consumer a lap behind has not freed it, full. */
+    } else {
+      pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    }
+  }
+
+  memcpy(cell_data(cell), el, q->el_size);
+  atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+  return true;
+}
+
+bool mpmc_pop(mpmc *q, void *out) {
+  int64_t    pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+  mpmc_cell *cell;
+  for (;;) {
+    cell = cell_at(q, pos);
+    int64_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    int64_t dif = seq - (pos + 1);
+
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      return false; /* Nothing was published here yet, empty. */
+    } else {
+      pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    }
+  }
+
+  if (out) memcpy(out, cell_data(cell), q->el_size);
+  atomic_store_explicit(&cell->sequence, pos + q->mask + 1,
+                        memory_order_release);
+  return true;
+}
+
+int64_t mpmc_length(mpmc *q) {
+  int64_t head = atomic_load_explicit(&q->dequeue_pos, memory_order_acquire);
+  int64_t tail = atomic_load_explicit(&q->enqueue_pos, memory_order_acquire);
+  return tail > head ? tail - head : 0;
+}
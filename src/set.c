@@ -1,85 +1,474 @@
 #include "csdsa.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /* Since the set is built on the map structure, we must have some data for a
    value to be stored. */
 #define VALUE_SIZE sizeof(int8_t)
 int8_t dead_value = 0;
 
+/* Sparse sets map member ids to dense positions with these. */
+typedef int32_t sparse_idx;
+
+/* Bitset sets keep one bit per id in words of this size. */
+typedef uint64_t bit_word;
+#define WORD_BITS  64
+#define SET_LAYOUT (SET_SPARSE | SET_BITSET)
+
 /*-------------------------------------------------------
  * Static Functions
  *-------------------------------------------------------*/
-static void init_asserts(set *s);
+static void      init_asserts(set *s);
+static bool      is_sparse(set *s);
+static bool      is_bitset(set *s);
+static uint64_t  sparse_id(set *s, void *key);
+static int64_t   sparse_find(set *s, uint64_t id);
+static bit_word *words(set *s);
+static void      words_grow(set *s, int64_t count);
+static void      words_and(bit_word *dest, bit_word *src, int64_t count);
+static void      words_or(bit_word *dest, bit_word *src, int64_t count);
+static bool      layout_valid(snapshot *snap);
 
 static void init_asserts(set *s) {
   assert(s);
   assert(s->internals.allocator);
-  assert(s->internals.elements.elements);
+  if (is_sparse(s)) {
+    assert(s->dense.elements);
+    assert(s->sparse.elements);
+  } else if (is_bitset(s)) {
+    assert(s->bits.elements);
+  } else {
+    assert(s->internals.elements.elements);
+  }
+}
+
+static bool is_sparse(set *s) { return s->internals.flags & SET_SPARSE; }
+static bool is_bitset(set *s) { return s->internals.flags & SET_BITSET; }
+
+static uint64_t sparse_id(set *s, void *key) {
+  uint64_t id = 0;
+  memcpy(&id, key, s->internals.__key_size);
+  return id;
+}
+
+static int64_t sparse_find(set *s, uint64_t id) {
+  /* The classic check: the sparse slot must point at a dense entry that
+     points back, whatever else the sparse array holds. */
+  if (id >= (uint64_t)s->sparse.length) return -1;
+  sparse_idx idx = *(sparse_idx *)vec_at(&s->sparse, id);
+  if (idx < 0 || idx >= s->dense.length) return -1;
+  if (sparse_id(s, vec_at(&s->dense, idx)) != id) return -1;
+  return idx;
+}
+
+static bit_word *words(set *s) { return (bit_word *)s->bits.elements; }
+
+static void words_grow(set *s, int64_t count) {
+  int64_t old = s->bits.length;
+  if (count <= old) return;
+
+  /* Words past the old length are fresh ids, never members, even when the
+     set was made with ALLOC_UNINIT. */
+  vec_resize(&s->bits, count);
+  memset(words(s) + old, 0, (count - old) * sizeof(bit_word));
+}
+
+static void words_and(bit_word *dest, bit_word *src, int64_t count) {
+  int64_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 2 <= count; i += 2) {
+    __m128i d = _mm_loadu_si128((__m128i *)(dest + i));
+    __m128i s = _mm_loadu_si128((__m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dest + i), _mm_and_si128(d, s));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 2 <= count; i += 2)
+    vst1q_u64(dest + i, vandq_u64(vld1q_u64(dest + i), vld1q_u64(src + i)));
+#endif
+  for (; i < count; i++) dest[i] &= src[i];
+}
+
+static void words_or(bit_word *dest, bit_word *src, int64_t count) {
+  int64_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 2 <= count; i += 2) {
+    __m128i d = _mm_loadu_si128((__m128i *)(dest + i));
+    __m128i s = _mm_loadu_si128((__m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dest + i), _mm_or_si128(d, s));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 2 <= count; i += 2)
+    vst1q_u64(dest + i, vorrq_u64(vld1q_u64(dest + i), vld1q_u64(src + i)));
+#endif
+  for (; i < count; i++) dest[i] |= src[i];
 }
 
 set *__set_init(set *s, int64_t el_size, stalloc *alloc, int32_t flags,
                 int64_t initial_size) {
   assert(el_size > 0);
   assert(alloc);
+  assert((flags & SET_LAYOUT) != SET_LAYOUT && "Pick one set layout.");
+
+  if (!(flags & SET_LAYOUT)) {
+    __map_init(&s->internals, VALUE_SIZE, el_size, alloc, flags, initial_size);
+    return s;
+  }
 
-  assert(__map_init(&s->internals, VALUE_SIZE, el_size, alloc, flags,
-                    initial_size) != NULL);
+  /* Integer sets only borrow the map's bookkeeping fields, not its table. */
+  assert(el_size <= (int64_t)sizeof(uint64_t) &&
+         "Sparse and bitset sets need integer keys.");
+  memset(&s->internals, 0, sizeof(s->internals));
+  s->internals.__key_size = el_size;
+  s->internals.allocator = alloc;
+  s->internals.flags = flags;
+
+  if (initial_size < 1) initial_size = 1;
+  if (flags & SET_BITSET) {
+    /* Here the initial size is the id universe, rounded up to full words. */
+    int64_t count = (initial_size + WORD_BITS - 1) / WORD_BITS;
+    __vec_init(&s->bits, sizeof(bit_word), alloc, flags, count);
+    return s;
+  }
+  __vec_init(&s->dense, el_size, alloc, flags, initial_size);
+  __vec_init(&s->sparse, sizeof(sparse_idx), alloc, flags, initial_size);
   return s;
 }
 
-void set_free(set *s) { map_free(&s->internals); }
-void set_clear(set *s) { map_clear(&s->internals); }
+void set_free(set *s) {
+  if (is_bitset(s)) {
+    vec_free(&s->bits);
+    return;
+  }
+  if (!is_sparse(s)) {
+    map_free(&s->internals);
+    return;
+  }
+  vec_free(&s->dense);
+  vec_free(&s->sparse);
+}
+void set_clear(set *s) {
+  if (is_bitset(s)) {
+    vec_clear(&s->bits); /* Regrowing zeroes the words again. */
+    return;
+  }
+  if (!is_sparse(s)) {
+    map_clear(&s->internals);
+    return;
+  }
+  vec_clear(&s->dense); /* Stale sparse slots fail the back check. */
+}
 set *set_copy(set *dest, set *src) {
-  map_copy(&dest->internals, &src->internals);
+  if (is_bitset(src)) {
+    memmove(dest, src, sizeof(*src));
+    vec_copy(&dest->bits, &src->bits);
+    return dest;
+  }
+  if (!is_sparse(src)) {
+    map_copy(&dest->internals, &src->internals);
+    return dest;
+  }
+  memmove(dest, src, sizeof(*src));
+  vec_copy(&dest->dense, &src->dense);
+  vec_copy(&dest->sparse, &src->sparse);
   return dest;
 }
-int64_t set_length(set *s) { return map_load(&s->internals); }
+bool set_save(set *s, int fd) {
+  init_asserts(s);
+  snapshot snap = {.kind = SNAPSHOT_SET};
+  if (!is_sparse(s) && !is_bitset(s)) {
+    __map_snapshot(&s->internals, &snap);
+    return __snapshot_save(&snap, fd);
+  }
+
+  snap.flags = s->internals.flags;
+  snap.key_size = s->internals.__key_size;
+  if (is_bitset(s)) {
+    snap.sections = 1;
+    snap.section[0] = s->bits;
+  } else {
+    snap.sections = 2;
+    snap.section[0] = s->dense;
+    snap.section[1] = s->sparse;
+  }
+  return __snapshot_save(&snap, fd);
+}
+
+/* __snapshot_open checked the file against itself, this checks it holds a
+   set that sparse_id and the bit words can read without overrunning. */
+static bool layout_valid(snapshot *snap) {
+  if ((snap->flags & SET_LAYOUT) == SET_LAYOUT) return false;
+  if (snap->key_size < 1 || snap->key_size > (int64_t)sizeof(uint64_t))
+    return false;
+  if (snap->flags & SET_BITSET)
+    return snap->sections == 1 &&
+           snap->section[0].__el_size == sizeof(bit_word);
+  return snap->sections == 2 && snap->section[0].__el_size == snap->key_size &&
+         snap->section[1].__el_size == sizeof(sparse_idx);
+}
+
+set *set_mmap_open(set *s, const char *path, stalloc *alloc) {
+  snapshot snap;
+  if (!__snapshot_open(&snap, path, SNAPSHOT_SET, alloc)) return NULL;
+  if (!(snap.flags & SET_LAYOUT))
+    return __map_from_snapshot(&s->internals, &snap, hash_bytes) ? s : NULL;
+
+  if (!layout_valid(&snap)) {
+    vec_free(&snap.section[0]);
+    return NULL;
+  }
 
-feach(intersects, kvpair, item, {
-  void *key = item.key;
-  set  *out = ((void **)args)[0];
-  set  *b = ((void **)args)[1];
+  memset(&s->internals, 0, sizeof(s->internals));
+  s->internals.__key_size = snap.key_size;
+  s->internals.allocator = alloc;
+  s->internals.flags = snap.flags & ~TO_HEAP;
+  if (snap.flags & SET_BITSET) {
+    s->bits = snap.section[0];
+  } else {
+    s->dense = snap.section[0];
+    s->sparse = snap.section[1];
+  }
+  return s;
+}
+
+int64_t set_length(set *s) {
+  if (is_bitset(s)) {
+    int64_t count = 0;
+    for (int64_t i = 0; i < s->bits.length; i++)
+      count += __builtin_popcountll(words(s)[i]);
+    return count;
+  }
+  return is_sparse(s) ? s->dense.length : map_load(&s->internals);
+}
+
+static void intersects(void *key, void *args) {
+  set *out = ((void **)args)[0];
+  set *b = ((void **)args)[1];
   if (set_has(b, key)) set_put(out, key);
-});
+}
 set *set_intersect(set *a, set *b, set *out) {
   assert(a->internals.__key_size == b->internals.__key_size);
   init_asserts(a);
   init_asserts(b);
 
-  /* Out can only be as big as the smallest of a and b */
-  int64_t min = set_length(a);
-  int64_t other = set_length(b);
-  if (other < min) min = other;
+  if (is_bitset(a) && is_bitset(b)) {
+    set_copy(out, a);
+    return set_intersect_into(out, b);
+  }
+
+  /* Walk the smaller set and probe the larger, out can be no bigger. */
+  set *small = a, *large = b;
+  if (set_length(b) < set_length(a)) {
+    small = b;
+    large = a;
+  }
 
   __set_init(out, a->internals.__key_size, a->internals.allocator,
-             a->internals.flags, min);
+             a->internals.flags, set_length(small));
 
   void *args[2];
   args[0] = out;
-  args[1] = b;
-  map_foreach(&a->internals, intersects, args);
+  args[1] = large;
+  set_foreach(small, intersects, args);
   return out;
 }
 
-static feach(add_to_set, kvpair, item, {
-  void *key = item.key;
-  set  *out = args;
-  set_put(out, key);
-});
+static void add_to_set(void *key, void *args) { set_put(args, key); }
 set *set_union(set *a, set *b, set *out) {
   init_asserts(a);
   init_asserts(b);
   assert(a->internals.__key_size == b->internals.__key_size);
 
+  /* When both sets match, copying the larger one moves its table without
+     rehashing a single key and only the smaller one gets inserted. */
+  if (a->internals.flags == b->internals.flags &&
+      a->internals.allocator == b->internals.allocator) {
+    set *small = a, *large = b;
+    if (!is_bitset(a) && set_length(b) < set_length(a)) {
+      small = b;
+      large = a;
+    }
+    set_copy(out, large);
+    return set_union_into(out, small);
+  }
+
   __set_init(out, a->internals.__key_size, a->internals.allocator,
-             a->internals.flags,
-             map_load(&a->internals) + map_load(&b->internals));
+             a->internals.flags, set_length(a) + set_length(b));
 
-  map_foreach(&a->internals, add_to_set, out);
-  map_foreach(&b->internals, add_to_set, out);
+  set_foreach(a, add_to_set, out);
+  set_foreach(b, add_to_set, out);
   return out;
 }
 
+static pred(key_in_set, kvpair, item, { return set_has(args, item.key); });
+set *set_intersect_into(set *a, set *b) {
+  init_asserts(a);
+  init_asserts(b);
+  assert(a->internals.__key_size == b->internals.__key_size);
+
+  if (is_bitset(a) && is_bitset(b)) {
+    int64_t shared = a->bits.length;
+    if (b->bits.length < shared) shared = b->bits.length;
+    words_and(words(a), words(b), shared);
+    a->bits.length = shared; /* Past b every word would be zero anyway. */
+    return a;
+  }
+
+  if (is_bitset(a)) {
+    for (int64_t i = 0; i < a->bits.length; i++) {
+      bit_word word = words(a)[i];
+      while (word) {
+        int32_t  bit = __builtin_ctzll(word);
+        uint64_t id = i * WORD_BITS + bit;
+        if (!set_has(b, &id)) words(a)[i] &= ~((bit_word)1 << bit);
+        word &= word - 1;
+      }
+    }
+    return a;
+  }
+
+  if (is_sparse(a)) {
+    /* Walking down means a deletion only swaps in members already kept. */
+    for (int64_t i = a->dense.length - 1; i >= 0; i--) {
+      void *key = vec_at(&a->dense, i);
+      if (!set_has(b, key)) set_del(a, key);
+    }
+    return a;
+  }
+
+  map_filter(&a->internals, key_in_set, b);
+  return a;
+}
+
+set *set_union_into(set *a, set *b) {
+  init_asserts(a);
+  init_asserts(b);
+  assert(a->internals.__key_size == b->internals.__key_size);
+
+  if (is_bitset(a) && is_bitset(b)) {
+    words_grow(a, b->bits.length);
+    words_or(words(a), words(b), b->bits.length);
+    return a;
+  }
+
+  set_foreach(b, add_to_set, a);
+  return a;
+}
+
+static feach(each_key, kvpair, item, {
+  _each n = ((void **)args)[0];
+  n(item.key, ((void **)args)[1]);
+});
+void set_foreach(set *s, _each n, void *args) {
+  init_asserts(s);
+  if (is_bitset(s)) {
+    for (int64_t i = 0; i < s->bits.length; i++) {
+      for (bit_word word = words(s)[i]; word; word &= word - 1) {
+        uint64_t id = i * WORD_BITS + __builtin_ctzll(word);
+        n(&id, args);
+      }
+    }
+    return;
+  }
+  if (!is_sparse(s)) {
+    void *each_args[2] = {n, args};
+    map_foreach(&s->internals, each_key, each_args);
+    return;
+  }
+
+  /* Only live members are visited, packed one after the other. */
+  for (int64_t i = 0; i < s->dense.length; i++) n(vec_at(&s->dense, i), args);
+}
+
+bool set_next(set *s, int64_t *cursor, void *key) {
+  init_asserts(s);
+  int64_t key_size = s->internals.__key_size;
+
+  if (is_bitset(s)) {
+    /* The cursor is the next id to test, whole empty words are skipped. */
+    for (int64_t i = *cursor / WORD_BITS; i < s->bits.length; i++) {
+      bit_word word = words(s)[i];
+      if (i == *cursor / WORD_BITS)
+        word &= ~(bit_word)0 << (*cursor % WORD_BITS);
+      if (!word) continue;
+
+      uint64_t id = i * WORD_BITS + __builtin_ctzll(word);
+      memcpy(key, &id, key_size);
+      *cursor = id + 1;
+      return true;
+    }
+    return false;
+  }
+  if (!is_sparse(s)) {
+    kvpair kv;
+    if (!map_next(&s->internals, cursor, &kv)) return false;
+    memcpy(key, kv.key, key_size);
+    return true;
+  }
+
+  if (*cursor >= s->dense.length) return false;
+  memcpy(key, vec_at(&s->dense, *cursor), key_size);
+  (*cursor)++;
+  return true;
+}
+
 /* Element Operations */
-void set_put(set *s, void *key) { map_put(&s->internals, key, &dead_value); }
-bool set_has(set *s, void *key) { return map_has(&s->internals, key); }
-void set_del(set *s, void *key) { map_del(&s->internals, key); }
\ No newline at end of file
+void set_put(set *s, void *key) {
+  if (is_bitset(s)) {
+    uint64_t id = sparse_id(s, key);
+    words_grow(s, id / WORD_BITS + 1);
+    words(s)[id / WORD_BITS] |= (bit_word)1 << (id % WORD_BITS);
+    return;
+  }
+  if (!is_sparse(s)) {
+    map_put(&s->internals, key, &dead_value);
+    return;
+  }
+
+  uint64_t id = sparse_id(s, key);
+  if (sparse_find(s, id) != -1) return;
+  assert(s->dense.length < INT32_MAX && "Sparse set is full.");
+
+  if (id >= (uint64_t)s->sparse.length) vec_resize(&s->sparse, id + 1);
+  sparse_idx idx = s->dense.length;
+  memcpy(vec_at(&s->sparse, id), &idx, sizeof(idx));
+  vec_push(&s->dense, key);
+}
+bool set_has(set *s, void *key) {
+  if (is_bitset(s)) {
+    uint64_t id = sparse_id(s, key);
+    if (id / WORD_BITS >= (uint64_t)s->bits.length) return false;
+    return words(s)[id / WORD_BITS] >> (id % WORD_BITS) & 1;
+  }
+  if (!is_sparse(s)) return map_has(&s->internals, key);
+  return sparse_find(s, sparse_id(s, key)) != -1;
+}
+void set_del(set *s, void *key) {
+  if (is_bitset(s)) {
+    uint64_t id = sparse_id(s, key);
+    if (id / WORD_BITS >= (uint64_t)s->bits.length) return;
+    words(s)[id / WORD_BITS] &= ~((bit_word)1 << (id % WORD_BITS));
+    return;
+  }
+  if (!is_sparse(s)) {
+    map_del(&s->internals, key);
+    return;
+  }
+
+  int64_t idx = sparse_find(s, sparse_id(s, key));
+  if (idx == -1) return;
+
+  /* Move the last member into the hole to keep the dense array packed. */
+  int64_t last = s->dense.length - 1;
+  if (idx != last) {
+    void *moved = vec_at(&s->dense, last);
+    vec_put(&s->dense, idx, moved);
+    sparse_idx new_idx = idx;
+    memcpy(vec_at(&s->sparse, sparse_id(s, moved)), &new_idx,
+           sizeof(new_idx));
+  }
+  vec_pop(&s->dense);
+}
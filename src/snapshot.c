@@ -0,0 +1,186 @@
+/*------------------------------------------------------------------------------
+ * Snapshot file layout strategy.
+ *
+ *  file  +--------------+-----------------+---+-----------------+---+
+ *        | header       | section 0       |pad| section 1       |pad|
+ *        +--------------+-----------------+---+-----------------+---+
+ *         SNAPSHOT_HEADER_SIZE, then every section on a cache line
+ *
+ * A snapshot is a container's bookkeeping followed by the raw element arrays
+ * of its vecs, exactly as they sit in memory. Slots hold keys and values
+ * inline and no pointers, and the header only records offsets from the start
+ * of the file, so the file means the same thing wherever it gets mapped.
+ *
+ * Opening maps the whole file read only and points the container's vecs
+ * straight into the pages, nothing is copied or rehashed. The kernel pages
+ * the arrays in on first touch. Section 0's vec carries SNAPSHOT_MAPPED and
+ * vec_free on it unmaps the file, found again through the header in front.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ENDIAN  0x01020304 /* Written natively, read back to check */
+
+static const char snapshot_magic[8] = {'c', 's', 'd', 's', 'a', 's', 'n', 'p'};
+
+typedef struct snapshot_file snapshot_file;
+struct snapshot_file {
+  char     magic[8];
+  int32_t  version, endian;
+  int32_t  kind, flags;
+  int32_t  in_use_id, sections;
+  int64_t  bytes; /* The whole file, for munmap. */
+  int64_t  el_size, key_size, count, tombstones;
+  uint64_t check;
+  int64_t  offset[SNAPSHOT_SECTIONS];
+  int64_t  length[SNAPSHOT_SECTIONS];
+  int64_t  section_el_size[SNAPSHOT_SECTIONS];
+};
+
+_Static_assert(sizeof(snapshot_file) <= SNAPSHOT_HEADER_SIZE,
+               "SNAPSHOT_HEADER_SIZE must fit the file header");
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static int64_t align_up(int64_t bytes);
+static bool    write_all(int fd, const void *buf, int64_t bytes);
+static bool    valid(snapshot_file *file, int64_t size, int32_t kind);
+
+static int64_t align_up(int64_t bytes) {
+  return (bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+static bool write_all(int fd, const void *buf, int64_t bytes) {
+  const char *at = buf;
+  while (bytes > 0) {
+    ssize_t done = write(fd, at, bytes);
+    if (done < 0) return false;
+    at += done;
+    bytes -= done;
+  }
+  return true;
+}
+
+static bool valid(snapshot_file *file, int64_t size, int32_t kind) {
+  if (size < SNAPSHOT_HEADER_SIZE) return false;
+  if (memcmp(file->magic, snapshot_magic, sizeof(snapshot_magic)))
+    return false;
+  if (file->version != SNAPSHOT_VERSION) return false;
+  if (file->endian != SNAPSHOT_ENDIAN) return false;
+  if (file->kind != kind || file->bytes != size) return false;
+  if (file->sections < 1 || file->sections > SNAPSHOT_SECTIONS) return false;
+  if (file->offset[0] != SNAPSHOT_HEADER_SIZE) return false;
+
+  for (int32_t i = 0; i < file->sections; i++) {
+    int64_t offset = file->offset[i];
+    if (offset < SNAPSHOT_HEADER_SIZE || offset % CACHE_LINE_SIZE)
+      return false;
+    if (file->length[i] < 0 || file->section_el_size[i] <= 0) return false;
+    if (file->length[i] > (size - offset) / file->section_el_size[i])
+      return false;
+  }
+  return true;
+}
+
+bool __snapshot_save(snapshot *snap, int fd) {
+  assert(snap);
+  assert(snap->sections > 0 && snap->sections <= SNAPSHOT_SECTIONS);
+
+  char          header[SNAPSHOT_HEADER_SIZE] = {0};
+  snapshot_file file = {.version = SNAPSHOT_VERSION,
+                        .endian = SNAPSHOT_ENDIAN,
+                        .kind = snap->kind,
+                        .flags = snap->flags,
+                        .in_use_id = snap->in_use_id,
+                        .sections = snap->sections,
+                        .el_size = snap->el_size,
+                        .key_size = snap->key_size,
+                        .count = snap->count,
+                        .tombstones = snap->tombstones,
+                        .check = snap->check};
+  memcpy(file.magic, snapshot_magic, sizeof(snapshot_magic));
+
+  int64_t offset = SNAPSHOT_HEADER_SIZE;
+  for (int32_t i = 0; i < snap->sections; i++) {
+    vec *section = &snap->section[i];
+    file.offset[i] = offset;
+    file.length[i] = section->length;
+    file.section_el_size[i] = section->__el_size;
+    offset = align_up(offset + section->length * section->__el_size);
+  }
+  file.bytes = offset;
+  memcpy(header, &file, sizeof(file));
+
+  if (!write_all(fd, header, sizeof(header))) return false;
+  for (int32_t i = 0; i < snap->sections; i++) {
+    static const char pad[CACHE_LINE_SIZE];
+    vec              *section = &snap->section[i];
+    int64_t           bytes = section->length * section->__el_size;
+    if (!write_all(fd, section->elements, bytes)) return false;
+    if (!write_all(fd, pad, align_up(bytes) - bytes)) return false;
+  }
+  return true;
+}
+
+bool __snapshot_open(snapshot *snap, const char *path, int32_t kind,
+                     stalloc *alloc) {
+  assert(snap);
+  assert(path);
+  assert(alloc);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < SNAPSHOT_HEADER_SIZE) {
+    close(fd);
+    return false;
+  }
+
+  /* The mapping outlives the descriptor. */
+  char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return false;
+
+  snapshot_file *file = (snapshot_file *)base;
+  if (!valid(file, st.st_size, kind)) {
+    munmap(base, st.st_size);
+    return false;
+  }
+
+  snap->kind = file->kind;
+  snap->flags = file->flags;
+  snap->in_use_id = file->in_use_id;
+  snap->sections = file->sections;
+  snap->el_size = file->el_size;
+  snap->key_size = file->key_size;
+  snap->count = file->count;
+  snap->tombstones = file->tombstones;
+  snap->check = file->check;
+
+  for (int32_t i = 0; i < file->sections; i++) {
+    vec *section = &snap->section[i];
+    memset(section, 0, sizeof(*section));
+    section->__el_size = file->section_el_size[i];
+    section->length = file->length[i];
+    section->__top = file->length[i];
+    section->__size = file->length[i];
+    section->flags = TO_STACK | (i == 0 ? SNAPSHOT_MAPPED : 0);
+    section->allocator = alloc;
+    section->elements = base + file->offset[i];
+  }
+  return true;
+}
+
+void __snapshot_close(vec *first) {
+  assert(first->flags & SNAPSHOT_MAPPED);
+  snapshot_file *file =
+      (snapshot_file *)((char *)first->elements - SNAPSHOT_HEADER_SIZE);
+  munmap(file, file->bytes);
+}
@@ -0,0 +1,233 @@
+/*------------------------------------------------------------------------------
+ * Structure of arrays memory layout strategy.
+ *
+ *  block +-----------------+---+-----------------+---+     +-------------+
+ *        | x x x x ... x   |pad| y y y y ... y   |pad| ... | z z z ... z |
+ *        +-----------------+---+-----------------+---+     +-------------+
+ *          ^ column 0            ^ column 1, each on a cache line
+ *
+ * Every field lives in its own column, all sharing one length and one
+ * capacity inside a single allocation. A pass that reads two fields of a
+ * particle only pulls those two columns through the cache, and every column
+ * is a plain contiguous array the compiler can vectorize over.
+ *
+ * Column 0 starts on the first cache line of the block and every column is
+ * rounded up to whole lines, so each one starts on its own line. Growing
+ * moves every column into a new block twice the size.
+ * ---------------------------------------------------------------------------*/
+
+#include "csdsa.h"
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void    init_asserts(soa *s);
+static void    bound_asserts(soa *s, int64_t row);
+static int64_t column_bytes(soa *s, int32_t col, int64_t rows);
+static char   *soa_alloc(soa *s, int64_t bytes, void **block);
+static void    soa_grow(soa *s, int64_t capacity);
+static void    row_view(soa *s, int64_t row, void **view);
+
+static void init_asserts(soa *s) {
+  assert(s);
+  assert(s->block);
+  assert(s->columns > 0 && s->columns <= SOA_MAX_COLUMNS);
+}
+
+static void bound_asserts(soa *s, int64_t row) {
+  init_asserts(s);
+  assert(row >= 0 && row < s->length);
+}
+
+static int64_t column_bytes(soa *s, int32_t col, int64_t rows) {
+  int64_t bytes = rows * s->el_sizes[col];
+  return (bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+/* Returns where column 0 goes, on a cache line, and sets block to what is
+   given back on free. Aligned pushes are always zeroed. */
+static char *soa_alloc(soa *s, int64_t bytes, void **block) {
+  if (!(s->flags & TO_HEAP)) {
+    *block = stpush_aligned(s->allocator, bytes, CACHE_LINE_SIZE);
+    return *block;
+  }
+
+  bool zero = !(s->flags & ALLOC_UNINIT);
+  bytes += CACHE_LINE_SIZE;
+  *block = zero ? halloc(s->allocator, bytes)
+                : halloc_uninit(s->allocator, bytes);
+  assert(*block);
+  uintptr_t start = (uintptr_t)*block + CACHE_LINE_SIZE - 1;
+  return (char *)(start - start % CACHE_LINE_SIZE);
+}
+
+/* Doubles the capacity until `capacity` rows fit, keeping the contents. */
+static void soa_grow(soa *s, int64_t capacity) {
+  if (capacity <= s->__size) return;
+  int64_t size = s->__size;
+  while (capacity > size) size *= 2;
+
+  int64_t bytes = 0;
+  for (int32_t c = 0; c < s->columns; c++) bytes += column_bytes(s, c, size);
+  void *old = s->block;
+  char *block = soa_alloc(s, bytes, &s->block);
+  assert(block);
+
+  for (int32_t c = 0; c < s->columns; c++) {
+    memcpy(block, s->column[c], s->length * s->el_sizes[c]);
+    s->column[c] = block;
+    block += column_bytes(s, c, size);
+  }
+
+  if (s->flags & TO_HEAP) hfree(s->allocator, old);
+  s->__size = size;
+  s->cache_counter++;
+}
+
+static void row_view(soa *s, int64_t row, void **view) {
+  for (int32_t c = 0; c < s->columns; c++)
+    view[c] = (char *)s->column[c] + row * s->el_sizes[c];
+}
+
+soa *__soa_init(soa *s, int32_t columns, int64_t *el_sizes, stalloc *alloc,
+                int32_t flags, int64_t initial_size) {
+  assert(columns > 0 && columns <= SOA_MAX_COLUMNS);
+  assert(el_sizes);
+  assert(alloc);
+  if (initial_size < 1) initial_size = 1;
+
+  s->length = 0;
+  s->__size = initial_size;
+  s->flags = flags;
+  s->cache_counter = 0;
+  s->columns = columns;
+  s->allocator = alloc;
+
+  int64_t bytes = 0;
+  for (int32_t c = 0; c < columns; c++) {
+    assert(el_sizes[c] > 0);
+    s->el_sizes[c] = el_sizes[c];
+    bytes += column_bytes(s, c, initial_size);
+  }
+
+  char *block = soa_alloc(s, bytes, &s->block);
+  assert(block);
+  for (int32_t c = 0; c < columns; c++) {
+    s->column[c] = block;
+    block += column_bytes(s, c, initial_size);
+  }
+  return s;
+}
+
+void soa_free(soa *s) {
+  if (s->flags & TO_HEAP) hfree(s->allocator, s->block);
+}
+
+void soa_clear(soa *s) {
+  init_asserts(s);
+  s->length = 0;
+}
+
+void soa_resize(soa *s, int64_t rows) {
+  init_asserts(s);
+  assert(rows >= 0);
+  soa_grow(s, rows);
+
+  /* Rows coming back into view are zeroed like a fresh push would be. */
+  if (rows > s->length && !(s->flags & ALLOC_UNINIT))
+    for (int32_t c = 0; c < s->columns; c++)
+      memset((char *)s->column[c] + s->length * s->el_sizes[c], 0,
+             (rows - s->length) * s->el_sizes[c]);
+  s->length = rows;
+}
+
+void soa_reserve(soa *s, int64_t capacity) {
+  init_asserts(s);
+  soa_grow(s, capacity);
+}
+
+int64_t soa_length(soa *s) { return s->length; }
+
+/* Element Operations */
+void *soa_column(soa *s, int32_t col) {
+  init_asserts(s);
+  assert(col >= 0 && col < s->columns);
+  return s->column[col];
+}
+
+void *soa_at(soa *s, int32_t col, int64_t row) {
+  bound_asserts(s, row);
+  assert(col >= 0 && col < s->columns);
+  return (char *)s->column[col] + row * s->el_sizes[col];
+}
+
+int64_t soa_push(soa *s) {
+  soa_resize(s, s->length + 1);
+  return s->length - 1;
+}
+
+void soa_pop(soa *s) {
+  init_asserts(s);
+  assert(s->length > 0);
+  s->length--;
+}
+
+void soa_delete_at(soa *s, int64_t row) {
+  bound_asserts(s, row);
+  for (int32_t c = 0; c < s->columns; c++) {
+    char *at = (char *)s->column[c] + row * s->el_sizes[c];
+    memmove(at, at + s->el_sizes[c], (s->length - row - 1) * s->el_sizes[c]);
+  }
+  s->length--;
+}
+
+void soa_swap(soa *s, int64_t row1, int64_t row2) {
+  bound_asserts(s, row1);
+  bound_asserts(s, row2);
+  for (int32_t c = 0; c < s->columns; c++)
+    memswap((char *)s->column[c] + row1 * s->el_sizes[c],
+            (char *)s->column[c] + row2 * s->el_sizes[c], s->el_sizes[c]);
+}
+
+/* Functional Operations
+   Rows are not contiguous, so callbacks get an array of pointers with one
+   entry per column pointing into that row. */
+int64_t soa_count_if(soa *s, _pred p, void *args) {
+  init_asserts(s);
+  void   *view[SOA_MAX_COLUMNS];
+  int64_t count = 0;
+  for (int64_t row = 0; row < s->length; row++) {
+    row_view(s, row, view);
+    if (p(view, args)) count++;
+  }
+  return count;
+}
+
+soa *soa_filter(soa *s, _pred p, void *args) {
+  init_asserts(s);
+  void   *view[SOA_MAX_COLUMNS];
+  int64_t kept = 0;
+
+  /* Compacts in place, every kept row only ever moves down. */
+  for (int64_t row = 0; row < s->length; row++) {
+    row_view(s, row, view);
+    if (!p(view, args)) continue;
+
+    if (kept != row)
+      for (int32_t c = 0; c < s->columns; c++)
+        memcpy((char *)s->column[c] + kept * s->el_sizes[c], view[c],
+               s->el_sizes[c]);
+    kept++;
+  }
+  s->length = kept;
+  return s;
+}
+
+void soa_foreach(soa *s, _each n, void *args) {
+  init_asserts(s);
+  void *view[SOA_MAX_COLUMNS];
+  for (int64_t row = 0; row < s->length; row++) {
+    row_view(s, row, view);
+    n(view, args);
+  }
+}
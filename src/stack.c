@@ -0,0 +1,51 @@
+#include "csdsa.h"
+
+/*-------------------------------------------------------
+ * Static Functions
+ *-------------------------------------------------------*/
+static void init_asserts(stack *s);
+
+static void init_asserts(stack *s) {
+  assert(s);
+  assert(s->elements.elements);
+}
+
+stack *__stack_init(stack *s, int64_t el_size, stalloc *alloc, int32_t flags,
+                    int64_t initial_size) {
+  assert(el_size > 0);
+  assert(alloc);
+  if (initial_size < 1) initial_size = 1;
+  __vec_init(&s->elements, el_size, alloc, flags, initial_size);
+  return s;
+}
+
+void stack_free(stack *s) { vec_free(&s->elements); }
+void stack_clear(stack *s) {
+  init_asserts(s);
+  vec_clear(&s->elements);
+}
+stack *stack_copy(stack *dest, stack *src) {
+  init_asserts(src);
+  vec_copy(&dest->elements, &src->elements);
+  return dest;
+}
+int64_t stack_length(stack *s) { return s->elements.length; }
+
+/* Element Operations */
+void stack_push(stack *s, void *el) {
+  init_asserts(s);
+  vec_push(&s->elements, el);
+}
+
+void stack_pop(stack *s, void *out) {
+  init_asserts(s);
+  assert(s->elements.length > 0 && "Pop from an empty stack.");
+  if (out) memcpy(out, vec_top(&s->elements), s->elements.__el_size);
+  vec_pop(&s->elements);
+}
+
+void *stack_peek(stack *s) {
+  init_asserts(s);
+  if (!s->elements.length) return NULL;
+  return vec_top(&s->elements);
+}
@@ -2,32 +2,57 @@
  * Concurrent Stack Allocator memory layout strategy.
  *                     Header
  *             31..............3 2 1 0
+ *            +----------------------+    Always 0 for
+ *            |Alignment Padding     |    protection
  * Memory     +----------------+-+-+-+  a=0 : Allocated
  * write -+-->|Block Size      |0|0|a|  a=1 : Free
  * guards |   +----------------+-+-+-+
- *        |   |Thead ID              |
- *        |   +----------------------+
  *        |   |Allocated User        |
  *        |   |Memory                |
  *        |   |                      |
- *        |   +----------------------+    Always 0 for
- *        |   |Alignment Padding     |    protection
- *        |   +----------------+-+-+-+         |
- *        +-->|Block Size      |0|0|a|         |
- *            +----------------+-+-+-+         |
- *                               ^             |
- *                               +-------------+
+ *        |   +----------------+-+-+-+
+ *        +-->|Block Size      |0|0|a|
+ *            +----------------+-+-+-+
+ *
+ * The padding sits in front of the header so that the user memory is aligned
+ * and the header always lives directly before it. The block size in both
+ * guards includes the padding, so blocks can still be walked backwards from
+ * the stack pointer by reading the footer.
+ *
  * Region:
- * +-----+-----+-----+--------------------------------+
- * |Block|Block|Block|                                |
- * +-----+-----+-----+--------------------------------+
- * +------->         ^                                ^
- * Stack             |  Atomic               Heap Div |
- * Allocator         +- Stack Ptr            Ptr    --+
+ * +-----+-----+-----+----------------+-----+-----+-----+
+ * |Block|Block|Block|                |Block|Free |Block|
+ * +-----+-----+-----+----------------+-----+-----+-----+
+ * +------->         ^                ^           <-----+
+ * Stack             |  Atomic        | Heap Div     Heap
+ * Allocator         +- Stack Ptr     +- Ptr    Allocator
+ *
+ * Heap blocks are carved downwards from the top of a region. Every heap block
+ * carries a 16 byte header (the guard and padding) and a footer guard, and
+ * block sizes are multiples of 16, so heap memory is 16 byte aligned like
+ * malloc's. The guards let a freed block find and coalesce with both of its
+ * neighbours. Free blocks are
+ * kept in segregated power of two size classes, and a free block that touches
+ * the heap divider is handed back to the region so the stack may use it.
+ *
+ * Concurrency: an allocator is owned by the thread that created it and only
+ * that thread pushes, pops or allocates from it, so none of the hot paths take
+ * a lock. Heap blocks freed by any other thread are pushed onto a lock-free
+ * return queue (many producers, one consumer) and recycled by the owner the
+ * next time it allocates. Threads that want their own arena use
+ * stalloc_thread_local(), which is freed at thread exit unless blocks from it
+ * are still out in other threads.
+ *
+ * Regions: when a frame ends, regions stacked above the innermost live frame
+ * that hold nothing are handed to the retention policy. By default the
+ * largest one is kept in place and the others are parked in a region cache
+ * (up to a high water mark) for append_new_alloc to reuse, so a steady state
+ * frame never goes back to the system for memory.
  * ---------------------------------------------------------------------------*/
 
 #include "csdsa.h"
 #include <execinfo.h>
+#include <sys/mman.h>
 
 #define ALLOCATED 0
 #define FREE      1
@@ -40,214 +65,682 @@
 #define IS_FREE(guard)          (((guard) & 1) == 1)
 #define MAKE_GUARD(size, state) (((size) << 4) | (state))
 
+#define HEAP_HEADER_SIZE 16 /* Guard padded out to keep user memory aligned */
+#define HEAP_GRANULE     16 /* Every heap block size is a multiple of this. */
+#define HEAP_MIN_BLOCK   48 /* Header, two free list links and the footer. */
+#define HEAP_MAX_BLOCK   (1 << 27) /* Larger requests go straight to libc. */
+#define HEAP_GUARD_LIMIT (1 << 28) /* Sizes a guard can hold, caps merges. */
+#define HEAP_MIN_CLASS   5         /* floor(log2(HEAP_MIN_BLOCK)) */
+#define HEAP_BIN_COUNT   24
+
+#define ALIGN_UP(x, a)   (((x) + ((a) - 1)) & ~((a) - 1))
+#define ALIGN_DOWN(x, a) ((x) & ~((a) - 1))
+
+/* Both compile to nothing unless enabled, see the configurations. */
+#ifdef STALLOC_STATS
+#define STAT(a, stmt)       ((a)->stats.stmt)
+#define STAT_USED(a, delta) stat_used(a, delta)
+#else
+#define STAT(a, stmt)       ((void)0)
+#define STAT_USED(a, delta) ((void)0)
+#endif
+
+#ifdef STALLOC_TRACE
+#define TRACE(a, event, ptr, bytes)                                            \
+  if ((a)->trace) (a)->trace(a, event, ptr, bytes, (a)->trace_args)
+#else
+#define TRACE(a, event, ptr, bytes) ((void)0)
+#endif
+
+typedef struct alloc       alloc;
 typedef struct stack_frame stack_frame;
 struct stack_frame {
   int64_t stack_allocs; /* The count of allocations done on this frame */
+  alloc  *mark_alloc;   /* The top region when the frame was started */
+  void   *mark_ptr;     /* Its stack pointer, restored by end_frame */
 };
 
-typedef struct alloc alloc;
 struct alloc {
   void   *region;
   void   *stack_ptr;
   void   *heap_div_ptr;
+  void   *heap_top; /* One past the last heap byte, the heap grows down. */
   int64_t region_size;
   alloc  *next;
 };
 
+/* Free heap blocks store their list links where the user memory used to be. */
+typedef struct heap_links heap_links;
+struct heap_links {
+  void *next, *prev;
+};
+
 struct stalloc {
-  alloc       *top;
+  alloc         *top;
+  alloc         *cache;       /* Parked regions, see the retention policy */
+  int64_t        cache_bytes; /* The bytes held by `cache` */
+  stalloc_policy policy;
+
   stack_frame *frames;
   int64_t      frame_count;
   int64_t      __frame_arr_len;
   int64_t      allocator_count; /* The count in `allocators` */
+
+  void    *heap_bins[HEAP_BIN_COUNT]; /* Free lists by power of two class. */
+  uint32_t heap_bin_map;              /* Bit i is set if bin i is non-empty. */
+
+  pthread_t        owner;        /* Only this thread touches the regions. */
+  _Atomic(void *) remote_frees; /* Blocks hfree'd by other threads. */
+  int64_t          libc_blocks;  /* Oversized blocks not yet given back */
+
+#ifdef STALLOC_STATS
+  stalloc_usage stats; /* Counters, peaks and a running bytes_used */
+#endif
+#ifdef STALLOC_TRACE
+  _stalloc_trace trace;
+  void          *trace_args;
+#endif
 };
 
-bool          pthread_key_init = false;
-pthread_key_t frame_context;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  frame_context;
+static pthread_key_t  thread_arena; /* Arenas made by stalloc_thread_local */
 
 /*-------------------------------------------------------
  * Implementation
  *-------------------------------------------------------*/
 static void append_new_alloc(stalloc *allocs, int64_t region_size);
 static void alloc_make(alloc *alloc, int64_t region_size);
-static void attempt_alloc_merge(stalloc *allocs);
-static void _stpop(stalloc *a, int64_t to_pop);
+static void alloc_reset(alloc *a);
+static void alloc_destroy(stalloc *a, alloc *region);
+static void release_regions(stalloc *a);
+static int64_t _stpop(stalloc *a, int64_t to_pop, void **block);
+#ifdef STALLOC_VALIDATE_FRAMES
+static void validate_frame(stalloc *a, stack_frame *frame);
+#endif
+static int64_t stack_padding(void *stack_ptr, int64_t align);
+static void   *push_block(stalloc *a, int64_t bytes, int64_t align, bool zero);
+static void   *heap_alloc(stalloc *a, int64_t bytes, bool zero);
+static void    owner_asserts(stalloc *a);
+
+static int64_t heap_block_size(int64_t bytes);
+static void    heap_write_guards(void *block, uint32_t size, uint32_t state);
+static alloc  *heap_region_of(stalloc *a, void *block);
+static void   *heap_take_free(stalloc *a, uint32_t size);
+static void   *heap_carve(stalloc *a, uint32_t size);
+static void    heap_bin_insert(stalloc *a, void *block, uint32_t size);
+static void    heap_bin_remove(stalloc *a, void *block, uint32_t size);
+static void    heap_release(stalloc *a, void *ptr);
+static void    heap_drain_remote(stalloc *a);
+static int64_t heap_bytes_used(stalloc *a);
+#ifdef STALLOC_STATS
+static void stat_used(stalloc *a, int64_t delta);
+#endif
+
+static void thread_arena_destroy(void *arena) {
+  stalloc *a = arena;
+  if (get_frame_ctx() == a) set_frame_ctx(NULL);
+
+  /* Blocks handed to other threads come back through remote_frees, which
+     lives in the arena. While any are still out the arena is left behind
+     rather than freed under them. */
+  heap_drain_remote(a);
+  if (heap_bytes_used(a) == 0 && a->libc_blocks == 0) stalloc_free(a);
+}
+
+static void keys_create(void) {
+  pthread_key_create(&frame_context, NULL);
+  pthread_key_create(&thread_arena, thread_arena_destroy);
+}
 
 stalloc *stalloc_create(int64_t bytes) {
+  return stalloc_create_with(bytes, STALLOC_POLICY_DEFAULT);
+}
+
+stalloc *stalloc_create_with(int64_t bytes, stalloc_policy policy) {
   stalloc *alloc = calloc(1, sizeof(*alloc));
+  alloc->policy = policy;
   append_new_alloc(alloc, bytes);
 
-  alloc->allocator_count = 0;
-
   alloc->frames = NULL;
   alloc->frame_count = 0;
   alloc->__frame_arr_len = 0;
 
-  if (!pthread_key_init) {
-    pthread_key_create(&frame_context, NULL);
-    pthread_key_init = true;
-  }
+  alloc->owner = pthread_self();
+  atomic_init(&alloc->remote_frees, NULL);
+
+  pthread_once(&key_once, keys_create);
+
+  return alloc;
+}
+
+stalloc *stalloc_thread_local(int64_t bytes) {
+  pthread_once(&key_once, keys_create);
+
+  stalloc *alloc = pthread_getspecific(thread_arena);
+  if (alloc != NULL) return alloc;
 
+  alloc = stalloc_create(bytes);
+  pthread_setspecific(thread_arena, alloc);
+
+  /* Become the frame context unless the thread already chose one. */
+  if (get_frame_ctx() == NULL) set_frame_ctx(alloc);
   return alloc;
 }
 
+void stalloc_adopt(stalloc *a) { a->owner = pthread_self(); }
+
 void stalloc_free(stalloc *a) {
-  alloc *cur = a->top;
-  while (cur != NULL) {
-    free(cur->region);
-    void *temp = cur->next;
-    free(cur);
-    cur = temp;
+  heap_drain_remote(a); /* Oversized blocks in the queue belong to libc. */
+
+  alloc *lists[2] = {a->top, a->cache};
+  for (int i = 0; i < 2; i++) {
+    alloc *cur = lists[i];
+    while (cur != NULL) {
+      alloc *temp = cur->next;
+      alloc_destroy(a, cur);
+      cur = temp;
+    }
   }
   free(a->frames);
   free(a);
 }
 
 void *__stpush(stalloc *a, int64_t bytes) {
+  return __stpush_aligned(a, bytes, STALLOC_ALIGNMENT);
+}
 
-  alloc  *alloc_to_use = a->top;
-  int64_t block_size = bytes;
+void *__stpush_aligned(stalloc *a, int64_t bytes, int64_t align) {
+  return push_block(a, bytes, align, true);
+}
 
-  // const size_t alignment = 8; // Assuming 8-byte alignment
-  // uintptr_t    current_addr = (uintptr_t)alloc_to_use->stack_ptr + HEADER_SIZE;
-  // uintptr_t aligned_addr = (current_addr + (alignment - 1)) & ~(alignment - 1);
-  // size_t    padding = aligned_addr - current_addr;
+void *__stpush_uninit(stalloc *a, int64_t bytes) {
+  return push_block(a, bytes, STALLOC_ALIGNMENT, false);
+}
 
-  // block_size += padding;
+static void *push_block(stalloc *a, int64_t bytes, int64_t align, bool zero) {
+  assert(align > 0 && (align & (align - 1)) == 0);
 
-  if (alloc_to_use->stack_ptr + block_size + HEADER_SIZE + FOOTER_SIZE >
+  alloc  *alloc_to_use = a->top;
+  int64_t padding = stack_padding(alloc_to_use->stack_ptr, align);
+
+  if (alloc_to_use->stack_ptr + padding + bytes + HEADER_SIZE + FOOTER_SIZE >
       alloc_to_use->heap_div_ptr) {
-    append_new_alloc(a, bytes);
+    append_new_alloc(a, bytes + align);
     alloc_to_use = a->top;
+    padding = stack_padding(alloc_to_use->stack_ptr, align);
   }
 
   /* The guard stores the TOTAL size of the block so the block can be skipped
-   while doing linear reads. Therefore, header/footer are included. */
-  uint32_t memory_guard =
-      MAKE_GUARD(block_size + HEADER_SIZE + FOOTER_SIZE, ALLOCATED);
+   while doing linear reads. Therefore, padding/header/footer are included. */
+  int64_t block_size = padding + HEADER_SIZE + bytes + FOOTER_SIZE;
+  assert(block_size < (1 << 28) && "Block too large for its guard.");
+  uint32_t memory_guard = MAKE_GUARD((uint32_t)block_size, ALLOCATED);
 
-  /* Write the header guard */
-  memcpy(alloc_to_use->stack_ptr, &memory_guard, HEADER_SIZE);
-  void *mem_to_return = alloc_to_use->stack_ptr + HEADER_SIZE;
+  /* Zero the padding and write the header guard right after it */
+  void *header = alloc_to_use->stack_ptr + padding;
+  memset(alloc_to_use->stack_ptr, 0, padding);
+  memcpy(header, &memory_guard, HEADER_SIZE);
+  void *mem_to_return = header + HEADER_SIZE;
 
   /* Zero out the user memory area for convenience */
-  memset(mem_to_return, 0, bytes);
+  if (zero) memset(mem_to_return, 0, bytes);
 
   /* Write the footer guard */
-  memcpy(alloc_to_use->stack_ptr + HEADER_SIZE + bytes, &memory_guard,
-         FOOTER_SIZE);
+  memcpy(mem_to_return + bytes, &memory_guard, FOOTER_SIZE);
 
   /* Move the stack pointer past the allocated block */
-  alloc_to_use->stack_ptr += HEADER_SIZE + bytes + FOOTER_SIZE;
+  alloc_to_use->stack_ptr += block_size;
 
   /* Add 1 to the top frame */
   a->frames[a->frame_count - 1].stack_allocs++;
 
+  STAT(a, pushes++);
+  STAT_USED(a, block_size);
+  TRACE(a, STALLOC_EVENT_PUSH, mem_to_return, bytes);
   return mem_to_return;
 }
 
+bool stextend(stalloc *a, void *ptr, int64_t new_bytes) {
+  assert(a);
+  assert(ptr);
+  assert(new_bytes >= 0);
+
+  /* The block must end exactly at the stack pointer of the top region. */
+  alloc *top = a->top;
+  if (top->stack_ptr == top->region) return false;
+  if (ptr - HEADER_SIZE < top->region || ptr >= top->stack_ptr) return false;
+
+  uint32_t footer = *(uint32_t *)(top->stack_ptr - FOOTER_SIZE);
+  uint32_t header = *(uint32_t *)(ptr - HEADER_SIZE);
+  void    *block = top->stack_ptr - BLOCK_SIZE(footer);
+  if (header != footer || ptr - HEADER_SIZE < block) return false;
+
+  /* A block from an outer frame would be cut back to the mark by end_frame. */
+  stack_frame *frame = &a->frames[a->frame_count - 1];
+  if (frame->mark_alloc == top && block < frame->mark_ptr) return false;
+
+  int64_t padding = (ptr - HEADER_SIZE) - block;
+  int64_t block_size = padding + HEADER_SIZE + new_bytes + FOOTER_SIZE;
+  if (block_size >= (1 << 28)) return false;
+  if (block + block_size > top->heap_div_ptr) return false;
+
+  uint32_t memory_guard = MAKE_GUARD((uint32_t)block_size, ALLOCATED);
+  memcpy(ptr - HEADER_SIZE, &memory_guard, HEADER_SIZE);
+  memcpy(ptr + new_bytes, &memory_guard, FOOTER_SIZE);
+  top->stack_ptr = block + block_size;
+  STAT_USED(a, block_size - (int64_t)BLOCK_SIZE(footer));
+  return true;
+}
+
 void *__stpushframe(int64_t bytes) { return __stpush(get_frame_ctx(), bytes); }
 
 void __stpop(stalloc *a) {
-  _stpop(a, 1);
+  assert(a->frames[a->frame_count - 1].stack_allocs > 0);
+  void   *block = NULL;
+  int64_t bytes = _stpop(a, 1, &block);
   a->frames[a->frame_count - 1].stack_allocs--;
-}
 
-void __stpopframe(void) {
-  _stpop(
-      get_frame_ctx(),
-      get_frame_ctx()->frames[get_frame_ctx()->frame_count - 1].stack_allocs);
+  STAT(a, pops++);
+  STAT_USED(a, -bytes);
+  TRACE(a, STALLOC_EVENT_POP, block, bytes);
+  (void)bytes;
 }
 
+void __stpopframe(void) { __stpop(get_frame_ctx()); }
+
 stalloc *get_frame_ctx(void) {
+  pthread_once(&key_once, keys_create);
   stalloc *alloc = pthread_getspecific(frame_context);
   return alloc;
 }
-void set_frame_ctx(stalloc *a) { pthread_setspecific(frame_context, a); }
+void set_frame_ctx(stalloc *a) {
+  pthread_once(&key_once, keys_create);
+  pthread_setspecific(frame_context, a);
+}
 
 /*-------------------------------------------------------
  * Heap Allocation
  *-------------------------------------------------------*/
-/* Note that the cache locality part of the allocator is not implemented, so
-   random heap allocs are just interfaced with stdlib.  */
-void *halloc(stalloc *alloc, int64_t bytes) { return calloc(1, bytes); }
-void *hrealloc(stalloc *alloc, void *ptr, int64_t bytes) {
+void *halloc(stalloc *a, int64_t bytes) { return heap_alloc(a, bytes, true); }
+
+void *halloc_uninit(stalloc *a, int64_t bytes) {
+  return heap_alloc(a, bytes, false);
+}
+
+static void *heap_alloc(stalloc *a, int64_t bytes, bool zero) {
+#ifdef DISABLE_ALLOCATOR
+  return zero ? calloc(1, bytes) : malloc(bytes);
+#endif
+  assert(bytes >= 0);
+
+  /* Without an allocator, e.g. a _hinit'ed container on a thread with no
+     frame context, the memory comes from libc. */
+  if (a == NULL) return zero ? calloc(1, bytes) : malloc(bytes);
+  owner_asserts(a);
+
+  int64_t size = heap_block_size(bytes);
+  if (size > HEAP_MAX_BLOCK) {
+    a->libc_blocks++;
+    return zero ? calloc(1, bytes) : malloc(bytes);
+  }
+
+  if (atomic_load_explicit(&a->remote_frees, memory_order_relaxed))
+    heap_drain_remote(a);
+
+  void *block = heap_take_free(a, size);
+  if (block == NULL) block = heap_carve(a, size);
+
+  void *mem_to_return = block + HEAP_HEADER_SIZE;
+  if (zero) memset(mem_to_return, 0, bytes);
+  return mem_to_return;
+}
+
+void *hrealloc(stalloc *a, void *ptr, int64_t bytes) {
+#ifdef DISABLE_ALLOCATOR
   return realloc(ptr, bytes);
+#endif
+  if (a == NULL) return realloc(ptr, bytes);
+  if (ptr == NULL) return halloc(a, bytes);
+  owner_asserts(a);
+
+  void  *block = ptr - HEAP_HEADER_SIZE;
+  alloc *owner = heap_region_of(a, block);
+  if (owner == NULL) return realloc(ptr, bytes); /* Came from libc. */
+
+  uint32_t size = BLOCK_SIZE(*(uint32_t *)block);
+  int64_t  need = heap_block_size(bytes);
+  if (need <= size) return ptr;
+
+  /* Try to grow in place by absorbing a free upper neighbour. */
+  void *upper = block + size;
+  if (need <= HEAP_MAX_BLOCK && upper < owner->heap_top &&
+      IS_FREE(*(uint32_t *)upper)) {
+    uint32_t upper_size = BLOCK_SIZE(*(uint32_t *)upper);
+    if (size + upper_size >= need && size + upper_size < HEAP_GUARD_LIMIT) {
+      heap_bin_remove(a, upper, upper_size);
+      uint32_t total = size + upper_size;
+      if (total - need >= HEAP_MIN_BLOCK) {
+        heap_write_guards(block + need, total - need, FREE);
+        heap_bin_insert(a, block + need, total - need);
+        total = need;
+      }
+      heap_write_guards(block, total, ALLOCATED);
+      STAT(a, merges++);
+      STAT_USED(a, (int64_t)total - size);
+      return ptr;
+    }
+  }
+
+  void *moved = halloc_uninit(a, bytes);
+  memcpy(moved, ptr, size - HEAP_HEADER_SIZE - FOOTER_SIZE);
+  hfree(a, ptr);
+  return moved;
+}
+
+void hfree(stalloc *a, void *ptr) {
+#ifdef DISABLE_ALLOCATOR
+  free(ptr);
+  return;
+#endif
+  if (ptr == NULL) return;
+  if (a == NULL) {
+    free(ptr);
+    return;
+  }
+
+  /* Foreign threads may not walk the regions, hand the block to the owner. */
+  if (!pthread_equal(pthread_self(), a->owner)) {
+    void *head = atomic_load_explicit(&a->remote_frees, memory_order_relaxed);
+    do {
+      *(void **)ptr = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &a->remote_frees, &head, ptr, memory_order_release,
+        memory_order_relaxed));
+    return;
+  }
+
+  heap_release(a, ptr);
+}
+
+static void heap_release(stalloc *a, void *ptr) {
+  void  *block = ptr - HEAP_HEADER_SIZE;
+  alloc *owner = heap_region_of(a, block);
+  if (owner == NULL) { /* Oversized blocks are owned by libc. */
+    a->libc_blocks--;
+    free(ptr);
+    return;
+  }
+
+  uint32_t size = BLOCK_SIZE(*(uint32_t *)block);
+  assert(!IS_FREE(*(uint32_t *)block));
+  STAT_USED(a, -(int64_t)size);
+
+  /* Coalesce with the block above, which always starts a new block. Merges
+     that would not fit in a guard leave the neighbours as separate blocks. */
+  void *upper = block + size;
+  if (upper < owner->heap_top && IS_FREE(*(uint32_t *)upper) &&
+      size + BLOCK_SIZE(*(uint32_t *)upper) < HEAP_GUARD_LIMIT) {
+    uint32_t upper_size = BLOCK_SIZE(*(uint32_t *)upper);
+    heap_bin_remove(a, upper, upper_size);
+    size += upper_size;
+    STAT(a, merges++);
+  }
+
+  /* Coalesce with the block below through its footer guard. */
+  if (block > owner->heap_div_ptr &&
+      IS_FREE(*(uint32_t *)(block - FOOTER_SIZE)) &&
+      size + BLOCK_SIZE(*(uint32_t *)(block - FOOTER_SIZE)) <
+          HEAP_GUARD_LIMIT) {
+    uint32_t lower_size = BLOCK_SIZE(*(uint32_t *)(block - FOOTER_SIZE));
+    block -= lower_size;
+    heap_bin_remove(a, block, lower_size);
+    size += lower_size;
+    STAT(a, merges++);
+  }
+
+  /* A free block on the divider is given back to the region. */
+  if (block == owner->heap_div_ptr) {
+    owner->heap_div_ptr += size;
+    return;
+  }
+
+  heap_write_guards(block, size, FREE);
+  heap_bin_insert(a, block, size);
 }
-void hfree(stalloc *alloc, void *ptr) { free(ptr); }
 
 /*-------------------------------------------------------
  * Stack Frame Interface
  *-------------------------------------------------------*/
-void start_frame(stalloc *alloc) {
-  if (alloc->__frame_arr_len == 0) {
-    alloc->__frame_arr_len = 1;
-    alloc->frames =
-        calloc(STACK_FRAME_GUESS, alloc->__frame_arr_len * sizeof(stack_frame));
+void start_frame(stalloc *a) {
+  if (a->frame_count == a->__frame_arr_len) {
+    a->__frame_arr_len =
+        a->__frame_arr_len ? a->__frame_arr_len * 2 : STACK_FRAME_GUESS;
+    a->frames = realloc(a->frames, a->__frame_arr_len * sizeof(stack_frame));
   }
 
-  alloc->frame_count++;
-  int64_t new_len = alloc->__frame_arr_len;
-  while (new_len < alloc->frame_count) new_len *= 2;
+  stack_frame *frame = &a->frames[a->frame_count++];
+  frame->stack_allocs = 0;
+  frame->mark_alloc = a->top;
+  frame->mark_ptr = a->top->stack_ptr;
+
+#ifdef STALLOC_STATS
+  if (a->frame_count > a->stats.frame_peak)
+    a->stats.frame_peak = a->frame_count;
+#endif
+
+  set_frame_ctx(a);
+}
+
+void end_frame(stalloc *a) {
+  assert(a->frame_count > 0);
+  stack_frame *frame = &a->frames[a->frame_count - 1];
+
+#ifdef STALLOC_VALIDATE_FRAMES
+  validate_frame(a, frame);
+#endif
 
-  set_frame_ctx(alloc);
-  alloc->frames[alloc->frame_count - 1].stack_allocs = 0;
+  /* Everything pushed on this frame lies above the mark, either in the marked
+     region or in regions stacked on top of it, so unwinding is a reset. */
+  for (alloc *cur = a->top; cur != frame->mark_alloc; cur = cur->next) {
+    STAT_USED(a, -(cur->stack_ptr - cur->region));
+    cur->stack_ptr = cur->region;
+  }
+  STAT_USED(a, -(frame->mark_alloc->stack_ptr - frame->mark_ptr));
+  frame->mark_alloc->stack_ptr = frame->mark_ptr;
+
+  a->frame_count--;
+  release_regions(a);
+}
 
-  /* No resizing needed */
-  if (new_len == alloc->__frame_arr_len) return;
+/*-------------------------------------------------------
+ * Statistics Interface
+ *-------------------------------------------------------*/
+void stalloc_stats(stalloc *a, stalloc_usage *out) {
+  assert(a);
+  assert(out);
+  memset(out, 0, sizeof(*out));
+#ifdef STALLOC_STATS
+  *out = a->stats;
+#endif
+
+  int64_t used = heap_bytes_used(a);
+  for (alloc *cur = a->top; cur != NULL; cur = cur->next) {
+    out->bytes_reserved += cur->region_size;
+    used += cur->stack_ptr - cur->region;
+  }
 
-  alloc->__frame_arr_len = new_len;
-  alloc->frames = recalloc(alloc->frames, new_len * sizeof(stack_frame));
+#ifdef STALLOC_STATS
+  assert(a->stats.bytes_used == used && "The running bytes_used drifted.");
+#endif
+  out->bytes_used = used;
+  out->bytes_cached = a->cache_bytes;
+  out->regions = a->allocator_count;
+  out->frame_depth = a->frame_count;
 }
 
-void end_frame(stalloc *alloc) {
-  assert(alloc->frame_count > 0);
-  _stpop(alloc, alloc->frames[alloc->frame_count - 1].stack_allocs);
-  alloc->frame_count--;
+void stalloc_stats_reset(stalloc *a) {
+  assert(a);
+#ifdef STALLOC_STATS
+  stalloc_usage usage;
+  stalloc_stats(a, &usage);
+  memset(&a->stats, 0, sizeof(a->stats));
+  a->stats.bytes_used = a->stats.bytes_peak = usage.bytes_used;
+  a->stats.frame_peak = a->frame_count;
+#endif
 }
 
+#ifdef STALLOC_TRACE
+void stalloc_trace(stalloc *a, _stalloc_trace hook, void *args) {
+  assert(a);
+  a->trace = hook;
+  a->trace_args = args;
+}
+#endif
+
 /*-------------------------------------------------------
  * Private Sections
  *-------------------------------------------------------*/
+static int64_t stack_padding(void *stack_ptr, int64_t align) {
+  uintptr_t user = (uintptr_t)stack_ptr + HEADER_SIZE;
+  return ALIGN_UP(user, (uintptr_t)align) - user;
+}
+
 static void alloc_make(alloc *a, int64_t region_size) {
   assert(a);
   assert(region_size > 0);
-  a->region = calloc(1, region_size + HEADER_SIZE + FOOTER_SIZE);
   a->region_size = region_size;
-  a->stack_ptr = a->region;
-  a->heap_div_ptr = a->stack_ptr + region_size;
   a->next = NULL;
 }
 
-static void append_new_alloc(stalloc *a, int64_t region_size) {
-  if (a->top == NULL) {
-    a->top = calloc(1, sizeof(*a->top));
-    a->allocator_count++;
+static void alloc_reset(alloc *a) {
+  a->stack_ptr = a->region;
+  a->heap_top = (void *)ALIGN_DOWN((uintptr_t)a->region + a->region_size,
+                                   HEAP_GRANULE);
+  a->heap_div_ptr = a->heap_top;
+}
+
+static bool alloc_empty(alloc *a) {
+  return a->stack_ptr == a->region && a->heap_div_ptr == a->heap_top;
+}
+
+static void alloc_map(stalloc *a, alloc *region) {
+  /* Pushes and halloc zero what they hand out, so regions need not be. */
+  int64_t bytes = region->region_size + HEADER_SIZE + FOOTER_SIZE;
+  if (a->policy.flags & STALLOC_MMAP) {
+    region->region = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(region->region != MAP_FAILED);
+  } else {
+    region->region = malloc(bytes);
+    assert(region->region);
+  }
+}
+
+static void alloc_destroy(stalloc *a, alloc *region) {
+  if (a->policy.flags & STALLOC_MMAP)
+    munmap(region->region, region->region_size + HEADER_SIZE + FOOTER_SIZE);
+  else
+    free(region->region);
+  free(region);
+}
+
+static alloc *cache_take(stalloc *a, int64_t region_size) {
+  /* Smallest parked region that satisfies the growth rule. */
+  alloc **best = NULL;
+  for (alloc **link = &a->cache; *link != NULL; link = &(*link)->next) {
+    if ((*link)->region_size < region_size * 2) continue;
+    if (best == NULL || (*link)->region_size < (*best)->region_size)
+      best = link;
+  }
+  if (best == NULL) return NULL;
+
+  alloc *taken = *best;
+  *best = taken->next;
+  a->cache_bytes -= taken->region_size;
+  alloc_reset(taken);
+  return taken;
+}
+
+static void cache_park(stalloc *a, alloc *region) {
+  a->allocator_count--;
 
-    alloc_make(a->top, region_size);
+  bool fits = a->cache_bytes + region->region_size <= a->policy.cache_bytes;
+  if (!(a->policy.flags & STALLOC_CACHE_REGIONS) || !fits) {
+    alloc_destroy(a, region);
     return;
   }
 
-  /* Each next allocator must be at least double the region size of the last,
-     and at least double the requested region size.  */
-  // alloc *last_top = alloc->top;
+  /* Keep the mapping but give the pages back until the region is reused. */
+  if (a->policy.flags & STALLOC_MMAP)
+    madvise(region->region, region->region_size, MADV_DONTNEED);
+
+  region->next = a->cache;
+  a->cache = region;
+  a->cache_bytes += region->region_size;
+}
+
+static void append_new_alloc(stalloc *a, int64_t region_size) {
   alloc *last_top = a->top;
-  size_t next_size = last_top->region_size;
-  next_size *= 2;
-  while (next_size < region_size * 2) next_size *= 2;
+  alloc *region = cache_take(a, region_size);
+
+  if (region == NULL) {
+    /* Each next allocator must be at least double the region size of the
+       last, and at least double the requested region size.  */
+    int64_t next_size = region_size;
+    if (last_top != NULL) {
+      next_size = last_top->region_size * 2;
+      while (next_size < region_size * 2) next_size *= 2;
+    }
+
+    region = calloc(1, sizeof(*region));
+    alloc_make(region, next_size);
+    alloc_map(a, region);
+    alloc_reset(region);
+    STAT(a, regions_created++);
+  }
 
   a->allocator_count++;
+  region->next = last_top;
+  a->top = region;
+  TRACE(a, STALLOC_EVENT_GROW, region->region, region->region_size);
+}
 
-  a->top = calloc(1, sizeof(*a->top));
-  alloc_make(a->top, next_size);
+static void release_regions(stalloc *a) {
+  /* The innermost frame mark is the newest region any frame refers to, so
+     only the regions stacked above it may be released. */
+  alloc *pinned = NULL;
+  if (a->frame_count > 0) pinned = a->frames[a->frame_count - 1].mark_alloc;
+
+  /* Pick the empty region that stays hot. Without RETAIN_LARGEST the base
+     region is kept so the allocator always owns at least one region. */
+  alloc *keep = NULL;
+  for (alloc *cur = a->top; cur != pinned; cur = cur->next) {
+    if (!(a->policy.flags & STALLOC_RETAIN_LARGEST)) {
+      if (cur->next == NULL) keep = cur;
+      continue;
+    }
+    if (alloc_empty(cur) && (!keep || cur->region_size > keep->region_size))
+      keep = cur;
+  }
 
-  a->top->next = last_top;
+  alloc **link = &a->top;
+  while (*link != pinned) {
+    alloc *cur = *link;
+    if (cur == keep || !alloc_empty(cur)) {
+      link = &cur->next;
+      continue;
+    }
+    *link = cur->next;
+    cache_park(a, cur);
+  }
 }
 
-static void _stpop(stalloc *a, int64_t to_pop) {
+/* Returns the bytes taken off, block is left at the last block popped. */
+static int64_t _stpop(stalloc *a, int64_t to_pop, void **block) {
   /* Cascade down from the top of the allocators and pop first found. */
   alloc  *cur = a->top;
-  int64_t popped_so_far = 0;
+  int64_t popped_so_far = 0, bytes = 0;
   while (cur != NULL && popped_so_far < to_pop) {
     if (cur->stack_ptr == cur->region) { /* Stack empty case. */
       cur = cur->next;
@@ -260,36 +753,187 @@ static void _stpop(stalloc *a, int64_t to_pop) {
     uint32_t size = BLOCK_SIZE(*(uint32_t *)buff_at(&buff));
     assert(!IS_FREE(*(uint32_t *)buff_at(&buff)));
     cur->stack_ptr -= size;
-    attempt_alloc_merge(a);
+    *block = cur->stack_ptr;
+    bytes += size;
     cur = a->top;
     popped_so_far++;
   }
+  return bytes;
 }
 
-void attempt_alloc_merge(stalloc *allocs) {
-  if (allocs->top == NULL) return;
-  alloc *top, *toptop;
-  top = allocs->top;
-  toptop = top->next;
+#ifdef STALLOC_VALIDATE_FRAMES
+/* Debug only, walks every block of the frame backwards through its guards. */
+static void validate_frame(stalloc *a, stack_frame *frame) {
+  int64_t blocks = 0;
+  for (alloc *cur = a->top; cur != NULL; cur = cur->next) {
+    void *floor = cur == frame->mark_alloc ? frame->mark_ptr : cur->region;
+    void *ptr = cur->stack_ptr;
+
+    while (ptr > floor) {
+      uint32_t guard = *(uint32_t *)(ptr - FOOTER_SIZE);
+      uint32_t size = BLOCK_SIZE(guard);
+      assert(!IS_FREE(guard));
+      assert(size >= HEADER_SIZE + FOOTER_SIZE && ptr - size >= floor);
+
+      /* The header follows the zeroed alignment padding. */
+      void *header = ptr - size;
+      while (memcmp(header, &guard, HEADER_SIZE) != 0) {
+        assert(*(uint8_t *)header == 0 && "Corrupted alignment padding.");
+        header++;
+      }
+      assert(header + HEADER_SIZE <= ptr - FOOTER_SIZE);
+
+      ptr -= size;
+      blocks++;
+    }
 
-  /* If toptop is NULL we only have one allocator. */
-  if (toptop == NULL) return;
+    if (cur == frame->mark_alloc) break;
+  }
+  assert(blocks == frame->stack_allocs && "Frame guards do not add up.");
+}
+#endif
 
-  /* Merge requirement check */
-  if (!(top->stack_ptr == top->region && toptop->stack_ptr == toptop->region))
-    return;
+/*-------------------------------------------------------
+ * Heap Private Sections
+ *-------------------------------------------------------*/
+static void owner_asserts(stalloc *a) {
+  /* Even finding out which region a block is in races the owner growing or
+     releasing them. Other threads hfree, or stalloc_adopt first. */
+  assert(pthread_equal(pthread_self(), a->owner) &&
+         "Only the owning thread may allocate from a stalloc.");
+  (void)a;
+}
+
+static int64_t heap_block_size(int64_t bytes) {
+  int64_t size = ALIGN_UP(bytes + HEAP_HEADER_SIZE + FOOTER_SIZE, HEAP_GRANULE);
+  return size < HEAP_MIN_BLOCK ? HEAP_MIN_BLOCK : size;
+}
+
+static int32_t heap_bin(uint32_t size) {
+  int32_t bin = (31 - __builtin_clz(size)) - HEAP_MIN_CLASS;
+  return bin < HEAP_BIN_COUNT ? bin : HEAP_BIN_COUNT - 1;
+}
+
+static void heap_write_guards(void *block, uint32_t size, uint32_t state) {
+  uint32_t memory_guard = MAKE_GUARD(size, state);
+  memcpy(block, &memory_guard, GUARD_SIZE);
+  memcpy(block + size - FOOTER_SIZE, &memory_guard, FOOTER_SIZE);
+}
+
+static alloc *heap_region_of(stalloc *a, void *block) {
+  for (alloc *cur = a->top; cur != NULL; cur = cur->next)
+    if (block >= cur->heap_div_ptr && block < cur->heap_top) return cur;
+  return NULL;
+}
+
+static void *heap_take_free(stalloc *a, uint32_t size) {
+  int32_t bin = heap_bin(size);
+  void   *found = NULL;
+
+  /* First fit inside the class that may hold smaller blocks than needed. */
+  for (void *cur = a->heap_bins[bin]; cur != NULL;
+       cur = ((heap_links *)(cur + HEAP_HEADER_SIZE))->next) {
+    if (BLOCK_SIZE(*(uint32_t *)cur) >= size) {
+      found = cur;
+      break;
+    }
+  }
+
+  /* Any block of a larger class fits, take the head of the smallest one. */
+  if (found == NULL) {
+    uint32_t larger = a->heap_bin_map & ~((2u << bin) - 1);
+    if (larger == 0) return NULL;
+    found = a->heap_bins[__builtin_ctz(larger)];
+  }
+
+  uint32_t found_size = BLOCK_SIZE(*(uint32_t *)found);
+  heap_bin_remove(a, found, found_size);
+
+  /* Split, the lower part stays free and the upper part is handed out. */
+  if (found_size - size >= HEAP_MIN_BLOCK) {
+    uint32_t rest = found_size - size;
+    heap_write_guards(found, rest, FREE);
+    heap_bin_insert(a, found, rest);
+    found += rest;
+    found_size = size;
+  }
+
+  heap_write_guards(found, found_size, ALLOCATED);
+  STAT_USED(a, found_size);
+  return found;
+}
 
-  /* Prepare merge block */
-  alloc *merged = calloc(1, top->region_size + toptop->region_size);
+static void *heap_carve(stalloc *a, uint32_t size) {
+  alloc *cur = a->top;
+  while (cur != NULL && cur->heap_div_ptr - cur->stack_ptr < size)
+    cur = cur->next;
+
+  if (cur == NULL) {
+    append_new_alloc(a, size);
+    cur = a->top;
+  }
+
+  cur->heap_div_ptr -= size;
+  heap_write_guards(cur->heap_div_ptr, size, ALLOCATED);
+  STAT_USED(a, size);
+  return cur->heap_div_ptr;
+}
+
+#ifdef STALLOC_STATS
+static void stat_used(stalloc *a, int64_t delta) {
+  a->stats.bytes_used += delta;
+  if (a->stats.bytes_used > a->stats.bytes_peak)
+    a->stats.bytes_peak = a->stats.bytes_used;
+}
+#endif
+
+static void heap_drain_remote(stalloc *a) {
+  /* Taking the whole list at once means the consumer never races a pop. */
+  void *cur =
+      atomic_exchange_explicit(&a->remote_frees, NULL, memory_order_acquire);
+  while (cur != NULL) {
+    void *next = *(void **)cur;
+    heap_release(a, cur);
+    cur = next;
+  }
+}
+
+static int64_t heap_bytes_used(stalloc *a) {
+  /* Heap spans hold free blocks too, those are subtracted through the bins. */
+  int64_t used = 0;
+  for (alloc *cur = a->top; cur != NULL; cur = cur->next)
+    used += cur->heap_top - cur->heap_div_ptr;
+  for (int32_t bin = 0; bin < HEAP_BIN_COUNT; bin++)
+    for (void *cur = a->heap_bins[bin]; cur != NULL;
+         cur = ((heap_links *)(cur + HEAP_HEADER_SIZE))->next)
+      used -= BLOCK_SIZE(*(uint32_t *)cur);
+  return used;
+}
+
+static void heap_bin_insert(stalloc *a, void *block, uint32_t size) {
+  int32_t     bin = heap_bin(size);
+  heap_links *links = block + HEAP_HEADER_SIZE;
 
-  alloc_make(merged, top->region_size + toptop->region_size);
-  merged->next = toptop->next;
+  links->prev = NULL;
+  links->next = a->heap_bins[bin];
+  if (links->next)
+    ((heap_links *)(links->next + HEAP_HEADER_SIZE))->prev = block;
 
-  /* CAS operation */
-  allocs->top = merged;
+  a->heap_bins[bin] = block;
+  a->heap_bin_map |= 1u << bin;
+}
+
+static void heap_bin_remove(stalloc *a, void *block, uint32_t size) {
+  int32_t     bin = heap_bin(size);
+  heap_links *links = block + HEAP_HEADER_SIZE;
+
+  if (links->prev)
+    ((heap_links *)(links->prev + HEAP_HEADER_SIZE))->next = links->next;
+  else
+    a->heap_bins[bin] = links->next;
 
-  free(top->region);
-  free(toptop->region);
-  free(top);
-  free(toptop);
-}
\ No newline at end of file
+  if (links->next)
+    ((heap_links *)(links->next + HEAP_HEADER_SIZE))->prev = links->prev;
+
+  if (a->heap_bins[bin] == NULL) a->heap_bin_map &= ~(1u << bin);
+}
@@ -1,6 +1,59 @@
 #include "csdsa.h"
 
+/* Word at a time hash in the style of wyhash by Wang Yi, keys are consumed
+ * 16 bytes per round and folded with 64x64->128 bit multiplies.
+ * https://github.com/wangyi-fudan/wyhash */
+#define HASH_SECRET_0 0xa0761d6478bd642full
+#define HASH_SECRET_1 0xe7037ed1a0b428dbull
+#define HASH_SECRET_2 0x8ebc6af09c88c6e3ull
+
+static uint64_t hash_mix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+static uint64_t hash_read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+static uint64_t hash_read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
 uint64_t hash_bytes(void *ptr, size_t size) {
+  const uint8_t *p = ptr;
+  uint64_t       seed = hash_mix(HASH_SECRET_2 ^ HASH_SECRET_0, HASH_SECRET_1);
+  uint64_t       a, b;
+
+  if (size <= 16) {
+    if (size >= 4) {
+      /* Two overlapping reads from each end cover 4 to 16 bytes. */
+      size_t step = (size >> 3) << 2;
+      a = (hash_read32(p) << 32) | hash_read32(p + step);
+      b = (hash_read32(p + size - 4) << 32) | hash_read32(p + size - 4 - step);
+    } else if (size > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[size >> 1] << 8) | p[size - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = size;
+    for (; i > 16; i -= 16, p += 16)
+      seed = hash_mix(hash_read64(p) ^ HASH_SECRET_1,
+                      hash_read64(p + 8) ^ seed);
+    a = hash_read64(p + i - 16);
+    b = hash_read64(p + i - 8);
+  }
+
+  __uint128_t r = (__uint128_t)(a ^ HASH_SECRET_1) * (b ^ seed);
+  return hash_mix((uint64_t)r ^ HASH_SECRET_0 ^ size,
+                  (uint64_t)(r >> 64) ^ HASH_SECRET_1);
+}
+
+uint64_t hash_djb2(void *ptr, size_t size) {
   /* djb2 by Dan Bernstein
    * http://www.cse.yorku.ca/~oz/hash.html */
   uint64_t       hash = 5381;
@@ -9,19 +62,53 @@ uint64_t hash_bytes(void *ptr, size_t size) {
   for (size_t i = 0; i < size; i++) {
     hash = ((hash << 5) + hash) + b_ptr[i];
   }
-  // log_info("hash %s (%ld) -> %ld\n", (char *)ptr, size, hash);
   return hash;
 }
 
+uint64_t hash_identity(void *ptr, size_t size) {
+  assert(size <= sizeof(uint64_t) && "Identity hashing needs integer keys.");
+  uint64_t key = 0;
+  memcpy(&key, ptr, size);
+  return key;
+}
+
+uint64_t hash_fibonacci(void *ptr, size_t size) {
+  /* Multiply by 2^64 / phi. The high bits mix best, and tables index with the
+     low bits, so swap the halves. */
+  uint64_t hash = hash_identity(ptr, size) * 0x9e3779b97f4a7c15ull;
+  return (hash >> 32) | (hash << 32);
+}
+
 void memswap(void *a, void *b, size_t size) {
-  unsigned char  temp;
+  if (a == b) return; /* The memcpys below may not overlap. */
   unsigned char *p = a;
   unsigned char *q = b;
 
-  for (size_t i = 0; i < size; i++) {
-    temp = p[i];
-    p[i] = q[i];
-    q[i] = temp;
+  /* Swap through a small temp, fixed size memcpy compiles to a few wide loads
+     and stores. Larger chunks first, the tail a word and then a byte at a
+     time. */
+  unsigned char chunk[32];
+  for (; size >= sizeof(chunk); size -= sizeof(chunk)) {
+    memcpy(chunk, p, sizeof(chunk));
+    memcpy(p, q, sizeof(chunk));
+    memcpy(q, chunk, sizeof(chunk));
+    p += sizeof(chunk);
+    q += sizeof(chunk);
+  }
+
+  uint64_t word;
+  for (; size >= sizeof(word); size -= sizeof(word)) {
+    memcpy(&word, p, sizeof(word));
+    memcpy(p, q, sizeof(word));
+    memcpy(q, &word, sizeof(word));
+    p += sizeof(word);
+    q += sizeof(word);
+  }
+
+  for (; size; size--) {
+    unsigned char temp = *p;
+    *p++ = *q;
+    *q++ = temp;
   }
 }
 
@@ -1,10 +1,38 @@
 #include "csdsa.h"
 
+/* Everything a _par operation hands its chunks through pool_run. */
+typedef struct par_job par_job;
+struct par_job {
+  vec            *v;
+  _each           n;
+  _pred           p;
+  _unary          u;
+  _binary         b;
+  void           *args;
+  void           *result;   /* The identity every fold chunk starts from. */
+  void           *partials; /* One result per chunk for folds. */
+  int64_t        *kept;     /* Survivors per chunk for filters. */
+  int64_t         result_size, grain;
+  _Atomic int64_t count;
+};
+
 static vec  *vec_construct(vec *v);
 static void  init_asserts(vec *v);
 static void  bound_asserts(vec *v, int64_t pos);
-static void *vec_alloc(vec *v, int64_t bytes);
+static void *vec_alloc(vec *v, int64_t bytes, bool zero);
 static void *lookup_el(vec *v, int64_t pos);
+static void  vec_grow(vec *v, int64_t capacity);
+static void  sort_insertion(vec *v, int64_t lo, int64_t hi, _compare cmp,
+                            void *args);
+static void  sort_heap(vec *v, int64_t lo, int64_t hi, _compare cmp,
+                       void *args);
+static void  sort_intro(vec *v, int64_t lo, int64_t hi, int32_t depth,
+                        _compare cmp, void *args);
+static void  count_if_range(int64_t begin, int64_t end, void *args);
+static void  filter_range(int64_t begin, int64_t end, void *args);
+static void  foreach_range(int64_t begin, int64_t end, void *args);
+static void  map_range(int64_t begin, int64_t end, void *args);
+static void  foldl_range(int64_t begin, int64_t end, void *args);
 
 vec *__vec_init(vec *v, int64_t el_size, stalloc *alloc, int32_t flags,
                 int64_t v_size) {
@@ -13,14 +41,16 @@ vec *__vec_init(vec *v, int64_t el_size, stalloc *alloc, int32_t flags,
   v->__size = v_size;
   v->__el_size = el_size;
   v->flags = flags;
-  v->elements = vec_alloc(v, v->__el_size * v->__size);
+  v->elements = vec_alloc(v, v->__el_size * v->__size, true);
   v->cache_counter = 0;
+  v->stats = NULL;
   assert(v->elements);
   return v;
 }
 
 void vec_free(vec *v) {
-  if (v->flags == TO_HEAP) {
+  if (v->flags & SNAPSHOT_MAPPED) __snapshot_close(v);
+  if (v->flags & TO_HEAP) {
     hfree(v->allocator, v->elements);
   };
 }
@@ -28,32 +58,30 @@ void vec_free(vec *v) {
 void vec_resize(vec *v, int64_t size) {
   init_asserts(v);
   v->length = size;
-  if (size <= v->__size) return;
-  int64_t old_size = v->__size;
-  while (size > v->__size) v->__size *= 2;
-  void *new_addr = vec_alloc(v, v->__size * v->__el_size);
-  assert(new_addr);
-
-  /* move to new_addr and set the new memory to 0 */
-  memmove(new_addr, v->elements, old_size * v->__el_size);
-  memset(new_addr + old_size * v->__el_size, 0,
-         v->__size * v->__el_size - old_size * v->__el_size);
-  v->cache_counter++;
+  vec_grow(v, size);
+}
 
-  /* If old address was heap alloc'd then it needs to be cleared */
-  if (v->flags == TO_HEAP) hfree(v->allocator, v->elements);
-  v->elements = new_addr;
+void vec_reserve(vec *v, int64_t capacity) {
+  init_asserts(v);
+  vec_grow(v, capacity);
 }
 
 void *vec_copy(vec *dest, vec *src) {
   init_asserts(src);
 
-  /* Copy metadata */
+  /* Copy metadata. A copy of a mapped snapshot lives in allocator memory,
+     and a mapped vec may be empty with nothing reserved. */
   memmove(dest, src, sizeof(*src));
+  dest->stats = NULL;
+  dest->flags &= ~SNAPSHOT_MAPPED;
+  if (dest->__size < 1) dest->__size = 1;
 
   /* Copy elements */
-  dest->elements = vec_alloc(dest, src->__size * src->__el_size);
-  memmove(dest->elements, src->elements, src->length * src->__el_size);
+  int64_t used = src->length * src->__el_size;
+  dest->elements = vec_alloc(dest, dest->__size * src->__el_size, false);
+  memmove(dest->elements, src->elements, used);
+  if (!(dest->flags & ALLOC_UNINIT))
+    memset(dest->elements + used, 0, dest->__size * src->__el_size - used);
 
   return dest;
 }
@@ -62,7 +90,30 @@ void vec_clear(vec *v) {
   init_asserts(v);
   v->length = 0;
   v->__top = 0;
-  memset(v->elements, 0, v->__size * v->__el_size);
+  if (!(v->flags & ALLOC_UNINIT))
+    memset(v->elements, 0, v->__size * v->__el_size);
+}
+
+void vec_track(vec *v, vec_stats *stats) {
+  assert(v);
+  v->stats = stats;
+}
+
+bool vec_save(vec *v, int fd) {
+  init_asserts(v);
+  snapshot snap = {.kind = SNAPSHOT_VEC,
+                   .el_size = v->__el_size,
+                   .count = v->length,
+                   .sections = 1};
+  snap.section[0] = *v;
+  return __snapshot_save(&snap, fd);
+}
+
+vec *vec_mmap_open(vec *v, const char *path, stalloc *alloc) {
+  snapshot snap;
+  if (!__snapshot_open(&snap, path, SNAPSHOT_VEC, alloc)) return NULL;
+  *v = snap.section[0];
+  return v;
 }
 
 /* Element operations */
@@ -73,8 +124,7 @@ void *vec_at(vec *v, int64_t pos) {
 
 void vec_put(vec *v, int64_t pos, void *el) {
   bound_asserts(v, pos);
-  void *cur_el = vec_at(v, pos);
-  memmove(cur_el, el, v->__el_size);
+  memmove(lookup_el(v, pos), el, v->__el_size);
 }
 
 void vec_delete_at(vec *v, int64_t pos) {
@@ -84,8 +134,8 @@ void vec_delete_at(vec *v, int64_t pos) {
     return;
   }
 
-  void *loc = vec_at(v, pos);
-  void *loc_next = vec_at(v, pos + 1);
+  void *loc = lookup_el(v, pos);
+  void *loc_next = lookup_el(v, pos + 1);
   assert(loc);
   assert(loc_next);
 
@@ -103,7 +153,7 @@ int64_t vec_find(vec *v, void *el) {
   init_asserts(v);
 
   for (int64_t i = 0; i < v->length; i++)
-    if (memcmp(el, vec_at(v, i), v->__el_size) == 0) return i;
+    if (memcmp(el, lookup_el(v, i), v->__el_size) == 0) return i;
   return -1;
 }
 void vec_push(vec *v, void *el) {
@@ -114,6 +164,37 @@ void vec_push(vec *v, void *el) {
   v->__top++;
   if (v->__top >= v->length) v->length = v->__top;
 }
+void vec_push_n(vec *v, void *src, int64_t n) {
+  init_asserts(v);
+  assert(n >= 0);
+  if (n == 0) return;
+  assert(src);
+
+  /* src may point into v itself, growing can move or free that memory. */
+  int64_t offset = -1;
+  if (src >= v->elements && src < v->elements + v->__size * v->__el_size)
+    offset = src - v->elements;
+
+  vec_grow(v, v->__top + n);
+  if (offset != -1) src = v->elements + offset;
+  memmove(lookup_el(v, v->__top), src, n * v->__el_size);
+  v->__top += n;
+  if (v->__top >= v->length) v->length = v->__top;
+}
+void vec_extend(vec *dest, vec *src) {
+  init_asserts(src);
+  assert(dest->__el_size == src->__el_size);
+  vec_push_n(dest, src->elements, src->length);
+}
+void *vec_emplace(vec *v) {
+  init_asserts(v);
+  vec_grow(v, v->__top + 1);
+  void *slot = lookup_el(v, v->__top);
+  if (!(v->flags & ALLOC_UNINIT)) memset(slot, 0, v->__el_size);
+  v->__top++;
+  if (v->__top >= v->length) v->length = v->__top;
+  return slot;
+}
 void vec_pop(vec *v) {
   init_asserts(v);
   assert(v->__top);
@@ -132,54 +213,145 @@ void vec_swap(vec *v, int64_t idx1, int64_t idx2) {
 
 /* Functional operations */
 void vec_sort(vec *v, _compare cmp, void *args) {
-  /* Just simple selection sort (I think) for now. */
+  init_asserts(v);
+  if (v->length < 2) return;
+
+  /* Introsort, quicksort that falls back to heapsort past 2*log2(n) levels
+     and finishes small ranges with insertion sort. */
+  int32_t depth = 2 * (63 - __builtin_clzll(v->length));
+  sort_intro(v, 0, v->length - 1, depth, cmp, args);
+}
+
+void vec_sort_stable(vec *v, _compare cmp, void *args) {
+  init_asserts(v);
+  if (v->length < 2) return;
+
+  /* Bottom up merge sort over insertion sorted runs, ping-ponging between
+     the elements and a scratch copy. */
+  int64_t n = v->length, es = v->__el_size;
+  for (int64_t lo = 0; lo < n; lo += VEC_SORT_RUN) {
+    int64_t hi = lo + VEC_SORT_RUN - 1;
+    sort_insertion(v, lo, hi < n ? hi : n - 1, cmp, args);
+  }
+  if (n <= VEC_SORT_RUN) return;
+
+  char *from = v->elements;
+  char *to = halloc_uninit(v->allocator, n * es);
+  char *scratch = to;
 
-  int64_t i, j;
-  for (i = 0; i < v->length; i++) {
-    for (j = 0; j < v->length - i - 1; j++) {
-      if (!cmp(vec_at(v, j), vec_at(v, j + 1), args)) vec_swap(v, j, j + 1);
+  for (int64_t width = VEC_SORT_RUN; width < n; width *= 2) {
+    for (int64_t lo = 0; lo < n; lo += 2 * width) {
+      int64_t mid = lo + width < n ? lo + width : n;
+      int64_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+      int64_t i = lo, j = mid, k = lo;
+
+      /* Take from the right run only when it is strictly smaller. */
+      while (i < mid && j < hi) {
+        if (cmp(from + j * es, from + i * es, args))
+          memcpy(to + k++ * es, from + j++ * es, es);
+        else
+          memcpy(to + k++ * es, from + i++ * es, es);
+      }
+      memcpy(to + k * es, from + i * es, (mid - i) * es);
+      memcpy(to + (k + mid - i) * es, from + j * es, (hi - j) * es);
+    }
+    char *temp = from;
+    from = to;
+    to = temp;
+  }
+
+  if (from != v->elements) memcpy(v->elements, from, n * es);
+  hfree(v->allocator, scratch);
+}
+
+void vec_sort_radix(vec *v, int64_t key_offset, int64_t key_size,
+                    bool is_signed) {
+  init_asserts(v);
+  assert(key_size > 0 && key_size <= 8);
+  assert(key_offset >= 0 && key_offset + key_size <= v->__el_size);
+  if (v->length < 2) return;
+
+  /* LSD radix sort, one stable counting pass per key byte. */
+  int64_t n = v->length, es = v->__el_size;
+  char   *from = v->elements;
+  char   *to = halloc_uninit(v->allocator, n * es);
+  char   *scratch = to;
+
+  for (int64_t digit = 0; digit < key_size; digit++) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    int64_t byte = key_offset + key_size - 1 - digit;
+#else
+    int64_t byte = key_offset + digit;
+#endif
+    /* Flipping the sign bit of the top byte orders negatives first. */
+    uint8_t flip = (is_signed && digit == key_size - 1) ? 0x80 : 0;
+
+    int64_t counts[256] = {0};
+    for (int64_t i = 0; i < n; i++)
+      counts[(uint8_t)from[i * es + byte] ^ flip]++;
+
+    /* Every key shares this byte, the pass would not move anything. */
+    if (counts[(uint8_t)from[byte] ^ flip] == n) continue;
+
+    int64_t offset = 0;
+    for (int32_t d = 0; d < 256; d++) {
+      int64_t count = counts[d];
+      counts[d] = offset;
+      offset += count;
     }
+
+    for (int64_t i = 0; i < n; i++) {
+      uint8_t d = (uint8_t)from[i * es + byte] ^ flip;
+      memcpy(to + counts[d]++ * es, from + i * es, es);
+    }
+
+    char *temp = from;
+    from = to;
+    to = temp;
   }
+
+  if (from != v->elements) memcpy(v->elements, from, n * es);
+  hfree(v->allocator, scratch);
 }
 
 int64_t vec_count_if(vec *v, _pred p, void *args) {
   init_asserts(v);
   int64_t count = 0;
   for (int64_t i = 0; i < v->length; i++)
-    if (p(vec_at(v, i), args)) count++;
+    if (p(lookup_el(v, i), args)) count++;
   return count;
 }
 
 vec *vec_filter(vec *v, _pred p, void *args) {
   init_asserts(v);
-  vec filter;
-  __vec_init(&filter, v->__el_size, v->allocator, TO_STACK,
-             VECTOR_DEFAULT_SIZE);
-  vec_resize(&filter, v->length);
+  assert(!(v->flags & SNAPSHOT_MAPPED) &&
+         "Mapped vecs are read only, vec_copy first.");
 
+  /* Compacts in place, survivors only move down so v keeps its memory and
+     flags. */
+  int64_t kept = 0;
   for (int64_t i = 0; i < v->length; i++) {
-    void *loc = vec_at(v, i);
-    if (p(loc, args)) vec_push(&filter, vec_at(v, i));
+    void *loc = lookup_el(v, i);
+    if (!p(loc, args)) continue;
+    if (kept != i) memcpy(lookup_el(v, kept), loc, v->__el_size);
+    kept++;
   }
-  vec_resize(&filter, filter.__top);
-
-  /* Free the internals of the *v vector and copy over the local one. */
-  vec_free(v);
-  memmove(v, &filter, sizeof(*v));
+  v->length = kept;
+  v->__top = kept;
 
   return v;
 }
 
 void vec_foreach(vec *v, _each n, void *args) {
   init_asserts(v);
-  for (int64_t i = 0; i < v->length; i++) n(vec_at(v, i), args);
+  for (int64_t i = 0; i < v->length; i++) n(lookup_el(v, i), args);
 }
 
 vec *vec_map(vec *v, _unary u, void *args) {
   init_asserts(v);
   void *mapped_el = stpusha(v->allocator, v->__el_size);
   for (int64_t i = 0; i < v->length; i++) {
-    void *el = vec_at(v, i);
+    void *el = lookup_el(v, i);
     u(mapped_el, el, args);
     memmove(el, mapped_el, v->__el_size);
   }
@@ -190,18 +362,203 @@ vec *vec_map(vec *v, _unary u, void *args) {
 void *vec_foldl(vec *v, _binary b, void *result, void *args) {
   init_asserts(v);
   for (int64_t i = 0; i < v->length; i++) {
-    b(result, result, vec_at(v, i), args);
+    b(result, result, lookup_el(v, i), args);
   }
   return result;
 }
 
+/* Batch Operations */
+void vec_foreach_batch(vec *v, _each_batch n, void *args) {
+  init_asserts(v);
+  for (int64_t i = 0; i < v->length; i += VEC_BATCH) {
+    int64_t count = v->length - i < VEC_BATCH ? v->length - i : VEC_BATCH;
+    n(lookup_el(v, i), count, v->__el_size, args);
+  }
+}
+
+vec *vec_map_batch(vec *v, _unary_batch u, void *args) {
+  vec_foreach_batch(v, u, args);
+  return v;
+}
+
+int64_t vec_count_if_batch(vec *v, _pred_batch p, void *args) {
+  init_asserts(v);
+  int64_t matches = 0;
+  for (int64_t i = 0; i < v->length; i += VEC_BATCH) {
+    int64_t count = v->length - i < VEC_BATCH ? v->length - i : VEC_BATCH;
+    matches += p(lookup_el(v, i), count, v->__el_size, args);
+  }
+  return matches;
+}
+
+/* Parallel Operations */
+int64_t vec_count_if_par(vec *v, _pred p, void *args, pool *pl) {
+  init_asserts(v);
+  par_job job = {.v = v, .p = p, .args = args};
+  atomic_init(&job.count, 0);
+  pool_run(pl, v->length, pool_grain(pl, v->length), count_if_range, &job);
+  return atomic_load(&job.count);
+}
+
+vec *vec_filter_par(vec *v, _pred p, void *args, pool *pl) {
+  init_asserts(v);
+  assert(!(v->flags & SNAPSHOT_MAPPED) &&
+         "Mapped vecs are read only, vec_copy first.");
+  int64_t grain = pool_grain(pl, v->length);
+  int64_t chunks = (v->length + grain - 1) / grain;
+  if (chunks == 0) return v;
+
+  /* Chunks compact themselves in parallel, then slide down in order. */
+  par_job job = {.v = v, .p = p, .args = args, .grain = grain};
+  job.kept = stpusha_uninit(v->allocator, chunks * sizeof(int64_t));
+  pool_run(pl, v->length, grain, filter_range, &job);
+
+  int64_t length = job.kept[0];
+  for (int64_t c = 1; c < chunks; c++) {
+    memmove(lookup_el(v, length), lookup_el(v, c * grain),
+            job.kept[c] * v->__el_size);
+    length += job.kept[c];
+  }
+  stpopa(v->allocator);
+
+  v->length = length;
+  v->__top = length;
+  return v;
+}
+
+void vec_foreach_par(vec *v, _each n, void *args, pool *pl) {
+  init_asserts(v);
+  par_job job = {.v = v, .n = n, .args = args};
+  pool_run(pl, v->length, pool_grain(pl, v->length), foreach_range, &job);
+}
+
+vec *vec_map_par(vec *v, _unary u, void *args, pool *pl) {
+  init_asserts(v);
+  par_job job = {.v = v, .u = u, .args = args};
+  pool_run(pl, v->length, pool_grain(pl, v->length), map_range, &job);
+  return v;
+}
+
+void *vec_foldl_par(vec *v, _binary b, _binary combine, void *result,
+                    int64_t result_size, void *args, pool *pl) {
+  init_asserts(v);
+  assert(result && result_size > 0);
+  int64_t grain = pool_grain(pl, v->length);
+  int64_t chunks = (v->length + grain - 1) / grain;
+  if (chunks == 0) return result;
+
+  par_job job = {.v = v,
+                 .b = b,
+                 .args = args,
+                 .result = result,
+                 .result_size = result_size,
+                 .grain = grain};
+  job.partials = stpusha_uninit(v->allocator, chunks * result_size);
+  pool_run(pl, v->length, grain, foldl_range, &job);
+
+  /* In chunk order, so combine only has to be associative. */
+  for (int64_t c = 0; c < chunks; c++)
+    combine(result, result, (char *)job.partials + c * result_size, args);
+  stpopa(v->allocator);
+  return result;
+}
+
 /*-------------------------------------------------------
  * Statics Below
  *-------------------------------------------------------*/
-static void *vec_alloc(vec *v, int64_t bytes) {
-  if (v->flags == TO_STACK)
-    return stpusha(v->allocator, v->__size * v->__el_size);
-  return halloc(v->allocator, v->__size * v->__el_size);
+static void count_if_range(int64_t begin, int64_t end, void *args) {
+  par_job *job = args;
+  int64_t  count = 0;
+  for (int64_t i = begin; i < end; i++)
+    if (job->p(lookup_el(job->v, i), job->args)) count++;
+  atomic_fetch_add_explicit(&job->count, count, memory_order_relaxed);
+}
+
+static void filter_range(int64_t begin, int64_t end, void *args) {
+  par_job *job = args;
+  vec     *v = job->v;
+  int64_t  kept = begin;
+  for (int64_t i = begin; i < end; i++) {
+    void *el = lookup_el(v, i);
+    if (!job->p(el, job->args)) continue;
+    if (kept != i) memcpy(lookup_el(v, kept), el, v->__el_size);
+    kept++;
+  }
+  job->kept[begin / job->grain] = kept - begin;
+}
+
+static void foreach_range(int64_t begin, int64_t end, void *args) {
+  par_job *job = args;
+  for (int64_t i = begin; i < end; i++)
+    job->n(lookup_el(job->v, i), job->args);
+}
+
+static void map_range(int64_t begin, int64_t end, void *args) {
+  par_job *job = args;
+  vec     *v = job->v;
+
+  /* The chunk's frame is on this worker's arena, it pops the scratch. */
+  void *mapped_el = stpush(v->__el_size);
+  for (int64_t i = begin; i < end; i++) {
+    void *el = lookup_el(v, i);
+    job->u(mapped_el, el, job->args);
+    memmove(el, mapped_el, v->__el_size);
+  }
+}
+
+static void foldl_range(int64_t begin, int64_t end, void *args) {
+  par_job *job = args;
+  void    *partial =
+      (char *)job->partials + begin / job->grain * job->result_size;
+
+  memcpy(partial, job->result, job->result_size);
+  for (int64_t i = begin; i < end; i++)
+    job->b(partial, partial, lookup_el(job->v, i), job->args);
+}
+
+static void *vec_alloc(vec *v, int64_t bytes, bool zero) {
+  zero = zero && !(v->flags & ALLOC_UNINIT);
+  if (v->flags & TO_HEAP)
+    return zero ? halloc(v->allocator, bytes)
+                : halloc_uninit(v->allocator, bytes);
+  return zero ? stpusha(v->allocator, bytes)
+              : stpusha_uninit(v->allocator, bytes);
+}
+/* Doubles the capacity until `capacity` elements fit, keeping the contents. */
+static void vec_grow(vec *v, int64_t capacity) {
+  if (capacity <= v->__size) return;
+  assert(!(v->flags & SNAPSHOT_MAPPED) &&
+         "Mapped vecs are read only, vec_copy first.");
+  int64_t old_size = v->__size;
+  while (capacity > v->__size) v->__size *= 2;
+  int64_t old_bytes = old_size * v->__el_size;
+  int64_t new_bytes = v->__size * v->__el_size;
+  v->cache_counter++;
+
+  /* Heap vectors reallocate, stack vectors grow in place when they are the
+     top block of the frame, otherwise move to a new block. */
+  void *old_addr = v->elements;
+  if (v->flags & TO_HEAP) {
+    v->elements = hrealloc(v->allocator, v->elements, new_bytes);
+    assert(v->elements);
+  } else if (!stextend(v->allocator, v->elements, new_bytes)) {
+    void *new_addr = vec_alloc(v, new_bytes, false);
+    assert(new_addr);
+    memmove(new_addr, v->elements, old_bytes);
+    v->elements = new_addr;
+  }
+
+  if (v->stats) {
+    v->stats->resizes++;
+    if (v->elements != old_addr) {
+      v->stats->moves++;
+      v->stats->bytes_copied += old_bytes;
+    }
+  }
+
+  /* Set the new memory to 0 */
+  if (!(v->flags & ALLOC_UNINIT))
+    memset(v->elements + old_bytes, 0, new_bytes - old_bytes);
 }
 static vec *vec_construct(vec *v) {
   v->length = 0;
@@ -217,6 +574,80 @@ static void bound_asserts(vec *v, int64_t i) {
   init_asserts(v);
   assert(i >= 0 && i < v->length);
 }
-static void *lookup_el(vec *v, int64_t pos) {
-  return v->elements + pos * v->__el_size;
+static inline void *lookup_el(vec *v, int64_t pos) {
+  return vec_at_unchecked(v, pos);
+}
+
+static void sort_insertion(vec *v, int64_t lo, int64_t hi, _compare cmp,
+                           void *args) {
+  for (int64_t i = lo + 1; i <= hi; i++)
+    for (int64_t j = i;
+         j > lo && cmp(lookup_el(v, j), lookup_el(v, j - 1), args); j--)
+      memswap(lookup_el(v, j), lookup_el(v, j - 1), v->__el_size);
+}
+
+static void sort_heap(vec *v, int64_t lo, int64_t hi, _compare cmp,
+                      void *args) {
+  int64_t n = hi - lo + 1;
+  for (int64_t end = n, start = n / 2 - 1;; ) {
+    /* First heapify from the middle down, then pop the max to the end. */
+    if (start >= 0) {
+      start--;
+    } else {
+      if (--end == 0) return;
+      memswap(lookup_el(v, lo), lookup_el(v, lo + end), v->__el_size);
+    }
+
+    int64_t root = start >= 0 ? start + 1 : 0;
+    for (int64_t child = 2 * root + 1; child < end; child = 2 * root + 1) {
+      if (child + 1 < end &&
+          cmp(lookup_el(v, lo + child), lookup_el(v, lo + child + 1), args))
+        child++;
+      if (!cmp(lookup_el(v, lo + root), lookup_el(v, lo + child), args)) break;
+      memswap(lookup_el(v, lo + root), lookup_el(v, lo + child), v->__el_size);
+      root = child;
+    }
+  }
+}
+
+static void sort_intro(vec *v, int64_t lo, int64_t hi, int32_t depth,
+                       _compare cmp, void *args) {
+  while (hi - lo + 1 > VEC_SORT_RUN) {
+    if (depth-- == 0) {
+      sort_heap(v, lo, hi, cmp, args);
+      return;
+    }
+
+    /* Median of three, moved to lo where it stays during partitioning. */
+    int64_t mid = lo + (hi - lo) / 2;
+    if (cmp(lookup_el(v, mid), lookup_el(v, lo), args))
+      memswap(lookup_el(v, mid), lookup_el(v, lo), v->__el_size);
+    if (cmp(lookup_el(v, hi), lookup_el(v, mid), args)) {
+      memswap(lookup_el(v, hi), lookup_el(v, mid), v->__el_size);
+      if (cmp(lookup_el(v, mid), lookup_el(v, lo), args))
+        memswap(lookup_el(v, mid), lookup_el(v, lo), v->__el_size);
+    }
+    memswap(lookup_el(v, mid), lookup_el(v, lo), v->__el_size);
+
+    /* Scans stop on equal keys, so runs of duplicates split evenly. */
+    void   *pivot = lookup_el(v, lo);
+    int64_t i = lo + 1, j = hi;
+    for (;;) {
+      while (i <= j && cmp(lookup_el(v, i), pivot, args)) i++;
+      while (i <= j && cmp(pivot, lookup_el(v, j), args)) j--;
+      if (i >= j) break;
+      memswap(lookup_el(v, i++), lookup_el(v, j--), v->__el_size);
+    }
+    memswap(pivot, lookup_el(v, j), v->__el_size);
+
+    /* Recurse into the smaller half, loop on the larger one. */
+    if (j - lo < hi - j) {
+      sort_intro(v, lo, j - 1, depth, cmp, args);
+      lo = j + 1;
+    } else {
+      sort_intro(v, j + 1, hi, depth, cmp, args);
+      hi = j - 1;
+    }
+  }
+  sort_insertion(v, lo, hi, cmp, args);
 }
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "csdsa.h"
+#include "unity.h"
+#include <sched.h>
+
+/* Both halves are written by one put, a reader seeing them disagree read a
+   value halfway through being written. */
+typedef struct pair pair;
+struct pair {
+  int64_t gen, check;
+};
+
+CMAP_TYPE_IMPL(int_cmap, int64_t, int64_t);
+CMAP_TYPE_IMPL_HASH(pair_cmap, int64_t, pair, hash_fibonacci);
+
+#define WRITERS 2
+#define READERS 2
+#define KEYS    4096 /* Per writer, enough to grow every shard a few times */
+#define ROUNDS  4
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+stalloc *allocator = NULL;
+int_cmap tmap;
+
+void setUp(void) { int_cmap_init(&tmap, 4, 8); }
+void tearDown(void) { int_cmap_free(&tmap); }
+
+void test_put_get_del(void);
+void test_growth(void);
+void test_clear_foreach(void);
+void test_threads(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_put_get_del));
+  FRAME(allocator, RUN_TEST(test_growth));
+  FRAME(allocator, RUN_TEST(test_clear_foreach));
+  FRAME(allocator, RUN_TEST(test_threads));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  GFRAME(allocator, tests());
+
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+void test_put_get_del(void) {
+  int64_t out = -1;
+  TEST_ASSERT(!int_cmap_get(&tmap, &(int64_t){1}, &out));
+  TEST_ASSERT(out == -1);
+
+  int_cmap_put(&tmap, &(int64_t){1}, &(int64_t){10});
+  int_cmap_put(&tmap, &(int64_t){2}, &(int64_t){20});
+  TEST_ASSERT(int_cmap_get(&tmap, &(int64_t){1}, &out));
+  TEST_ASSERT(out == 10);
+  TEST_ASSERT(int_cmap_has(&tmap, &(int64_t){2}));
+  TEST_ASSERT(int_cmap_load(&tmap) == 2);
+
+  /* Overwriting keeps the count. */
+  int_cmap_put(&tmap, &(int64_t){1}, &(int64_t){11});
+  TEST_ASSERT(int_cmap_get(&tmap, &(int64_t){1}, &out));
+  TEST_ASSERT(out == 11);
+  TEST_ASSERT(int_cmap_load(&tmap) == 2);
+
+  int_cmap_del(&tmap, &(int64_t){1});
+  int_cmap_del(&tmap, &(int64_t){3});
+  TEST_ASSERT(!int_cmap_has(&tmap, &(int64_t){1}));
+  TEST_ASSERT(int_cmap_has(&tmap, &(int64_t){2}));
+  TEST_ASSERT(int_cmap_load(&tmap) == 1);
+}
+
+void test_growth(void) {
+  for (int64_t i = 0; i < 10000; i++) int_cmap_put(&tmap, &i, &(int64_t){-i});
+  TEST_ASSERT(int_cmap_load(&tmap) == 10000);
+
+  /* Dropping the old tables leaves the live ones intact. */
+  int_cmap_reclaim(&tmap);
+  for (int64_t i = 0; i < 10000; i++) {
+    int64_t out;
+    TEST_ASSERT(int_cmap_get(&tmap, &i, &out));
+    TEST_ASSERT(out == -i);
+  }
+
+  /* Churn through deletes and reinserts, tombstones get cleared out. */
+  for (int64_t round = 0; round < 4; round++) {
+    for (int64_t i = 0; i < 10000; i += 2) int_cmap_del(&tmap, &i);
+    for (int64_t i = 0; i < 10000; i += 2)
+      int_cmap_put(&tmap, &i, &(int64_t){round});
+  }
+  TEST_ASSERT(int_cmap_load(&tmap) == 10000);
+  int64_t out;
+  TEST_ASSERT(int_cmap_get(&tmap, &(int64_t){9998}, &out) && out == 3);
+  TEST_ASSERT(int_cmap_get(&tmap, &(int64_t){9999}, &out) && out == -9999);
+}
+
+static void sum_values(void *el, void *args) {
+  kvpair *kv = el;
+  *(int64_t *)args += *(int64_t *)kv->value;
+}
+
+void test_clear_foreach(void) {
+  for (int64_t i = 1; i <= 100; i++) int_cmap_put(&tmap, &i, &i);
+  int64_t sum = 0;
+  int_cmap_foreach(&tmap, sum_values, &sum);
+  TEST_ASSERT(sum == 5050);
+
+  int_cmap_clear(&tmap);
+  TEST_ASSERT(int_cmap_load(&tmap) == 0);
+  TEST_ASSERT(!int_cmap_has(&tmap, &(int64_t){50}));
+
+  sum = 0;
+  int_cmap_foreach(&tmap, sum_values, &sum);
+  TEST_ASSERT(sum == 0);
+
+  /* A single shard works the same. */
+  int_cmap one;
+  int_cmap_init(&one, 1, 1);
+  for (int64_t i = 0; i < 100; i++) int_cmap_put(&one, &i, &i);
+  TEST_ASSERT(int_cmap_load(&one) == 100);
+  TEST_ASSERT(int_cmap_has(&one, &(int64_t){99}));
+  int_cmap_free(&one);
+}
+
+typedef struct worker worker;
+struct worker {
+  pair_cmap       *m;
+  int64_t          first; /* Writers only, the start of their key range */
+  int64_t          found, torn;
+  _Atomic int32_t *writing;
+};
+
+static void *writer(void *arg) {
+  worker *w = arg;
+  for (int64_t gen = 1; gen <= ROUNDS; gen++) {
+    for (int64_t k = w->first; k < w->first + KEYS; k++)
+      pair_cmap_put(w->m, &k, &(pair){gen, gen ^ k});
+    for (int64_t k = w->first; k < w->first + KEYS; k += 3)
+      pair_cmap_del(w->m, &k);
+  }
+  atomic_fetch_sub(w->writing, 1);
+  return NULL;
+}
+
+static void *reader(void *arg) {
+  worker *w = arg;
+  do {
+    for (int64_t k = 0; k < WRITERS * KEYS; k++) {
+      pair out;
+      if (!pair_cmap_get(w->m, &k, &out)) continue;
+      w->found++;
+      if (out.check != (out.gen ^ k)) w->torn++;
+    }
+    sched_yield();
+  } while (atomic_load(w->writing) > 0);
+  return NULL;
+}
+
+void test_threads(void) {
+  pair_cmap m;
+  pair_cmap_init(&m, 0, 1);
+  _Atomic int32_t writing = WRITERS;
+
+  pthread_t threads[WRITERS + READERS];
+  worker    workers[WRITERS + READERS];
+  for (int i = 0; i < WRITERS + READERS; i++) {
+    workers[i] = (worker){.m = &m, .first = i * KEYS, .writing = &writing};
+    pthread_create(&threads[i], NULL, i < WRITERS ? writer : reader,
+                   &workers[i]);
+  }
+  for (int i = 0; i < WRITERS + READERS; i++) pthread_join(threads[i], NULL);
+
+  /* Readers saw entries and never half of one. */
+  for (int i = WRITERS; i < WRITERS + READERS; i++) {
+    TEST_ASSERT(workers[i].found > 0);
+    TEST_ASSERT(workers[i].torn == 0);
+  }
+
+  /* Keys the last round deleted are gone, the rest hold its values. */
+  TEST_ASSERT(pair_cmap_load(&m) == WRITERS * (KEYS - (KEYS + 2) / 3));
+  for (int64_t k = 0; k < WRITERS * KEYS; k++) {
+    pair out;
+    bool deleted = (k % KEYS) % 3 == 0;
+    TEST_ASSERT(pair_cmap_get(&m, &k, &out) == !deleted);
+    if (!deleted) TEST_ASSERT(out.gen == ROUNDS && out.check == (ROUNDS ^ k));
+  }
+
+  pair_cmap_free(&m);
+}
@@ -0,0 +1,189 @@
+#include "csdsa.h"
+#include "unity.h"
+#include <stdbool.h>
+
+typedef struct complex_struct cs;
+struct complex_struct {
+  int  x, y, z;
+  bool active;
+};
+
+FMAP_TYPE_IMPL(int_cs_fmap, int, cs);
+FMAP_TYPE_IMPL(int_int_fmap, int, int);
+FMAP_TYPE_IMPL_HASH(ident_fmap, int64_t, int, hash_identity);
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+int_cs_fmap tmap;
+stalloc    *allocator = NULL;
+
+void setUp(void) {
+  start_frame(allocator);
+  int_cs_fmap_inita(&tmap, allocator, TO_STACK, MAP_DEFAULT_SIZE);
+}
+void tearDown(void) {
+  int_cs_fmap_free(&tmap);
+  end_frame(allocator);
+}
+
+void test_put_and_find(void);
+void test_remove(void);
+void test_colliding_keys(void);
+void test_churn(void);
+void test_functional(void);
+void test_get_or_insert(void);
+void test_copy_and_clear(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_put_and_find));
+  FRAME(allocator, RUN_TEST(test_remove));
+  FRAME(allocator, RUN_TEST(test_colliding_keys));
+  FRAME(allocator, RUN_TEST(test_churn));
+  FRAME(allocator, RUN_TEST(test_functional));
+  FRAME(allocator, RUN_TEST(test_get_or_insert));
+  FRAME(allocator, RUN_TEST(test_copy_and_clear));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  GFRAME(allocator, tests());
+
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+void test_put_and_find(void) {
+  for (int i = 0; i < 1000; i++)
+    int_cs_fmap_put(&tmap, &i, &(cs){.x = i, .y = -i, .active = true});
+
+  TEST_ASSERT(int_cs_fmap_load(&tmap) == 1000);
+  TEST_ASSERT((tmap.__size & (tmap.__size - 1)) == 0);
+
+  for (int i = 0; i < 1000; i++) {
+    kvpair kv = int_cs_fmap_get(&tmap, &i);
+    TEST_ASSERT(kv.key && *(int *)kv.key == i);
+    TEST_ASSERT(((cs *)kv.value)->x == i && ((cs *)kv.value)->y == -i);
+  }
+  for (int i = 1000; i < 2000; i++) TEST_ASSERT(!int_cs_fmap_has(&tmap, &i));
+
+  /* Overwrites keep the load. */
+  int key = 5;
+  int_cs_fmap_put(&tmap, &key, &(cs){.x = 50});
+  TEST_ASSERT(((cs *)int_cs_fmap_get(&tmap, &key).value)->x == 50);
+  TEST_ASSERT(int_cs_fmap_load(&tmap) == 1000);
+}
+
+void test_remove(void) {
+  for (int i = 0; i < 500; i++) int_cs_fmap_put(&tmap, &i, &(cs){.x = i});
+  for (int i = 0; i < 500; i += 2) int_cs_fmap_del(&tmap, &i);
+
+  TEST_ASSERT(int_cs_fmap_load(&tmap) == 250);
+  for (int i = 0; i < 500; i++)
+    TEST_ASSERT(int_cs_fmap_has(&tmap, &i) == (i % 2 == 1));
+
+  /* Deleting what is not there does nothing. */
+  int missing = 1234;
+  int_cs_fmap_del(&tmap, &missing);
+  TEST_ASSERT(int_cs_fmap_load(&tmap) == 250);
+}
+
+void test_colliding_keys(void) {
+  /* With identity hashing these keys share every low bit, so they all start
+     at the same group with the same fragment and spill over many groups. */
+  ident_fmap m;
+  ident_fmap_inita(&m, allocator, TO_HEAP, 64);
+
+  for (int64_t i = 0; i < 100; i++) {
+    int64_t key = i << 32;
+    ident_fmap_put(&m, &key, &(int){(int)i});
+  }
+  for (int64_t i = 0; i < 100; i++) {
+    int64_t key = i << 32;
+    TEST_ASSERT(*(int *)ident_fmap_get(&m, &key).value == i);
+  }
+
+  /* Deleting from the middle of the chain must not hide what follows. */
+  for (int64_t i = 0; i < 100; i += 3) {
+    int64_t key = i << 32;
+    ident_fmap_del(&m, &key);
+  }
+  for (int64_t i = 0; i < 100; i++) {
+    int64_t key = i << 32;
+    TEST_ASSERT(ident_fmap_has(&m, &key) == (i % 3 != 0));
+  }
+
+  ident_fmap_free(&m);
+}
+
+void test_churn(void) {
+  int_int_fmap m;
+  int_int_fmap_inita(&m, allocator, TO_HEAP, 64);
+
+  /* A sliding window of live keys never grows the table. */
+  for (int i = 0; i < 20000; i++) {
+    int_int_fmap_put(&m, &i, &i);
+    int old = i - 20;
+    if (old >= 0) int_int_fmap_del(&m, &old);
+  }
+  TEST_ASSERT(m.__size == 64);
+  TEST_ASSERT(int_int_fmap_load(&m) == 20);
+  for (int i = 20000 - 20; i < 20000; i++)
+    TEST_ASSERT(*(int *)int_int_fmap_get(&m, &i).value == i);
+
+  int_int_fmap_free(&m);
+}
+
+feach(sum_x, kvpair, kv, { *(int *)args += ((cs *)kv.value)->x; });
+pred(is_even_key, kvpair, kv, { return *(int *)kv.key % 2 == 0; });
+pred(is_key_42, kvpair, kv, { return *(int *)kv.key == 42; });
+void test_functional(void) {
+  for (int i = 0; i < 100; i++) int_cs_fmap_put(&tmap, &i, &(cs){.x = 1});
+
+  int sum = 0;
+  int_cs_fmap_foreach(&tmap, sum_x, &sum);
+  TEST_ASSERT(sum == 100);
+
+  TEST_ASSERT(int_cs_fmap_count_if(&tmap, is_even_key, NULL) == 50);
+  TEST_ASSERT(*(int *)int_cs_fmap_find_one(&tmap, is_key_42, NULL).key == 42);
+
+  int_cs_fmap_filter(&tmap, is_even_key, NULL);
+  TEST_ASSERT(int_cs_fmap_load(&tmap) == 50);
+  for (int i = 0; i < 100; i++)
+    TEST_ASSERT(int_cs_fmap_has(&tmap, &i) == (i % 2 == 0));
+  TEST_ASSERT(int_cs_fmap_find_one(&tmap, is_key_42, NULL).key != NULL);
+}
+
+void test_get_or_insert(void) {
+  int_int_fmap counts;
+  int_int_fmap_inita(&counts, allocator, TO_STACK_UNINIT, 4);
+
+  for (int i = 0; i < 1000; i++)
+    (*int_int_fmap_get_or_insert(&counts, &(int){i % 37}))++;
+
+  TEST_ASSERT(int_int_fmap_load(&counts) == 37);
+  for (int i = 0; i < 37; i++) {
+    int expected = 1000 / 37 + (i < 1000 % 37);
+    TEST_ASSERT(*(int *)int_int_fmap_get(&counts, &i).value == expected);
+  }
+}
+
+void test_copy_and_clear(void) {
+  for (int i = 0; i < 64; i++) int_cs_fmap_put(&tmap, &i, &(cs){.x = i});
+
+  int_cs_fmap copy;
+  int_cs_fmap_copy(&copy, &tmap);
+  int_cs_fmap_clear(&tmap);
+
+  TEST_ASSERT(int_cs_fmap_load(&tmap) == 0);
+  TEST_ASSERT(int_cs_fmap_load(&copy) == 64);
+  for (int i = 0; i < 64; i++) {
+    TEST_ASSERT(!int_cs_fmap_has(&tmap, &i));
+    TEST_ASSERT(((cs *)int_cs_fmap_get(&copy, &i).value)->x == i);
+  }
+}
@@ -0,0 +1,187 @@
+#include "csdsa.h"
+#include "unity.h"
+#include <stdlib.h>
+
+typedef struct point point;
+struct point {
+  int x, y;
+};
+
+GRAPH_TYPE_IMPL(grid, point);
+VEC_TYPE_IMPL(id_vec, int64_t);
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+stalloc *allocator = NULL;
+grid     tgrid;
+
+#define SIDE 16
+
+/* A SIDE x SIDE grid where every cell links to its four neighbors with
+   weight 1, vertex ids go row by row. */
+static void build_grid(grid *g) {
+  for (int y = 0; y < SIDE; y++)
+    for (int x = 0; x < SIDE; x++) grid_add_vertex(g, &(point){x, y});
+
+  for (int y = 0; y < SIDE; y++) {
+    for (int x = 0; x < SIDE; x++) {
+      int64_t v = y * SIDE + x;
+      if (x + 1 < SIDE) grid_add_edge(g, v, v + 1, 1);
+      if (x > 0) grid_add_edge(g, v, v - 1, 1);
+      if (y + 1 < SIDE) grid_add_edge(g, v, v + SIDE, 1);
+      if (y > 0) grid_add_edge(g, v, v - SIDE, 1);
+    }
+  }
+}
+
+void setUp(void) {
+  start_frame(allocator);
+  grid_inita(&tgrid, allocator, TO_STACK, SIDE * SIDE);
+  build_grid(&tgrid);
+}
+void tearDown(void) {
+  grid_free(&tgrid);
+  end_frame(allocator);
+}
+
+void test_compile(void);
+void test_bfs(void);
+void test_dfs(void);
+void test_a_star(void);
+void test_a_star_unreachable(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_compile));
+  FRAME(allocator, RUN_TEST(test_bfs));
+  FRAME(allocator, RUN_TEST(test_dfs));
+  FRAME(allocator, RUN_TEST(test_a_star));
+  FRAME(allocator, RUN_TEST(test_a_star_unreachable));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  GFRAME(allocator, tests());
+
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+void test_compile(void) {
+  TEST_ASSERT(grid_vertices(&tgrid) == SIDE * SIDE);
+  TEST_ASSERT(grid_edges(&tgrid) == 4 * SIDE * (SIDE - 1));
+
+  /* Runs keep the order the edges were added in. */
+  int64_t  count;
+  int64_t *n = grid_neighbors(&tgrid, SIDE + 1, &count);
+  TEST_ASSERT(count == 4);
+  TEST_ASSERT(n[0] == SIDE + 2 && n[1] == SIDE && n[2] == 2 * SIDE + 1 &&
+              n[3] == 1);
+
+  grid_neighbors(&tgrid, 0, &count);
+  TEST_ASSERT(count == 2);
+
+  /* Changing the builder recompiles on the next read. */
+  TEST_ASSERT(grid_del_edge(&tgrid, 0, 1));
+  TEST_ASSERT(!grid_del_edge(&tgrid, 0, 1));
+  grid_add_edge(&tgrid, 0, SIDE * SIDE - 1, 2.5);
+  n = grid_neighbors(&tgrid, 0, &count);
+  TEST_ASSERT(count == 2);
+  TEST_ASSERT(n[0] == SIDE && n[1] == SIDE * SIDE - 1);
+  TEST_ASSERT(grid_weights(&tgrid, 0)[1] == 2.5);
+}
+
+typedef struct order order;
+struct order {
+  int64_t seen[SIDE * SIDE];
+  int64_t count;
+  int64_t stop_at;
+};
+pred(record, int64_t, v, {
+  order *o = args;
+  o->seen[o->count++] = v;
+  return v == o->stop_at;
+});
+
+static int distance(grid *g, int64_t a, int64_t b) {
+  point *pa = grid_vertex(g, a), *pb = grid_vertex(g, b);
+  return abs(pa->x - pb->x) + abs(pa->y - pb->y);
+}
+
+void test_bfs(void) {
+  order o = {.stop_at = -1};
+  TEST_ASSERT(!grid_bfs(&tgrid, 0, record, &o, allocator));
+  TEST_ASSERT(o.count == SIDE * SIDE);
+
+  /* Breadth first reaches vertices in order of hops from the start. */
+  for (int64_t i = 1; i < o.count; i++)
+    TEST_ASSERT(distance(&tgrid, 0, o.seen[i - 1]) <=
+                distance(&tgrid, 0, o.seen[i]));
+
+  order stop = {.stop_at = 3 * SIDE + 3};
+  TEST_ASSERT(grid_bfs(&tgrid, 0, record, &stop, allocator));
+  TEST_ASSERT(stop.seen[stop.count - 1] == 3 * SIDE + 3);
+  TEST_ASSERT(stop.count < SIDE * SIDE);
+}
+
+void test_dfs(void) {
+  order o = {.stop_at = -1};
+  TEST_ASSERT(!grid_dfs(&tgrid, 0, record, &o, allocator));
+  TEST_ASSERT(o.count == SIDE * SIDE);
+
+  /* Following the first edge each time walks the top row first. */
+  for (int64_t i = 0; i < SIDE; i++) TEST_ASSERT(o.seen[i] == i);
+
+  /* Nothing is visited twice. */
+  bool visited[SIDE * SIDE] = {0};
+  for (int64_t i = 0; i < o.count; i++) {
+    TEST_ASSERT(!visited[o.seen[i]]);
+    visited[o.seen[i]] = true;
+  }
+}
+
+static double manhattan(void *vertex, void *goal, void *args) {
+  (void)args;
+  point *a = vertex, *b = goal;
+  return abs(a->x - b->x) + abs(a->y - b->y);
+}
+
+void test_a_star(void) {
+  id_vec path;
+  id_vec_inita(&path, allocator, TO_STACK, 4);
+
+  int64_t goal = SIDE * SIDE - 1;
+  double cost =
+      grid_a_star(&tgrid, 0, goal, manhattan, NULL, &path, allocator);
+  TEST_ASSERT(cost == 2 * (SIDE - 1));
+  TEST_ASSERT(path.length == 2 * (SIDE - 1) + 1);
+  TEST_ASSERT(*id_vec_at(&path, 0) == 0);
+  TEST_ASSERT(*id_vec_at(&path, path.length - 1) == goal);
+  for (int64_t i = 1; i < path.length; i++)
+    TEST_ASSERT(distance(&tgrid, *id_vec_at(&path, i - 1),
+                         *id_vec_at(&path, i)) == 1);
+
+  /* A cheaper shortcut wins over the hop count, Dijkstra agrees. */
+  grid_add_edge(&tgrid, 0, goal, 5);
+  cost = grid_a_star(&tgrid, 0, goal, manhattan, NULL, &path, allocator);
+  TEST_ASSERT(cost == 5);
+  TEST_ASSERT(path.length == 2);
+  TEST_ASSERT(grid_a_star(&tgrid, 0, goal, NULL, NULL, NULL, allocator) == 5);
+}
+
+void test_a_star_unreachable(void) {
+  int64_t island = grid_add_vertex(&tgrid, &(point){-5, -5});
+  TEST_ASSERT(grid_a_star(&tgrid, 0, island, manhattan, NULL, NULL,
+                          allocator) == -1);
+
+  /* Edges are directed. */
+  grid_add_edge(&tgrid, island, 0, 1);
+  TEST_ASSERT(grid_a_star(&tgrid, 0, island, NULL, NULL, NULL, allocator) ==
+              -1);
+  TEST_ASSERT(grid_a_star(&tgrid, island, 0, NULL, NULL, NULL, allocator) == 1);
+}
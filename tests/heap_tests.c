@@ -0,0 +1,156 @@
+#include "csdsa.h"
+#include "unity.h"
+
+typedef struct task task;
+struct task {
+  int priority;
+  int id;
+};
+
+compare(int_less, int, a, b, { return a < b; });
+compare(int_greater, int, a, b, { return a > b; });
+compare(task_less, task, a, b, { return a.priority < b.priority; });
+
+HEAP_TYPE_IMPL(min_heap, int, int_less);
+HEAP_TYPE_IMPL(max_heap, int, int_greater);
+HEAP_TYPE_IMPL(task_heap, task, task_less);
+VEC_TYPE_IMPL(int_vec, int);
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+stalloc *allocator = NULL;
+min_heap theap;
+
+void setUp(void) {
+  start_frame(allocator);
+  min_heap_inita(&theap, allocator, TO_STACK, 4);
+}
+void tearDown(void) {
+  min_heap_free(&theap);
+  end_frame(allocator);
+}
+
+void test_push_pop(void);
+void test_max_heap(void);
+void test_decrease_key(void);
+void test_from_vec(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_push_pop));
+  FRAME(allocator, RUN_TEST(test_max_heap));
+  FRAME(allocator, RUN_TEST(test_decrease_key));
+  FRAME(allocator, RUN_TEST(test_from_vec));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  GFRAME(allocator, tests());
+
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+void test_push_pop(void) {
+  TEST_ASSERT(min_heap_peek(&theap) == NULL);
+
+  /* A scrambled permutation of 0..999, with duplicates mixed in. */
+  for (int i = 0; i < 1000; i++)
+    min_heap_push(&theap, &(int){(i * 7919) % 1000});
+  for (int i = 0; i < 100; i++) min_heap_push(&theap, &(int){i});
+  TEST_ASSERT(min_heap_length(&theap) == 1100);
+  TEST_ASSERT(*min_heap_peek(&theap) == 0);
+
+  int prev = -1, out;
+  while (min_heap_length(&theap)) {
+    min_heap_pop(&theap, &out);
+    TEST_ASSERT(out >= prev);
+    prev = out;
+  }
+  TEST_ASSERT(prev == 999);
+}
+
+void test_max_heap(void) {
+  max_heap h;
+  max_heap_inita(&h, allocator, TO_HEAP_UNINIT, 1);
+
+  for (int i = 0; i < 50; i++) max_heap_push(&h, &i);
+  for (int i = 49; i >= 0; i--) {
+    TEST_ASSERT(*max_heap_peek(&h) == i);
+    max_heap_pop(&h, NULL);
+  }
+
+  max_heap_free(&h);
+}
+
+void test_decrease_key(void) {
+  task_heap h;
+  task_heap_inita(&h, allocator, TO_STACK, 8);
+
+  int64_t handles[64];
+  for (int i = 0; i < 64; i++)
+    handles[i] = task_heap_push(&h, &(task){.priority = 100 + i, .id = i});
+
+  /* Handles follow their element as it moves. */
+  task_heap_decrease_key(&h, handles[40], &(task){.priority = 1, .id = 40});
+  TEST_ASSERT(task_heap_peek(&h)->id == 40);
+  TEST_ASSERT(task_heap_get(&h, handles[63])->id == 63);
+
+  task out;
+  task_heap_pop(&h, &out);
+  TEST_ASSERT(out.id == 40);
+  TEST_ASSERT(!task_heap_contains(&h, handles[40]));
+
+  for (int i = 0; i < 64; i += 2) {
+    if (i == 40) continue;
+    task_heap_decrease_key(&h, handles[i], &(task){.priority = i, .id = i});
+  }
+  for (int i = 0; i < 64; i++)
+    if (i != 40) TEST_ASSERT(task_heap_get(&h, handles[i])->id == i);
+
+  /* Evens come out first, in order, then the untouched odds. */
+  for (int i = 0; i < 64; i += 2) {
+    if (i == 40) continue;
+    task_heap_pop(&h, &out);
+    TEST_ASSERT(out.id == i);
+  }
+  for (int i = 1; i < 64; i += 2) {
+    task_heap_pop(&h, &out);
+    TEST_ASSERT(out.id == i);
+  }
+  TEST_ASSERT(task_heap_length(&h) == 0);
+
+  /* Popped handles are handed out again. */
+  int64_t again = task_heap_push(&h, &(task){.priority = 5});
+  TEST_ASSERT(again >= 0 && again < 64);
+}
+
+void test_from_vec(void) {
+  int_vec v;
+  int_vec_inita(&v, allocator, TO_STACK, 8);
+  for (int i = 0; i < 333; i++) int_vec_push(&v, &(int){(i * 31) % 333});
+
+  min_heap h;
+  min_heap_from_vec(&h, &v);
+  TEST_ASSERT(min_heap_length(&h) == 333);
+
+  /* The source is copied, not reordered. */
+  TEST_ASSERT(*int_vec_at(&v, 1) == 31);
+
+  for (int i = 0; i < 333; i++) {
+    int out;
+    min_heap_pop(&h, &out);
+    TEST_ASSERT(out == i);
+  }
+
+  /* Handles of a heapified vec start as the source indexes. */
+  min_heap_from_vec(&h, &v);
+  TEST_ASSERT(*min_heap_get(&h, 1) == 31);
+  min_heap_decrease_key(&h, 1, &(int){-1});
+  TEST_ASSERT(*min_heap_peek(&h) == -1);
+}
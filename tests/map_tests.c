@@ -47,6 +47,14 @@ void test_map_copy(void);
 void test_map_clear(void);
 void test_map_cache(void);
 void test_overwrites(void);
+void test_uninit_map(void);
+void test_hashers(void);
+void test_tombstones(void);
+void test_get_or_insert(void);
+void test_incremental_rehash(void);
+void test_reserve_and_shrink(void);
+void test_next(void);
+void test_track(void);
 
 void tests(void) {
   FRAME(allocator, RUN_TEST(test_count_if));
@@ -62,6 +70,14 @@ void tests(void) {
   FRAME(allocator, RUN_TEST(test_map_clear));
   FRAME(allocator, RUN_TEST(test_map_cache));
   FRAME(allocator, RUN_TEST(test_overwrites));
+  FRAME(allocator, RUN_TEST(test_uninit_map));
+  FRAME(allocator, RUN_TEST(test_hashers));
+  FRAME(allocator, RUN_TEST(test_tombstones));
+  FRAME(allocator, RUN_TEST(test_get_or_insert));
+  FRAME(allocator, RUN_TEST(test_incremental_rehash));
+  FRAME(allocator, RUN_TEST(test_reserve_and_shrink));
+  FRAME(allocator, RUN_TEST(test_next));
+  FRAME(allocator, RUN_TEST(test_track));
 }
 
 int main(void) {
@@ -294,4 +310,273 @@ void test_overwrites(void) {
   int_int_map_put(&orig, &a, &b);
 
   TEST_ASSERT(*(int *)int_int_map_get(&orig, &a).value == 20);
-}
\ No newline at end of file
+}
+
+void test_uninit_map(void) {
+  /* Leave memory behind that looks like live slots to the next table. */
+  int *garbage = stpusha(allocator, sizeof(int) * 3 * 64);
+  for (int i = 0; i < 3 * 64; i++) garbage[i] = 1;
+  stpopa(allocator);
+
+  int_int_map_t m;
+  int_int_map_inita(&m, allocator, TO_STACK_UNINIT, 64);
+  for (int i = 0; i < 64; i++) TEST_ASSERT(!int_int_map_has(&m, &i));
+
+  for (int i = 0; i < 40; i++) int_int_map_put(&m, &i, &i);
+  TEST_ASSERT(int_int_map_load(&m) == 40);
+
+  int_int_map_clear(&m);
+  for (int i = 0; i < 40; i++) TEST_ASSERT(!int_int_map_has(&m, &i));
+  TEST_ASSERT(int_int_map_load(&m) == 0);
+}
+
+MAP_TYPE_IMPL_HASH(ident_map, int64_t, int, hash_identity);
+MAP_TYPE_IMPL_HASH(fib_map, int64_t, int, hash_fibonacci);
+
+void test_hashers(void) {
+  /* Sizes round up to a power of two. */
+  ident_map ident;
+  ident_map_inita(&ident, allocator, TO_STACK, 20);
+  TEST_ASSERT(ident.__size == 32);
+
+  fib_map fib;
+  fib_map_inita(&fib, allocator, TO_HEAP, 20);
+
+  for (int64_t i = 0; i < 300; i++) {
+    int64_t strided = i * 1024;
+    ident_map_put(&ident, &i, &(int){(int)i});
+    fib_map_put(&fib, &strided, &(int){(int)i});
+  }
+  TEST_ASSERT(ident.hasher == hash_identity);
+  TEST_ASSERT(ident_map_load(&ident) == 300);
+  TEST_ASSERT(fib_map_load(&fib) == 300);
+  TEST_ASSERT((ident.__size & (ident.__size - 1)) == 0);
+
+  for (int64_t i = 0; i < 300; i++) {
+    int64_t strided = i * 1024;
+    TEST_ASSERT(*(int *)ident_map_get(&ident, &i).value == i);
+    TEST_ASSERT(*(int *)fib_map_get(&fib, &strided).value == i);
+  }
+  fib_map_free(&fib);
+
+  /* The default hash reads every byte, whatever the key length. */
+  char key[40] = {0};
+  for (size_t len = 1; len < sizeof(key); len++) {
+    uint64_t zeroes = hash_bytes(key, len);
+    TEST_ASSERT(zeroes != hash_bytes(key, len - 1));
+
+    size_t ends[] = {0, len - 1};
+    for (int e = 0; e < 2; e++) {
+      key[ends[e]] = 1;
+      TEST_ASSERT(hash_bytes(key, len) != zeroes);
+      key[ends[e]] = 0;
+    }
+  }
+}
+
+void test_tombstones(void) {
+  ident_map m;
+  ident_map_inita(&m, allocator, TO_STACK, 32);
+
+  /* With identity hashing these all share slot 0 and probe into 1 and 2. */
+  int64_t chain[] = {0, 32, 64};
+  for (int i = 0; i < 3; i++) ident_map_put(&m, &chain[i], &(int){i});
+
+  ident_map_del(&m, &chain[1]);
+  TEST_ASSERT(m.tombstones == 1);
+  TEST_ASSERT(!ident_map_has(&m, &chain[1]));
+  TEST_ASSERT(*(int *)ident_map_get(&m, &chain[2]).value == 2);
+
+  /* Deleting the end of the chain clears the tombstone behind it. */
+  ident_map_del(&m, &chain[2]);
+  TEST_ASSERT(m.tombstones == 0);
+  TEST_ASSERT(ident_map_has(&m, &chain[0]));
+
+  /* Churning through keys never grows the table. */
+  for (int64_t i = 1; i < 10000; i++) {
+    int64_t key = i * 7;
+    ident_map_put(&m, &key, &(int){1});
+    if (i % 3 == 0) {
+      int64_t old = (i - 2) * 7;
+      ident_map_del(&m, &old);
+      old = (i - 1) * 7;
+      ident_map_del(&m, &old);
+      ident_map_del(&m, &key);
+    }
+  }
+  TEST_ASSERT(m.__size == 32);
+  TEST_ASSERT(ident_map_load(&m) == 1);
+  TEST_ASSERT(ident_map_has(&m, &chain[0]));
+}
+
+void test_get_or_insert(void) {
+  int_int_map_t counts;
+  int_int_map_inita(&counts, allocator, TO_HEAP_UNINIT, 4);
+
+  /* Counters start at zero and are bumped in place. */
+  for (int i = 0; i < 1000; i++)
+    (*int_int_map_get_or_insert(&counts, &(int){i % 37}))++;
+  TEST_ASSERT(int_int_map_load(&counts) == 37);
+  for (int i = 0; i < 37; i++) {
+    int expected = 1000 / 37 + (i < 1000 % 37);
+    TEST_ASSERT(*(int *)int_int_map_get(&counts, &i).value == expected);
+  }
+
+  /* Puts over deleted keys reuse their tombstones. */
+  for (int i = 0; i < 37; i++) int_int_map_del(&counts, &i);
+  for (int i = 0; i < 37; i++) int_int_map_put(&counts, &i, &(int){-i});
+  TEST_ASSERT(int_int_map_load(&counts) == 37);
+  TEST_ASSERT(counts.tombstones + counts.slots_in_use <= counts.__size);
+  for (int i = 0; i < 37; i++)
+    TEST_ASSERT(*int_int_map_get_or_insert(&counts, &i) == -i);
+
+  int_int_map_free(&counts);
+}
+
+feach(count_entries, kvpair, kv, {
+  (void)kv;
+  (*(int *)args)++;
+});
+void test_incremental_rehash(void) {
+  int_int_map_t m;
+  int_int_map_inita(&m, allocator, TO_HEAP | MAP_INCREMENTAL, 16);
+
+  int     migrations = 0;
+  int32_t last_counter = m.cache_counter;
+  for (int i = 0; i < 5000; i++) {
+    bool was_migrating = m.__old.elements != NULL;
+    int_int_map_put(&m, &i, &i);
+    TEST_ASSERT(m.cache_counter >= last_counter);
+    last_counter = m.cache_counter;
+    if (!m.__old.elements) continue;
+
+    /* Mid migration, keys from both tables stay reachable. */
+    TEST_ASSERT(*(int *)int_int_map_get(&m, &(int){i / 2}).value == i / 2);
+    TEST_ASSERT(int_int_map_has(&m, &i));
+    TEST_ASSERT(!int_int_map_has(&m, &(int){i + 1}));
+    if (was_migrating) continue;
+
+    /* Right after a resize started the oldest keys have not moved yet. */
+    migrations++;
+    for (int k = 0; k < 4; k++) {
+      int_int_map_del(&m, &k);
+      TEST_ASSERT(!int_int_map_has(&m, &k));
+      int_int_map_put(&m, &k, &k);
+    }
+  }
+  TEST_ASSERT(migrations > 3);
+  TEST_ASSERT(int_int_map_load(&m) == 5000);
+
+  for (int i = 0; i < 5000; i += 2) int_int_map_del(&m, &i);
+  for (int i = 0; i < 5000; i++)
+    TEST_ASSERT(int_int_map_has(&m, &i) == (i % 2 == 1));
+
+  /* Functional operations only see one table. */
+  int entries = 0;
+  int_int_map_foreach(&m, count_entries, &entries);
+  TEST_ASSERT(m.__old.elements == NULL);
+  TEST_ASSERT(entries == int_int_map_load(&m));
+
+  int_int_map_free(&m);
+}
+
+pred(is_even_int_key, kvpair, kv, { return *(int *)kv.key % 2 == 0; });
+void test_reserve_and_shrink(void) {
+  int_int_map_t m;
+  int_int_map_inita(&m, allocator, TO_HEAP, 1);
+
+  /* One rehash up front, none while loading. */
+  int_int_map_reserve(&m, 1000);
+  int32_t counter = m.cache_counter;
+  int64_t size = m.__size;
+  for (int i = 0; i < 1000; i++) int_int_map_put(&m, &i, &i);
+  TEST_ASSERT(m.cache_counter == counter);
+  TEST_ASSERT(m.__size == size);
+
+  /* Reserving less than what fits does nothing. */
+  int_int_map_reserve(&m, 10);
+  TEST_ASSERT(m.__size == size);
+
+  /* Filtering happens in place. */
+  void *elements = m.elements.elements;
+  int_int_map_filter(&m, is_even_int_key, NULL);
+  TEST_ASSERT(m.elements.elements == elements);
+  TEST_ASSERT(int_int_map_load(&m) == 500);
+  for (int i = 0; i < 1000; i++)
+    TEST_ASSERT(int_int_map_has(&m, &i) == (i % 2 == 0));
+
+  for (int i = 100; i < 1000; i++) int_int_map_del(&m, &i);
+  int_int_map_shrink_to_fit(&m);
+  TEST_ASSERT(m.__size < size);
+  TEST_ASSERT(m.tombstones == 0);
+  TEST_ASSERT(int_int_map_load(&m) == 50);
+  for (int i = 0; i < 100; i += 2)
+    TEST_ASSERT(*(int *)int_int_map_get(&m, &i).value == i);
+
+  int_int_map_free(&m);
+}
+
+void test_next(void) {
+  int_int_map_t m;
+  int_int_map_inita(&m, allocator, TO_STACK, 4);
+  for (int i = 0; i < 200; i++) int_int_map_put(&m, &i, &(int){i * 2});
+  for (int i = 0; i < 200; i += 4) int_int_map_del(&m, &i);
+
+  /* Tombstones are stepped over, every live entry comes out once. */
+  int64_t cursor = 0, seen = 0;
+  kvpair  kv;
+  while (map_next(&m, &cursor, &kv)) {
+    TEST_ASSERT(*(int *)kv.key % 4 != 0);
+    TEST_ASSERT(*(int *)kv.value == *(int *)kv.key * 2);
+    seen++;
+  }
+  TEST_ASSERT(seen == 150);
+  TEST_ASSERT(!map_next(&m, &cursor, &kv));
+}
+
+void test_track(void) {
+  map_stats ident_stats = {0}, fib_stats = {0};
+  ident_map ident;
+  fib_map   fib;
+  ident_map_inita(&ident, allocator, TO_STACK, 1024);
+  fib_map_inita(&fib, allocator, TO_STACK, 1024);
+  ident_map_track(&ident, &ident_stats);
+  fib_map_track(&fib, &fib_stats);
+
+  /* Strided keys all land on one home slot with the identity hash. */
+  for (int64_t i = 0; i < 500; i++) {
+    int64_t strided = i * 1024;
+    ident_map_put(&ident, &strided, &(int){(int)i});
+    fib_map_put(&fib, &strided, &(int){(int)i});
+  }
+  for (int64_t i = 0; i < 1000; i++) {
+    int64_t strided = i * 1024;
+    ident_map_has(&ident, &strided);
+    fib_map_has(&fib, &strided);
+  }
+
+  TEST_ASSERT(fib_stats.hits == 500 && fib_stats.misses == 1000);
+  TEST_ASSERT(ident_stats.hits == fib_stats.hits);
+  TEST_ASSERT(ident_stats.probe_max >= 500);
+  TEST_ASSERT(fib_stats.probe_max < 32);
+  TEST_ASSERT(fib_stats.probes[0] + fib_stats.probes[1] >
+              (fib_stats.hits + fib_stats.misses) * 9 / 10);
+  TEST_ASSERT(ident_stats.probe_total > fib_stats.probe_total * 50);
+
+  int64_t buckets = 0;
+  for (int32_t b = 0; b < MAP_PROBE_BUCKETS; b++)
+    buckets += fib_stats.probes[b];
+  TEST_ASSERT(buckets == fib_stats.hits + fib_stats.misses);
+
+  /* Growing rehashes once and keeps the stats attached. */
+  TEST_ASSERT(fib_stats.rehashes == 0);
+  for (int64_t i = 500; i < 800; i++) fib_map_put(&fib, &i, &(int){0});
+  TEST_ASSERT(fib_stats.rehashes == 1 && fib.stats == &fib_stats);
+  TEST_ASSERT(fib_stats.rehash_ns > 0);
+
+  fib_map copy;
+  fib_map_copy(&copy, &fib);
+  TEST_ASSERT(copy.stats == NULL);
+
+  fib_map_debug_stats(&fib);
+}
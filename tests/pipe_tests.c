@@ -0,0 +1,190 @@
+#include "csdsa.h"
+#include "unity.h"
+
+VEC_TYPE_IMPL(int_vec, int);
+VEC_TYPE_IMPL(double_vec, double);
+MAP_TYPE_IMPL(int_map, int, int);
+SET_TYPE_IMPL(int_set, int);
+SPARSE_SET_TYPE_IMPL(id_set, uint32_t);
+BITSET_SET_TYPE_IMPL(mask_set, uint32_t);
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+stalloc *allocator = NULL;
+int_vec  tvec;
+
+void setUp(void) {
+  start_frame(allocator);
+  int_vec_inita(&tvec, allocator, TO_STACK, 8);
+  for (int i = 0; i < 100; i++) int_vec_push(&tvec, &i);
+}
+void tearDown(void) { end_frame(allocator); }
+
+void test_vec_fused(void);
+void test_change_type(void);
+void test_collect(void);
+void test_map_source(void);
+void test_set_sources(void);
+void test_other_thread(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_vec_fused));
+  FRAME(allocator, RUN_TEST(test_change_type));
+  FRAME(allocator, RUN_TEST(test_collect));
+  FRAME(allocator, RUN_TEST(test_map_source));
+  FRAME(allocator, RUN_TEST(test_set_sources));
+  FRAME(allocator, RUN_TEST(test_other_thread));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  GFRAME(allocator, tests());
+
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+pred(is_even, int, x, return x % 2 == 0);
+pred(under_50, int, x, return x < 50);
+unary(square, int, x, return x * x);
+fold(int64_t, sum, int, total, x, return total + x);
+
+static void halve(void *out, void *el, void *args) {
+  *(double *)out = *(int *)el / 2.0;
+}
+static void sum_doubles(void *out, void *a, void *b, void *args) {
+  *(double *)out = *(double *)a + *(double *)b;
+}
+static void plus_value(void *out, void *el, void *args) {
+  kvpair *kv = el;
+  *(int *)out = *(int *)kv->key + *(int *)kv->value;
+}
+static bool key_over_10(void *el, void *args) {
+  return *(int *)((kvpair *)el)->key > 10;
+}
+
+void test_vec_fused(void) {
+  /* Evens under 50, squared, summed, in one pass with the source intact. */
+  pipeline p;
+  int64_t  total = 0;
+  pipe_from_vec(&p, &tvec);
+  pipe_filter(&p, is_even, NULL);
+  pipe_filter(&p, under_50, NULL);
+  pipe_map(&p, square, 0, NULL);
+  pipe_fold(&p, sum, &total, NULL);
+
+  int64_t expect = 0;
+  for (int i = 0; i < 50; i += 2) expect += i * i;
+  TEST_ASSERT(total == expect);
+  TEST_ASSERT(*int_vec_at(&tvec, 7) == 7);
+
+  /* The stages stay recorded, terminals can run again. */
+  TEST_ASSERT(pipe_count(&p) == 25);
+  TEST_ASSERT(pipe_count(pipe_from_vec(&p, &tvec)) == 100);
+}
+
+void test_change_type(void) {
+  /* Filters after a map see the mapped value, squares under 50 are 0..7. */
+  pipeline p;
+  pipe_map(pipe_from_vec(&p, &tvec), square, 0, NULL);
+  pipe_filter(&p, under_50, NULL);
+  pipe_map(&p, halve, sizeof(double), NULL);
+
+  double total = 0;
+  pipe_fold(&p, sum_doubles, &total, NULL);
+  TEST_ASSERT(total == (0 + 1 + 4 + 9 + 16 + 25 + 36 + 49) / 2.0);
+}
+
+void test_collect(void) {
+  double_vec out;
+  double_vec_inita(&out, allocator, TO_STACK, 1);
+
+  pipeline p;
+  pipe_filter(pipe_from_vec(&p, &tvec), is_even, NULL);
+  pipe_map(&p, halve, sizeof(double), NULL);
+  pipe_collect(&p, &out);
+
+  TEST_ASSERT(out.length == 50);
+  for (int i = 0; i < 50; i++) TEST_ASSERT(*double_vec_at(&out, i) == i);
+}
+
+void test_map_source(void) {
+  int_map m;
+  int_map_inita(&m, allocator, TO_STACK, 4);
+  for (int i = 0; i < 40; i++) int_map_put(&m, &i, &(int){i * 10});
+
+  pipeline p;
+  int64_t  total = 0;
+  pipe_filter(pipe_from_map(&p, &m), key_over_10, NULL);
+  pipe_map(&p, plus_value, sizeof(int), NULL);
+  pipe_fold(&p, sum, &total, NULL);
+
+  int64_t expect = 0;
+  for (int i = 11; i < 40; i++) expect += i * 11;
+  TEST_ASSERT(total == expect);
+  TEST_ASSERT(pipe_count(&p) == 29);
+}
+
+void test_set_sources(void) {
+  int_set  iset;
+  id_set   ids;
+  mask_set mask;
+  int_set_inita(&iset, allocator, TO_STACK, 4);
+  id_set_inita(&ids, allocator, TO_STACK, 4);
+  mask_set_inita(&mask, allocator, TO_STACK, 1);
+  for (int i = 0; i < 64; i += 3) {
+    int_set_put(&iset, &i);
+    id_set_put(&ids, &(uint32_t){i});
+    mask_set_put(&mask, &(uint32_t){i});
+  }
+
+  /* Keys come out as the set's key type, 4 bytes for all three. */
+  set *sets[3] = {&iset, &ids, &mask};
+  for (int k = 0; k < 3; k++) {
+    pipeline p;
+    int64_t  total = 0;
+    pipe_filter(pipe_from_set(&p, sets[k]), is_even, NULL);
+    pipe_fold(&p, sum, &total, NULL);
+    TEST_ASSERT(total == 0 + 6 + 12 + 18 + 24 + 30 + 36 + 42 + 48 + 54 + 60);
+  }
+}
+
+typedef struct walk walk;
+struct walk {
+  int_vec *v;
+  int64_t  total, count;
+};
+
+static void *walk_vec(void *arg) {
+  walk    *w = arg;
+  pipeline p;
+  pipe_filter(pipe_from_vec(&p, w->v), under_50, NULL);
+  pipe_map(&p, square, sizeof(int), NULL);
+  pipe_fold(&p, sum, &w->total, NULL);
+  w->count = pipe_count(&p);
+  return NULL;
+}
+
+void test_other_thread(void) {
+  int_vec v;
+  int_vec_inita(&v, allocator, TO_HEAP, 8);
+  for (int i = 0; i < 100; i++) int_vec_push(&v, &i);
+
+  /* The allocator is this thread's, the walk must not touch it. */
+  pthread_t thread;
+  walk      w = {.v = &v};
+  pthread_create(&thread, NULL, walk_vec, &w);
+  pthread_join(thread, NULL);
+
+  int64_t expect = 0;
+  for (int i = 0; i < 50; i++) expect += i * i;
+  TEST_ASSERT(w.total == expect);
+  TEST_ASSERT(w.count == 50);
+  int_vec_free(&v);
+}
@@ -0,0 +1,196 @@
+#include "csdsa.h"
+#include "unity.h"
+
+VEC_TYPE_IMPL(int_vec, int);
+MAP_TYPE_IMPL(int_map, int, int);
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+stalloc *allocator = NULL;
+pool    *tpool = NULL;
+
+void setUp(void) { start_frame(allocator); }
+void tearDown(void) { end_frame(allocator); }
+
+void test_run_covers_range(void);
+void test_single_worker(void);
+void test_worker_frames(void);
+void test_vec_par(void);
+void test_foldl_par(void);
+void test_map_par(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_run_covers_range));
+  FRAME(allocator, RUN_TEST(test_single_worker));
+  FRAME(allocator, RUN_TEST(test_worker_frames));
+  FRAME(allocator, RUN_TEST(test_vec_par));
+  FRAME(allocator, RUN_TEST(test_foldl_par));
+  FRAME(allocator, RUN_TEST(test_map_par));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+  tpool = pool_create(4);
+
+  GFRAME(allocator, tests());
+
+  pool_free(tpool);
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+static void mark_range(int64_t begin, int64_t end, void *args) {
+  _Atomic int32_t *hits = args;
+  for (int64_t i = begin; i < end; i++) atomic_fetch_add(&hits[i], 1);
+}
+
+static void sum_frame_range(int64_t begin, int64_t end, void *args) {
+  /* Scratch comes from the worker's own frame context. */
+  int64_t *scratch = stpush((end - begin) * sizeof(int64_t));
+  int64_t  sum = 0;
+  for (int64_t i = begin; i < end; i++) scratch[i - begin] = i;
+  for (int64_t i = begin; i < end; i++) sum += scratch[i - begin];
+  atomic_fetch_add((_Atomic int64_t *)args, sum);
+}
+
+static void add_one(void *el, void *args) { (*(int *)el)++; }
+static bool is_even(void *el, void *args) { return *(int *)el % 2 == 0; }
+static void square(void *out, void *el, void *args) {
+  *(int *)out = *(int *)el * *(int *)el;
+}
+static void add_el(void *out, void *a, void *b, void *args) {
+  *(int64_t *)out = *(int64_t *)a + *(int *)b;
+}
+static void add_sums(void *out, void *a, void *b, void *args) {
+  *(int64_t *)out = *(int64_t *)a + *(int64_t *)b;
+}
+
+/* Keeps the order chunks combine in: a list of first/last pairs. */
+typedef struct span span;
+struct span {
+  int64_t first, last;
+};
+static void span_el(void *out, void *a, void *b, void *args) {
+  span *s = out;
+  int   el = *(int *)b;
+  if (s->first < 0) s->first = el;
+  s->last = el;
+}
+static void span_join(void *out, void *a, void *b, void *args) {
+  span *l = a, *r = b, *o = out;
+  if (r->first < 0) return;
+  if (l->first >= 0) TEST_ASSERT(l->last + 1 == r->first);
+  o->first = l->first < 0 ? r->first : l->first;
+  o->last = r->last;
+}
+
+static bool value_over_100(void *el, void *args) {
+  return *(int *)((kvpair *)el)->value > 100;
+}
+static void sum_values(void *el, void *args) {
+  atomic_fetch_add((_Atomic int64_t *)args, *(int *)((kvpair *)el)->value);
+}
+
+void test_run_covers_range(void) {
+  int64_t          n = 10007;
+  _Atomic int32_t *hits = stpusha(allocator, n * sizeof(*hits));
+
+  /* Odd grains leave a short last chunk. */
+  pool_run(tpool, n, 7, mark_range, hits);
+  pool_run(tpool, n, 1000, mark_range, hits);
+  pool_run(tpool, n, n * 2, mark_range, hits);
+  for (int64_t i = 0; i < n; i++) TEST_ASSERT(atomic_load(&hits[i]) == 3);
+
+  pool_run(tpool, 0, 7, mark_range, hits);
+  TEST_ASSERT(pool_workers(tpool) == 4);
+  TEST_ASSERT(pool_grain(tpool, 10) == POOL_MIN_GRAIN);
+  TEST_ASSERT(pool_grain(tpool, 1 << 20) > POOL_MIN_GRAIN);
+}
+
+void test_single_worker(void) {
+  pool            *p = pool_create(1);
+  _Atomic int32_t *hits = stpusha(allocator, 100 * sizeof(*hits));
+
+  pool_run(p, 100, 3, mark_range, hits);
+  for (int64_t i = 0; i < 100; i++) TEST_ASSERT(atomic_load(&hits[i]) == 1);
+
+  pool_free(p);
+}
+
+void test_worker_frames(void) {
+  _Atomic int64_t sum;
+  atomic_init(&sum, 0);
+
+  int64_t n = 100000;
+  pool_run(tpool, n, 4096, sum_frame_range, &sum);
+  TEST_ASSERT(atomic_load(&sum) == n * (n - 1) / 2);
+}
+
+void test_vec_par(void) {
+  int_vec v;
+  int_vec_inita(&v, allocator, TO_STACK, 8);
+  for (int i = 0; i < 20000; i++) int_vec_push(&v, &i);
+
+  int_vec_foreach_par(&v, add_one, NULL, tpool);
+  TEST_ASSERT(*int_vec_at(&v, 0) == 1);
+  TEST_ASSERT(*int_vec_at(&v, 19999) == 20000);
+
+  TEST_ASSERT(int_vec_count_if_par(&v, is_even, NULL, tpool) ==
+              int_vec_count_if(&v, is_even, NULL));
+
+  /* Survivors keep their order across chunk boundaries. */
+  int_vec_filter_par(&v, is_even, NULL, tpool);
+  TEST_ASSERT(v.length == 10000);
+  for (int i = 0; i < 10000; i++) TEST_ASSERT(*int_vec_at(&v, i) == 2 * i + 2);
+
+  int_vec_clear(&v);
+  for (int i = 0; i < 3000; i++) int_vec_push(&v, &(int){i % 40});
+  int_vec_map_par(&v, square, NULL, tpool);
+  for (int i = 0; i < 3000; i++)
+    TEST_ASSERT(*int_vec_at(&v, i) == (i % 40) * (i % 40));
+
+  /* An empty vec is left alone. */
+  int_vec_clear(&v);
+  int_vec_filter_par(&v, is_even, NULL, tpool);
+  TEST_ASSERT(v.length == 0);
+}
+
+void test_foldl_par(void) {
+  int_vec v;
+  int_vec_inita(&v, allocator, TO_STACK, 8);
+  for (int i = 0; i < 50000; i++) int_vec_push(&v, &i);
+
+  int64_t sum = 0;
+  int_vec_foldl_par(&v, add_el, add_sums, &sum, sizeof(sum), NULL, tpool);
+  TEST_ASSERT(sum == (int64_t)50000 * 49999 / 2);
+
+  /* Chunks combine left to right, span_join checks they line up. */
+  span s = {-1, -1};
+  vec_foldl_par(&v, span_el, span_join, &s, sizeof(s), NULL, tpool);
+  TEST_ASSERT(s.first == 0 && s.last == 49999);
+
+  int_vec_clear(&v);
+  sum = 7;
+  vec_foldl_par(&v, add_el, add_sums, &sum, sizeof(sum), NULL, tpool);
+  TEST_ASSERT(sum == 7);
+}
+
+void test_map_par(void) {
+  int_map m;
+  int_map_inita(&m, allocator, TO_STACK, MAP_DEFAULT_SIZE);
+  for (int i = 0; i < 5000; i++) int_map_put(&m, &i, &i);
+
+  TEST_ASSERT(int_map_count_if_par(&m, value_over_100, NULL, tpool) == 4899);
+  TEST_ASSERT(int_map_count_if_par(&m, value_over_100, NULL, tpool) ==
+              int_map_count_if(&m, value_over_100, NULL));
+
+  _Atomic int64_t sum;
+  atomic_init(&sum, 0);
+  int_map_foreach_par(&m, sum_values, &sum, tpool);
+  TEST_ASSERT(atomic_load(&sum) == (int64_t)5000 * 4999 / 2);
+}
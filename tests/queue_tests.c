@@ -0,0 +1,227 @@
+#include "csdsa.h"
+#include "unity.h"
+#include <sched.h>
+
+QUEUE_TYPE_IMPL(int_queue, int);
+CONCURRENT_QUEUE_TYPE_IMPL(int_spsc, spsc, int64_t);
+CONCURRENT_QUEUE_TYPE_IMPL(int_mpmc, mpmc, int64_t);
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+stalloc  *allocator = NULL;
+int_queue tqueue;
+
+void setUp(void) {
+  start_frame(allocator);
+  int_queue_inita(&tqueue, allocator, TO_STACK, 4);
+}
+void tearDown(void) {
+  int_queue_free(&tqueue);
+  end_frame(allocator);
+}
+
+void test_push_pop(void);
+void test_wrap_and_grow(void);
+void test_copy(void);
+void test_spsc(void);
+void test_spsc_threads(void);
+void test_mpmc(void);
+void test_mpmc_threads(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_push_pop));
+  FRAME(allocator, RUN_TEST(test_wrap_and_grow));
+  FRAME(allocator, RUN_TEST(test_copy));
+  FRAME(allocator, RUN_TEST(test_spsc));
+  FRAME(allocator, RUN_TEST(test_spsc_threads));
+  FRAME(allocator, RUN_TEST(test_mpmc));
+  FRAME(allocator, RUN_TEST(test_mpmc_threads));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  GFRAME(allocator, tests());
+
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+void test_push_pop(void) {
+  TEST_ASSERT(int_queue_peek(&tqueue) == NULL);
+
+  for (int i = 0; i < 1000; i++) int_queue_push(&tqueue, &i);
+  TEST_ASSERT(int_queue_length(&tqueue) == 1000);
+  TEST_ASSERT(*int_queue_at(&tqueue, 500) == 500);
+
+  for (int i = 0; i < 1000; i++) {
+    TEST_ASSERT(*int_queue_peek(&tqueue) == i);
+    int out;
+    int_queue_pop(&tqueue, &out);
+    TEST_ASSERT(out == i);
+  }
+  TEST_ASSERT(int_queue_length(&tqueue) == 0);
+}
+
+void test_wrap_and_grow(void) {
+  /* Leave the head in the middle so the ring has wrapped when it grows. */
+  for (int i = 0; i < 3; i++) int_queue_push(&tqueue, &i);
+  int_queue_pop(&tqueue, NULL);
+  int_queue_pop(&tqueue, NULL);
+  for (int i = 3; i < 6; i++) int_queue_push(&tqueue, &i);
+  TEST_ASSERT(tqueue.elements.length == 4);
+
+  for (int i = 6; i < 20; i++) int_queue_push(&tqueue, &i);
+  TEST_ASSERT(int_queue_length(&tqueue) == 18);
+  for (int i = 2; i < 20; i++) TEST_ASSERT(*int_queue_at(&tqueue, i - 2) == i);
+
+  /* A steady stream through a small window never grows the ring. */
+  int_queue_clear(&tqueue);
+  int64_t size = tqueue.elements.length;
+  for (int i = 0; i < 10000; i++) {
+    int_queue_push(&tqueue, &i);
+    int out;
+    int_queue_pop(&tqueue, &out);
+    TEST_ASSERT(out == i);
+  }
+  TEST_ASSERT(tqueue.elements.length == size);
+}
+
+void test_copy(void) {
+  for (int i = 0; i < 7; i++) int_queue_push(&tqueue, &i);
+  int_queue_pop(&tqueue, NULL);
+
+  int_queue copy;
+  int_queue_copy(&copy, &tqueue);
+  int_queue_clear(&tqueue);
+  TEST_ASSERT(int_queue_length(&copy) == 6);
+  TEST_ASSERT(*int_queue_peek(&copy) == 1);
+}
+
+void test_spsc(void) {
+  int_spsc q;
+  int_spsc_init(&q, allocator, 5);
+
+  /* Rounded up to 8 slots. */
+  for (int64_t i = 0; i < 8; i++) TEST_ASSERT(int_spsc_push(&q, &i));
+  TEST_ASSERT(!int_spsc_push(&q, &(int64_t){8}));
+  TEST_ASSERT(int_spsc_length(&q) == 8);
+
+  int64_t out;
+  for (int64_t i = 0; i < 8; i++) {
+    TEST_ASSERT(int_spsc_pop(&q, &out));
+    TEST_ASSERT(out == i);
+  }
+  TEST_ASSERT(!int_spsc_pop(&q, &out));
+
+  int_spsc_free(&q);
+}
+
+#define STREAM    200000
+#define PRODUCERS 4
+
+static void *spsc_producer(void *arg) {
+  for (int64_t i = 0; i < STREAM; i++)
+    while (!int_spsc_push(arg, &i))
+      sched_yield();
+  return NULL;
+}
+
+void test_spsc_threads(void) {
+  int_spsc q;
+  int_spsc_init(&q, allocator, 64);
+
+  pthread_t producer;
+  pthread_create(&producer, NULL, spsc_producer, &q);
+
+  /* Order is kept end to end. */
+  bool in_order = true;
+  for (int64_t i = 0; i < STREAM; i++) {
+    int64_t out;
+    while (!int_spsc_pop(&q, &out))
+      sched_yield();
+    in_order &= out == i;
+  }
+  pthread_join(producer, NULL);
+  TEST_ASSERT(in_order);
+  TEST_ASSERT(int_spsc_length(&q) == 0);
+
+  int_spsc_free(&q);
+}
+
+void test_mpmc(void) {
+  int_mpmc q;
+  int_mpmc_init(&q, allocator, 4);
+
+  for (int64_t i = 0; i < 4; i++) TEST_ASSERT(int_mpmc_push(&q, &i));
+  TEST_ASSERT(!int_mpmc_push(&q, &(int64_t){4}));
+
+  /* Slots are reused lap after lap. */
+  int64_t out;
+  for (int64_t i = 4; i < 100; i++) {
+    TEST_ASSERT(int_mpmc_pop(&q, &out));
+    TEST_ASSERT(out == i - 4);
+    TEST_ASSERT(int_mpmc_push(&q, &i));
+  }
+  TEST_ASSERT(int_mpmc_length(&q) == 4);
+
+  int_mpmc_free(&q);
+}
+
+typedef struct mpmc_args mpmc_args;
+struct mpmc_args {
+  int_mpmc *q;
+  int64_t   first;
+  int64_t   sum;
+};
+
+static void *mpmc_producer(void *arg) {
+  mpmc_args *a = arg;
+  for (int64_t i = a->first; i < a->first + STREAM / PRODUCERS; i++)
+    while (!int_mpmc_push(a->q, &i))
+      sched_yield();
+  return NULL;
+}
+
+static void *mpmc_consumer(void *arg) {
+  mpmc_args *a = arg;
+  for (int64_t i = 0; i < STREAM / PRODUCERS; i++) {
+    int64_t out;
+    while (!int_mpmc_pop(a->q, &out))
+      sched_yield();
+    a->sum += out;
+  }
+  return NULL;
+}
+
+void test_mpmc_threads(void) {
+  int_mpmc q;
+  int_mpmc_init(&q, allocator, 128);
+
+  pthread_t producers[PRODUCERS], consumers[PRODUCERS];
+  mpmc_args pargs[PRODUCERS], cargs[PRODUCERS];
+  for (int i = 0; i < PRODUCERS; i++) {
+    pargs[i] = (mpmc_args){.q = &q, .first = i * (STREAM / PRODUCERS)};
+    cargs[i] = (mpmc_args){.q = &q};
+    pthread_create(&producers[i], NULL, mpmc_producer, &pargs[i]);
+    pthread_create(&consumers[i], NULL, mpmc_consumer, &cargs[i]);
+  }
+
+  int64_t sum = 0;
+  for (int i = 0; i < PRODUCERS; i++) {
+    pthread_join(producers[i], NULL);
+    pthread_join(consumers[i], NULL);
+    sum += cargs[i].sum;
+  }
+
+  /* Every element came out exactly once. */
+  TEST_ASSERT(sum == (int64_t)STREAM * (STREAM - 1) / 2);
+  TEST_ASSERT(int_mpmc_length(&q) == 0);
+
+  int_mpmc_free(&q);
+}
@@ -1,6 +1,7 @@
 #include "csdsa.h"
 #include "unity.h"
 #include <pthread.h>
+#include <sched.h>
 
 #define ALLOCATED 0
 #define FREE      1
@@ -86,6 +87,399 @@ void stack_frame_tests(void) {
   end_frame(alloc);
 }
 
+void heap_reuse_tests(void) {
+  stalloc *alloc = stalloc_create(1024);
+
+  int *a = halloc(alloc, sizeof(int) * 16);
+  TEST_ASSERT(a[0] == 0 && a[15] == 0);
+  a[3] = 7;
+  hfree(alloc, a);
+
+  /* The same sized request should come back from the freed block. */
+  int *b = halloc(alloc, sizeof(int) * 16);
+  TEST_ASSERT(a == b);
+  TEST_ASSERT(b[3] == 0);
+  hfree(alloc, b);
+
+  stalloc_free(alloc);
+}
+
+void heap_coalesce_tests(void) {
+  stalloc *alloc = stalloc_create(1024);
+
+  /* Blocks are carved downwards so x sits above y which sits above z. */
+  void *x = halloc(alloc, 100);
+  void *y = halloc(alloc, 100);
+  void *z = halloc(alloc, 100);
+  TEST_ASSERT(x > y && y > z);
+
+  hfree(alloc, x);
+  hfree(alloc, y);
+
+  /* x and y merged into one free block large enough for 200 bytes. */
+  void *xy = halloc(alloc, 200);
+  TEST_ASSERT(xy == y);
+
+  hfree(alloc, xy);
+  hfree(alloc, z);
+
+  /* Everything went back to the region, so we are carved from the top. */
+  TEST_ASSERT(halloc(alloc, 100) == x);
+
+  stalloc_free(alloc);
+}
+
+void heap_realloc_tests(void) {
+  stalloc *alloc = stalloc_create(256);
+
+  int *arr = halloc(alloc, sizeof(int) * 8);
+  for (int i = 0; i < 8; i++) arr[i] = i;
+
+  /* Growing past the region forces a new region and a copy. */
+  arr = hrealloc(alloc, arr, sizeof(int) * 1024);
+  for (int i = 0; i < 8; i++) TEST_ASSERT(arr[i] == i);
+  arr[1023] = 1023;
+
+  /* Oversized requests are routed to libc and still freeable. */
+  void *huge = halloc(alloc, (1 << 27) + 1);
+  TEST_ASSERT(huge != NULL);
+  hfree(alloc, huge);
+
+  hfree(alloc, arr);
+  stalloc_free(alloc);
+}
+
+void heap_large_coalesce_tests(void) {
+  stalloc *alloc = stalloc_create(STALLOC_DEFAULT);
+  int64_t  large = 100 * 1024 * 1024;
+  char    *blocks[8];
+
+  /* Regions double, so later ones hold several of these side by side. */
+  for (int i = 0; i < 8; i++) {
+    blocks[i] = halloc_uninit(alloc, large);
+    blocks[i][0] = i;
+    blocks[i][large - 1] = i;
+  }
+
+  /* Merged, the neighbours would not fit in a guard, so they stay apart. */
+  hfree(alloc, blocks[3]);
+  hfree(alloc, blocks[4]);
+  hfree(alloc, blocks[5]);
+
+  char *again = halloc_uninit(alloc, large);
+  again[0] = again[large - 1] = 1;
+  for (int i = 0; i < 8; i++) {
+    if (i >= 3 && i <= 5) continue;
+    TEST_ASSERT(blocks[i][0] == i && blocks[i][large - 1] == i);
+  }
+
+  hfree(alloc, again);
+  for (int i = 0; i < 8; i++) {
+    if (i < 3 || i > 5) hfree(alloc, blocks[i]);
+  }
+  stalloc_free(alloc);
+}
+
+void heap_alignment_tests(void) {
+  stalloc *alloc = stalloc_create(1024);
+  void    *blocks[200];
+
+  /* Fresh carves, then reuse of split free blocks, then moves and in place
+     growth, all hand out memory aligned like malloc's. */
+  for (int i = 1; i < 200; i++) {
+    blocks[i] = halloc(alloc, i);
+    TEST_ASSERT((uintptr_t)blocks[i] % 16 == 0);
+  }
+  for (int i = 1; i < 200; i += 2) hfree(alloc, blocks[i]);
+  for (int i = 1; i < 200; i += 2) {
+    blocks[i] = halloc(alloc, 200 - i);
+    TEST_ASSERT((uintptr_t)blocks[i] % 16 == 0);
+  }
+  for (int i = 1; i < 200; i++) {
+    blocks[i] = hrealloc(alloc, blocks[i], i * 3);
+    TEST_ASSERT((uintptr_t)blocks[i] % 16 == 0);
+  }
+
+  for (int i = 1; i < 200; i++) hfree(alloc, blocks[i]);
+  stalloc_free(alloc);
+}
+
+void heap_null_alloc_tests(void) {
+  /* A thread with no frame context still gets working heap containers. */
+  stalloc *ctx = get_frame_ctx();
+  set_frame_ctx(NULL);
+
+  int_vec v;
+  int_vec_hinit(&v);
+  for (int i = 0; i < 100; i++) int_vec_push(&v, &i);
+  TEST_ASSERT(v.length == 100 && *int_vec_at(&v, 99) == 99);
+  int_vec_free(&v);
+
+  int *p = hrealloc(NULL, halloc(NULL, sizeof(int)), sizeof(int) * 64);
+  TEST_ASSERT(p[0] == 0);
+  hfree(NULL, p);
+
+  set_frame_ctx(ctx);
+}
+
+static void *foreign_free(void *arg) {
+  void **args = arg;
+  hfree(args[0], args[1]);
+  return NULL;
+}
+
+void heap_cross_thread_free_tests(void) {
+  stalloc *alloc = stalloc_create(1024);
+  void    *block = halloc(alloc, 64);
+
+  pthread_t thread;
+  void     *args[2] = {alloc, block};
+  pthread_create(&thread, NULL, foreign_free, args);
+  pthread_join(thread, NULL);
+
+  /* The owner picks the returned block up on its next allocation. */
+  TEST_ASSERT(halloc(alloc, 64) == block);
+
+  stalloc_free(alloc);
+}
+
+atomic_int arenas_alive;
+
+static void *thread_local_arena(void *arg) {
+  stalloc *alloc = stalloc_thread_local(STALLOC_DEFAULT);
+  TEST_ASSERT(alloc == stalloc_thread_local(STALLOC_DEFAULT));
+  TEST_ASSERT(get_frame_ctx() == alloc);
+
+  GFRAME(alloc, function_using_heap());
+
+  /* Keep every arena alive until all threads have made theirs. */
+  *(stalloc **)arg = alloc;
+  atomic_fetch_add(&arenas_alive, 1);
+  while (atomic_load(&arenas_alive) < 4) sched_yield();
+  return NULL;
+}
+
+void thread_local_arena_tests(void) {
+  pthread_t threads[4];
+  stalloc  *arenas[4];
+  atomic_store(&arenas_alive, 0);
+  for (int i = 0; i < 4; i++)
+    pthread_create(&threads[i], NULL, thread_local_arena, &arenas[i]);
+  for (int i = 0; i < 4; i++) pthread_join(threads[i], NULL);
+
+  for (int i = 0; i < 4; i++)
+    for (int j = i + 1; j < 4; j++) TEST_ASSERT(arenas[i] != arenas[j]);
+}
+
+static void *thread_local_handoff(void *arg) {
+  stalloc *alloc = stalloc_thread_local(STALLOC_DEFAULT);
+  void   **out = arg;
+  out[0] = alloc;
+  out[1] = halloc(alloc, 64);
+  return NULL;
+}
+
+void thread_local_handoff_tests(void) {
+  /* The arena outlives its thread while a block from it is still out. */
+  void     *out[2];
+  pthread_t thread;
+  pthread_create(&thread, NULL, thread_local_handoff, out);
+  pthread_join(thread, NULL);
+
+  memset(out[1], 1, 64);
+  hfree(out[0], out[1]);
+}
+
+void aligned_push_tests(void) {
+  stalloc *alloc = stalloc_create(256);
+  start_frame(alloc);
+
+  void *first = stpusha(alloc, 3);
+  TEST_ASSERT((uintptr_t)first % STALLOC_ALIGNMENT == 0);
+
+  int64_t aligns[] = {8, 16, 32, 64};
+  void   *pushed[4];
+  for (int i = 0; i < 4; i++) {
+    pushed[i] = stpush_aligned(alloc, 5, aligns[i]);
+    TEST_ASSERT((uintptr_t)pushed[i] % aligns[i] == 0);
+  }
+
+  /* Popping walks back over the padded blocks. */
+  for (int i = 0; i < 4; i++) stpopa(alloc);
+  TEST_ASSERT(stpush_aligned(alloc, 5, 8) == pushed[0]);
+
+  end_frame(alloc);
+  stalloc_free(alloc);
+}
+
+void frame_unwind_tests(void) {
+  stalloc *alloc = stalloc_create(128);
+  start_frame(alloc);
+  int *outer = stpusha(alloc, sizeof(int));
+  *outer = 42;
+
+  /* Spill over several regions, then unwind them all at once. The regions
+     are merged after the first pass, so later passes reuse the same memory. */
+  void *last_first = NULL;
+  for (int pass = 0; pass < 4; pass++) {
+    start_frame(alloc);
+    void *first = stpusha(alloc, 16);
+    for (int i = 0; i < 1000; i++) stpusha(alloc, 24);
+    end_frame(alloc);
+
+    if (pass > 1) TEST_ASSERT(first == last_first);
+    last_first = first;
+  }
+
+  TEST_ASSERT(*outer == 42);
+  end_frame(alloc);
+  stalloc_free(alloc);
+}
+
+static void spill_frames(stalloc *alloc) {
+  void *last_first = NULL;
+  for (int pass = 0; pass < 6; pass++) {
+    start_frame(alloc);
+    int *first = stpusha(alloc, sizeof(int) * 4);
+    for (int i = 0; i < 1000; i++) *(int *)stpusha(alloc, 24) = i;
+    TEST_ASSERT(first[0] == 0 && first[3] == 0);
+    end_frame(alloc);
+
+    /* Once a region holds the whole frame it stays hot for every pass. */
+    if (pass > 3) TEST_ASSERT((void *)first == last_first);
+    last_first = first;
+  }
+}
+
+void retention_policy_tests(void) {
+  stalloc_policy policies[] = {
+      STALLOC_POLICY_DEFAULT,
+      {.flags = STALLOC_RETAIN_LARGEST},
+      {.flags = STALLOC_RETAIN_LARGEST | STALLOC_CACHE_REGIONS | STALLOC_MMAP,
+       .cache_bytes = 1 << 16},
+  };
+
+  for (int i = 0; i < 3; i++) {
+    stalloc *alloc = stalloc_create_with(128, policies[i]);
+    spill_frames(alloc);
+    stalloc_free(alloc);
+  }
+
+  /* Without retention regions come and go, but memory stays usable. */
+  stalloc *alloc = stalloc_create_with(128, (stalloc_policy){0});
+  start_frame(alloc);
+  for (int i = 0; i < 1000; i++) *(int *)stpusha(alloc, 24) = i;
+  end_frame(alloc);
+  start_frame(alloc);
+  TEST_ASSERT(*(int *)stpusha(alloc, sizeof(int)) == 0);
+  end_frame(alloc);
+  stalloc_free(alloc);
+}
+
+void stack_extend_tests(void) {
+  stalloc *alloc = stalloc_create(1024);
+  start_frame(alloc);
+
+  /* The top block grows and shrinks in place. */
+  char *a = stpusha(alloc, 16);
+  memset(a, 7, 16);
+  TEST_ASSERT(stextend(alloc, a, 200));
+  TEST_ASSERT(a[15] == 7);
+  TEST_ASSERT(stextend(alloc, a, 8));
+
+  /* Once something sits on top of it, it can no longer move. */
+  char *b = stpusha(alloc, 16);
+  TEST_ASSERT(!stextend(alloc, a, 64));
+  TEST_ASSERT(!stextend(alloc, b, 4096));
+  TEST_ASSERT(stextend(alloc, b, 64));
+
+  /* Popping walks back over the resized blocks. */
+  stpopa(alloc);
+  TEST_ASSERT(stextend(alloc, a, 32));
+
+  /* Blocks of an outer frame stay put. */
+  start_frame(alloc);
+  TEST_ASSERT(!stextend(alloc, a, 64));
+  end_frame(alloc);
+
+  /* A stack vector alone on the frame never changes address. */
+  int_vec v;
+  int_vec_inita(&v, alloc, TO_STACK, 1);
+  int *elements = v.elements;
+  for (int i = 0; i < 128; i++) int_vec_push(&v, &i);
+  TEST_ASSERT(v.elements == elements);
+  for (int i = 0; i < 128; i++) TEST_ASSERT(*int_vec_at(&v, i) == i);
+
+  end_frame(alloc);
+  stalloc_free(alloc);
+}
+
+#ifdef STALLOC_TRACE
+static void count_events(stalloc *alloc, int32_t event, void *ptr,
+                         int64_t bytes, void *args) {
+  ((int64_t *)args)[event]++;
+}
+#endif
+
+void stats_tests(void) {
+  stalloc      *alloc = stalloc_create(1024);
+  stalloc_usage usage;
+  stalloc_stats(alloc, &usage);
+  TEST_ASSERT(usage.bytes_used == 0 && usage.frame_depth == 0);
+  TEST_ASSERT(usage.regions == 1 && usage.bytes_reserved == 1024);
+
+#ifdef STALLOC_TRACE
+  int64_t events[3] = {0};
+  stalloc_trace(alloc, count_events, events);
+#endif
+
+  /* Pushing past the first region adds one, measured with the guards. */
+  start_frame(alloc);
+  start_frame(alloc);
+  stpusha(alloc, 16);
+  stpusha(alloc, 2000);
+  stalloc_stats(alloc, &usage);
+  TEST_ASSERT(usage.regions == 2 && usage.bytes_reserved > 1024);
+  TEST_ASSERT(usage.bytes_used >= 2016 + 4 * HEADER_SIZE);
+  TEST_ASSERT(usage.frame_depth == 2);
+
+  /* Free heap blocks do not count, whether binned or merged away. */
+  int64_t stack_used = usage.bytes_used;
+  void   *a = halloc(alloc, 100), *b = halloc(alloc, 100);
+  void   *c = halloc(alloc, 100);
+  stalloc_stats(alloc, &usage);
+  TEST_ASSERT(usage.bytes_used > stack_used + 300);
+  hfree(alloc, b);
+  hfree(alloc, a);
+  hfree(alloc, c);
+  stalloc_stats(alloc, &usage);
+  TEST_ASSERT(usage.bytes_used == stack_used);
+
+  stpopa(alloc);
+  end_frame(alloc);
+  end_frame(alloc);
+  stalloc_stats(alloc, &usage);
+  TEST_ASSERT(usage.bytes_used == 0 && usage.frame_depth == 0);
+
+#ifdef STALLOC_STATS
+  TEST_ASSERT(usage.pushes == 2 && usage.pops == 1);
+  TEST_ASSERT(usage.frame_peak == 2 && usage.regions_created == 2);
+  TEST_ASSERT(usage.bytes_peak > stack_used + 300);
+  TEST_ASSERT(usage.merges == 2);
+
+  stalloc_stats_reset(alloc);
+  stalloc_stats(alloc, &usage);
+  TEST_ASSERT(usage.pushes == 0 && usage.bytes_peak == 0);
+#endif
+#ifdef STALLOC_TRACE
+  TEST_ASSERT(events[STALLOC_EVENT_PUSH] == 2);
+  TEST_ASSERT(events[STALLOC_EVENT_POP] == 1);
+  TEST_ASSERT(events[STALLOC_EVENT_GROW] == 1);
+#endif
+
+  stalloc_free(alloc);
+}
+
 int main() {
 
   UNITY_BEGIN();
@@ -93,6 +487,20 @@ int main() {
   RUN_TEST(test_block_bit_arithmatic);
   RUN_TEST(test_concurrent_globals);
   RUN_TEST(stack_frame_tests);
+  RUN_TEST(heap_reuse_tests);
+  RUN_TEST(heap_coalesce_tests);
+  RUN_TEST(heap_realloc_tests);
+  RUN_TEST(heap_large_coalesce_tests);
+  RUN_TEST(heap_alignment_tests);
+  RUN_TEST(heap_null_alloc_tests);
+  RUN_TEST(heap_cross_thread_free_tests);
+  RUN_TEST(thread_local_arena_tests);
+  RUN_TEST(thread_local_handoff_tests);
+  RUN_TEST(aligned_push_tests);
+  RUN_TEST(frame_unwind_tests);
+  RUN_TEST(retention_policy_tests);
+  RUN_TEST(stack_extend_tests);
+  RUN_TEST(stats_tests);
 
   UNITY_END();
 }
\ No newline at end of file
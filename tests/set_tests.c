@@ -2,6 +2,8 @@
 #include "unity.h"
 
 SET_TYPE_IMPL(int_set, int);
+SPARSE_SET_TYPE_IMPL(id_set, uint32_t);
+BITSET_SET_TYPE_IMPL(mask_set, uint32_t);
 
 stalloc *allocator = NULL;
 int_set  iset;
@@ -50,9 +52,184 @@ void test_resize(void) {
   TEST_ASSERT(set_length(&iset) == 0);
 }
 
+void test_sparse_put_has_del(void) {
+  id_set ids;
+  id_set_inita(&ids, allocator, TO_STACK_UNINIT, 4);
+
+  for (uint32_t i = 0; i < 1000; i += 3) id_set_put(&ids, &i);
+  uint32_t again = 300;
+  id_set_put(&ids, &again);
+  TEST_ASSERT(id_set_length(&ids) == 334);
+
+  for (uint32_t i = 0; i < 1200; i++)
+    TEST_ASSERT(id_set_has(&ids, &i) == (i < 1000 && i % 3 == 0));
+
+  /* Deleting swaps the last member into the hole, which must stay findable. */
+  for (uint32_t i = 0; i < 1000; i += 6) id_set_del(&ids, &i);
+  for (uint32_t i = 0; i < 1000; i++)
+    TEST_ASSERT(id_set_has(&ids, &i) == (i % 6 == 3));
+  TEST_ASSERT(id_set_length(&ids) == 167);
+
+  id_set_clear(&ids);
+  TEST_ASSERT(id_set_length(&ids) == 0);
+  for (uint32_t i = 0; i < 1000; i++) TEST_ASSERT(!id_set_has(&ids, &i));
+
+  id_set_free(&ids);
+}
+
+static feach(sum_ids, uint32_t, id, { *(int64_t *)args += id; });
+static feach(sum_ints, int, i, { *(int64_t *)args += i; });
+void test_foreach(void) {
+  id_set ids;
+  id_set_inita(&ids, allocator, TO_HEAP, 4);
+
+  /* Only live members are visited however far apart their ids are. */
+  uint32_t spread[] = {5, 100000, 42, 7};
+  for (int i = 0; i < 4; i++) id_set_put(&ids, &spread[i]);
+  id_set_del(&ids, &spread[1]);
+
+  int64_t sum = 0;
+  id_set_foreach(&ids, sum_ids, &sum);
+  TEST_ASSERT(sum == 5 + 42 + 7);
+
+  for (int i = 0; i < 10; i++) int_set_put(&iset, &i);
+  sum = 0;
+  int_set_foreach(&iset, sum_ints, &sum);
+  TEST_ASSERT(sum == 45);
+
+  id_set_free(&ids);
+}
+
+void test_set_operations(void) {
+  id_set a, b, both, either;
+  id_set_inita(&a, allocator, TO_STACK, 8);
+  id_set_inita(&b, allocator, TO_STACK, 8);
+
+  for (uint32_t i = 0; i < 100; i += 2) id_set_put(&a, &i);
+  for (uint32_t i = 0; i < 100; i += 3) id_set_put(&b, &i);
+
+  id_set_intersect(&a, &b, &both);
+  id_set_union(&a, &b, &either);
+
+  for (uint32_t i = 0; i < 100; i++) {
+    TEST_ASSERT(id_set_has(&both, &i) == (i % 6 == 0));
+    TEST_ASSERT(id_set_has(&either, &i) == (i % 2 == 0 || i % 3 == 0));
+  }
+
+  id_set copy;
+  id_set_copy(&copy, &either);
+  id_set_clear(&either);
+  TEST_ASSERT(id_set_length(&copy) == 67);
+  TEST_ASSERT(id_set_length(&either) == 0);
+
+  int_set c, hashed_both;
+  int_set_inita(&c, allocator, TO_STACK, 8);
+  for (int i = 0; i < 100; i += 2) int_set_put(&iset, &i);
+  for (int i = 0; i < 100; i += 5) int_set_put(&c, &i);
+  int_set_intersect(&iset, &c, &hashed_both);
+  TEST_ASSERT(int_set_length(&hashed_both) == 10);
+}
+
+void test_bitset(void) {
+  mask_set a, b, both, either;
+  mask_set_inita(&a, allocator, TO_STACK_UNINIT, 64);
+  mask_set_inita(&b, allocator, TO_HEAP, 1);
+
+  /* Puts past the starting universe grow it. */
+  for (uint32_t i = 0; i < 1000; i += 2) mask_set_put(&a, &i);
+  for (uint32_t i = 0; i < 300; i += 3) mask_set_put(&b, &i);
+  TEST_ASSERT(mask_set_length(&a) == 500);
+  TEST_ASSERT(mask_set_length(&b) == 100);
+
+  mask_set_intersect(&a, &b, &both);
+  mask_set_union(&a, &b, &either);
+  for (uint32_t i = 0; i < 1100; i++) {
+    TEST_ASSERT(mask_set_has(&both, &i) == (i < 300 && i % 6 == 0));
+    TEST_ASSERT(mask_set_has(&either, &i) ==
+                ((i < 1000 && i % 2 == 0) || (i < 300 && i % 3 == 0)));
+  }
+
+  int64_t sum = 0;
+  mask_set_foreach(&both, sum_ints, &sum);
+  TEST_ASSERT(sum == 6 * (49 * 50 / 2));
+
+  mask_set_del(&a, &(uint32_t){4});
+  TEST_ASSERT(!mask_set_has(&a, &(uint32_t){4}));
+  mask_set_clear(&a);
+  TEST_ASSERT(mask_set_length(&a) == 0);
+  mask_set_put(&a, &(uint32_t){700});
+  TEST_ASSERT(mask_set_length(&a) == 1);
+
+  mask_set_free(&b);
+}
+
+void test_operations_into(void) {
+  /* Hashed, sparse and bitset sets of the same key size mix, and the result
+     keeps the left one's layout. */
+  id_set   ids;
+  mask_set mask;
+  id_set_inita(&ids, allocator, TO_STACK, 8);
+  mask_set_inita(&mask, allocator, TO_STACK, 8);
+
+  for (int i = 0; i < 200; i++) int_set_put(&iset, &i);
+  for (uint32_t i = 0; i < 200; i += 4) id_set_put(&ids, &i);
+  for (uint32_t i = 0; i < 200; i += 10) mask_set_put(&mask, &i);
+
+  int_set_intersect_into(&iset, &ids);
+  TEST_ASSERT(int_set_length(&iset) == 50);
+  id_set_intersect_into(&ids, &mask);
+  TEST_ASSERT(id_set_length(&ids) == 10);
+  for (uint32_t i = 0; i < 200; i++)
+    TEST_ASSERT(id_set_has(&ids, &i) == (i % 20 == 0));
+
+  mask_set_intersect_into(&mask, &ids);
+  TEST_ASSERT(mask_set_length(&mask) == 10);
+
+  int extra = 1001;
+  int_set_put(&iset, &extra);
+  id_set_union_into(&ids, &iset);
+  TEST_ASSERT(id_set_length(&ids) == 51);
+  TEST_ASSERT(id_set_has(&ids, &(uint32_t){1001}));
+  mask_set_union_into(&mask, &ids);
+  TEST_ASSERT(mask_set_length(&mask) == 51);
+}
+
+void test_next(void) {
+  id_set   ids;
+  mask_set mask;
+  id_set_inita(&ids, allocator, TO_STACK, 4);
+  mask_set_inita(&mask, allocator, TO_STACK, 1);
+  for (uint32_t i = 0; i < 300; i += 7) {
+    id_set_put(&ids, &i);
+    mask_set_put(&mask, &i);
+    int_set_put(&iset, &(int){(int)i});
+  }
+
+  /* Every mode visits each member exactly once. */
+  set *sets[3] = {&ids, &mask, &iset};
+  for (int k = 0; k < 3; k++) {
+    int64_t  cursor = 0, seen = 0, sum = 0;
+    uint32_t key;
+    while (set_next(sets[k], &cursor, &key)) {
+      TEST_ASSERT(key % 7 == 0 && key < 300);
+      sum += key;
+      seen++;
+    }
+    TEST_ASSERT(seen == 43);
+    TEST_ASSERT(sum == 7 * 42 * 43 / 2);
+    TEST_ASSERT(!set_next(sets[k], &cursor, &key));
+  }
+}
+
 void tests(void) {
   FRAME(allocator, RUN_TEST(test_simple_put_has));
   FRAME(allocator, RUN_TEST(test_resize));
+  FRAME(allocator, RUN_TEST(test_sparse_put_has_del));
+  FRAME(allocator, RUN_TEST(test_foreach));
+  FRAME(allocator, RUN_TEST(test_set_operations));
+  FRAME(allocator, RUN_TEST(test_bitset));
+  FRAME(allocator, RUN_TEST(test_operations_into));
+  FRAME(allocator, RUN_TEST(test_next));
 }
 
 int main(void) {
@@ -0,0 +1,380 @@
+#include "csdsa.h"
+#include "unity.h"
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct cell cell;
+struct cell {
+  float   cost;
+  int32_t links[3];
+};
+
+VEC_TYPE_IMPL(cell_vec, cell);
+VEC_TYPE_IMPL(int_vec, int);
+MAP_TYPE_IMPL(cell_map, int64_t, cell);
+MAP_TYPE_IMPL_HASH(fib_map, int64_t, cell, hash_fibonacci);
+SET_TYPE_IMPL(int_set, int);
+SPARSE_SET_TYPE_IMPL(id_set, uint32_t);
+BITSET_SET_TYPE_IMPL(mask_set, uint32_t);
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+stalloc *allocator = NULL;
+char     path[] = "/tmp/csdsa_snapshot_XXXXXX";
+int      fd = -1;
+
+void setUp(void) {
+  start_frame(allocator);
+  fd = mkstemp(path);
+  TEST_ASSERT(fd >= 0);
+}
+void tearDown(void) {
+  close(fd);
+  unlink(path);
+  memcpy(path + strlen(path) - 6, "XXXXXX", 6);
+  end_frame(allocator);
+}
+
+void test_vec_round_trip(void);
+void test_map_round_trip(void);
+void test_map_hasher_mismatch(void);
+void test_set_round_trip(void);
+void test_mapped_copies(void);
+void test_mapped_filters(void);
+void test_rejects_bad_files(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_vec_round_trip));
+  FRAME(allocator, RUN_TEST(test_map_round_trip));
+  FRAME(allocator, RUN_TEST(test_map_hasher_mismatch));
+  FRAME(allocator, RUN_TEST(test_set_round_trip));
+  FRAME(allocator, RUN_TEST(test_mapped_copies));
+  FRAME(allocator, RUN_TEST(test_mapped_filters));
+  FRAME(allocator, RUN_TEST(test_rejects_bad_files));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  GFRAME(allocator, tests());
+
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+static cell cell_for(int64_t i) {
+  return (cell){.cost = i * 0.5f, .links = {(int32_t)i, -(int32_t)i, 7}};
+}
+
+static bool cheap(void *el, void *args) {
+  return ((cell *)((kvpair *)el)->value)->cost < 10;
+}
+
+void test_vec_round_trip(void) {
+  cell_vec v;
+  cell_vec_inita(&v, allocator, TO_STACK, 8);
+  for (int64_t i = 0; i < 1000; i++) cell_vec_push(&v, &(cell){0});
+  for (int64_t i = 0; i < 1000; i++) *cell_vec_at(&v, i) = cell_for(i);
+  TEST_ASSERT(cell_vec_save(&v, fd));
+
+  cell_vec mapped;
+  TEST_ASSERT(cell_vec_mmap_open(&mapped, path, allocator) == &mapped);
+  TEST_ASSERT(mapped.length == 1000);
+  TEST_ASSERT(memcmp(mapped.elements, v.elements, 1000 * sizeof(cell)) == 0);
+  TEST_ASSERT(cell_vec_at(&mapped, 999)->links[1] == -999);
+
+  /* The wrong element type is refused. */
+  int_vec ints;
+  TEST_ASSERT(int_vec_mmap_open(&ints, path, allocator) == NULL);
+
+  cell_vec_free(&mapped);
+}
+
+void test_map_round_trip(void) {
+  cell_map m;
+  cell_map_inita(&m, allocator, TO_STACK, 4);
+  for (int64_t i = 0; i < 5000; i++) cell_map_put(&m, &i, &(cell){0});
+  for (int64_t i = 0; i < 5000; i++)
+    *cell_map_get_or_insert(&m, &i) = cell_for(i);
+  for (int64_t i = 0; i < 5000; i += 10) cell_map_del(&m, &i);
+  TEST_ASSERT(cell_map_save(&m, fd));
+
+  /* Probes work straight off the mapped slots, tombstones and all. */
+  cell_map mapped;
+  TEST_ASSERT(cell_map_mmap_open(&mapped, path, allocator) == &mapped);
+  TEST_ASSERT(cell_map_load(&mapped) == 4500);
+  TEST_ASSERT(mapped.tombstones == m.tombstones);
+  for (int64_t i = 0; i < 5000; i++) {
+    TEST_ASSERT(cell_map_has(&mapped, &i) == (i % 10 != 0));
+    if (i % 10)
+      TEST_ASSERT(((cell *)cell_map_get(&mapped, &i).value)->links[0] == i);
+  }
+
+  /* Read only operations still have an allocator for their temporaries. */
+  pipeline p;
+  pipe_filter(pipe_from_map(&p, &mapped), cheap, NULL);
+  TEST_ASSERT(pipe_count(&p) == cell_map_count_if(&m, cheap, NULL));
+
+  cell_map_free(&mapped);
+}
+
+void test_map_hasher_mismatch(void) {
+  fib_map m;
+  fib_map_inita(&m, allocator, TO_STACK, 64);
+  for (int64_t i = 0; i < 40; i++) fib_map_put(&m, &i, &(cell){.cost = i});
+  TEST_ASSERT(fib_map_save(&m, fd));
+
+  /* Laid out by hash_fibonacci, hash_bytes would probe the wrong slots. */
+  cell_map wrong;
+  TEST_ASSERT(cell_map_mmap_open(&wrong, path, allocator) == NULL);
+
+  fib_map mapped;
+  TEST_ASSERT(fib_map_mmap_open(&mapped, path, allocator) == &mapped);
+  for (int64_t i = 0; i < 40; i++)
+    TEST_ASSERT(((cell *)fib_map_get(&mapped, &i).value)->cost == i);
+  fib_map_free(&mapped);
+}
+
+void test_set_round_trip(void) {
+  int_set  iset;
+  id_set   ids;
+  mask_set mask;
+  int_set_inita(&iset, allocator, TO_STACK, 4);
+  id_set_inita(&ids, allocator, TO_STACK, 4);
+  mask_set_inita(&mask, allocator, TO_STACK, 1);
+  for (int i = 0; i < 700; i += 7) {
+    int_set_put(&iset, &i);
+    id_set_put(&ids, &(uint32_t){i});
+    mask_set_put(&mask, &(uint32_t){i});
+  }
+
+  set *sets[3] = {&iset, &ids, &mask};
+  for (int k = 0; k < 3; k++) {
+    TEST_ASSERT(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+    TEST_ASSERT(set_save(sets[k], fd));
+
+    set mapped;
+    TEST_ASSERT(set_mmap_open(&mapped, path, allocator) == &mapped);
+    TEST_ASSERT(set_length(&mapped) == 100);
+    for (uint32_t i = 0; i < 700; i++)
+      TEST_ASSERT(set_has(&mapped, &i) == (i % 7 == 0));
+    set_free(&mapped);
+  }
+
+  /* Typed opens check the layout too. */
+  id_set   as_ids;
+  mask_set as_mask;
+  TEST_ASSERT(id_set_mmap_open(&as_ids, path, allocator) == NULL);
+  TEST_ASSERT(mask_set_mmap_open(&as_mask, path, allocator) == &as_mask);
+  mask_set_free(&as_mask);
+}
+
+static void reopen(void) {
+  TEST_ASSERT(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+}
+
+void test_mapped_copies(void) {
+  /* Copies own ordinary memory, they grow and free like any container. An
+     empty mapped vec has no capacity to double from. */
+  for (int n = 0; n <= 10; n += 10) {
+    int_vec v, mapped, copy;
+    int_vec_inita(&v, allocator, TO_STACK, 1);
+    for (int i = 0; i < n; i++) int_vec_push(&v, &i);
+    reopen();
+    TEST_ASSERT(int_vec_save(&v, fd));
+    TEST_ASSERT(int_vec_mmap_open(&mapped, path, allocator) == &mapped);
+
+    vec_copy(&copy, &mapped);
+    for (int i = n; i < 100; i++) int_vec_push(&copy, &i);
+    TEST_ASSERT(copy.length == 100 && *int_vec_at(&copy, 99) == 99);
+    int_vec_free(&copy);
+    int_vec_free(&mapped);
+  }
+
+  cell_map m, mapped, copy;
+  cell_map_inita(&m, allocator, TO_STACK, 4);
+  for (int64_t i = 0; i < 50; i++) cell_map_put(&m, &i, &(cell){.cost = i});
+  reopen();
+  TEST_ASSERT(cell_map_save(&m, fd));
+  TEST_ASSERT(cell_map_mmap_open(&mapped, path, allocator) == &mapped);
+  cell_map_copy(&copy, &mapped);
+  for (int64_t i = 50; i < 500; i++)
+    cell_map_put(&copy, &i, &(cell){.cost = i});
+  TEST_ASSERT(cell_map_load(&copy) == 500);
+  TEST_ASSERT(((cell *)cell_map_get(&copy, &(int64_t){7}).value)->cost == 7);
+  cell_map_free(&copy);
+  cell_map_free(&mapped);
+
+  /* set_union and the bitset set_intersect start from a copy of a. */
+  int_set  iset;
+  id_set   ids;
+  mask_set mask;
+  int_set_inita(&iset, allocator, TO_STACK, 4);
+  id_set_inita(&ids, allocator, TO_STACK, 4);
+  mask_set_inita(&mask, allocator, TO_STACK, 1);
+  for (int i = 0; i < 70; i += 7) {
+    int_set_put(&iset, &i);
+    id_set_put(&ids, &(uint32_t){i});
+    mask_set_put(&mask, &(uint32_t){i});
+  }
+
+  set *sets[3] = {&iset, &ids, &mask};
+  for (int k = 0; k < 3; k++) {
+    set mapped_set, out;
+    reopen();
+    TEST_ASSERT(set_save(sets[k], fd));
+    TEST_ASSERT(set_mmap_open(&mapped_set, path, allocator) == &mapped_set);
+
+    set_union(&mapped_set, sets[k], &out);
+    for (uint32_t i = 1000; i < 1500; i++) set_put(&out, &i);
+    TEST_ASSERT(set_length(&out) == 510);
+    set_free(&out);
+
+    set_intersect(&mapped_set, sets[k], &out);
+    TEST_ASSERT(set_length(&out) == 10);
+    set_free(&out);
+    set_free(&mapped_set);
+  }
+}
+
+pred(is_odd, int, n, { return n % 2 == 1; });
+pred(is_odd_key, kvpair, kv, { return *(int64_t *)kv.key % 2 == 1; });
+
+static void filter_vec(void *v) { vec_filter(v, is_odd, NULL); }
+static void filter_map(void *m) { map_filter(m, is_odd_key, NULL); }
+static void push_vec(void *v) { vec_push(v, &(int){10}); }
+static void push_n_vec(void *v) { vec_push_n(v, (int[]){10, 11}, 2); }
+
+/* Runs fn in a child, true when it died on an assert. */
+static bool aborts(void (*fn)(void *), void *container) {
+  pid_t child = fork();
+  if (child == 0) {
+    freopen("/dev/null", "w", stderr);
+    fn(container);
+    _exit(0);
+  }
+  int status;
+  waitpid(child, &status, 0);
+  return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+void test_mapped_filters(void) {
+  /* Filters compact in place and pushes grow in place, a mapped container
+     has to be copied first. */
+  int_vec v, mapped, copy;
+  int_vec_inita(&v, allocator, TO_STACK, 10);
+  for (int i = 0; i < 10; i++) int_vec_push(&v, &i);
+  reopen();
+  TEST_ASSERT(int_vec_save(&v, fd));
+  TEST_ASSERT(int_vec_mmap_open(&mapped, path, allocator) == &mapped);
+
+  TEST_ASSERT(aborts(filter_vec, &mapped));
+  TEST_ASSERT(aborts(push_vec, &mapped));
+  TEST_ASSERT(aborts(push_n_vec, &mapped));
+  vec_copy(&copy, &mapped);
+  int_vec_filter(&copy, is_odd, NULL);
+  TEST_ASSERT(copy.length == 5 && *int_vec_at(&copy, 4) == 9);
+  TEST_ASSERT(mapped.length == 10 && *int_vec_at(&mapped, 9) == 9);
+  int_vec_free(&copy);
+  int_vec_free(&mapped);
+
+  /* An empty snapshot has no capacity to double from either. */
+  int_vec_clear(&v);
+  reopen();
+  TEST_ASSERT(int_vec_save(&v, fd));
+  TEST_ASSERT(int_vec_mmap_open(&mapped, path, allocator) == &mapped);
+  TEST_ASSERT(aborts(push_vec, &mapped));
+  int_vec_free(&mapped);
+
+  cell_map m, mapped_map, map_copy;
+  cell_map_inita(&m, allocator, TO_STACK, 4);
+  for (int64_t i = 0; i < 20; i++) cell_map_put(&m, &i, &(cell){.cost = i});
+  reopen();
+  TEST_ASSERT(cell_map_save(&m, fd));
+  TEST_ASSERT(cell_map_mmap_open(&mapped_map, path, allocator) == &mapped_map);
+
+  TEST_ASSERT(aborts(filter_map, &mapped_map));
+  cell_map_copy(&map_copy, &mapped_map);
+  cell_map_filter(&map_copy, is_odd_key, NULL);
+  TEST_ASSERT(cell_map_load(&map_copy) == 10);
+  TEST_ASSERT(cell_map_load(&mapped_map) == 20);
+  cell_map_free(&map_copy);
+  cell_map_free(&mapped_map);
+}
+
+void test_rejects_bad_files(void) {
+  int_vec v;
+  int_vec_inita(&v, allocator, TO_STACK, 8);
+  for (int i = 0; i < 100; i++) int_vec_push(&v, &i);
+
+  /* Missing, empty and truncated files, then a vec opened as a map. */
+  TEST_ASSERT(int_vec_mmap_open(&v, "/tmp/csdsa_no_such_file", allocator) ==
+              NULL);
+  TEST_ASSERT(int_vec_mmap_open(&v, path, allocator) == NULL);
+
+  TEST_ASSERT(int_vec_save(&v, fd));
+  cell_map m;
+  TEST_ASSERT(cell_map_mmap_open(&m, path, allocator) == NULL);
+
+  TEST_ASSERT(ftruncate(fd, SNAPSHOT_HEADER_SIZE + 8) == 0);
+  int_vec mapped;
+  TEST_ASSERT(int_vec_mmap_open(&mapped, path, allocator) == NULL);
+
+  /* Well formed files holding sets no integer set can read: keys too wide
+     for an id, dense entries not key sized and bit words of the wrong size. */
+  int64_t key_sizes[] = {16, 4, 4};
+  int64_t el_sizes[] = {16, 8, 4};
+  int32_t layouts[] = {SET_SPARSE, SET_SPARSE, SET_BITSET};
+  for (int k = 0; k < 3; k++) {
+    snapshot snap = {.kind = SNAPSHOT_SET, .flags = layouts[k],
+                     .key_size = key_sizes[k]};
+    snap.sections = layouts[k] == SET_BITSET ? 1 : 2;
+    __vec_init(&snap.section[0], el_sizes[k], allocator, TO_STACK, 4);
+    __vec_init(&snap.section[1], sizeof(int32_t), allocator, TO_STACK, 4);
+    vec_resize(&snap.section[0], 4);
+    vec_resize(&snap.section[1], 4);
+
+    TEST_ASSERT(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+    TEST_ASSERT(__snapshot_save(&snap, fd));
+    set bad;
+    TEST_ASSERT(set_mmap_open(&bad, path, allocator) == NULL);
+  }
+  /* Map headers whose slot size and hasher check line up with a real map of
+     int64_t keys and cell values, but whose fields do not: a negative key
+     size, no value, a zeroed in_use_id and more entries than slots. The last
+     one is sound and opens. */
+  cell_map good;
+  cell_map_inita(&good, allocator, TO_STACK, 8);
+  TEST_ASSERT(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+  TEST_ASSERT(cell_map_save(&good, fd));
+  snapshot real;
+  TEST_ASSERT(__snapshot_open(&real, path, SNAPSHOT_MAP, allocator));
+  __snapshot_close(&real.section[0]);
+
+  int64_t slot = sizeof(int64_t) + sizeof(cell) + sizeof(int32_t);
+  int64_t map_keys[] = {-4, slot - 4, 8, 8, 8};
+  int32_t map_ids[] = {1, 1, 0, 1, 1};
+  int64_t map_counts[] = {0, 0, 0, 9, 0};
+  for (int k = 0; k < 5; k++) {
+    snapshot snap = real;
+    snap.key_size = map_keys[k];
+    snap.el_size = slot - sizeof(int32_t) - map_keys[k];
+    snap.in_use_id = map_ids[k];
+    snap.count = map_counts[k];
+    __vec_init(&snap.section[0], slot, allocator, TO_STACK, 8);
+    vec_resize(&snap.section[0], 8);
+
+    TEST_ASSERT(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0);
+    TEST_ASSERT(__snapshot_save(&snap, fd));
+    map opened;
+    map *result = map_mmap_open(&opened, path, allocator, NULL);
+    TEST_ASSERT(result == (k == 4 ? &opened : NULL));
+    if (result) map_free(result);
+  }
+}
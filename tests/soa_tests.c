@@ -0,0 +1,155 @@
+#include "csdsa.h"
+#include "unity.h"
+#include <stdint.h>
+
+SOA_TYPE_IMPL(particles, (x, float), (y, float), (vx, float), (vy, float),
+              (alive, bool), (id, int64_t));
+
+/*-------------------------------------------------------
+ * REGISTER
+ *-------------------------------------------------------*/
+
+stalloc  *allocator = NULL;
+particles tparticles;
+
+void setUp(void) {
+  start_frame(allocator);
+  particles_inita(&tparticles, allocator, TO_STACK, 4);
+}
+void tearDown(void) {
+  particles_free(&tparticles);
+  end_frame(allocator);
+}
+
+void test_push_and_columns(void);
+void test_row_access(void);
+void test_functional(void);
+void test_delete_and_resize(void);
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_push_and_columns));
+  FRAME(allocator, RUN_TEST(test_row_access));
+  FRAME(allocator, RUN_TEST(test_functional));
+  FRAME(allocator, RUN_TEST(test_delete_and_resize));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+
+  GFRAME(allocator, tests());
+
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
+
+static void spawn(particles *p, int64_t n) {
+  for (int64_t i = 0; i < n; i++)
+    particles_push(p, &(particles_el){.x = i, .y = -i, .vx = 1, .vy = 2,
+                                      .alive = i % 2 == 0, .id = i});
+}
+
+void test_push_and_columns(void) {
+  spawn(&tparticles, 1000);
+  TEST_ASSERT(particles_length(&tparticles) == 1000);
+  TEST_ASSERT(tparticles.columns == particles_columns);
+
+  /* Each column is its own contiguous array, a pass only touches what it
+     reads. */
+  float *x = particles_x(&tparticles), *vx = particles_vx(&tparticles);
+  for (int64_t i = 0; i < particles_length(&tparticles); i++) x[i] += vx[i];
+
+  int64_t *id = particles_id(&tparticles);
+  for (int64_t i = 0; i < 1000; i++) {
+    TEST_ASSERT(x[i] == i + 1);
+    TEST_ASSERT(id[i] == i);
+  }
+
+  /* Every column starts on its own cache line. */
+  for (int32_t c = 0; c < tparticles.columns; c++) {
+    TEST_ASSERT((uintptr_t)tparticles.column[c] % CACHE_LINE_SIZE == 0);
+    if (c == 0) continue;
+    TEST_ASSERT(tparticles.column[c] > tparticles.column[c - 1]);
+  }
+}
+
+void test_row_access(void) {
+  spawn(&tparticles, 10);
+
+  particles_el el = particles_get(&tparticles, 3);
+  TEST_ASSERT(el.x == 3 && el.y == -3 && !el.alive && el.id == 3);
+
+  el.alive = true;
+  el.vy = 9;
+  particles_set(&tparticles, 3, &el);
+  TEST_ASSERT(particles_alive(&tparticles)[3]);
+  TEST_ASSERT(particles_vy(&tparticles)[3] == 9);
+
+  particles_row row = particles_at(&tparticles, 7);
+  *row.x = 70;
+  TEST_ASSERT(particles_get(&tparticles, 7).x == 70);
+
+  particles_swap(&tparticles, 0, 7);
+  TEST_ASSERT(particles_get(&tparticles, 0).x == 70);
+  TEST_ASSERT(particles_get(&tparticles, 7).id == 0);
+}
+
+feach(integrate, particles_row, p, {
+  *p.x += *p.vx;
+  *p.y += *p.vy;
+  *(int64_t *)args += 1;
+});
+pred(is_alive, particles_row, p, { return *p.alive; });
+pred(id_over_100, particles_row, p, { return *p.id > 100; });
+
+void test_functional(void) {
+  spawn(&tparticles, 500);
+
+  int64_t visited = 0;
+  particles_foreach(&tparticles, integrate, &visited);
+  TEST_ASSERT(visited == 500);
+  TEST_ASSERT(particles_get(&tparticles, 10).y == -10 + 2);
+
+  TEST_ASSERT(particles_count_if(&tparticles, is_alive, NULL) == 250);
+
+  /* Filtering keeps every column in step and the order of what is left. */
+  particles_filter(&tparticles, is_alive, NULL);
+  TEST_ASSERT(particles_length(&tparticles) == 250);
+  for (int64_t i = 0; i < 250; i++) {
+    particles_el el = particles_get(&tparticles, i);
+    TEST_ASSERT(el.alive && el.id == 2 * i && el.x == 2 * i + 1);
+  }
+  TEST_ASSERT(particles_count_if(&tparticles, id_over_100, NULL) == 199);
+}
+
+void test_delete_and_resize(void) {
+  particles p;
+  particles_inita(&p, allocator, TO_HEAP, 1);
+  spawn(&p, 64);
+
+  particles_delete_at(&p, 0);
+  particles_pop(&p);
+  TEST_ASSERT(particles_length(&p) == 62);
+  for (int64_t i = 0; i < 62; i++) TEST_ASSERT(particles_id(&p)[i] == i + 1);
+
+  /* Shrinking then growing brings back zeroed rows. */
+  particles_resize(&p, 10);
+  particles_resize(&p, 20);
+  for (int64_t i = 10; i < 20; i++) {
+    particles_el el = particles_get(&p, i);
+    TEST_ASSERT(el.x == 0 && el.id == 0 && !el.alive);
+  }
+
+  int32_t resizes = p.cache_counter;
+  particles_reserve(&p, 4096);
+  TEST_ASSERT(p.cache_counter == resizes + 1);
+  TEST_ASSERT(particles_id(&p)[5] == 6);
+  for (int32_t c = 0; c < p.columns; c++)
+    TEST_ASSERT((uintptr_t)p.column[c] % CACHE_LINE_SIZE == 0);
+
+  particles_clear(&p);
+  TEST_ASSERT(particles_length(&p) == 0);
+  particles_free(&p);
+}
@@ -0,0 +1,73 @@
+#include "csdsa.h"
+#include "unity.h"
+
+typedef struct frame_info frame_info;
+struct frame_info {
+  int64_t id;
+  double  time;
+};
+
+STACK_TYPE_IMPL(int_stack, int);
+STACK_TYPE_IMPL(frame_stack, frame_info);
+
+stalloc  *allocator = NULL;
+int_stack tstack;
+
+void setUp(void) {
+  start_frame(allocator);
+  int_stack_inita(&tstack, allocator, TO_STACK, STACK_DEFAULT_SIZE);
+}
+void tearDown(void) {
+  int_stack_free(&tstack);
+  end_frame(allocator);
+}
+
+void test_push_pop(void) {
+  TEST_ASSERT(int_stack_peek(&tstack) == NULL);
+
+  for (int i = 0; i < 1000; i++) int_stack_push(&tstack, &i);
+  TEST_ASSERT(int_stack_length(&tstack) == 1000);
+
+  for (int i = 999; i >= 0; i--) {
+    TEST_ASSERT(*int_stack_peek(&tstack) == i);
+    int out;
+    int_stack_pop(&tstack, &out);
+    TEST_ASSERT(out == i);
+  }
+  TEST_ASSERT(int_stack_length(&tstack) == 0);
+}
+
+void test_copy_and_clear(void) {
+  frame_stack frames, copy;
+  frame_stack_inita(&frames, allocator, TO_HEAP, 2);
+
+  for (int64_t i = 0; i < 10; i++)
+    frame_stack_push(&frames, &(frame_info){.id = i, .time = i * 0.5});
+
+  frame_stack_copy(&copy, &frames);
+  frame_stack_clear(&frames);
+  TEST_ASSERT(frame_stack_length(&frames) == 0);
+  TEST_ASSERT(frame_stack_length(&copy) == 10);
+  TEST_ASSERT(frame_stack_peek(&copy)->id == 9);
+
+  frame_stack_pop(&copy, NULL);
+  TEST_ASSERT(frame_stack_peek(&copy)->time == 4.0);
+
+  frame_stack_free(&frames);
+  frame_stack_free(&copy);
+}
+
+void tests(void) {
+  FRAME(allocator, RUN_TEST(test_push_pop));
+  FRAME(allocator, RUN_TEST(test_copy_and_clear));
+}
+
+int main(void) {
+  UNITY_BEGIN();
+
+  allocator = stalloc_create(STALLOC_DEFAULT);
+  GFRAME(allocator, tests());
+  stalloc_free(allocator);
+
+  UNITY_END();
+}
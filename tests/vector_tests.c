@@ -1,3 +1,5 @@
+#include <stddef.h>
+
 #include "csdsa.h"
 #include "unity.h"
 
@@ -34,6 +36,16 @@ void test_cache_counter(void);
 void sort(void);
 void delete_by_idx(void);
 void test_vec_copy(void);
+void test_uninit_vec(void);
+void sort_large(void);
+void sort_stable(void);
+void sort_radix(void);
+void sort_typed(void);
+void bulk_push(void);
+void self_extend(void);
+void element_access(void);
+void batch_callbacks(void);
+void track_growth(void);
 
 void tests(void) {
   FRAME(allocator, RUN_TEST(push_pop_clear_256));
@@ -47,6 +59,16 @@ void tests(void) {
   FRAME(allocator, RUN_TEST(delete_by_idx));
   FRAME(allocator, RUN_TEST(test_vec_copy));
   FRAME(allocator, RUN_TEST(test_cache_counter));
+  FRAME(allocator, RUN_TEST(test_uninit_vec));
+  FRAME(allocator, RUN_TEST(sort_large));
+  FRAME(allocator, RUN_TEST(sort_stable));
+  FRAME(allocator, RUN_TEST(sort_radix));
+  FRAME(allocator, RUN_TEST(sort_typed));
+  FRAME(allocator, RUN_TEST(bulk_push));
+  FRAME(allocator, RUN_TEST(self_extend));
+  FRAME(allocator, RUN_TEST(element_access));
+  FRAME(allocator, RUN_TEST(batch_callbacks));
+  FRAME(allocator, RUN_TEST(track_growth));
 }
 
 int main(void) {
@@ -125,10 +147,15 @@ void filter_multiples_of_10_and_sum(void) {
     gvec_push(&vector, &(group){.x = i, .y = i, .z = i, .active = false});
   }
 
-  int sum = 0;
+  void *elements = vector.elements;
+  int   sum = 0;
   sum = *(int *)gvec_foldl(gvec_filter(&vector, is_mult_10, NULL), adder, &sum,
                            NULL);
   TEST_ASSERT(sum == 30);
+
+  /* Filtering compacts in place, the heap vector keeps its memory. */
+  TEST_ASSERT(vector.elements == elements && vector.flags == TO_HEAP);
+  TEST_ASSERT(vector.length == 3);
 }
 
 pred(is_mult_2, group, el, return el.x % 2 == 0);
@@ -242,4 +269,249 @@ void test_cache_counter(void) {
   }
 
   TEST_ASSERT(ivec.cache_counter == 1);
-}
\ No newline at end of file
+}
+
+void test_uninit_vec(void) {
+  int flags[] = {TO_STACK_UNINIT, TO_HEAP_UNINIT};
+  for (int f = 0; f < 2; f++) {
+    int_vec ivec;
+    int_vec_inita(&ivec, allocator, flags[f], 2);
+
+    for (int i = 0; i < 100; i++) int_vec_push(&ivec, &i);
+    for (int i = 0; i < 100; i++) TEST_ASSERT(*int_vec_at(&ivec, i) == i);
+
+    int_vec_clear(&ivec);
+    TEST_ASSERT(ivec.length == 0);
+    int_vec_push(&ivec, &(int){7});
+    TEST_ASSERT(*int_vec_top(&ivec) == 7);
+
+    int_vec_free(&ivec);
+  }
+}
+
+compare(sort_x_asc, group, a, b, return a.x < b.x;);
+VEC_SORT_IMPL(gvec, group, sort_x_asc);
+
+/* Pseudo random, few distinct and already sorted inputs. */
+static void fill_groups(gvec *v, int n, int pattern) {
+  uint32_t seed = 12345;
+  for (int i = 0; i < n; i++) {
+    seed = seed * 1103515245 + 12345;
+    int x = pattern == 0 ? (int)(seed >> 8) % 100000 - 50000
+            : pattern == 1 ? (int)(seed >> 8) % 8
+                           : i;
+    gvec_push(v, &(group){.x = x, .y = i});
+  }
+}
+
+void sort_large(void) {
+  for (int pattern = 0; pattern < 3; pattern++) {
+    gvec_clear(&vector);
+    fill_groups(&vector, 5000, pattern);
+    gvec_sort(&vector, sort_asc, NULL);
+
+    for (int i = 1; i < vector.length; i++)
+      TEST_ASSERT(gvec_at(&vector, i - 1)->x <= gvec_at(&vector, i)->x);
+  }
+}
+
+void sort_stable(void) {
+  fill_groups(&vector, 3000, 1);
+  gvec_sort_stable(&vector, sort_asc, NULL);
+
+  for (int i = 1; i < vector.length; i++) {
+    group *last = gvec_at(&vector, i - 1), *cur = gvec_at(&vector, i);
+    TEST_ASSERT(last->x <= cur->x);
+    if (last->x == cur->x) TEST_ASSERT(last->y < cur->y);
+  }
+}
+
+void sort_radix(void) {
+  fill_groups(&vector, 3000, 0);
+  gvec_push(&vector, &(group){.x = INT32_MIN, .y = -1});
+  gvec_push(&vector, &(group){.x = INT32_MAX, .y = -1});
+  gvec_sort_radix(&vector, offsetof(group, x), sizeof(int), true);
+
+  TEST_ASSERT(gvec_at(&vector, 0)->x == INT32_MIN);
+  TEST_ASSERT(gvec_top(&vector)->x == INT32_MAX);
+  for (int i = 1; i < vector.length; i++)
+    TEST_ASSERT(gvec_at(&vector, i - 1)->x <= gvec_at(&vector, i)->x);
+
+  /* Unsigned keys, equal keys keep their order. */
+  int_vec ivec;
+  int_vec_inita(&ivec, allocator, TO_HEAP, 1);
+  for (int i = 0; i < 1000; i++) int_vec_push(&ivec, &(int){(i * 7919) % 613});
+  int_vec_sort_radix(&ivec, 0, sizeof(int), false);
+  for (int i = 1; i < ivec.length; i++)
+    TEST_ASSERT(*int_vec_at(&ivec, i - 1) <= *int_vec_at(&ivec, i));
+  int_vec_free(&ivec);
+}
+
+void sort_typed(void) {
+  for (int pattern = 0; pattern < 3; pattern++) {
+    gvec_clear(&vector);
+    fill_groups(&vector, 5000, pattern);
+    gvec_sort_sort_x_asc(&vector, NULL);
+
+    for (int i = 1; i < vector.length; i++)
+      TEST_ASSERT(gvec_at(&vector, i - 1)->x <= gvec_at(&vector, i)->x);
+  }
+}
+
+void bulk_push(void) {
+  int src[300];
+  for (int i = 0; i < 300; i++) src[i] = i;
+
+  int_vec ivec;
+  int_vec_inita(&ivec, allocator, TO_STACK, 1);
+
+  /* Reserving up front means the pushes below never resize. */
+  int_vec_reserve(&ivec, 600);
+  int32_t resizes = ivec.cache_counter;
+  TEST_ASSERT(ivec.length == 0);
+
+  int_vec_push_n(&ivec, src, 300);
+  TEST_ASSERT(ivec.length == 300);
+  for (int i = 0; i < 300; i++) TEST_ASSERT(*int_vec_at(&ivec, i) == i);
+
+  int *slot = int_vec_emplace(&ivec);
+  TEST_ASSERT(*slot == 0);
+  *slot = 300;
+  TEST_ASSERT(*int_vec_top(&ivec) == 300);
+  TEST_ASSERT(ivec.cache_counter == resizes);
+
+  int_vec other;
+  int_vec_inita(&other, allocator, TO_HEAP, 1);
+  int_vec_push(&other, &(int){-1});
+  int_vec_extend(&other, &ivec);
+  TEST_ASSERT(other.length == 302);
+  TEST_ASSERT(*int_vec_at(&other, 0) == -1);
+  for (int i = 0; i <= 300; i++) TEST_ASSERT(*int_vec_at(&other, i + 1) == i);
+
+  int_vec_push_n(&other, NULL, 0);
+  TEST_ASSERT(other.length == 302);
+
+  int_vec_free(&other);
+  int_vec_free(&ivec);
+}
+
+void self_extend(void) {
+  /* The source lives in the vec being grown, so it moves along with it. */
+  int32_t flags[2] = {TO_HEAP, TO_STACK};
+  for (int f = 0; f < 2; f++) {
+    int_vec v;
+    int_vec_inita(&v, allocator, flags[f], 4);
+    for (int i = 0; i < 4; i++) int_vec_push(&v, &i);
+
+    int_vec_extend(&v, &v);
+    TEST_ASSERT(v.length == 8);
+    for (int i = 0; i < 8; i++) TEST_ASSERT(*int_vec_at(&v, i) == i % 4);
+
+    int_vec_push_n(&v, int_vec_at(&v, 5), 3);
+    TEST_ASSERT(v.length == 11);
+    for (int i = 8; i < 11; i++) TEST_ASSERT(*int_vec_at(&v, i) == i - 7);
+
+    int_vec_free(&v);
+  }
+}
+
+typedef struct odd_sized odd_sized;
+struct odd_sized {
+  char bytes[45]; /* One 32 byte chunk, a word and five single bytes. */
+};
+VEC_TYPE_IMPL(odd_vec, odd_sized);
+
+void element_access(void) {
+  odd_vec odds;
+  odd_vec_inita(&odds, allocator, TO_STACK, 2);
+
+  odd_sized a, b;
+  for (int i = 0; i < 45; i++) {
+    a.bytes[i] = i;
+    b.bytes[i] = -i;
+  }
+  odd_vec_push(&odds, &a);
+  odd_vec_push(&odds, &b);
+  odd_vec_push(&odds, &a); /* Past the capacity, takes the slow path. */
+  TEST_ASSERT(odds.length == 3);
+
+  vec_swap(&odds, 0, 1);
+  for (int i = 0; i < 45; i++) {
+    TEST_ASSERT(odd_vec_at(&odds, 0)->bytes[i] == -i);
+    TEST_ASSERT(odd_vec_at(&odds, 1)->bytes[i] == i);
+  }
+  odd_vec_swap(&odds, 0, 1);
+  TEST_ASSERT(memcmp(odd_vec_at_unchecked(&odds, 0), &a, sizeof(a)) == 0);
+  TEST_ASSERT(memcmp(vec_at_unchecked(&odds, 1), &b, sizeof(b)) == 0);
+
+  odd_vec_put(&odds, 2, &b);
+  TEST_ASSERT(memcmp(odd_vec_at(&odds, 2), &b, sizeof(b)) == 0);
+  odd_vec_pop(&odds);
+  odd_vec_push(&odds, &a);
+  TEST_ASSERT(memcmp(odd_vec_top(&odds), &a, sizeof(a)) == 0);
+  TEST_ASSERT(odds.length == 3);
+}
+
+VEC_TYPE_IMPL(float_vec, float);
+
+unary_batch(scale, float, x, return x * *(float *)args);
+pred_batch(over_half, float, x, return x > 0.5f);
+feach_batch(sum_floats, float, x, { *(double *)args += x; });
+
+static int64_t batches = 0;
+static void    count_batches(void *base, int64_t count, int64_t stride,
+                             void *args) {
+  TEST_ASSERT(stride == sizeof(float));
+  TEST_ASSERT(count > 0 && count <= VEC_BATCH);
+  *(int64_t *)args += count;
+  batches++;
+}
+
+void batch_callbacks(void) {
+  float_vec v;
+  float_vec_inita(&v, allocator, TO_STACK, 8);
+
+  /* Not a multiple of VEC_BATCH, the last run is short. */
+  int64_t n = VEC_BATCH * 3 + 17;
+  for (int64_t i = 0; i < n; i++) float_vec_push(&v, &(float){i % 4 * 0.25f});
+
+  int64_t seen = 0;
+  float_vec_foreach_batch(&v, count_batches, &seen);
+  TEST_ASSERT(seen == n);
+  TEST_ASSERT(batches == 4);
+
+  TEST_ASSERT(float_vec_count_if_batch(&v, over_half, NULL) == n / 4);
+
+  float_vec_map_batch(&v, scale, &(float){4.0f});
+  TEST_ASSERT(*float_vec_at(&v, 3) == 3.0f);
+  TEST_ASSERT(*float_vec_at(&v, n - 1) == 0.0f);
+
+  double sum = 0;
+  float_vec_foreach_batch(&v, sum_floats, &sum);
+  TEST_ASSERT(sum == (double)(n / 4) * 6.0);
+}
+
+void track_growth(void) {
+  vec_stats stats = {0};
+  int_vec   ivec, copy;
+  int_vec_inita(&ivec, allocator, TO_STACK, 1);
+  int_vec_track(&ivec, &stats);
+
+  /* Alone on top of the frame, the stack vec grows in place. */
+  for (int i = 0; i < 1000; i++) int_vec_push(&ivec, &i);
+  TEST_ASSERT(stats.resizes == 10 && stats.moves == 0);
+  TEST_ASSERT(stats.bytes_copied == 0);
+
+  /* Something pushed on top forces the next growth to move. */
+  stpusha(allocator, 16);
+  for (int i = 0; i < 100; i++) int_vec_push(&ivec, &i);
+  TEST_ASSERT(stats.resizes == 11 && stats.moves == 1);
+  TEST_ASSERT(stats.bytes_copied == 1024 * sizeof(int));
+
+  int_vec_copy(&copy, &ivec);
+  TEST_ASSERT(copy.stats == NULL);
+
+  int_vec_track(&ivec, NULL);
+  for (int i = 0; i < 2000; i++) int_vec_push(&ivec, &i);
+  TEST_ASSERT(stats.resizes == 11);
+}